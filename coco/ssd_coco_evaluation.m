@@ -24,6 +24,14 @@ function results = ssd_coco_evaluation(varargin)
 %    If true, overwrite previous predictions by any detector sharing the 
 %    same model name, otherwise, load results directly from cache.
 %
+%   `reuseDetections` :: false
+%    If true, the detections of a previous run of the detector are read
+%    from its binary detection cache (see vl_detectioncache), if it is
+%    complete and was computed for the same test images, rather than
+%    computed again (e.g. to evaluate them with other settings).  The
+%    cache is written whenever the detector is run, if vl_detectioncache
+%    is compiled.
+%
 %   `useMiniVal` :: false
 %    If true (and the testset is set to `val`), evaluate on the `mini-val` 
 %    subsection of the coco data, rather than the full validation set.  This
@@ -42,6 +50,7 @@ function results = ssd_coco_evaluation(varargin)
   opts.testset = 'val' ;
   opts.visualise = false ;
   opts.refreshCache = false ;
+  opts.reuseDetections = false ;
   opts.modelName = 'ssd-mscoco-vggvd-300' ;
 
   % configure batch opts
@@ -92,15 +101,18 @@ function results = ssd_coco_evaluation(varargin)
   resultsFile = sprintf('%s-%s-results.mat', opts.modelName, opts.testset) ;
   rawPredsFile = sprintf('%s-%s-raw-preds.mat', opts.modelName, opts.testset) ;
   decodedPredsFile = sprintf('%s-%s-decoded.mat', opts.modelName, opts.testset) ;
+  detsFile = sprintf('%s-%s-dets', opts.modelName, opts.testset) ;
   evalCacheDir = fullfile(expDir, 'eval_cache') ;
   if ~exist(evalCacheDir, 'dir') 
     mkdir(evalCacheDir) ; mkdir(fullfile(evalCacheDir, 'cache')) ;
   end
 
   cacheOpts.rawPredsCache = fullfile(evalCacheDir, rawPredsFile) ;
+  cacheOpts.detectionCache = fullfile(evalCacheDir, detsFile) ;
   cacheOpts.decodedPredsCache = fullfile(evalCacheDir, decodedPredsFile) ;
   cacheOpts.resultsCache = fullfile(evalCacheDir, resultsFile) ;
   cacheOpts.evalCacheDir = evalCacheDir ;
+  cacheOpts.reuseDetections = opts.reuseDetections ;
   opts.cacheOpts = cacheOpts ; 
 
   results = ssd_evaluation(expDir, net, opts) ;
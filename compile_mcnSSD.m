@@ -47,12 +47,34 @@ function [opts, mex_src, lib_src, flags] = preCompileFn(opts, mex_src, ...
   inc_local = sprintf('-I"%s"', fullfile(root, 'src')) ;
   flags.base{end+1} = inc ; flags.base{end+1} = inc_local ;
 
+  % the scalar and SIMD box decoders (bits/impl/boxdecoder.hpp) only agree
+  % bit for bit if multiply-adds are not fused into FMAs
+  if ~ispc
+    if ~isfield(flags, 'ccpass'), flags.ccpass = {} ; end
+    flags.ccpass{end+1} = '-ffp-contract=off' ;
+  end
+
   % Add module files
   lib_src{end+1} = fullfile(root,'src/bits',['nnmultiboxdetector.' ext]) ;
   mex_src{end+1} = fullfile(root,'src',['vl_nnmultiboxdetector.' ext]) ;
+  mex_src{end+1} = fullfile(root,'src',['vl_matchpriors.' ext]) ;
+  mex_src{end+1} = fullfile(root,'src',['vl_hardnegatives.' ext]) ;
+  lib_src{end+1} = fullfile(root,'src/bits',['nnmultiboxloss.' ext]) ;
+  mex_src{end+1} = fullfile(root,'src',['vl_multiboxloss.' ext]) ;
+  mex_src{end+1} = fullfile(root,'src',['vl_augmentbatch.' ext]) ;
+  mex_src{end+1} = fullfile(root,'src',['vl_evaldetections.' ext]) ;
+  mex_src{end+1} = fullfile(root,'src',['vl_detectioncache.' ext]) ;
+  mex_src{end+1} = fullfile(root,'src',['vl_priorbox.' ext]) ;
 
   % CPU-specific files
   lib_src{end+1} = fullfile(root,'src/bits/impl/multiboxdetector_cpu.cpp') ;
+  lib_src{end+1} = fullfile(root,'src/bits/impl/priormatcher_cpu.cpp') ;
+  lib_src{end+1} = fullfile(root,'src/bits/impl/hardnegatives_cpu.cpp') ;
+  lib_src{end+1} = fullfile(root,'src/bits/impl/multiboxloss_cpu.cpp') ;
+  lib_src{end+1} = fullfile(root,'src/bits/impl/augment_cpu.cpp') ;
+  lib_src{end+1} = fullfile(root,'src/bits/impl/detectioneval_cpu.cpp') ;
+  lib_src{end+1} = fullfile(root,'src/bits/impl/detectioncache_cpu.cpp') ;
+  lib_src{end+1} = fullfile(root,'src/bits/impl/priorbox_cpu.cpp') ;
 
   % GPU-specific files
   if opts.enableGpu
@@ -76,6 +76,8 @@ function stored = setDetectionOpts(stored, opts)
 % ----------------------------------------------
   detector = stored{1}.find('detection_out', 1) ;
   props = {'nmsThresh', 'keepTopK', 'nmsTopK', 'confThresh'} ;
+  optional = {'numThreads'} ; % only set if supplied
+  props = [props optional(isfield(opts.modelOpts, optional))] ;
   for ii = 1:numel(props)
     key = props{ii} ; value = opts.modelOpts.(key) ;
     detector.inputs = updateArgs(detector.inputs, key, value) ;
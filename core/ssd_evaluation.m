@@ -38,13 +38,26 @@ function res = checkCache(opts, net, imdb, testIdx)
     tmp = load(path) ; res = tmp.results ;
   else
     predictions = computePredictions(net, imdb, testIdx, opts) ;
-    decodedPreds = decodePredictions(predictions, imdb, testIdx, opts) ;
-    s.results = opts.dataOpts.eval_func(opts.modelName, decodedPreds, imdb, opts) ;
+    if useNativeEval(opts)
+      % evaluate the detector outputs directly (see vl_evaldetections),
+      % which may be given as the path of a detection cache
+      s.results = opts.dataOpts.native_eval_func(opts.modelName, ...
+                                          predictions, imdb, testIdx, opts) ;
+    else
+      decodedPreds = decodePredictions(predictions, imdb, testIdx, opts) ;
+      s.results = opts.dataOpts.eval_func(opts.modelName, decodedPreds, imdb, opts) ;
+    end
     fprintf('saving results to %s\n', path);
     save(path, '-struct', 's', '-v7.3') ;
     res = s.results ;
   end
 
+% -------------------------------------------------
+function ok = useNativeEval(opts)
+% -------------------------------------------------
+  ok = isfield(opts.dataOpts, 'native_eval_func') ...
+       && ~isempty(opts.dataOpts.native_eval_func) ;
+
 % -------------------------------------------------------------------------
 function decodedPreds = decodePredictions(predictions, imdb, testIdx, opts) 
 % -------------------------------------------------------------------------
@@ -207,8 +220,26 @@ function predictions = computePredictions(net, imdb, testIdx, opts)
     if scale == 1, net_ = net{1} ; else, net_ = net{2} ; end
     params.predIdx = net_.getVarIndex(opts.modelOpts.predVar) ;
     addpath(fullfile(vl_rootnn, 'contrib/mcnSSD/matlab/mex')) ; % fix path issue
+    cachePath = detectionCachePath(opts, scale) ;
+    if ~isempty(cachePath) && opts.cacheOpts.reuseDetections ...
+        && isCompleteCache(cachePath, imdb, testIdx)
+      if numel(scales) == 1 && useNativeEval(opts)
+        % the native evaluation reads the cache in place
+        fprintf('evaluating detections from %s\n', cachePath) ;
+        predictions{ii} = cachePath ;
+      else
+        fprintf('loading detections from %s\n', cachePath) ;
+        predictions{ii} = vl_detectioncache('read', cachePath, ...
+                                        'Height', opts.modelOpts.keepTopK) ;
+      end
+      continue ;
+    end
+    if ~isempty(cachePath) && exist(cacheImagesPath(cachePath), 'file')
+      delete(cacheImagesPath(cachePath)) ;
+    end
     if numel(opts.gpus) <= 1
-       state = processDetections(net_, imdb, params, opts, 'scale', scale) ;
+       state = processDetections(net_, imdb, params, opts, 'scale', scale, ...
+                                 'cachePath', cachePath) ;
        predictions_ = state.predictions ;
     else
       keepTopK = opts.modelOpts.keepTopK ; outCols = opts.modelOpts.outCols ;
@@ -220,17 +251,74 @@ function predictions = computePredictions(net, imdb, testIdx, opts)
         state_ = state{i} ;
         predictions_(:,:,:,state_.computedIdx) = state_.predictions ;
       end
+      if ~isempty(cachePath) % the workers interleave images, so write here
+        numClasses = numel(imdb.meta.classes) ;
+        vl_detectioncache('open', cachePath, 'NumClasses', numClasses) ;
+        vl_detectioncache('append', cachePath, predictions_) ;
+        vl_detectioncache('finish', cachePath) ;
+      end
+    end
+    if ~isempty(cachePath) % record the images of the cache
+      images = imdb.images.name(testIdx) ;
+      save(cacheImagesPath(cachePath), 'testIdx', 'images') ;
     end
     predictions{ii} = predictions_ ;
   end
   predictions = mergeMultiscalePredictions(predictions, imdb, opts) ;
 
+% ----------------------------------------------------
+function path = detectionCachePath(opts, scale)
+% ----------------------------------------------------
+% The detections of each scale are cached in a binary file (see
+% vl_detectioncache), if it is configured and compiled
+  path = '' ;
+  if ~isfield(opts.cacheOpts, 'detectionCache') ...
+      || isempty(opts.cacheOpts.detectionCache) ...
+      || exist('vl_detectioncache', 'file') ~= 3
+    return ;
+  end
+  path = sprintf('%s-scale%g.bin', opts.cacheOpts.detectionCache, scale) ;
+
+% ----------------------------------------------------
+function path = cacheImagesPath(cachePath)
+% ----------------------------------------------------
+% The test images of a detection cache are recorded next to it
+  path = regexprep(cachePath, '\.bin$', '-images.mat') ;
+
+% ----------------------------------------------------
+function ok = isCompleteCache(path, imdb, testIdx)
+% ----------------------------------------------------
+% A cache is reused only if it is complete and holds the detections of
+% the same test images (in the same order)
+  ok = false ;
+  if ~exist(path, 'file') || ~exist(cacheImagesPath(path), 'file')
+    return ;
+  end
+  try
+    info = vl_detectioncache('info', path) ;
+    recorded = load(cacheImagesPath(path)) ;
+    ok = (info.numImages == numel(testIdx)) ...
+         && isequal(recorded.testIdx(:), testIdx(:)) ...
+         && isequal(recorded.images(:), ...
+                    reshape(imdb.images.name(testIdx), [], 1)) ;
+  catch err
+    fprintf('ignoring detection cache: %s\n', err.message) ;
+  end
+
 % --------------------------------------------------------------------
 function selectedPreds = mergeMultiscalePredictions(preds, imdb, opts) 
 % --------------------------------------------------------------------
   % handle single scale evaluation first 
   if numel(preds) == 1, selectedPreds = preds{1} ; return ; end
 
+  % the native merge produces the same detections as the code below
+  if exist('vl_nnmultiboxdetector', 'file') == 3
+    selectedPreds = vl_nnmultiboxdetector('merge', preds, ...
+                          'nmsThresh', opts.msOpts.nmsThresh, ...
+                          'numThreads', 0) ;
+    return ;
+  end
+
   selectedPreds = zeros(size(preds{1}), 'like', preds{1}) ;
   batchSize = size(selectedPreds, 4) ;
   numClasses = numel(imdb.meta.classes) - 1 ;
@@ -277,6 +365,7 @@ function selectedPreds = mergeMultiscalePredictions(preds, imdb, opts)
 function state = processDetections(net, imdb, params, opts, varargin) 
 % -------------------------------------------------------------------
   sopts.scale = [] ;
+  sopts.cachePath = '' ;
   sopts = vl_argparse(sopts, varargin) ;
 
   % benchmark speed
@@ -292,6 +381,12 @@ function state = processDetections(net, imdb, params, opts, varargin)
   state.predictions = zeros(keepTopK, outCols, 1, numel(computedIdx), 'single') ; 
   state.computedIdx = computedIdx ; offset = 1 ;
 
+  % the detections are appended to the cache batch by batch
+  if ~isempty(sopts.cachePath)
+    vl_detectioncache('open', sopts.cachePath, ...
+                      'NumClasses', numel(imdb.meta.classes)) ;
+  end
+
   for t = 1:opts.batchOpts.batchSize:numel(testIdx) 
     % display progress
     progress = fix((t-1) / opts.batchOpts.batchSize) + 1 ;
@@ -319,6 +414,10 @@ function state = processDetections(net, imdb, params, opts, varargin)
     storeIdx = offset:offset + numel(batch) - 1 ;
     offset = offset + numel(batch) ; out = net.vars{params.predIdx} ;
     state.predictions(:,:,:,storeIdx) = out(1:opts.modelOpts.keepTopK,:,:,:) ;
+    if ~isempty(sopts.cachePath)
+      vl_detectioncache('append', sopts.cachePath, ...
+                        gather(state.predictions(:,:,:,storeIdx))) ;
+    end
     time = toc(start) + adjustTime ; batchTime = time - stats.time ;
     stats.num = num ; stats.time = time ; currentSpeed = batchSize / batchTime ;
     averageSpeed = (t + batchSize - 1) / time ;
@@ -328,6 +427,9 @@ function state = processDetections(net, imdb, params, opts, varargin)
     end
     fprintf('speed %.1f (%.1f) Hz', averageSpeed, currentSpeed) ; fprintf('\n') ;
   end
+  if ~isempty(sopts.cachePath)
+    vl_detectioncache('finish', sopts.cachePath) ;
+  end
   net.move('cpu') ;
 
 % -------------------------------------------------------------------------
@@ -209,6 +209,20 @@ function loss = add_loss(opts, gtBoxes, gtLabels, priors, confs, locs)
   hardNegs.name = 'hardNegs' ; cWeights.name = 'cWeights' ;
   exLabels.name = 'extendedLabels' ;
 
+  % the fused native loss computes the same value (and derivatives) as
+  % the chain of layers below, without building the targets
+  useNative = (~isfield(opts.modelOpts, 'nativeLoss') ...
+               || opts.modelOpts.nativeLoss) ...
+               && exist('vl_multiboxloss', 'file') == 3 ;
+  if useNative
+    args = {locs, confs, priors, gtBoxes, gtLabels, matches, hardNegs, ...
+            'numClasses', numClasses, 'backgroundLabel', 1, ...
+            'locWeight', opts.modelOpts.locWeight, 'numThreads', 0} ;
+    loss = Layer.create(@vl_multiboxloss, args, 'numInputDer', 2) ;
+    loss.name = 'mbox_loss' ;
+    return ;
+  end
+
   args = {locs, confs, matches, hardNegs, 'numClasses', numClasses} ;
   largs = {'numInputDer', 2} ;
   [tarPreds, classPreds] = Layer.create(@vl_nnmultiboxcoder, args, largs{:}) ;
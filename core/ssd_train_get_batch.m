@@ -1,5 +1,10 @@
 function batchData = ssd_train_get_batch(imdb, batch, batchOpts, varargin)
 % SSD_TRAIN_GET_BATCH generates mini batches for training SSD
+%   If `batchOpts.nativeAugmentation` is true, the augmentation is done by
+%   VL_AUGMENTBATCH on `batchOpts.numThreads` threads.  When called without
+%   output arguments (as the trainer does to prefetch the next batch), the
+%   batch is then augmented in the background while the current one is
+%   processed.
 
 imIds = imdb.images.name(batch) ;
 imNames = imdb.images.name(batch) ;
@@ -10,6 +15,12 @@ annotations = {imdb.annotations{batch}} ;
 targets = cellfun(@(x) x.boxes, annotations, 'UniformOutput', false) ;
 labels = cellfun(@(x) single(x.classes), annotations, 'UniformOutput', false) ;
 
+if isfield(batchOpts, 'nativeAugmentation') && batchOpts.nativeAugmentation
+    batchData = nativeAugmentation(imPaths, targets, labels, batch, ...
+                                   batchOpts, nargout == 0) ;
+    return ;
+end
+
 % ------------------------------------------
 % Data augmentation
 % ------------------------------------------
@@ -146,3 +157,67 @@ end
 batchData = {'data', data, ...
              'labels', labels, ...
              'targets', targets } ;
+
+% ------------------------------------------------------------------------
+function batchData = nativeAugmentation(imPaths, targets, labels, batch, ...
+                                        batchOpts, prefetch)
+% ------------------------------------------------------------------------
+args = {'ImageSize', batchOpts.imageSize(1:2), ...
+        'Average', [123, 117, 104], ...
+        'ResizeMethods', batchOpts.resizeMethods, ...
+        'NumThreads', batchOpts.numThreads, ...
+        'Key', batch} ;
+if isfield(batchOpts, 'prefetchDepth')
+    args = [args {'PrefetchDepth', batchOpts.prefetchDepth}] ;
+end
+if batchOpts.distortOpts.use
+    d = batchOpts.distortOpts ;
+    args = [args {'Brightness', [d.brightnessProb d.brightnessDelta], ...
+                  'Contrast', [d.contrastProb d.contrastLower d.contrastUpper], ...
+                  'Saturation', [d.saturationProb d.saturationLower d.saturationUpper], ...
+                  'Hue', [d.hueProb d.hueDelta], ...
+                  'RandomOrder', d.randomOrderProb}] ;
+end
+if batchOpts.zoomOpts.use
+    z = batchOpts.zoomOpts ;
+    args = [args {'Zoom', [z.prob z.minScale z.maxScale]}] ;
+end
+if batchOpts.patchOpts.use
+    p = batchOpts.patchOpts ;
+    args = [args {'Patch', [p.numTrials p.minPatchScale p.maxPatchScale ...
+                            p.minAspect p.maxAspect], ...
+                  'ClipTargets', p.clipTargets}] ;
+end
+if batchOpts.flipOpts.use
+    args = [args {'Flip', batchOpts.flipOpts.prob}] ;
+end
+
+% use the batch prefetched by the previous call, if there is one
+data = [] ;
+if ~prefetch
+    [data, targets_, labels_] = vl_augmentbatch({}, {}, {}, [], args{:}) ;
+end
+
+if isempty(data)
+    if batchOpts.use_vl_imreadjpeg
+        ims = vl_imreadjpeg(imPaths, 'NumThreads', batchOpts.numThreads) ;
+    else
+        ims = cellfun(@(x) single(imread(x)), imPaths, 'Uni', 0) ;
+    end
+    % the augmentation of each image only depends on its seed
+    seeds = randi(2^31 - 1, 1, numel(batch)) ;
+    if prefetch
+        vl_augmentbatch(ims, targets, labels, seeds, args{:}, 'Prefetch') ;
+        batchData = {} ;
+        return ;
+    end
+    [data, targets_, labels_] = vl_augmentbatch(ims, targets, labels, seeds, args{:}) ;
+end
+
+if batchOpts.useGpu
+    data = gpuArray(data) ;
+end
+
+batchData = {'data', data, ...
+             'labels', labels_, ...
+             'targets', targets_ } ;
@@ -6,6 +6,7 @@ classdef MultiboxDetector < dagnn.ElementWise
     confThresh = 0.01
     numClasses = 21
     backgroundLabel = 1 
+    numThreads = 1
   end
 
   methods
@@ -16,7 +17,8 @@ classdef MultiboxDetector < dagnn.ElementWise
                               'nmsThresh', obj.nmsThresh, ...
                               'numClasses', double(obj.numClasses), ...
                               'confThresh', obj.confThresh, ...
-                              'backgroundLabel', double(obj.backgroundLabel)) ;
+                              'backgroundLabel', double(obj.backgroundLabel), ...
+                              'numThreads', double(obj.numThreads)) ;
     end
 
     function [derInputs, derParams] = backward(obj, inputs, params, derOutputs)
@@ -10,11 +10,18 @@ classdef PriorBox < dagnn.ElementWise
     offset = 0.5
     usePriorCaching = true
     priorCache = []
+    priorCacheKey = []
   end
   
   methods
     function outputs = forward(obj, inputs, params)
-        if obj.usePriorCaching && ~isempty(obj.priorCache)
+        % the priors only depend on the sizes of the feature map and of
+        % the image (and on where they are stored)
+        key = [size(inputs{1}, 1) size(inputs{1}, 2) ...
+               size(inputs{2}, 1) size(inputs{2}, 2) ...
+               isa(inputs{1}, 'gpuArray')] ;
+        if obj.usePriorCaching && ~isempty(obj.priorCache) ...
+                               && isequal(obj.priorCacheKey, key)
             outputs = obj.priorCache ;
         else
             y = vl_nnpriorbox(inputs{1}, inputs{2}, ...
@@ -32,10 +39,9 @@ classdef PriorBox < dagnn.ElementWise
             outputs{1} = y ;
         end  
 
-        % NOTE: if the training is moved from the gpu to the cpu
-        % during training, the cache must be refreshed
         if obj.usePriorCaching
             obj.priorCache = outputs ;
+            obj.priorCacheKey = key ;
         end
     end
     
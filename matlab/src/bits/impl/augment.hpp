@@ -0,0 +1,225 @@
+// @file augment.hpp
+// @brief SSD training data augmentation
+// @author Samuel Albanie
+// @author Andrea Vedaldi
+
+/*
+Copyright (C) 2017- Samuel Albanie and Andrea Vedaldi.
+All rights reserved.
+
+This file is part of the VLFeat library and is made available under
+the terms of the BSD license (see the COPYING file).
+*/
+
+#ifndef VL_AUGMENT_H
+#define VL_AUGMENT_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace vl { namespace impl {
+
+  // Generator of the random numbers used to augment an image (splitmix64).
+  // Every image has its own generator, seeded by the caller, so that the
+  // augmentation of an image only depends on its seed.
+  class AugmentRandom
+  {
+  public:
+    explicit AugmentRandom(uint64_t seed) : state(seed) { }
+
+    uint64_t next()
+    {
+      uint64_t z = (state += 0x9e3779b97f4a7c15ULL) ;
+      z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL ;
+      z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL ;
+      return z ^ (z >> 31) ;
+    }
+
+    // uniform in [0, 1)
+    double uniform() { return (next() >> 11) * (1.0 / 9007199254740992.0) ; }
+
+    // uniform in {0, ..., n - 1}
+    int index(int n) { return (int)(uniform() * n) ; }
+
+  private:
+    uint64_t state ;
+  } ;
+
+  // The interpolation kernels of MATLAB's imresize
+  enum ResizeMethod
+  {
+    RESIZE_NEAREST = 0,
+    RESIZE_BILINEAR,
+    RESIZE_BICUBIC,
+    RESIZE_BOX,
+    RESIZE_LANCZOS2,
+    RESIZE_LANCZOS3
+  } ;
+
+  // The augmentation settings, following the batchOpts of
+  // core/ssd_train_get_batch.m.  A step is skipped if its probability is
+  // zero (the patch sampler, which has none, if patchNumTrials is zero).
+  struct AugmentOptions
+  {
+    int height ;
+    int width ;
+    float average [3] ;
+    std::vector<ResizeMethod> resizeMethods ;
+
+    double brightnessProb ;
+    double brightnessDelta ;
+    double contrastProb ;
+    double contrastLower ;
+    double contrastUpper ;
+    double saturationProb ;
+    double saturationLower ;
+    double saturationUpper ;
+    double hueProb ;
+    double hueDelta ;
+    double randomOrderProb ;
+
+    double zoomProb ;
+    double zoomMinScale ;
+    double zoomMaxScale ;
+
+    int patchNumTrials ;
+    double patchMinScale ;
+    double patchMaxScale ;
+    double patchMinAspect ;
+    double patchMaxAspect ;
+    bool clipTargets ;
+
+    double flipProb ;
+
+    AugmentOptions() ;
+  } ;
+
+  // An image with its annotations.  The pixels are stored as a MATLAB
+  // height x width x depth single array (depth 1 or 3, values in
+  // [0, 255]), and the numBoxes boxes as a column-major numBoxes x 4
+  // [xmin ymin xmax ymax] matrix of normalised coordinates.
+  struct AugmentImage
+  {
+    std::vector<float> pixels ;
+    int height ;
+    int width ;
+    int depth ;
+    std::vector<double> boxes ;
+    std::vector<float> labels ;
+    uint64_t seed ;
+  } ;
+
+  // The annotations of an augmented image, in the same format
+  struct AugmentAnnotations
+  {
+    std::vector<double> boxes ;
+    std::vector<float> labels ;
+  } ;
+
+  // Sample a training patch of an image whose annotations are `boxes` as
+  // matlab/utils/patchSampler.m does: every strategy (minimum IoU with a
+  // box of 0.1, 0.3, 0.5, 0.7, 0.9 or none) tries up to
+  // options.patchNumTrials random patches and keeps the first acceptable
+  // one, and a patch is picked uniformly among them and the whole image.
+  // The boxes whose centres lie in the patch are re-expressed relative to
+  // it (and clipped if options.clipTargets is set); if there are none the
+  // sampling is repeated, falling back to the whole image after a bounded
+  // number of rounds.  The patch is [xmin ymin xmax ymax].
+  void samplePatch(AugmentOptions const &options,
+                   double const *boxes,
+                   float const *labels,
+                   int numBoxes,
+                   AugmentRandom &random,
+                   double patch [4],
+                   AugmentAnnotations *annotations) ;
+
+  // Augment an image as core/ssd_train_get_batch.m does (photometric
+  // distortion, zoom out, patch sampling, resizing with a randomly chosen
+  // method and flipping), writing the mean-subtracted options.height x
+  // options.width x 3 result to `output`.  The zoomed out canvas is never
+  // formed: only the sampled patch is extracted from it, and the
+  // photometric distortion is applied to the pixels of the patch.
+  void augmentImage(AugmentOptions const &options,
+                    AugmentImage const &image,
+                    float *output,
+                    AugmentAnnotations *annotations) ;
+
+  // A batch of images and its augmented version (a height x width x 3 x
+  // batchSize array)
+  struct AugmentBatch
+  {
+    AugmentOptions options ;
+    std::vector<AugmentImage> images ;
+    std::vector<float> data ;
+    std::vector<AugmentAnnotations> annotations ;
+
+    void init(AugmentOptions const &options, int batchSize) ;
+    float *imageData(int i) ;
+  } ;
+
+  // Augment the images of a batch on `numThreads` threads (a non-positive
+  // value selects the number of hardware threads).  The result does not
+  // depend on the number of threads.
+  void augmentBatch(AugmentBatch *batch, int numThreads) ;
+
+  // A pool of worker threads augmenting batches in the background.
+  // Batches are identified by a key (e.g. the indices of their images);
+  // up to `capacity` of them are kept, and the oldest one is dropped when
+  // a new one would exceed the capacity.  The images of each batch are
+  // processed in parallel, in submission order.
+  class AugmentQueue
+  {
+  public:
+    AugmentQueue() ;
+    ~AugmentQueue() ;
+
+    // Start (or restart) the pool with `numThreads` workers (a
+    // non-positive value selects the number of hardware threads)
+    void setNumThreads(int numThreads) ;
+    int getNumThreads() const ;
+    void setCapacity(int capacity) ;
+
+    void submit(std::vector<double> const &key,
+                std::shared_ptr<AugmentBatch> const &batch) ;
+
+    // Wait for the batch with the given key and remove it from the queue.
+    // Returns NULL if there is no such batch.
+    std::shared_ptr<AugmentBatch> take(std::vector<double> const &key) ;
+
+    void clear() ;
+
+  private:
+    struct Entry
+    {
+      std::vector<double> key ;
+      std::shared_ptr<AugmentBatch> batch ;
+      int numPending ;
+      bool cancelled ;
+    } ;
+    struct Task
+    {
+      std::shared_ptr<Entry> entry ;
+      int image ;
+    } ;
+
+    void work() ;
+    void stop() ;
+
+    std::mutex mutex ;
+    std::condition_variable taskAvailable ;
+    std::condition_variable taskDone ;
+    std::deque<Task> tasks ;
+    std::deque<std::shared_ptr<Entry> > entries ;
+    std::vector<std::thread> workers ;
+    int capacity ;
+    bool quit ;
+  } ;
+
+} }
+
+#endif /* defined(VL_AUGMENT_H) */
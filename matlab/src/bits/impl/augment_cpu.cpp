@@ -0,0 +1,688 @@
+// @file augment_cpu.cpp
+// @brief SSD training data augmentation CPU implementation
+// @author Samuel Albanie
+// @author Andrea Vedaldi
+
+/*
+Copyright (C) 2017- Samuel Albanie and Andrea Vedaldi.
+All rights reserved.
+
+This file is part of the VLFeat library and is made available under
+the terms of the BSD license (see the COPYING file).
+*/
+
+#include "augment.hpp"
+#include "parallel.hpp"
+#include <algorithm>
+#include <cmath>
+
+using namespace vl::impl ;
+
+/* ------------------------------------------------------------ */
+/*                                                       useful */
+/* ------------------------------------------------------------ */
+
+// The number of times patchSampler.m would be allowed to try to find a
+// patch containing the centre of a box before using the whole image
+static const int maxPatchRounds = 50 ;
+
+static const double pi = 3.14159265358979323846 ;
+static const double matlabEps = 2.220446049250313e-16 ;
+
+static inline double clamp(double x, double lower, double upper)
+{
+  return std::min(std::max(x, lower), upper) ;
+}
+
+// MATLAB's rgb2hsv and hsv2rgb (all components in [0, 1])
+static void rgbToHsv(double const *rgb, double *hsv)
+{
+  double r = rgb[0], g = rgb[1], b = rgb[2] ;
+  double v = std::max(r, std::max(g, b)) ;
+  double delta = v - std::min(r, std::min(g, b)) ;
+  double s = (v > 0) ? delta / v : 0 ;
+  double h = 0 ;
+  if (delta > 0) {
+    if (r == v) { h = (g - b) / delta ; }
+    else if (g == v) { h = 2 + (b - r) / delta ; }
+    else { h = 4 + (r - g) / delta ; }
+    h /= 6 ;
+    if (h < 0) { h += 1 ; }
+  }
+  hsv[0] = h ; hsv[1] = s ; hsv[2] = v ;
+}
+
+static void hsvToRgb(double const *hsv, double *rgb)
+{
+  double h = 6 * hsv[0], s = hsv[1], v = hsv[2] ;
+  int k = (int)std::floor(h) ;
+  double f = h - k ;
+  double p = v * (1 - s), q = v * (1 - s * f), t = v * (1 - s * (1 - f)) ;
+  switch (k % 6) {
+    case 0 : rgb[0] = v ; rgb[1] = t ; rgb[2] = p ; break ;
+    case 1 : rgb[0] = q ; rgb[1] = v ; rgb[2] = p ; break ;
+    case 2 : rgb[0] = p ; rgb[1] = v ; rgb[2] = t ; break ;
+    case 3 : rgb[0] = p ; rgb[1] = q ; rgb[2] = v ; break ;
+    case 4 : rgb[0] = t ; rgb[1] = p ; rgb[2] = v ; break ;
+    default: rgb[0] = v ; rgb[1] = p ; rgb[2] = q ; break ;
+  }
+}
+
+// The photometric distortion of an image, drawn once and applied to each
+// of its pixels (the steps of ssd_train_get_batch.m, in the same order)
+struct Distortion
+{
+  bool brightness, contrast, saturation, hue, reorder ;
+  double brightnessAdjust, contrastAdjust, saturationAdjust, hueAdjust ;
+  int order [3] ;
+
+  void sample(AugmentOptions const &opts, AugmentRandom &random)
+  {
+    brightness = random.uniform() < opts.brightnessProb ;
+    if (brightness) {
+      brightnessAdjust = -opts.brightnessDelta + random.uniform() * 2 * opts.brightnessDelta ;
+    }
+    contrast = random.uniform() < opts.contrastProb ;
+    if (contrast) {
+      contrastAdjust = opts.contrastLower + random.uniform() *
+        (opts.contrastUpper - opts.contrastLower) ;
+    }
+    saturation = random.uniform() < opts.saturationProb ;
+    if (saturation) {
+      saturationAdjust = opts.saturationLower + random.uniform() *
+        (opts.saturationUpper - opts.saturationLower) ;
+    }
+    hue = random.uniform() < opts.hueProb ;
+    if (hue) {
+      hueAdjust = -opts.hueDelta + random.uniform() * 2 * opts.hueDelta ;
+    }
+    order[0] = 0 ; order[1] = 1 ; order[2] = 2 ;
+    reorder = random.uniform() < opts.randomOrderProb ;
+    if (reorder) {
+      for (int c = 2 ; c > 0 ; --c) {
+        std::swap(order[c], order[random.index(c + 1)]) ;
+      }
+    }
+  }
+
+  bool any() const
+  {
+    return brightness || contrast || saturation || hue || reorder ;
+  }
+
+  void apply(float *rgb) const
+  {
+    double x [3] = { rgb[0], rgb[1], rgb[2] } ;
+    if (brightness) {
+      for (int c = 0 ; c < 3 ; ++c) { x[c] = clamp(x[c] + brightnessAdjust, 0, 255) ; }
+    }
+    if (contrast) {
+      for (int c = 0 ; c < 3 ; ++c) { x[c] = clamp(x[c] * contrastAdjust, 0, 255) ; }
+    }
+    for (int step = 0 ; step < 2 ; ++step) {
+      if (step == 0 ? !saturation : !hue) { continue ; }
+      double y [3] = { x[0] / 255, x[1] / 255, x[2] / 255 } ;
+      double hsv [3] ;
+      rgbToHsv(y, hsv) ;
+      if (step == 0) {
+        hsv[1] = clamp(hsv[1] * saturationAdjust, 0, 1) ;
+      } else {
+        hsv[0] = clamp(hsv[0] + hueAdjust, 0, 1) ;
+      }
+      hsvToRgb(hsv, y) ;
+      for (int c = 0 ; c < 3 ; ++c) { x[c] = y[c] * 255 ; }
+    }
+    for (int c = 0 ; c < 3 ; ++c) { rgb[c] = (float)x[order[c]] ; }
+  }
+} ;
+
+/* ------------------------------------------------------------ */
+/*                                                     resizing */
+/* ------------------------------------------------------------ */
+
+// The kernels of imresize, and their widths
+static double resizeKernel(ResizeMethod method, double x)
+{
+  double a = std::abs(x) ;
+  switch (method) {
+    case RESIZE_NEAREST :
+    case RESIZE_BOX :
+      return (-0.5 <= x && x < 0.5) ? 1 : 0 ;
+    case RESIZE_BILINEAR :
+      return (a <= 1) ? 1 - a : 0 ;
+    case RESIZE_BICUBIC :
+      if (a <= 1) { return 1.5 * a * a * a - 2.5 * a * a + 1 ; }
+      if (a <= 2) { return -0.5 * a * a * a + 2.5 * a * a - 4 * a + 2 ; }
+      return 0 ;
+    case RESIZE_LANCZOS2 :
+      if (a >= 2) { return 0 ; }
+      return (std::sin(pi * x) * std::sin(pi * x / 2) + matlabEps) /
+        (pi * pi * x * x / 2 + matlabEps) ;
+    case RESIZE_LANCZOS3 :
+      if (a >= 3) { return 0 ; }
+      return (std::sin(pi * x) * std::sin(pi * x / 3) + matlabEps) /
+        (pi * pi * x * x / 3 + matlabEps) ;
+  }
+  return 0 ;
+}
+
+static double resizeKernelWidth(ResizeMethod method)
+{
+  switch (method) {
+    case RESIZE_NEAREST : case RESIZE_BOX : return 1 ;
+    case RESIZE_BILINEAR : return 2 ;
+    case RESIZE_BICUBIC : case RESIZE_LANCZOS2 : return 4 ;
+    case RESIZE_LANCZOS3 : return 6 ;
+  }
+  return 1 ;
+}
+
+// The contributions of the input samples to each output sample along a
+// dimension, as computed by imresize (antialiased when shrinking, except
+// for nearest neighbour interpolation, with symmetric padding)
+struct Contributions
+{
+  int support ;
+  std::vector<int> indices ;
+  std::vector<float> weights ;
+
+  void init(ResizeMethod method, int inputSize, int outputSize)
+  {
+    double scale = (double)outputSize / inputSize ;
+    double width = resizeKernelWidth(method) ;
+    bool antialias = (scale < 1 && method != RESIZE_NEAREST) ;
+    if (antialias) { width /= scale ; }
+    support = (int)std::ceil(width) + 2 ;
+    indices.resize((size_t)outputSize * support) ;
+    weights.resize((size_t)outputSize * support) ;
+    std::vector<double> w(support) ;
+    for (int x = 0 ; x < outputSize ; ++x) {
+      // 1-based coordinates, as in imresize
+      double u = (x + 1) / scale + 0.5 * (1 - 1 / scale) ;
+      int left = (int)std::floor(u - width / 2) ;
+      double sum = 0 ;
+      for (int k = 0 ; k < support ; ++k) {
+        double d = u - (left + k) ;
+        w[k] = antialias ? scale * resizeKernel(method, scale * d)
+                         : resizeKernel(method, d) ;
+        sum += w[k] ;
+      }
+      for (int k = 0 ; k < support ; ++k) {
+        int j = (left + k - 1) % (2 * inputSize) ;
+        if (j < 0) { j += 2 * inputSize ; }
+        if (j >= inputSize) { j = 2 * inputSize - 1 - j ; }
+        indices[(size_t)x * support + k] = j ;
+        weights[(size_t)x * support + k] = (float)(w[k] / sum) ;
+      }
+    }
+  }
+} ;
+
+// Resize the rows (dim = 0) or columns (dim = 1) of a height x width x 3
+// image
+static void resizeDimension(float const *input, int height, int width,
+                            int dim, Contributions const &contrib,
+                            int outputSize, float *output)
+{
+  const int outHeight = (dim == 0) ? outputSize : height ;
+  const int outWidth = (dim == 0) ? width : outputSize ;
+  const int S = contrib.support ;
+  for (int c = 0 ; c < 3 ; ++c) {
+    float const *in = input + (size_t)height * width * c ;
+    float *out = output + (size_t)outHeight * outWidth * c ;
+    if (dim == 0) {
+      for (int x = 0 ; x < width ; ++x) {
+        float const *column = in + (size_t)height * x ;
+        for (int y = 0 ; y < outHeight ; ++y) {
+          int const *idx = &contrib.indices[(size_t)y * S] ;
+          float const *w = &contrib.weights[(size_t)y * S] ;
+          float acc = 0 ;
+          for (int k = 0 ; k < S ; ++k) { acc += w[k] * column[idx[k]] ; }
+          out[y + (size_t)outHeight * x] = acc ;
+        }
+      }
+    } else {
+      std::fill(out, out + (size_t)outHeight * outWidth, 0.f) ;
+      for (int x = 0 ; x < outWidth ; ++x) {
+        int const *idx = &contrib.indices[(size_t)x * S] ;
+        float const *w = &contrib.weights[(size_t)x * S] ;
+        float *column = out + (size_t)outHeight * x ;
+        for (int k = 0 ; k < S ; ++k) {
+          if (w[k] == 0) { continue ; }
+          float const *source = in + (size_t)height * idx[k] ;
+          for (int y = 0 ; y < outHeight ; ++y) { column[y] += w[k] * source[y] ; }
+        }
+      }
+    }
+  }
+}
+
+// imresize(input, [outHeight outWidth], method), resizing first the
+// dimension with the smallest scale factor
+static void resizeImage(float const *input, int height, int width,
+                        ResizeMethod method, int outHeight, int outWidth,
+                        float *output)
+{
+  Contributions rows, columns ;
+  rows.init(method, height, outHeight) ;
+  columns.init(method, width, outWidth) ;
+  if ((double)outHeight / height <= (double)outWidth / width) {
+    std::vector<float> buffer((size_t)outHeight * width * 3) ;
+    resizeDimension(input, height, width, 0, rows, outHeight, buffer.data()) ;
+    resizeDimension(buffer.data(), outHeight, width, 1, columns, outWidth, output) ;
+  } else {
+    std::vector<float> buffer((size_t)height * outWidth * 3) ;
+    resizeDimension(input, height, width, 1, columns, outWidth, buffer.data()) ;
+    resizeDimension(buffer.data(), height, outWidth, 0, rows, outHeight, output) ;
+  }
+}
+
+/* ------------------------------------------------------------ */
+/*                                                      patches */
+/* ------------------------------------------------------------ */
+
+// updateAnnotations.m: keep the boxes whose centre lies in the patch and
+// express them relative to it
+static bool updateAnnotations(AugmentOptions const &opts, double const *patch,
+                              double const *boxes, float const *labels,
+                              int numBoxes, AugmentAnnotations *annotations)
+{
+  std::vector<int> retained ;
+  for (int b = 0 ; b < numBoxes ; ++b) {
+    double cx = (boxes[b] + boxes[b + 2 * numBoxes]) / 2 ;
+    double cy = (boxes[b + numBoxes] + boxes[b + 3 * numBoxes]) / 2 ;
+    if (patch[0] <= cx && cx <= patch[2] && patch[1] <= cy && cy <= patch[3]) {
+      retained.push_back(b) ;
+    }
+  }
+  if (retained.empty()) { return false ; }
+
+  const int M = retained.size() ;
+  const double offset [2] = { patch[0], patch[1] } ;
+  const double scale [2] = { 1 / (patch[2] - patch[0]), 1 / (patch[3] - patch[1]) } ;
+  annotations->boxes.resize(4 * M) ;
+  annotations->labels.resize(M) ;
+  for (int k = 0 ; k < M ; ++k) {
+    int b = retained[k] ;
+    for (int c = 0 ; c < 4 ; ++c) {
+      double x = scale[c % 2] * (boxes[b + c * numBoxes] - offset[c % 2]) ;
+      if (opts.clipTargets) { x = clamp(x, 0, 1) ; }
+      annotations->boxes[k + c * M] = x ;
+    }
+    annotations->labels[k] = labels[b] ;
+  }
+  return true ;
+}
+
+// runPatchTrials.m: the first of up to numTrials random patches whose IoU
+// with one of the boxes is at least minOverlap
+static bool runPatchTrials(AugmentOptions const &opts, double minOverlap,
+                           double const *boxes, int numBoxes,
+                           AugmentRandom &random, double *patch)
+{
+  for (int t = 0 ; t < opts.patchNumTrials ; ++t) {
+    // following caffe, the scale is the square root of the patch area,
+    // and the aspect ratio is constrained to fit in the unit box
+    double scale = opts.patchMinScale +
+      (opts.patchMaxScale - opts.patchMinScale) * random.uniform() ;
+    double minAspect = std::max(opts.patchMinAspect, scale * scale) ;
+    double maxAspect = std::min(opts.patchMaxAspect, 1 / (scale * scale)) ;
+    double aspect = minAspect + random.uniform() * (maxAspect - minAspect) ;
+    double w = scale * std::sqrt(aspect) ;
+    double h = scale / std::sqrt(aspect) ;
+    double x = random.uniform() * (1 - w) ;
+    double y = random.uniform() * (1 - h) ;
+
+    bool accept = (minOverlap <= 0) ;
+    for (int b = 0 ; b < numBoxes && !accept ; ++b) {
+      double bx0 = boxes[b], by0 = boxes[b + numBoxes] ;
+      double bx1 = boxes[b + 2 * numBoxes], by1 = boxes[b + 3 * numBoxes] ;
+      double iw = std::min(bx1, x + w) - std::max(bx0, x) ;
+      double ih = std::min(by1, y + h) - std::max(by0, y) ;
+      if (iw <= 0 || ih <= 0) { continue ; }
+      double inter = iw * ih ;
+      double uni = (bx1 - bx0) * (by1 - by0) + w * h - inter ;
+      accept = (inter >= minOverlap * uni) ;
+    }
+    if (accept) {
+      patch[0] = x ; patch[1] = y ; patch[2] = x + w ; patch[3] = y + h ;
+      return true ;
+    }
+  }
+  return false ;
+}
+
+void
+vl::impl::samplePatch(AugmentOptions const &options,
+                      double const *boxes,
+                      float const *labels,
+                      int numBoxes,
+                      AugmentRandom &random,
+                      double patch [4],
+                      AugmentAnnotations *annotations)
+{
+  static const double minOverlaps [] = { 0.1, 0.3, 0.5, 0.7, 0.9, 0 } ;
+  const int numStrategies = sizeof(minOverlaps) / sizeof(minOverlaps[0]) ;
+  double candidates [numStrategies + 1][4] ;
+
+  for (int round = 0 ; round < maxPatchRounds ; ++round) {
+    int numCandidates = 0 ;
+    for (int s = 0 ; s < numStrategies ; ++s) {
+      numCandidates += runPatchTrials(options, minOverlaps[s], boxes, numBoxes,
+                                      random, candidates[numCandidates]) ;
+    }
+    // the whole image is always a candidate
+    double *whole = candidates[numCandidates++] ;
+    whole[0] = 0 ; whole[1] = 0 ; whole[2] = 1 ; whole[3] = 1 ;
+    double const *chosen = candidates[random.index(numCandidates)] ;
+    std::copy(chosen, chosen + 4, patch) ;
+    if (updateAnnotations(options, patch, boxes, labels, numBoxes, annotations)) {
+      return ;
+    }
+  }
+
+  patch[0] = 0 ; patch[1] = 0 ; patch[2] = 1 ; patch[3] = 1 ;
+  if (!updateAnnotations(options, patch, boxes, labels, numBoxes, annotations)) {
+    annotations->boxes.assign(boxes, boxes + 4 * numBoxes) ;
+    annotations->labels.assign(labels, labels + numBoxes) ;
+  }
+}
+
+/* ------------------------------------------------------------ */
+/*                                                 augmentation */
+/* ------------------------------------------------------------ */
+
+AugmentOptions::AugmentOptions()
+: height(300), width(300),
+  brightnessProb(0), brightnessDelta(0),
+  contrastProb(0), contrastLower(1), contrastUpper(1),
+  saturationProb(0), saturationLower(1), saturationUpper(1),
+  hueProb(0), hueDelta(0), randomOrderProb(0),
+  zoomProb(0), zoomMinScale(1), zoomMaxScale(1),
+  patchNumTrials(0), patchMinScale(0.3), patchMaxScale(1),
+  patchMinAspect(0.5), patchMaxAspect(2), clipTargets(false),
+  flipProb(0)
+{
+  average[0] = 123 ; average[1] = 117 ; average[2] = 104 ;
+  resizeMethods.push_back(RESIZE_BILINEAR) ;
+}
+
+void
+vl::impl::augmentImage(AugmentOptions const &opts,
+                       AugmentImage const &image,
+                       float *output,
+                       AugmentAnnotations *annotations)
+{
+  AugmentRandom random(image.seed) ;
+  const int H = image.height ;
+  const int W = image.width ;
+  const int numBoxes = image.labels.size() ;
+
+  ResizeMethod method = RESIZE_BILINEAR ;
+  if (!opts.resizeMethods.empty()) {
+    method = opts.resizeMethods[random.index(opts.resizeMethods.size())] ;
+  }
+  Distortion distortion ;
+  distortion.sample(opts, random) ;
+
+  // zoom out: the image is placed at a random location of a larger
+  // canvas filled with the average colour
+  int canvasHeight = H, canvasWidth = W, offsetY = 0, offsetX = 0 ;
+  std::vector<double> boxes(image.boxes) ;
+  if (random.uniform() < opts.zoomProb) {
+    double zoom = opts.zoomMinScale + random.uniform() *
+      (opts.zoomMaxScale - opts.zoomMinScale) ;
+    canvasHeight = (int)std::round(H * zoom) ;
+    canvasWidth = (int)std::round(W * zoom) ;
+    double uy = random.uniform() ;
+    double ux = random.uniform() ;
+    offsetY = (int)std::round(uy * (canvasHeight - H)) ;
+    offsetX = (int)std::round(ux * (canvasWidth - W)) ;
+    for (int b = 0 ; b < numBoxes ; ++b) {
+      for (int c = 0 ; c < 4 ; ++c) {
+        double u = (c % 2) ? uy : ux ;
+        double &x = boxes[b + c * numBoxes] ;
+        x = u * (zoom - 1) / zoom + x / zoom ;
+      }
+    }
+  }
+
+  // patch sampling
+  double patch [4] = { 0, 0, 1, 1 } ;
+  if (opts.patchNumTrials > 0 && numBoxes > 0) {
+    samplePatch(opts, boxes.data(), image.labels.data(), numBoxes, random,
+                patch, annotations) ;
+  } else {
+    annotations->boxes = boxes ;
+    annotations->labels = image.labels ;
+  }
+
+  // extract the patch from the (virtual) canvas, distorting the pixels
+  // which come from the image
+  const int x0 = (int)std::round(patch[0] * (canvasWidth - 1)) ;
+  const int x1 = (int)std::round(patch[2] * (canvasWidth - 1)) ;
+  const int y0 = (int)std::round(patch[1] * (canvasHeight - 1)) ;
+  const int y1 = (int)std::round(patch[3] * (canvasHeight - 1)) ;
+  const int cropHeight = y1 - y0 + 1 ;
+  const int cropWidth = x1 - x0 + 1 ;
+  const size_t cropArea = (size_t)cropHeight * cropWidth ;
+  const size_t imageArea = (size_t)H * W ;
+  std::vector<float> crop(cropArea * 3) ;
+  for (int x = 0 ; x < cropWidth ; ++x) {
+    const int u = x0 + x - offsetX ;
+    for (int y = 0 ; y < cropHeight ; ++y) {
+      const int v = y0 + y - offsetY ;
+      const size_t dst = y + (size_t)cropHeight * x ;
+      float rgb [3] ;
+      if (0 <= u && u < W && 0 <= v && v < H) {
+        const size_t src = v + (size_t)H * u ;
+        for (int c = 0 ; c < 3 ; ++c) {
+          rgb[c] = image.pixels[src + imageArea * (image.depth == 3 ? c : 0)] ;
+        }
+        if (distortion.any()) { distortion.apply(rgb) ; }
+      } else {
+        for (int c = 0 ; c < 3 ; ++c) { rgb[c] = opts.average[c] ; }
+      }
+      for (int c = 0 ; c < 3 ; ++c) { crop[dst + cropArea * c] = rgb[c] ; }
+    }
+  }
+
+  resizeImage(crop.data(), cropHeight, cropWidth, method, opts.height,
+              opts.width, output) ;
+
+  // flipping
+  const size_t outputArea = (size_t)opts.height * opts.width ;
+  if (random.uniform() < opts.flipProb) {
+    for (int c = 0 ; c < 3 ; ++c) {
+      float *channel = output + outputArea * c ;
+      for (int x = 0 ; x < opts.width / 2 ; ++x) {
+        std::swap_ranges(channel + (size_t)opts.height * x,
+                         channel + (size_t)opts.height * (x + 1),
+                         channel + (size_t)opts.height * (opts.width - 1 - x)) ;
+      }
+    }
+    std::vector<double> &b = annotations->boxes ;
+    const int M = annotations->labels.size() ;
+    for (int k = 0 ; k < M ; ++k) {
+      double xmin = b[k] ;
+      b[k] = 1 - b[k + 2 * M] ;
+      b[k + 2 * M] = 1 - xmin ;
+    }
+  }
+
+  for (int c = 0 ; c < 3 ; ++c) {
+    float *channel = output + outputArea * c ;
+    for (size_t k = 0 ; k < outputArea ; ++k) { channel[k] -= opts.average[c] ; }
+  }
+}
+
+/* ------------------------------------------------------------ */
+/*                                                      batches */
+/* ------------------------------------------------------------ */
+
+void
+AugmentBatch::init(AugmentOptions const &options, int batchSize)
+{
+  this->options = options ;
+  images.resize(batchSize) ;
+  annotations.resize(batchSize) ;
+  data.assign((size_t)options.height * options.width * 3 * batchSize, 0.f) ;
+}
+
+float *
+AugmentBatch::imageData(int i)
+{
+  return data.data() + (size_t)options.height * options.width * 3 * i ;
+}
+
+void
+vl::impl::augmentBatch(AugmentBatch *batch, int numThreads)
+{
+  const int batchSize = batch->images.size() ;
+  const int numWorkers = getNumWorkers(numThreads, batchSize) ;
+  parallelFor(numWorkers, batchSize, [&](int i, int worker) {
+    augmentImage(batch->options, batch->images[i], batch->imageData(i),
+                 &batch->annotations[i]) ;
+  }) ;
+}
+
+/* ------------------------------------------------------------ */
+/*                                                        queue */
+/* ------------------------------------------------------------ */
+
+AugmentQueue::AugmentQueue()
+: capacity(2), quit(false)
+{ }
+
+AugmentQueue::~AugmentQueue()
+{
+  stop() ;
+}
+
+void
+AugmentQueue::stop()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex) ;
+    quit = true ;
+  }
+  taskAvailable.notify_all() ;
+  for (size_t t = 0 ; t < workers.size() ; ++t) { workers[t].join() ; }
+  workers.clear() ;
+  quit = false ;
+}
+
+void
+AugmentQueue::setNumThreads(int numThreads)
+{
+  numThreads = getNumWorkers(numThreads, 1 << 30) ;
+  if (numThreads == (int)workers.size()) { return ; }
+  stop() ;
+  for (int t = 0 ; t < numThreads ; ++t) {
+    workers.push_back(std::thread(&AugmentQueue::work, this)) ;
+  }
+}
+
+int
+AugmentQueue::getNumThreads() const
+{
+  return workers.size() ;
+}
+
+void
+AugmentQueue::setCapacity(int capacity)
+{
+  std::lock_guard<std::mutex> lock(mutex) ;
+  this->capacity = std::max(capacity, 1) ;
+  while ((int)entries.size() > this->capacity) {
+    entries.front()->cancelled = true ;
+    entries.pop_front() ;
+  }
+}
+
+void
+AugmentQueue::submit(std::vector<double> const &key,
+                     std::shared_ptr<AugmentBatch> const &batch)
+{
+  if (workers.empty()) { setNumThreads(0) ; }
+  {
+    std::lock_guard<std::mutex> lock(mutex) ;
+    for (auto e = entries.begin() ; e != entries.end() ; ++e) {
+      if ((*e)->key == key) {
+        (*e)->cancelled = true ;
+        entries.erase(e) ;
+        break ;
+      }
+    }
+    std::shared_ptr<Entry> entry(new Entry) ;
+    entry->key = key ;
+    entry->batch = batch ;
+    entry->numPending = batch->images.size() ;
+    entry->cancelled = false ;
+    entries.push_back(entry) ;
+    for (int i = 0 ; i < entry->numPending ; ++i) {
+      Task task = { entry, i } ;
+      tasks.push_back(task) ;
+    }
+    while ((int)entries.size() > capacity) {
+      entries.front()->cancelled = true ;
+      entries.pop_front() ;
+    }
+  }
+  taskAvailable.notify_all() ;
+}
+
+std::shared_ptr<AugmentBatch>
+AugmentQueue::take(std::vector<double> const &key)
+{
+  std::unique_lock<std::mutex> lock(mutex) ;
+  for (auto e = entries.begin() ; e != entries.end() ; ++e) {
+    if ((*e)->key == key) {
+      std::shared_ptr<Entry> entry = *e ;
+      entries.erase(e) ;
+      taskDone.wait(lock, [&]() { return entry->numPending == 0 ; }) ;
+      return entry->batch ;
+    }
+  }
+  return std::shared_ptr<AugmentBatch>() ;
+}
+
+void
+AugmentQueue::clear()
+{
+  std::lock_guard<std::mutex> lock(mutex) ;
+  for (size_t e = 0 ; e < entries.size() ; ++e) {
+    entries[e]->cancelled = true ;
+  }
+  entries.clear() ;
+  tasks.clear() ;
+}
+
+void
+AugmentQueue::work()
+{
+  for (;;) {
+    Task task ;
+    bool cancelled ;
+    {
+      std::unique_lock<std::mutex> lock(mutex) ;
+      taskAvailable.wait(lock, [&]() { return quit || !tasks.empty() ; }) ;
+      if (quit) { return ; }
+      task = tasks.front() ;
+      tasks.pop_front() ;
+      cancelled = task.entry->cancelled ;
+    }
+    // each task owns its image, which is released once augmented
+    AugmentBatch &batch = *task.entry->batch ;
+    if (!cancelled) {
+      augmentImage(batch.options, batch.images[task.image],
+                   batch.imageData(task.image), &batch.annotations[task.image]) ;
+    }
+    std::vector<float>().swap(batch.images[task.image].pixels) ;
+    {
+      std::lock_guard<std::mutex> lock(mutex) ;
+      --task.entry->numPending ;
+    }
+    taskDone.notify_all() ;
+  }
+}
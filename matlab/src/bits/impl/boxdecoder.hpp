@@ -0,0 +1,369 @@
+// @file boxdecoder.hpp
+// @brief Vectorised decoding of multibox location predictions against a
+// precomputed table of prior geometry
+// @author Samuel Albanie
+// @author Andrea Vedaldi
+
+/*
+Copyright (C) 2017- Samuel Albanie and Andrea Vedaldi.
+All rights reserved.
+
+This file is part of the VLFeat library and is made available under
+the terms of the BSD license (see the COPYING file).
+*/
+
+#ifndef VL_BOXDECODER_H
+#define VL_BOXDECODER_H
+
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define VL_BOXDECODER_SSE2 1
+#include <emmintrin.h>
+#endif
+
+// AVX2 is selected at runtime when the compiler supports per-function
+// targets, or at compile time when the whole unit is built with -mavx2
+#if defined(__AVX2__)
+#define VL_BOXDECODER_AVX2 1
+#define VL_BOXDECODER_AVX2_TARGET
+#include <immintrin.h>
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define VL_BOXDECODER_AVX2 1
+#define VL_BOXDECODER_AVX2_TARGET __attribute__((target("avx2")))
+#include <immintrin.h>
+#endif
+
+namespace vl { namespace impl {
+
+  // Geometry of the priors in structure-of-arrays form: centres, sizes and
+  // variances are each stored contiguously, so they can be streamed by the
+  // vectorised decoder.  The table is built from a priors tensor holding
+  // numPriors [xmin ymin xmax ymax] boxes followed by numPriors variances.
+  struct PriorTable
+  {
+    enum { CENTER_X = 0, CENTER_Y, WIDTH, HEIGHT, VAR0, VAR1, VAR2, VAR3,
+           NUM_FIELDS } ;
+
+    int numPriors ;
+    std::vector<float> data ;
+
+    PriorTable() : numPriors(0) { }
+
+    float const * field(int f) const { return &data[0] + f * numPriors ; }
+
+    template <typename T>
+    void init(T const *priors, int numPriors_)
+    {
+      numPriors = numPriors_ ;
+      data.resize(NUM_FIELDS * numPriors) ;
+      float *centerX = &data[0] + CENTER_X * numPriors ;
+      float *centerY = &data[0] + CENTER_Y * numPriors ;
+      float *width = &data[0] + WIDTH * numPriors ;
+      float *height = &data[0] + HEIGHT * numPriors ;
+      T const *vars = priors + numPriors * 4 ;
+      for (int p = 0 ; p < numPriors ; ++p) {
+        const float xmin = priors[p * 4] ;
+        const float ymin = priors[p * 4 + 1] ;
+        const float xmax = priors[p * 4 + 2] ;
+        const float ymax = priors[p * 4 + 3] ;
+        width[p] = xmax - xmin ;
+        height[p] = ymax - ymin ;
+        centerX[p] = (xmin + xmax) * 0.5f ;
+        centerY[p] = (ymin + ymax) * 0.5f ;
+        for (int k = 0 ; k < 4 ; ++k) {
+          data[(VAR0 + k) * numPriors + p] = vars[p * 4 + k] ;
+        }
+      }
+    }
+  } ;
+
+  /* ---------------------------------------------------------------- */
+  /*                                                         fast exp */
+  /* ---------------------------------------------------------------- */
+
+  // A Cephes-style exp: x = n ln(2) + r with |r| <= ln(2)/2, exp(r) from a
+  // degree 6 polynomial and 2^n assembled in the exponent bits.  The inputs
+  // are clamped to [-88.37, 88.37].  Over [-87, 88] the relative error
+  // against exp computed in double precision is below 1e-7 (< 2 ulp).
+  // The scalar and SIMD versions perform the same sequence of operations,
+  // so they produce identical results provided the compiler does not
+  // contract the multiply-adds into FMAs: both builds pass
+  // -ffp-contract=off (see standalone/test_boxdecoder.cpp).
+  namespace fastexp {
+    const float hi = 88.3762626647949f ;
+    const float lo = -88.3762626647949f ;
+    const float log2e = 1.44269504088896341f ;
+    const float c1 = 0.693359375f ;
+    const float c2 = -2.12194440e-4f ;
+    const float p0 = 1.9875691500e-4f ;
+    const float p1 = 1.3981999507e-3f ;
+    const float p2 = 8.3334519073e-3f ;
+    const float p3 = 4.1665795894e-2f ;
+    const float p4 = 1.6666665459e-1f ;
+    const float p5 = 5.0000001201e-1f ;
+  }
+
+  inline float fastExp(float x)
+  {
+    x = x < fastexp::hi ? x : fastexp::hi ;
+    x = x > fastexp::lo ? x : fastexp::lo ;
+    float fx = x * fastexp::log2e + 0.5f ;
+    float n = (float)(int32_t)fx ;
+    n = (n > fx) ? n - 1.0f : n ;
+    x = x - n * fastexp::c1 ;
+    x = x - n * fastexp::c2 ;
+    float y = fastexp::p0 ;
+    y = y * x + fastexp::p1 ;
+    y = y * x + fastexp::p2 ;
+    y = y * x + fastexp::p3 ;
+    y = y * x + fastexp::p4 ;
+    y = y * x + fastexp::p5 ;
+    y = y * (x * x) + x + 1.0f ;
+    int32_t bits = ((int32_t)n + 127) << 23 ;
+    float scale ;
+    memcpy(&scale, &bits, sizeof(scale)) ;
+    return y * scale ;
+  }
+
+#ifdef VL_BOXDECODER_SSE2
+  inline __m128 fastExp(__m128 x)
+  {
+    x = _mm_min_ps(x, _mm_set1_ps(fastexp::hi)) ;
+    x = _mm_max_ps(x, _mm_set1_ps(fastexp::lo)) ;
+    __m128 fx = _mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(fastexp::log2e)),
+                           _mm_set1_ps(0.5f)) ;
+    __m128 n = _mm_cvtepi32_ps(_mm_cvttps_epi32(fx)) ;
+    n = _mm_sub_ps(n, _mm_and_ps(_mm_cmpgt_ps(n, fx), _mm_set1_ps(1.0f))) ;
+    x = _mm_sub_ps(x, _mm_mul_ps(n, _mm_set1_ps(fastexp::c1))) ;
+    x = _mm_sub_ps(x, _mm_mul_ps(n, _mm_set1_ps(fastexp::c2))) ;
+    __m128 y = _mm_set1_ps(fastexp::p0) ;
+    y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(fastexp::p1)) ;
+    y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(fastexp::p2)) ;
+    y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(fastexp::p3)) ;
+    y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(fastexp::p4)) ;
+    y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(fastexp::p5)) ;
+    y = _mm_add_ps(_mm_add_ps(_mm_mul_ps(y, _mm_mul_ps(x, x)), x),
+                   _mm_set1_ps(1.0f)) ;
+    __m128i bits = _mm_slli_epi32(_mm_add_epi32(_mm_cvttps_epi32(n),
+                                                _mm_set1_epi32(127)), 23) ;
+    return _mm_mul_ps(y, _mm_castsi128_ps(bits)) ;
+  }
+#endif
+
+#ifdef VL_BOXDECODER_AVX2
+  VL_BOXDECODER_AVX2_TARGET
+  inline __m256 fastExp(__m256 x)
+  {
+    x = _mm256_min_ps(x, _mm256_set1_ps(fastexp::hi)) ;
+    x = _mm256_max_ps(x, _mm256_set1_ps(fastexp::lo)) ;
+    __m256 fx = _mm256_add_ps(_mm256_mul_ps(x, _mm256_set1_ps(fastexp::log2e)),
+                              _mm256_set1_ps(0.5f)) ;
+    __m256 n = _mm256_cvtepi32_ps(_mm256_cvttps_epi32(fx)) ;
+    n = _mm256_sub_ps(n, _mm256_and_ps(_mm256_cmp_ps(n, fx, _CMP_GT_OQ),
+                                       _mm256_set1_ps(1.0f))) ;
+    x = _mm256_sub_ps(x, _mm256_mul_ps(n, _mm256_set1_ps(fastexp::c1))) ;
+    x = _mm256_sub_ps(x, _mm256_mul_ps(n, _mm256_set1_ps(fastexp::c2))) ;
+    __m256 y = _mm256_set1_ps(fastexp::p0) ;
+    y = _mm256_add_ps(_mm256_mul_ps(y, x), _mm256_set1_ps(fastexp::p1)) ;
+    y = _mm256_add_ps(_mm256_mul_ps(y, x), _mm256_set1_ps(fastexp::p2)) ;
+    y = _mm256_add_ps(_mm256_mul_ps(y, x), _mm256_set1_ps(fastexp::p3)) ;
+    y = _mm256_add_ps(_mm256_mul_ps(y, x), _mm256_set1_ps(fastexp::p4)) ;
+    y = _mm256_add_ps(_mm256_mul_ps(y, x), _mm256_set1_ps(fastexp::p5)) ;
+    y = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(y, _mm256_mul_ps(x, x)), x),
+                      _mm256_set1_ps(1.0f)) ;
+    __m256i bits = _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvttps_epi32(n),
+                                                      _mm256_set1_epi32(127)), 23) ;
+    return _mm256_mul_ps(y, _mm256_castsi256_ps(bits)) ;
+  }
+#endif
+
+  /* ---------------------------------------------------------------- */
+  /*                                                     box decoding */
+  /* ---------------------------------------------------------------- */
+
+  // Decoded boxes of a single image, one coordinate array per corner
+  struct DecodedBoxes
+  {
+    float *xmin ;
+    float *ymin ;
+    float *xmax ;
+    float *ymax ;
+  } ;
+
+  // Scalar decoder for priors [begin, end).  The location predictions
+  // are stored as [x y w h] offsets per prior.
+  template <typename T>
+  void decodeBoxesScalar(PriorTable const &table,
+                         T const *locData,
+                         int begin,
+                         int end,
+                         DecodedBoxes const &out)
+  {
+    float const *centerX = table.field(PriorTable::CENTER_X) ;
+    float const *centerY = table.field(PriorTable::CENTER_Y) ;
+    float const *width = table.field(PriorTable::WIDTH) ;
+    float const *height = table.field(PriorTable::HEIGHT) ;
+    float const *var0 = table.field(PriorTable::VAR0) ;
+    float const *var1 = table.field(PriorTable::VAR1) ;
+    float const *var2 = table.field(PriorTable::VAR2) ;
+    float const *var3 = table.field(PriorTable::VAR3) ;
+    for (int p = begin ; p < end ; ++p) {
+      const float locX = locData[p * 4] ;
+      const float locY = locData[p * 4 + 1] ;
+      const float locW = locData[p * 4 + 2] ;
+      const float locH = locData[p * 4 + 3] ;
+      float decodedCenterX = var0[p] * locX * width[p] + centerX[p] ;
+      float decodedCenterY = var1[p] * locY * height[p] + centerY[p] ;
+      float halfWidth = fastExp(var2[p] * locW) * width[p] * 0.5f ;
+      float halfHeight = fastExp(var3[p] * locH) * height[p] * 0.5f ;
+      out.xmin[p] = decodedCenterX - halfWidth ;
+      out.ymin[p] = decodedCenterY - halfHeight ;
+      out.xmax[p] = decodedCenterX + halfWidth ;
+      out.ymax[p] = decodedCenterY + halfHeight ;
+    }
+  }
+
+#ifdef VL_BOXDECODER_SSE2
+  // Four priors at a time: the interleaved offsets are transposed into
+  // x, y, w, h registers and the results are stored contiguously
+  inline void decodeBoxesSSE2(PriorTable const &table,
+                              float const *locData,
+                              int begin,
+                              int end,
+                              DecodedBoxes const &out)
+  {
+    float const *centerX = table.field(PriorTable::CENTER_X) ;
+    float const *centerY = table.field(PriorTable::CENTER_Y) ;
+    float const *width = table.field(PriorTable::WIDTH) ;
+    float const *height = table.field(PriorTable::HEIGHT) ;
+    float const *var0 = table.field(PriorTable::VAR0) ;
+    float const *var1 = table.field(PriorTable::VAR1) ;
+    float const *var2 = table.field(PriorTable::VAR2) ;
+    float const *var3 = table.field(PriorTable::VAR3) ;
+    const __m128 half = _mm_set1_ps(0.5f) ;
+    int p = begin ;
+    for ( ; p + 4 <= end ; p += 4) {
+      __m128 locX = _mm_loadu_ps(locData + p * 4) ;
+      __m128 locY = _mm_loadu_ps(locData + p * 4 + 4) ;
+      __m128 locW = _mm_loadu_ps(locData + p * 4 + 8) ;
+      __m128 locH = _mm_loadu_ps(locData + p * 4 + 12) ;
+      _MM_TRANSPOSE4_PS(locX, locY, locW, locH) ;
+      __m128 w = _mm_loadu_ps(width + p) ;
+      __m128 h = _mm_loadu_ps(height + p) ;
+      __m128 cx = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(_mm_loadu_ps(var0 + p), locX), w),
+                             _mm_loadu_ps(centerX + p)) ;
+      __m128 cy = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(_mm_loadu_ps(var1 + p), locY), h),
+                             _mm_loadu_ps(centerY + p)) ;
+      __m128 hw = _mm_mul_ps(_mm_mul_ps(fastExp(_mm_mul_ps(_mm_loadu_ps(var2 + p), locW)), w), half) ;
+      __m128 hh = _mm_mul_ps(_mm_mul_ps(fastExp(_mm_mul_ps(_mm_loadu_ps(var3 + p), locH)), h), half) ;
+      _mm_storeu_ps(out.xmin + p, _mm_sub_ps(cx, hw)) ;
+      _mm_storeu_ps(out.ymin + p, _mm_sub_ps(cy, hh)) ;
+      _mm_storeu_ps(out.xmax + p, _mm_add_ps(cx, hw)) ;
+      _mm_storeu_ps(out.ymax + p, _mm_add_ps(cy, hh)) ;
+    }
+    decodeBoxesScalar(table, locData, p, end, out) ;
+  }
+#endif
+
+#ifdef VL_BOXDECODER_AVX2
+  // Eight priors at a time: pairs of priors are loaded per register, the
+  // 128-bit halves are regrouped and then transposed within each half
+  VL_BOXDECODER_AVX2_TARGET
+  inline void decodeBoxesAVX2(PriorTable const &table,
+                              float const *locData,
+                              int begin,
+                              int end,
+                              DecodedBoxes const &out)
+  {
+    float const *centerX = table.field(PriorTable::CENTER_X) ;
+    float const *centerY = table.field(PriorTable::CENTER_Y) ;
+    float const *width = table.field(PriorTable::WIDTH) ;
+    float const *height = table.field(PriorTable::HEIGHT) ;
+    float const *var0 = table.field(PriorTable::VAR0) ;
+    float const *var1 = table.field(PriorTable::VAR1) ;
+    float const *var2 = table.field(PriorTable::VAR2) ;
+    float const *var3 = table.field(PriorTable::VAR3) ;
+    const __m256 half = _mm256_set1_ps(0.5f) ;
+    int p = begin ;
+    for ( ; p + 8 <= end ; p += 8) {
+      __m256 r0 = _mm256_loadu_ps(locData + p * 4) ;
+      __m256 r1 = _mm256_loadu_ps(locData + p * 4 + 8) ;
+      __m256 r2 = _mm256_loadu_ps(locData + p * 4 + 16) ;
+      __m256 r3 = _mm256_loadu_ps(locData + p * 4 + 24) ;
+      __m256 t0 = _mm256_permute2f128_ps(r0, r2, 0x20) ;
+      __m256 t1 = _mm256_permute2f128_ps(r0, r2, 0x31) ;
+      __m256 t2 = _mm256_permute2f128_ps(r1, r3, 0x20) ;
+      __m256 t3 = _mm256_permute2f128_ps(r1, r3, 0x31) ;
+      __m256 u0 = _mm256_unpacklo_ps(t0, t1) ;
+      __m256 u1 = _mm256_unpackhi_ps(t0, t1) ;
+      __m256 u2 = _mm256_unpacklo_ps(t2, t3) ;
+      __m256 u3 = _mm256_unpackhi_ps(t2, t3) ;
+      __m256 locX = _mm256_shuffle_ps(u0, u2, _MM_SHUFFLE(1,0,1,0)) ;
+      __m256 locY = _mm256_shuffle_ps(u0, u2, _MM_SHUFFLE(3,2,3,2)) ;
+      __m256 locW = _mm256_shuffle_ps(u1, u3, _MM_SHUFFLE(1,0,1,0)) ;
+      __m256 locH = _mm256_shuffle_ps(u1, u3, _MM_SHUFFLE(3,2,3,2)) ;
+      __m256 w = _mm256_loadu_ps(width + p) ;
+      __m256 h = _mm256_loadu_ps(height + p) ;
+      __m256 cx = _mm256_add_ps(_mm256_mul_ps(_mm256_mul_ps(_mm256_loadu_ps(var0 + p), locX), w),
+                                _mm256_loadu_ps(centerX + p)) ;
+      __m256 cy = _mm256_add_ps(_mm256_mul_ps(_mm256_mul_ps(_mm256_loadu_ps(var1 + p), locY), h),
+                                _mm256_loadu_ps(centerY + p)) ;
+      __m256 hw = _mm256_mul_ps(_mm256_mul_ps(fastExp(_mm256_mul_ps(_mm256_loadu_ps(var2 + p), locW)), w), half) ;
+      __m256 hh = _mm256_mul_ps(_mm256_mul_ps(fastExp(_mm256_mul_ps(_mm256_loadu_ps(var3 + p), locH)), h), half) ;
+      _mm256_storeu_ps(out.xmin + p, _mm256_sub_ps(cx, hw)) ;
+      _mm256_storeu_ps(out.ymin + p, _mm256_sub_ps(cy, hh)) ;
+      _mm256_storeu_ps(out.xmax + p, _mm256_add_ps(cx, hw)) ;
+      _mm256_storeu_ps(out.ymax + p, _mm256_add_ps(cy, hh)) ;
+    }
+    decodeBoxesScalar(table, locData, p, end, out) ;
+  }
+
+  inline bool hasAVX2()
+  {
+#if defined(__AVX2__)
+    return true ;
+#else
+    static const bool supported = __builtin_cpu_supports("avx2") ;
+    return supported ;
+#endif
+  }
+#endif
+
+  // Decode the location predictions of priors [begin, end) of a single
+  // image into `out`, using the widest instruction set available
+  template <typename T>
+  void decodeBoxes(PriorTable const &table,
+                   T const *locData,
+                   int begin,
+                   int end,
+                   DecodedBoxes const &out)
+  {
+    decodeBoxesScalar(table, locData, begin, end, out) ;
+  }
+
+  template <>
+  inline void decodeBoxes<float>(PriorTable const &table,
+                                 float const *locData,
+                                 int begin,
+                                 int end,
+                                 DecodedBoxes const &out)
+  {
+#ifdef VL_BOXDECODER_AVX2
+    if (hasAVX2()) {
+      decodeBoxesAVX2(table, locData, begin, end, out) ;
+      return ;
+    }
+#endif
+#ifdef VL_BOXDECODER_SSE2
+    decodeBoxesSSE2(table, locData, begin, end, out) ;
+#else
+    decodeBoxesScalar(table, locData, begin, end, out) ;
+#endif
+  }
+
+} }
+
+#endif /* defined(VL_BOXDECODER_H) */
@@ -0,0 +1,150 @@
+// @file detectioncache.hpp
+// @brief Memory mapped binary cache of detections
+// @author Samuel Albanie
+// @author Andrea Vedaldi
+
+/*
+Copyright (C) 2017- Samuel Albanie and Andrea Vedaldi.
+All rights reserved.
+
+This file is part of the VLFeat library and is made available under
+the terms of the BSD license (see the COPYING file).
+*/
+
+#ifndef VL_DETECTIONCACHE_H
+#define VL_DETECTIONCACHE_H
+
+#include <cstddef>
+#include <cstdio>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace vl { namespace impl {
+
+  // The layout of a cache file (version 1), in the byte order of the
+  // machine that wrote it:
+  //
+  //   header          a DetectionCacheHeader (64 bytes)
+  //   image data      for each image, its n detections as a column-major
+  //                   n x 6 float array [label score xmin ymin xmax ymax]
+  //                   (the rows of the detector output, without padding)
+  //   image index     numImages + 1 uint64 row offsets into image data
+  //   class index     numClasses + 1 uint64 row offsets into class data
+  //   class data      for each label 1, ..., numClasses, its m detections
+  //                   as a column-major m x 6 float array [image score
+  //                   xmin ymin xmax ymax] (1-based image indices), by
+  //                   descending score with ties in image and row order
+  //
+  // The image data is written as the batches are appended, and the rest
+  // when the writer finishes, after which the header is marked complete.
+  // All sections are 8-byte aligned, so that they can be used in place
+  // from a memory mapping of the file.
+  enum { DETECTION_CACHE_VERSION = 1 } ;
+
+  struct DetectionCacheHeader
+  {
+    char magic [8] ;
+    uint32_t version ;
+    uint32_t byteOrder ;
+    uint32_t numClasses ;
+    uint32_t complete ;
+    uint64_t numImages ;
+    uint64_t numDetections ;
+    uint64_t imageIndexOffset ;
+    uint64_t classIndexOffset ;
+    uint64_t classDataOffset ;
+  } ;
+
+  // Writes a cache file incrementally.  A file which is not finished
+  // (e.g. because the writer is destroyed first) is never marked complete
+  // and is rejected by DetectionCache.  Methods return false on failure,
+  // with a message in getLastError().
+  class DetectionCacheWriter
+  {
+  public:
+    DetectionCacheWriter() ;
+    ~DetectionCacheWriter() ;
+
+    bool open(std::string const &path, int numClasses) ;
+
+    // Append the detections of numImages images in the fixed size layout
+    // of the detector (a height x 6 x 1 x numImages array), skipping the
+    // padding rows (with a label below one)
+    bool append(float const *detections, size_t height, size_t numImages) ;
+
+    // Append the detections of numImages images in the compact layout of
+    // the detector (6 x M, with counts[i] records for image i)
+    bool appendCompact(float const *records, float const *counts,
+                       size_t numImages) ;
+
+    // Write the indices and the class sections and close the file
+    bool finish() ;
+
+    bool isOpen() const ;
+    size_t getNumImages() const ;
+    std::string const &getLastError() const ;
+
+  private:
+    bool writeImage(float const *rows, size_t stride, size_t numRows,
+                    bool compact) ;
+    bool fail(std::string const &message) ;
+    void abandon() ;
+
+    FILE *file ;
+    std::string path ;
+    int numClasses ;
+    std::vector<uint64_t> imageOffsets ;
+    std::vector<float> block ;
+    std::string lastError ;
+  } ;
+
+  // A read-only memory mapping of a complete cache file.  The detections
+  // of an image or of a class are returned in place, so only the pages
+  // which are used are read from disk.
+  class DetectionCache
+  {
+  public:
+    DetectionCache() ;
+    ~DetectionCache() ;
+
+    bool open(std::string const &path) ;
+    void close() ;
+
+    bool isOpen() const ;
+    int getNumClasses() const ;
+    size_t getNumImages() const ;
+    size_t getNumDetections() const ;
+
+    // The detections of an image (0-based), as a column-major n x 6
+    // [label score xmin ymin xmax ymax] array; returns n, or 0 (and a
+    // NULL array) if the cache has no such image
+    size_t getImageDetections(size_t image, float const **data) const ;
+
+    // The detections of a label (1-based), as a column-major m x 6
+    // [image score xmin ymin xmax ymax] array; returns m, or 0 (and a
+    // NULL array) if the cache has no such label
+    size_t getClassDetections(int label, float const **data) const ;
+
+    std::string const &getLastError() const ;
+
+  private:
+    bool fail(std::string const &message) ;
+
+    void *mapping ;
+    size_t size ;
+#ifdef _WIN32
+    void *fileHandle ;
+    void *mappingHandle ;
+#endif
+    DetectionCacheHeader const *header ;
+    uint64_t const *imageIndex ;
+    uint64_t const *classIndex ;
+    float const *imageData ;
+    float const *classData ;
+    std::string lastError ;
+  } ;
+
+} }
+
+#endif /* defined(VL_DETECTIONCACHE_H) */
@@ -0,0 +1,522 @@
+// @file detectioncache_cpu.cpp
+// @brief Memory mapped binary cache of detections
+// @author Samuel Albanie
+// @author Andrea Vedaldi
+
+/*
+Copyright (C) 2017- Samuel Albanie and Andrea Vedaldi.
+All rights reserved.
+
+This file is part of the VLFeat library and is made available under
+the terms of the BSD license (see the COPYING file).
+*/
+
+#include "detectioncache.hpp"
+#include <algorithm>
+#include <cstring>
+#include <sstream>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#endif
+
+using namespace vl::impl ;
+
+/* ------------------------------------------------------------ */
+/*                                                       useful */
+/* ------------------------------------------------------------ */
+
+static char const cacheMagic [8] = {'M','C','N','D','E','T','S','\0'} ;
+
+// Written in the byte order of the writer, to detect a foreign one
+static uint32_t const cacheByteOrder = 0x01020304 ;
+
+static bool seekTo(FILE *file, uint64_t offset)
+{
+#ifdef _WIN32
+  return _fseeki64(file, (__int64)offset, SEEK_SET) == 0 ;
+#else
+  return fseeko(file, (off_t)offset, SEEK_SET) == 0 ;
+#endif
+}
+
+// Descending score, ties broken by ascending (global) row
+static bool scoreRowDescend(std::pair<float, uint64_t> const &a,
+                            std::pair<float, uint64_t> const &b)
+{
+  return (a.first > b.first) || (a.first == b.first && a.second < b.second) ;
+}
+
+/* ------------------------------------------------------------ */
+/*                                         DetectionCacheWriter */
+/* ------------------------------------------------------------ */
+
+DetectionCacheWriter::DetectionCacheWriter()
+: file(NULL), numClasses(0)
+{ }
+
+DetectionCacheWriter::~DetectionCacheWriter()
+{
+  abandon() ;
+}
+
+bool DetectionCacheWriter::isOpen() const
+{
+  return file != NULL ;
+}
+
+size_t DetectionCacheWriter::getNumImages() const
+{
+  return imageOffsets.empty() ? 0 : imageOffsets.size() - 1 ;
+}
+
+std::string const & DetectionCacheWriter::getLastError() const
+{
+  return lastError ;
+}
+
+// Close the file without finishing it, leaving it incomplete
+void DetectionCacheWriter::abandon()
+{
+  if (file) {
+    fclose(file) ;
+    file = NULL ;
+  }
+}
+
+bool DetectionCacheWriter::fail(std::string const &message)
+{
+  lastError = message ;
+  abandon() ;
+  return false ;
+}
+
+bool DetectionCacheWriter::open(std::string const &path, int numClasses)
+{
+  abandon() ;
+  lastError.clear() ;
+  if (numClasses < 1) {
+    return fail("the number of classes must be positive") ;
+  }
+  file = fopen(path.c_str(), "w+b") ;
+  if (file == NULL) {
+    return fail("could not open " + path + " for writing") ;
+  }
+  this->path = path ;
+  this->numClasses = numClasses ;
+  imageOffsets.assign(1, 0) ;
+
+  DetectionCacheHeader header ;
+  memset(&header, 0, sizeof(header)) ;
+  memcpy(header.magic, cacheMagic, sizeof(cacheMagic)) ;
+  header.version = DETECTION_CACHE_VERSION ;
+  header.byteOrder = cacheByteOrder ;
+  header.numClasses = (uint32_t)numClasses ;
+  if (fwrite(&header, sizeof(header), 1, file) != 1) {
+    return fail("could not write to " + path) ;
+  }
+  return true ;
+}
+
+// Append an image whose element (r, j) is rows[r + stride * j] (the
+// fixed layout) or rows[6 * r + j] (the compact layout).  Rows with a
+// label below one (or NaN) are padding; the other labels must be class
+// numbers, as finish() uses them as indices.
+bool DetectionCacheWriter::writeImage(float const *rows, size_t stride,
+                                      size_t numRows, bool compact)
+{
+  size_t n = 0 ;
+  for (size_t r = 0 ; r < numRows ; ++r) {
+    float label = compact ? rows[6 * r] : rows[r] ;
+    if (!(label >= 1)) { continue ; }
+    if (label > numClasses) {
+      std::ostringstream msg ;
+      msg << "a detection has label " << label << ", but there are only "
+          << numClasses << " classes" ;
+      return fail(msg.str()) ;
+    }
+    if (label != (float)(int)label) {
+      std::ostringstream msg ;
+      msg << "a detection has label " << label << ", which is not an integer" ;
+      return fail(msg.str()) ;
+    }
+    ++ n ;
+  }
+  block.resize(6 * n) ;
+  size_t k = 0 ;
+  for (size_t r = 0 ; r < numRows ; ++r) {
+    float label = compact ? rows[6 * r] : rows[r] ;
+    if (!(label >= 1)) { continue ; }
+    for (size_t j = 0 ; j < 6 ; ++j) {
+      block[k + n * j] = compact ? rows[6 * r + j] : rows[r + stride * j] ;
+    }
+    ++ k ;
+  }
+  if (n > 0 && fwrite(&block[0], sizeof(float), 6 * n, file) != 6 * n) {
+    return fail("could not write to " + path) ;
+  }
+  imageOffsets.push_back(imageOffsets.back() + n) ;
+  return true ;
+}
+
+bool DetectionCacheWriter::append(float const *detections, size_t height,
+                                  size_t numImages)
+{
+  if (!isOpen()) {
+    return fail("the cache is not open") ;
+  }
+  for (size_t i = 0 ; i < numImages ; ++i) {
+    if (!writeImage(detections + 6 * height * i, height, height, false)) {
+      return false ;
+    }
+  }
+  return true ;
+}
+
+bool DetectionCacheWriter::appendCompact(float const *records,
+                                         float const *counts,
+                                         size_t numImages)
+{
+  if (!isOpen()) {
+    return fail("the cache is not open") ;
+  }
+  size_t offset = 0 ;
+  for (size_t i = 0 ; i < numImages ; ++i) {
+    if (!(counts[i] >= 0)) {
+      return fail("the detection counts must be non-negative") ;
+    }
+    size_t count = (size_t)counts[i] ;
+    if (!writeImage(records + 6 * offset, 0, count, true)) {
+      return false ;
+    }
+    offset += count ;
+  }
+  return true ;
+}
+
+bool DetectionCacheWriter::finish()
+{
+  if (!isOpen()) {
+    return fail("the cache is not open") ;
+  }
+  size_t numImages = imageOffsets.size() - 1 ;
+  uint64_t numDetections = imageOffsets.back() ;
+  uint64_t imageIndexOffset = sizeof(DetectionCacheHeader)
+    + 6 * sizeof(float) * numDetections ;
+  uint64_t classIndexOffset = imageIndexOffset
+    + sizeof(uint64_t) * (numImages + 1) ;
+  uint64_t classDataOffset = classIndexOffset
+    + sizeof(uint64_t) * (numClasses + 1) ;
+
+  if (fwrite(&imageOffsets[0], sizeof(uint64_t), numImages + 1, file)
+      != numImages + 1) {
+    return fail("could not write to " + path) ;
+  }
+
+  // The class sections need all the detections of a class, so the image
+  // data is read back once, here, rather than kept in memory while the
+  // batches are appended
+  std::vector<float> data(6 * numDetections) ;
+  if (fflush(file) != 0 || !seekTo(file, sizeof(DetectionCacheHeader))) {
+    return fail("could not read back " + path) ;
+  }
+  if (numDetections > 0 &&
+      fread(&data[0], sizeof(float), data.size(), file) != data.size()) {
+    return fail("could not read back " + path) ;
+  }
+
+  // Bucket the detections by label in (image, row) order, and rank the
+  // bucket of each label
+  std::vector<uint64_t> classOffsets(numClasses + 1, 0) ;
+  for (size_t i = 0 ; i < numImages ; ++i) {
+    float const *dets = data.data() + 6 * imageOffsets[i] ;
+    size_t n = imageOffsets[i+1] - imageOffsets[i] ;
+    for (size_t r = 0 ; r < n ; ++r) {
+      classOffsets[(int)dets[r]] ++ ;
+    }
+  }
+  for (int c = 0 ; c < numClasses ; ++c) {
+    classOffsets[c + 1] += classOffsets[c] ;
+  }
+  std::vector<std::pair<float, uint64_t> > ranked (numDetections) ;
+  std::vector<uint32_t> rowImages (numDetections) ;
+  {
+    std::vector<uint64_t> next (classOffsets.begin(), classOffsets.end() - 1) ;
+    for (size_t i = 0 ; i < numImages ; ++i) {
+      float const *dets = data.data() + 6 * imageOffsets[i] ;
+      size_t n = imageOffsets[i+1] - imageOffsets[i] ;
+      for (size_t r = 0 ; r < n ; ++r) {
+        uint64_t row = imageOffsets[i] + r ;
+        ranked[next[(int)dets[r] - 1] ++] =
+          std::pair<float, uint64_t>(dets[r + n], row) ;
+        rowImages[row] = (uint32_t)i ;
+      }
+    }
+  }
+  std::vector<float> classData (6 * numDetections) ;
+  for (int c = 0 ; c < numClasses ; ++c) {
+    uint64_t begin = classOffsets[c] ;
+    uint64_t m = classOffsets[c + 1] - begin ;
+    std::sort(ranked.begin() + begin, ranked.begin() + begin + m,
+              scoreRowDescend) ;
+    float *out = classData.data() + 6 * begin ;
+    for (uint64_t k = 0 ; k < m ; ++k) {
+      uint64_t row = ranked[begin + k].second ;
+      size_t i = rowImages[row] ;
+      float const *dets = data.data() + 6 * imageOffsets[i] ;
+      size_t n = imageOffsets[i+1] - imageOffsets[i] ;
+      size_t r = row - imageOffsets[i] ;
+      out[k] = (float)(i + 1) ;
+      for (size_t j = 1 ; j < 6 ; ++j) {
+        out[k + m * j] = dets[r + n * j] ;
+      }
+    }
+  }
+
+  DetectionCacheHeader header ;
+  memset(&header, 0, sizeof(header)) ;
+  memcpy(header.magic, cacheMagic, sizeof(cacheMagic)) ;
+  header.version = DETECTION_CACHE_VERSION ;
+  header.byteOrder = cacheByteOrder ;
+  header.numClasses = (uint32_t)numClasses ;
+  header.numImages = numImages ;
+  header.numDetections = numDetections ;
+  header.imageIndexOffset = imageIndexOffset ;
+  header.classIndexOffset = classIndexOffset ;
+  header.classDataOffset = classDataOffset ;
+
+  // The header is marked complete last, once everything else is written
+  if (!seekTo(file, classIndexOffset) ||
+      fwrite(&classOffsets[0], sizeof(uint64_t), numClasses + 1, file)
+      != (size_t)numClasses + 1 ||
+      (numDetections > 0 &&
+       fwrite(&classData[0], sizeof(float), classData.size(), file)
+       != classData.size()) ||
+      fflush(file) != 0) {
+    return fail("could not write to " + path) ;
+  }
+  header.complete = 1 ;
+  if (!seekTo(file, 0) ||
+      fwrite(&header, sizeof(header), 1, file) != 1) {
+    return fail("could not write to " + path) ;
+  }
+  int status = fclose(file) ;
+  file = NULL ;
+  if (status != 0) {
+    return fail("could not write to " + path) ;
+  }
+  return true ;
+}
+
+/* ------------------------------------------------------------ */
+/*                                               DetectionCache */
+/* ------------------------------------------------------------ */
+
+DetectionCache::DetectionCache()
+: mapping(NULL), size(0),
+#ifdef _WIN32
+  fileHandle(NULL), mappingHandle(NULL),
+#endif
+  header(NULL), imageIndex(NULL), classIndex(NULL),
+  imageData(NULL), classData(NULL)
+{ }
+
+DetectionCache::~DetectionCache()
+{
+  close() ;
+}
+
+bool DetectionCache::isOpen() const
+{
+  return header != NULL ;
+}
+
+int DetectionCache::getNumClasses() const
+{
+  return header ? (int)header->numClasses : 0 ;
+}
+
+size_t DetectionCache::getNumImages() const
+{
+  return header ? (size_t)header->numImages : 0 ;
+}
+
+size_t DetectionCache::getNumDetections() const
+{
+  return header ? (size_t)header->numDetections : 0 ;
+}
+
+std::string const & DetectionCache::getLastError() const
+{
+  return lastError ;
+}
+
+size_t DetectionCache::getImageDetections(size_t image,
+                                          float const **data) const
+{
+  if (!header || image >= header->numImages) {
+    *data = NULL ;
+    return 0 ;
+  }
+  *data = imageData + 6 * imageIndex[image] ;
+  return (size_t)(imageIndex[image + 1] - imageIndex[image]) ;
+}
+
+size_t DetectionCache::getClassDetections(int label,
+                                          float const **data) const
+{
+  if (!header || label < 1 || (uint32_t)label > header->numClasses) {
+    *data = NULL ;
+    return 0 ;
+  }
+  *data = classData + 6 * classIndex[label - 1] ;
+  return (size_t)(classIndex[label] - classIndex[label - 1]) ;
+}
+
+void DetectionCache::close()
+{
+#ifdef _WIN32
+  if (mapping) { UnmapViewOfFile(mapping) ; }
+  if (mappingHandle) { CloseHandle((HANDLE)mappingHandle) ; }
+  if (fileHandle) { CloseHandle((HANDLE)fileHandle) ; }
+  fileHandle = NULL ;
+  mappingHandle = NULL ;
+#else
+  if (mapping) { munmap(mapping, size) ; }
+#endif
+  mapping = NULL ;
+  size = 0 ;
+  header = NULL ;
+  imageIndex = NULL ;
+  classIndex = NULL ;
+  imageData = NULL ;
+  classData = NULL ;
+}
+
+bool DetectionCache::fail(std::string const &message)
+{
+  lastError = message ;
+  close() ;
+  return false ;
+}
+
+// Check that an index is a monotonic sequence from zero to total
+static bool isValidIndex(uint64_t const *index, uint64_t length,
+                         uint64_t total)
+{
+  if (index[0] != 0 || index[length - 1] != total) { return false ; }
+  for (uint64_t k = 1 ; k < length ; ++k) {
+    if (index[k] < index[k - 1]) { return false ; }
+  }
+  return true ;
+}
+
+bool DetectionCache::open(std::string const &path)
+{
+  close() ;
+  lastError.clear() ;
+
+#ifdef _WIN32
+  HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ,
+                            NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL,
+                            NULL) ;
+  if (file == INVALID_HANDLE_VALUE) {
+    return fail("could not open " + path) ;
+  }
+  fileHandle = file ;
+  LARGE_INTEGER fileSize ;
+  if (!GetFileSizeEx(file, &fileSize)) {
+    return fail("could not open " + path) ;
+  }
+  size = (size_t)fileSize.QuadPart ;
+  if (size < sizeof(DetectionCacheHeader)) {
+    return fail(path + " is not a detection cache (it is too short)") ;
+  }
+  mappingHandle = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL) ;
+  if (mappingHandle == NULL) {
+    return fail("could not map " + path) ;
+  }
+  mapping = MapViewOfFile((HANDLE)mappingHandle, FILE_MAP_READ, 0, 0, 0) ;
+  if (mapping == NULL) {
+    return fail("could not map " + path) ;
+  }
+#else
+  int fd = ::open(path.c_str(), O_RDONLY) ;
+  if (fd < 0) {
+    return fail("could not open " + path) ;
+  }
+  struct stat st ;
+  if (fstat(fd, &st) != 0) {
+    ::close(fd) ;
+    return fail("could not open " + path) ;
+  }
+  if ((size_t)st.st_size < sizeof(DetectionCacheHeader)) {
+    ::close(fd) ;
+    return fail(path + " is not a detection cache (it is too short)") ;
+  }
+  size = (size_t)st.st_size ;
+  void *address = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0) ;
+  ::close(fd) ;
+  if (address == MAP_FAILED) {
+    size = 0 ;
+    return fail("could not map " + path) ;
+  }
+  mapping = address ;
+#endif
+
+  DetectionCacheHeader const *h = (DetectionCacheHeader const*)mapping ;
+  if (memcmp(h->magic, cacheMagic, sizeof(cacheMagic)) != 0) {
+    return fail(path + " is not a detection cache") ;
+  }
+  if (h->byteOrder != cacheByteOrder) {
+    return fail(path + " was written with a different byte order") ;
+  }
+  if (h->version != DETECTION_CACHE_VERSION) {
+    std::ostringstream msg ;
+    msg << path << " has version " << h->version
+        << ", but version " << (int)DETECTION_CACHE_VERSION
+        << " is supported" ;
+    return fail(msg.str()) ;
+  }
+  if (!h->complete) {
+    return fail(path + " is incomplete (it was not finished)") ;
+  }
+
+  // Check the layout before trusting any offset
+  uint64_t const recordSize = 6 * sizeof(float) ;
+  bool valid =
+    h->numClasses > 0 &&
+    h->numDetections <= size / recordSize &&
+    h->numImages < size / sizeof(uint64_t) &&
+    h->imageIndexOffset == sizeof(DetectionCacheHeader)
+      + recordSize * h->numDetections &&
+    h->classIndexOffset == h->imageIndexOffset
+      + sizeof(uint64_t) * (h->numImages + 1) &&
+    h->classDataOffset == h->classIndexOffset
+      + sizeof(uint64_t) * ((uint64_t)h->numClasses + 1) &&
+    (uint64_t)size == h->classDataOffset + recordSize * h->numDetections ;
+  if (!valid) {
+    return fail(path + " is corrupted (its sections are inconsistent)") ;
+  }
+  char const *base = (char const*)mapping ;
+  imageIndex = (uint64_t const*)(base + h->imageIndexOffset) ;
+  classIndex = (uint64_t const*)(base + h->classIndexOffset) ;
+  if (!isValidIndex(imageIndex, h->numImages + 1, h->numDetections) ||
+      !isValidIndex(classIndex, (uint64_t)h->numClasses + 1,
+                    h->numDetections)) {
+    return fail(path + " is corrupted (its indices are inconsistent)") ;
+  }
+  imageData = (float const*)(base + sizeof(DetectionCacheHeader)) ;
+  classData = (float const*)(base + h->classDataOffset) ;
+  header = h ;
+  return true ;
+}
@@ -0,0 +1,108 @@
+// @file detectioneval.hpp
+// @brief Detection evaluation (VOC and COCO average precision)
+// @author Samuel Albanie
+// @author Andrea Vedaldi
+
+/*
+Copyright (C) 2017- Samuel Albanie and Andrea Vedaldi.
+All rights reserved.
+
+This file is part of the VLFeat library and is made available under
+the terms of the BSD license (see the COPYING file).
+*/
+
+#ifndef VL_DETECTIONEVAL_H
+#define VL_DETECTIONEVAL_H
+
+#include <vector>
+
+namespace vl { namespace impl {
+
+  // The average precision measures.  The VOC measures follow the
+  // VOCevaldet code of the devkit: a detection is matched to the ground
+  // truth box it overlaps most, and is ignored if that box is difficult
+  // (VOC07 averages the interpolated precision at 11 recall levels, VOC12
+  // integrates it over all the recall levels).  COCO follows the
+  // evaluateImg and accumulate methods of the COCO API (area range 'all'):
+  // a detection is matched to the best overlapping box which is not yet
+  // matched, preferring boxes which are not crowds, the overlap with a
+  // crowd is measured relative to the area of the detection, and the
+  // interpolated precision is averaged at 101 recall levels.
+  enum APMetric
+  {
+    AP_VOC07 = 0,
+    AP_VOC12,
+    AP_COCO
+  } ;
+
+  struct DetectionEvalOptions
+  {
+    APMetric metric ;
+
+    // The IoU thresholds at which a detection is a true positive (VOC
+    // requires an overlap of at least the threshold, and so does COCO)
+    std::vector<double> iouThresholds ;
+
+    // The maximum number of detections of each class kept for each image
+    // (the highest scoring ones), or -1 for no limit
+    int maxDetections ;
+
+    // If true, boxes are in inclusive pixel coordinates, so that widths
+    // and heights are xmax - xmin + 1 (as in the VOC devkit)
+    bool pixelCoordinates ;
+
+    // If true, the detected boxes are clipped to [0, 1] (the extent of
+    // the image in normalised coordinates) before they are matched
+    bool clipBoxes ;
+
+    // A non-positive value selects the number of hardware threads
+    int numThreads ;
+
+    DetectionEvalOptions() ;
+  } ;
+
+  // The detections and the ground truth of an image.  The detections are
+  // the rows of a column-major numDetections x 6 [label score xmin ymin
+  // xmax ymax] array, such as the fixed size output of the multibox
+  // detector for this image (rows with a label below one are padding).
+  // The ground truth boxes are the rows of a column-major numObjects x 4
+  // [xmin ymin xmax ymax] array, with their labels and (if not NULL) their
+  // difficult (VOC) or crowd (COCO) flags.
+  struct DetectionEvalImage
+  {
+    float const *detections ;
+    int numDetections ;
+    float const *boxes ;
+    float const *labels ;
+    unsigned char const *flags ;
+    int numObjects ;
+  } ;
+
+  struct DetectionEvalResult
+  {
+    // numClasses x numThresholds (column-major): the average precision of
+    // the labels 1, ..., numClasses, or NaN for a label without (non
+    // difficult, non crowd) ground truth boxes
+    std::vector<double> ap ;
+
+    // the number of (non difficult, non crowd) ground truth boxes of each
+    // label
+    std::vector<int> numPositives ;
+  } ;
+
+  // Evaluate the detections of a set of images.  The detections of each
+  // image are matched to its ground truth in parallel, and the precision
+  // recall curves of the classes are then computed in parallel.  The
+  // detections of a class are ranked by descending score, with ties
+  // broken by image and then row order, as the stable sorts of the MATLAB
+  // and COCO code do, so the result does not depend on the number of
+  // threads.
+  void evaluateDetections(DetectionEvalImage const *images,
+                          int numImages,
+                          int numClasses,
+                          DetectionEvalOptions const &options,
+                          DetectionEvalResult *result) ;
+
+} }
+
+#endif /* defined(VL_DETECTIONEVAL_H) */
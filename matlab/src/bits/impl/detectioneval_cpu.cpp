@@ -0,0 +1,385 @@
+// @file detectioneval_cpu.cpp
+// @brief Detection evaluation (VOC and COCO average precision)
+// @author Samuel Albanie
+// @author Andrea Vedaldi
+
+/*
+Copyright (C) 2017- Samuel Albanie and Andrea Vedaldi.
+All rights reserved.
+
+This file is part of the VLFeat library and is made available under
+the terms of the BSD license (see the COPYING file).
+*/
+
+#include "detectioneval.hpp"
+#include "parallel.hpp"
+#include <algorithm>
+#include <float.h>
+#include <limits>
+
+using namespace vl::impl ;
+
+/* ------------------------------------------------------------ */
+/*                                                       useful */
+/* ------------------------------------------------------------ */
+
+enum {
+  STATUS_FALSE_POSITIVE = 0,
+  STATUS_TRUE_POSITIVE,
+  STATUS_IGNORED
+} ;
+
+// The matched detections of an image, grouped by label.  The k-th ranked
+// detection of label c is at classOffsets[c - 1] + k and its status at
+// the t-th IoU threshold is status[numThresholds * (classOffsets[c - 1]
+// + k) + t].
+struct ImageMatches
+{
+  std::vector<int> classOffsets ;
+  std::vector<float> scores ;
+  std::vector<unsigned char> status ;
+  std::vector<int> numPositives ;
+} ;
+
+// Per-worker scratch space
+struct EvalScratch
+{
+  std::vector<int> detOffsets ;
+  std::vector<std::pair<float, int> > dets ;
+  std::vector<int> objectOffsets ;
+  std::vector<int> objects ;
+  std::vector<double> overlaps ;
+  std::vector<int> matches ;
+  std::vector<std::pair<float, int> > ranked ;
+  std::vector<unsigned char const*> rankedStatus ;
+  std::vector<double> recall ;
+  std::vector<double> precision ;
+} ;
+
+// Descending score, ties broken by ascending index (a stable sort)
+static bool scoreIndexDescend(std::pair<float, int> const &a,
+                              std::pair<float, int> const &b)
+{
+  return (a.first > b.first) || (a.first == b.first && a.second < b.second) ;
+}
+
+// The overlap of a detection with a ground truth box, measured relative
+// to the area of the detection for a crowd.  `one` is added to the widths
+// and heights of boxes in pixel coordinates.
+static double overlap(double const *det, double const *box, bool crowd,
+                      double one)
+{
+  double iw = std::min(det[2], box[2]) - std::max(det[0], box[0]) + one ;
+  double ih = std::min(det[3], box[3]) - std::max(det[1], box[1]) + one ;
+  if (iw <= 0 || ih <= 0) {
+    return 0 ;
+  }
+  double intersection = iw * ih ;
+  double detArea = (det[2] - det[0] + one) * (det[3] - det[1] + one) ;
+  if (crowd) {
+    return intersection / detArea ;
+  }
+  double boxArea = (box[2] - box[0] + one) * (box[3] - box[1] + one) ;
+  return intersection / (detArea + boxArea - intersection) ;
+}
+
+// Gather the detections and the ground truth of an image by label and
+// match them at every threshold
+static void matchImage(DetectionEvalImage const &image,
+                       int numClasses,
+                       DetectionEvalOptions const &options,
+                       EvalScratch &ws,
+                       ImageMatches *matches)
+{
+  const int numThresholds = options.iouThresholds.size() ;
+  const bool coco = (options.metric == AP_COCO) ;
+  const double one = options.pixelCoordinates ? 1 : 0 ;
+  float const *rows = image.detections ;
+  const int height = image.numDetections ;
+
+  // bucket the detections by label (in row order) and rank each bucket
+  ws.detOffsets.assign(numClasses + 1, 0) ;
+  for (int r = 0 ; r < height ; ++r) {
+    const float label = rows[r] ;
+    if (label >= 1 && label <= numClasses && rows[height + r] == rows[height + r]) {
+      ws.detOffsets[(int)label]++ ;
+    }
+  }
+  for (int c = 0 ; c < numClasses ; ++c) {
+    ws.detOffsets[c + 1] += ws.detOffsets[c] ;
+  }
+  ws.dets.resize(ws.detOffsets[numClasses]) ;
+  for (int r = 0 ; r < height ; ++r) {
+    const float label = rows[r] ;
+    if (label >= 1 && label <= numClasses && rows[height + r] == rows[height + r]) {
+      ws.dets[ws.detOffsets[(int)label - 1]++] = std::make_pair(rows[height + r], r) ;
+    }
+  }
+  for (int c = numClasses ; c > 0 ; --c) {
+    ws.detOffsets[c] = ws.detOffsets[c - 1] ;
+  }
+  ws.detOffsets[0] = 0 ;
+
+  // bucket the ground truth by label (in row order, and with the crowds
+  // last for COCO)
+  ws.objectOffsets.assign(numClasses + 1, 0) ;
+  matches->numPositives.assign(numClasses, 0) ;
+  for (int g = 0 ; g < image.numObjects ; ++g) {
+    const float label = image.labels[g] ;
+    if (label >= 1 && label <= numClasses) {
+      ws.objectOffsets[(int)label]++ ;
+      if (!(image.flags && image.flags[g])) {
+        matches->numPositives[(int)label - 1]++ ;
+      }
+    }
+  }
+  for (int c = 0 ; c < numClasses ; ++c) {
+    ws.objectOffsets[c + 1] += ws.objectOffsets[c] ;
+  }
+  ws.objects.resize(ws.objectOffsets[numClasses]) ;
+  for (int pass = 0 ; pass < (coco ? 2 : 1) ; ++pass) {
+    for (int g = 0 ; g < image.numObjects ; ++g) {
+      const float label = image.labels[g] ;
+      const bool flagged = image.flags && image.flags[g] ;
+      if (label >= 1 && label <= numClasses && (!coco || flagged == (pass == 1))) {
+        ws.objects[ws.objectOffsets[(int)label - 1]++] = g ;
+      }
+    }
+  }
+  for (int c = numClasses ; c > 0 ; --c) {
+    ws.objectOffsets[c] = ws.objectOffsets[c - 1] ;
+  }
+  ws.objectOffsets[0] = 0 ;
+
+  // rank and match the detections of each label
+  matches->classOffsets.assign(numClasses + 1, 0) ;
+  matches->scores.clear() ;
+  matches->status.clear() ;
+  for (int c = 0 ; c < numClasses ; ++c) {
+    std::pair<float, int> *dets = ws.dets.data() + ws.detOffsets[c] ;
+    int numDets = ws.detOffsets[c + 1] - ws.detOffsets[c] ;
+    std::sort(dets, dets + numDets, scoreIndexDescend) ;
+    if (options.maxDetections > -1) {
+      numDets = std::min(numDets, options.maxDetections) ;
+    }
+    int const *objects = ws.objects.data() + ws.objectOffsets[c] ;
+    const int numObjects = ws.objectOffsets[c + 1] - ws.objectOffsets[c] ;
+
+    ws.overlaps.resize((size_t)numDets * numObjects) ;
+    for (int d = 0 ; d < numDets ; ++d) {
+      const int r = dets[d].second ;
+      double det [4] = {rows[2 * height + r], rows[3 * height + r],
+                        rows[4 * height + r], rows[5 * height + r]} ;
+      if (options.clipBoxes) {
+        for (int k = 0 ; k < 4 ; ++k) {
+          det[k] = std::min(std::max(det[k], 0.0), 1.0) ;
+        }
+      }
+      for (int j = 0 ; j < numObjects ; ++j) {
+        const int g = objects[j] ;
+        const int n = image.numObjects ;
+        double box [4] = {image.boxes[g], image.boxes[n + g],
+                          image.boxes[2 * n + g], image.boxes[3 * n + g]} ;
+        const bool crowd = coco && image.flags && image.flags[g] ;
+        ws.overlaps[(size_t)numObjects * d + j] = overlap(det, box, crowd, one) ;
+      }
+    }
+
+    const size_t begin = matches->scores.size() ;
+    matches->classOffsets[c + 1] = begin + numDets ;
+    matches->status.resize((begin + numDets) * numThresholds) ;
+    for (int d = 0 ; d < numDets ; ++d) {
+      matches->scores.push_back(dets[d].first) ;
+    }
+    unsigned char *status = matches->status.data() + begin * numThresholds ;
+    ws.matches.assign((size_t)numObjects * numThresholds, -1) ;
+
+    if (!coco) {
+      // VOC: the detection is matched to the box it overlaps most, which
+      // may be difficult or already matched
+      for (int d = 0 ; d < numDets ; ++d) {
+        double maxOverlap = -std::numeric_limits<double>::infinity() ;
+        int best = -1 ;
+        for (int j = 0 ; j < numObjects ; ++j) {
+          if (ws.overlaps[(size_t)numObjects * d + j] > maxOverlap) {
+            maxOverlap = ws.overlaps[(size_t)numObjects * d + j] ;
+            best = j ;
+          }
+        }
+        for (int t = 0 ; t < numThresholds ; ++t) {
+          unsigned char &s = status[numThresholds * d + t] ;
+          s = STATUS_FALSE_POSITIVE ;
+          if (best < 0 || !(maxOverlap >= options.iouThresholds[t])) {
+            continue ;
+          }
+          if (image.flags && image.flags[objects[best]]) {
+            s = STATUS_IGNORED ;
+          } else if (ws.matches[numObjects * t + best] < 0) {
+            s = STATUS_TRUE_POSITIVE ;
+            ws.matches[numObjects * t + best] = d ;
+          }
+        }
+      }
+    } else {
+      // COCO: the detection is matched to the best overlapping box which is
+      // not yet matched (crowds can be matched repeatedly), stopping at the
+      // crowds if a box which is not a crowd was found
+      for (int t = 0 ; t < numThresholds ; ++t) {
+        int *matched = ws.matches.data() + numObjects * t ;
+        for (int d = 0 ; d < numDets ; ++d) {
+          double iou = std::min(options.iouThresholds[t], 1 - 1e-10) ;
+          int m = -1 ;
+          for (int j = 0 ; j < numObjects ; ++j) {
+            const bool crowd = image.flags && image.flags[objects[j]] ;
+            if (matched[j] >= 0 && !crowd) {
+              continue ;
+            }
+            if (m > -1 && !(image.flags && image.flags[objects[m]]) && crowd) {
+              break ;
+            }
+            if (ws.overlaps[(size_t)numObjects * d + j] < iou) {
+              continue ;
+            }
+            iou = ws.overlaps[(size_t)numObjects * d + j] ;
+            m = j ;
+          }
+          unsigned char &s = status[numThresholds * d + t] ;
+          if (m < 0) {
+            s = STATUS_FALSE_POSITIVE ;
+          } else {
+            s = (image.flags && image.flags[objects[m]]) ? STATUS_IGNORED
+                                                          : STATUS_TRUE_POSITIVE ;
+            matched[m] = d ;
+          }
+        }
+      }
+    }
+  }
+}
+
+// The average precision of a precision recall curve.  `precision` is
+// made monotonically decreasing (the interpolated precision) in place.
+static double averagePrecision(APMetric metric,
+                               std::vector<double> const &recall,
+                               std::vector<double> &precision)
+{
+  const int n = recall.size() ;
+  for (int i = n - 2 ; i >= 0 ; --i) {
+    precision[i] = std::max(precision[i], precision[i + 1]) ;
+  }
+  double ap = 0 ;
+  switch (metric) {
+    case AP_VOC07:
+      // the interpolated precision at recall 0, 0.1, ..., 1 (computed as
+      // MATLAB's 0:0.1:1 does, so that the fourth level is just above 0.3)
+      for (int k = 0 ; k <= 10 ; ++k) {
+        const double level = (k <= 5) ? k * 0.1 : 1 - (10 - k) * 0.1 ;
+        const int i = std::lower_bound(recall.begin(), recall.end(), level)
+                      - recall.begin() ;
+        ap += ((i < n) ? precision[i] : 0) / 11 ;
+      }
+      break ;
+
+    case AP_VOC12: {
+      // the area under the interpolated precision curve
+      double previous = 0 ;
+      for (int i = 0 ; i < n ; ++i) {
+        if (recall[i] != previous) {
+          ap += (recall[i] - previous) * precision[i] ;
+          previous = recall[i] ;
+        }
+      }
+      break ;
+    }
+
+    case AP_COCO:
+      // the interpolated precision at recall 0, 0.01, ..., 1 (computed as
+      // numpy.linspace does)
+      for (int k = 0 ; k <= 100 ; ++k) {
+        const double level = (k < 100) ? k * 0.01 : 1.0 ;
+        const int i = std::lower_bound(recall.begin(), recall.end(), level)
+                      - recall.begin() ;
+        ap += (i < n) ? precision[i] : 0 ;
+      }
+      ap /= 101 ;
+      break ;
+  }
+  return ap ;
+}
+
+/* ------------------------------------------------------------ */
+/*                                                   evaluation */
+/* ------------------------------------------------------------ */
+
+vl::impl::DetectionEvalOptions::DetectionEvalOptions()
+: metric(AP_VOC07),
+  iouThresholds(1, 0.5),
+  maxDetections(-1),
+  pixelCoordinates(false),
+  clipBoxes(false),
+  numThreads(1)
+{ }
+
+void
+vl::impl::evaluateDetections(DetectionEvalImage const *images,
+                             int numImages,
+                             int numClasses,
+                             DetectionEvalOptions const &options,
+                             DetectionEvalResult *result)
+{
+  const int numThresholds = options.iouThresholds.size() ;
+  const int numWorkers = getNumWorkers(options.numThreads,
+                                       std::max(numImages, numClasses)) ;
+  std::vector<EvalScratch> scratch(numWorkers) ;
+  std::vector<ImageMatches> matches(numImages) ;
+
+  // Match the detections of each image to its ground truth
+  parallelFor(numWorkers, numImages, [&](int i, int worker) {
+    matchImage(images[i], numClasses, options, scratch[worker], &matches[i]) ;
+  }) ;
+
+  // Rank the detections of each class over all images and compute the
+  // average precision at every threshold
+  result->ap.assign((size_t)numClasses * numThresholds, 0) ;
+  result->numPositives.assign(numClasses, 0) ;
+  parallelFor(numWorkers, numClasses, [&](int c, int worker) {
+    EvalScratch &ws = scratch[worker] ;
+    int numPositives = 0 ;
+    ws.ranked.clear() ;
+    ws.rankedStatus.clear() ;
+    for (int i = 0 ; i < numImages ; ++i) {
+      ImageMatches const &m = matches[i] ;
+      numPositives += m.numPositives[c] ;
+      for (int k = m.classOffsets[c] ; k < m.classOffsets[c + 1] ; ++k) {
+        ws.ranked.push_back(std::make_pair(m.scores[k], (int)ws.ranked.size())) ;
+        ws.rankedStatus.push_back(m.status.data() + (size_t)numThresholds * k) ;
+      }
+    }
+    std::sort(ws.ranked.begin(), ws.ranked.end(), scoreIndexDescend) ;
+    result->numPositives[c] = numPositives ;
+
+    for (int t = 0 ; t < numThresholds ; ++t) {
+      double &ap = result->ap[(size_t)numClasses * t + c] ;
+      if (numPositives == 0) {
+        ap = std::numeric_limits<double>::quiet_NaN() ;
+        continue ;
+      }
+      // ignored detections leave the curve unchanged, so they are skipped
+      double tp = 0 ;
+      double fp = 0 ;
+      ws.recall.clear() ;
+      ws.precision.clear() ;
+      for (int k = 0 ; k < ws.ranked.size() ; ++k) {
+        const unsigned char s = ws.rankedStatus[ws.ranked[k].second][t] ;
+        if (s == STATUS_IGNORED) {
+          continue ;
+        }
+        if (s == STATUS_TRUE_POSITIVE) { tp += 1 ; } else { fp += 1 ; }
+        ws.recall.push_back(tp / numPositives) ;
+        ws.precision.push_back((options.metric == AP_COCO) ?
+                               tp / (tp + fp + DBL_EPSILON) : tp / (tp + fp)) ;
+      }
+      ap = averagePrecision(options.metric, ws.recall, ws.precision) ;
+    }
+  }) ;
+}
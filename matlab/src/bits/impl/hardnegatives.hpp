@@ -0,0 +1,76 @@
+// @file hardnegatives.hpp
+// @brief Hard negative mining for the multibox loss
+// @author Samuel Albanie
+// @author Andrea Vedaldi
+
+/*
+Copyright (C) 2017- Samuel Albanie and Andrea Vedaldi.
+All rights reserved.
+
+This file is part of the VLFeat library and is made available under
+the terms of the BSD license (see the COPYING file).
+*/
+
+#ifndef VL_HARDNEGATIVES_H
+#define VL_HARDNEGATIVES_H
+
+#include <vector>
+
+namespace vl { namespace impl {
+
+  // The priors of an image which take part in mining: `positives` lists
+  // the (0-based) priors matched to a ground truth box and `ignored` the
+  // priors which may never be selected as negatives (e.g. those crossing
+  // the image boundary).  Both lists may contain repeated entries.
+  struct HardNegativeImage
+  {
+    int const *positives ;
+    int numPositives ;
+    int const *ignored ;
+    int numIgnored ;
+  } ;
+
+  // Select the hard negatives of an image, as done by
+  // matlab/utils/compute_hard_negs.m:
+  //
+  // 1. the background loss of every prior is computed as the softmax
+  //    cross-entropy of its scores against `backgroundLabel` (0-based),
+  //    i.e. logsumexp(x) - x(backgroundLabel)
+  // 2. the loss of the positive and ignored priors is set to -Inf
+  // 3. the numNeg = min(round(negPosRatio * numPositives),
+  //    numPriors - numPositives) priors with the largest loss are kept,
+  //    in order of decreasing loss (ties in order of increasing index,
+  //    and NaNs first, as by MATLAB's sort(..., 'descend'))
+  //
+  // Rather than sorting all the priors, the kept priors are found by
+  // partial selection and only they are sorted.  Bounds on the loss are
+  // used to skip the evaluation of the loss of priors which cannot be
+  // kept.  `confPreds` holds the numClasses scores of every prior
+  // (prior-major).
+  template <typename T>
+  void mineHardNegatives(T const *confPreds,
+                         int numPriors,
+                         int numClasses,
+                         int backgroundLabel,
+                         double negPosRatio,
+                         HardNegativeImage const &image,
+                         std::vector<int> *hardNegs) ;
+
+  // Mine the images of a batch on `numThreads` threads (a non-positive
+  // value selects the number of hardware threads).  The scores of image i
+  // start at confPreds + i * numPriors * numClasses.  The result does not
+  // depend on the number of threads.
+  template <typename T>
+  void mineHardNegativesBatch(T const *confPreds,
+                              int numPriors,
+                              int numClasses,
+                              int backgroundLabel,
+                              double negPosRatio,
+                              HardNegativeImage const *images,
+                              int batchSize,
+                              int numThreads,
+                              std::vector<int> *hardNegs) ;
+
+} }
+
+#endif /* defined(VL_HARDNEGATIVES_H) */
@@ -0,0 +1,197 @@
+// @file hardnegatives_cpu.cpp
+// @brief Hard negative mining CPU implementation (a native version of
+// matlab/utils/compute_hard_negs.m)
+// @author Samuel Albanie
+// @author Andrea Vedaldi
+
+/*
+Copyright (C) 2017- Samuel Albanie and Andrea Vedaldi.
+All rights reserved.
+
+This file is part of the VLFeat library and is made available under
+the terms of the BSD license (see the COPYING file).
+*/
+
+#include "hardnegatives.hpp"
+#include "parallel.hpp"
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <limits>
+#include <vector>
+
+/* ------------------------------------------------------------ */
+/*                                                       useful */
+/* ------------------------------------------------------------ */
+
+// The order of MATLAB's sort(loss, 'descend'): NaNs first, then by
+// decreasing loss, with ties in order of increasing index
+template<typename T>
+struct DescendingLoss
+{
+  T const *loss ;
+  DescendingLoss(T const *loss) : loss(loss) { }
+  bool operator() (int a, int b) const {
+    bool nanA = std::isnan(loss[a]) ;
+    bool nanB = std::isnan(loss[b]) ;
+    if (nanA != nanB) { return nanA ; }
+    if (!nanA && loss[a] != loss[b]) { return loss[a] > loss[b] ; }
+    return a < b ;
+  }
+} ;
+
+namespace vl { namespace impl {
+
+  template <typename T>
+  void mineHardNegatives(T const *confPreds,
+                         int numPriors,
+                         int numClasses,
+                         int backgroundLabel,
+                         double negPosRatio,
+                         HardNegativeImage const &image,
+                         std::vector<int> *hardNegs)
+  {
+    const T minusInf = -std::numeric_limits<T>::infinity() ;
+    const int numNeg = std::min((int)std::round(negPosRatio * image.numPositives),
+                                numPriors - image.numPositives) ;
+    hardNegs->clear() ;
+    if (numNeg <= 0) {
+      return ;
+    }
+
+    // positive and ignored priors have a loss of -Inf
+    std::vector<T> loss(numPriors, 0) ;
+    for (int k = 0 ; k < image.numPositives ; ++k) {
+      loss[image.positives[k]] = minusInf ;
+    }
+    for (int k = 0 ; k < image.numIgnored ; ++k) {
+      loss[image.ignored[k]] = minusInf ;
+    }
+
+    // With m and s the largest and second largest scores of a prior and
+    // e = exp(s - m), its loss is bounded by
+    //
+    //   m - x(bg) + log(1 + e) <= loss <= m - x(bg) + log(1 + (C - 1) e).
+    //
+    // Once the numNeg-th largest lower bound is known, the priors whose
+    // upper bound falls short of it cannot be selected, and their loss
+    // (C exponentials) need not be evaluated.  The bounds are widened to
+    // cover the rounding errors of the evaluation of the loss.  Priors
+    // with non-finite scores are always evaluated.
+    std::vector<int> candidates ;
+    std::vector<int> evaluated ;
+    std::vector<double> upper(numPriors) ;
+    std::vector<double> lower ;
+    candidates.reserve(numPriors) ;
+    lower.reserve(numPriors) ;
+    const double eps = 4 * (numClasses + 8) * std::numeric_limits<T>::epsilon() ;
+    for (int p = 0 ; p < numPriors ; ++p) {
+      if (loss[p] == minusInf) { continue ; }
+      T const *x = confPreds + (size_t)p * numClasses ;
+      T first = x[0] ;
+      T second = minusInf ;
+      bool finite = std::isfinite(x[0]) ;
+      for (int c = 1 ; c < numClasses ; ++c) {
+        if (x[c] > first) {
+          second = first ;
+          first = x[c] ;
+        } else if (x[c] > second) {
+          second = x[c] ;
+        }
+        finite &= (bool)std::isfinite(x[c]) ;
+      }
+      candidates.push_back(p) ;
+      if (finite) {
+        double e = std::exp((double)second - first) ;
+        double margin = (double)first - x[backgroundLabel] ;
+        double slack = eps * (std::abs((double)first) +
+                              std::abs((double)x[backgroundLabel]) + margin +
+                              std::log((double)numClasses) + 1) ;
+        lower.push_back(margin + std::log1p(e) - slack) ;
+        upper[p] = margin + std::log1p((numClasses - 1) * e) + slack ;
+      } else {
+        upper[p] = std::numeric_limits<double>::infinity() ;
+      }
+    }
+    if (numNeg < (int)lower.size()) {
+      std::nth_element(lower.begin(), lower.begin() + numNeg - 1,
+                       lower.end(), std::greater<double>()) ;
+      const double threshold = lower[numNeg - 1] ;
+      for (int k = 0 ; k < (int)candidates.size() ; ++k) {
+        if (upper[candidates[k]] >= threshold) {
+          evaluated.push_back(candidates[k]) ;
+        }
+      }
+    } else {
+      evaluated.swap(candidates) ;
+    }
+
+    // background loss, evaluated as in MATLAB
+    std::vector<int> ranked ;
+    ranked.reserve(evaluated.size()) ;
+    for (int k = 0 ; k < (int)evaluated.size() ; ++k) {
+      int p = evaluated[k] ;
+      T const *x = confPreds + (size_t)p * numClasses ;
+      T maxScore = x[0] ;
+      for (int c = 1 ; c < numClasses ; ++c) {
+        maxScore = std::max(maxScore, x[c]) ;
+      }
+      T sum = 0 ;
+      for (int c = 0 ; c < numClasses ; ++c) {
+        sum += std::exp(x[c] - maxScore) ;
+      }
+      loss[p] = maxScore + std::log(sum) - x[backgroundLabel] ;
+      if (loss[p] != minusInf) { ranked.push_back(p) ; }
+    }
+
+    // Priors with a loss of -Inf all come last, in order of increasing
+    // index, so only the others need to be ranked, and only the numNeg
+    // best of them need to be sorted.  (If priors were skipped, at least
+    // numNeg priors have a finite loss.)
+    DescendingLoss<T> before(loss.data()) ;
+    const int numRanked = std::min(numNeg, (int)ranked.size()) ;
+    if (numRanked < (int)ranked.size()) {
+      std::nth_element(ranked.begin(), ranked.begin() + numRanked,
+                       ranked.end(), before) ;
+    }
+    std::sort(ranked.begin(), ranked.begin() + numRanked, before) ;
+    hardNegs->assign(ranked.begin(), ranked.begin() + numRanked) ;
+    for (int p = 0 ; p < numPriors && (int)hardNegs->size() < numNeg ; ++p) {
+      if (loss[p] == minusInf) { hardNegs->push_back(p) ; }
+    }
+  }
+
+  template <typename T>
+  void mineHardNegativesBatch(T const *confPreds,
+                              int numPriors,
+                              int numClasses,
+                              int backgroundLabel,
+                              double negPosRatio,
+                              HardNegativeImage const *images,
+                              int batchSize,
+                              int numThreads,
+                              std::vector<int> *hardNegs)
+  {
+    const int numWorkers = getNumWorkers(numThreads, batchSize) ;
+    parallelFor(numWorkers, batchSize, [&](int i, int worker) {
+        mineHardNegatives(confPreds + (size_t)i * numPriors * numClasses,
+                          numPriors, numClasses, backgroundLabel,
+                          negPosRatio, images[i], &hardNegs[i]) ;
+    }) ;
+  }
+
+} } // namespace vl::impl
+
+template void vl::impl::mineHardNegatives<float>(float const *, int, int,
+    int, double, vl::impl::HardNegativeImage const &, std::vector<int> *) ;
+template void vl::impl::mineHardNegativesBatch<float>(float const *, int,
+    int, int, double, vl::impl::HardNegativeImage const *, int, int,
+    std::vector<int> *) ;
+
+#ifdef ENABLE_DOUBLE
+template void vl::impl::mineHardNegatives<double>(double const *, int, int,
+    int, double, vl::impl::HardNegativeImage const &, std::vector<int> *) ;
+template void vl::impl::mineHardNegativesBatch<double>(double const *, int,
+    int, int, double, vl::impl::HardNegativeImage const *, int, int,
+    std::vector<int> *) ;
+#endif
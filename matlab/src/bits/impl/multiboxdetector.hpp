@@ -15,17 +15,23 @@ the terms of the BSD license (see the COPYING file).
 #define VL_MULTIBOXDETECTOR_H
 
 #include <bits/data.hpp>
+#include "../nnmultiboxdetector.hpp"
 #include <cstddef>
 
 // defines the dispatcher for CUDA kernels:
 namespace vl { namespace impl {
 
+  class PriorCache ;
+  class MultiboxWorkspace ;
+  struct MultiboxStats ;
+
   template<vl::DeviceType dev, typename T>
   struct multiboxdetector {
 
     static vl::ErrorCode
     forward(Context& context,
             T* output,
+            T* counts,
             T const* locPreds,
             T const* confPreds,
             T const* priors,
@@ -35,10 +41,66 @@ namespace vl { namespace impl {
             float nmsThresh,
             float confThresh, 
             int backgroundLabel, 
+            MultiboxNMSMethod nmsMethod,
+            bool compact,
             size_t outHeight, 
             size_t outWidth, 
             size_t batchSize, 
-            size_t numPriors) ;
+            size_t numPriors,
+            int numThreads,
+            bool lazyDecode,
+            PriorCache *priorCache,
+            MultiboxWorkspace *workspace,
+            MultiboxStats *stats) ;
+
+    // For predictions in reduced precision (CPU only)
+    static vl::ErrorCode
+    forward(Context& context,
+            T* output,
+            T* counts,
+            MultiboxPreds const& locPreds,
+            MultiboxPreds const& confPreds,
+            T const* priors,
+            int nmsTopK,
+            int keepTopK,
+            int numClasses,
+            float nmsThresh,
+            float confThresh, 
+            int backgroundLabel, 
+            MultiboxNMSMethod nmsMethod,
+            bool compact,
+            size_t outHeight, 
+            size_t outWidth, 
+            size_t batchSize, 
+            size_t numPriors,
+            int numThreads,
+            bool lazyDecode,
+            PriorCache *priorCache,
+            MultiboxWorkspace *workspace,
+            MultiboxStats *stats) ;
+  } ;
+
+  // Merge the fixed size detections of an image batch computed at
+  // several scales (numInputs arrays of inputHeights[s] x 6 x 1 x
+  // batchSize), as core/ssd_evaluation.m does: the detections of each
+  // label are pooled across scales and suppressed by NMS, and the
+  // outHeight best ones are written to output in descending score order.
+  // Rows with a label below one are padding and are ignored.
+  template<vl::DeviceType dev, typename T>
+  struct multiboxmerge {
+
+    static vl::ErrorCode
+    forward(Context& context,
+            T* output,
+            T* counts,
+            T const* const* inputs,
+            size_t const* inputHeights,
+            size_t numInputs,
+            float nmsThresh,
+            size_t outHeight,
+            size_t batchSize,
+            int numThreads,
+            MultiboxWorkspace *workspace) ;
   } ;
 
 } }
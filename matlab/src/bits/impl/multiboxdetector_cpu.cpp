@@ -13,316 +13,717 @@ the terms of the BSD license (see the COPYING file).
 */
 
 #include "multiboxdetector.hpp"
+#include "boxdecoder.hpp"
+#include "priorcache.hpp"
+#include "multiboxstats.hpp"
+#include "multiboxworkspace.hpp"
+#include "nms.hpp"
+#include "parallel.hpp"
+#include "predformats.hpp"
+#include "topk.hpp"
 #include <bits/data.hpp>
 #include <assert.h>
 #include <float.h>
 #include <cstdio>
 #include <algorithm>
-#include <math.h>
 #include <string.h>
 
-#include <map>
 #include <vector>
 
 /* ------------------------------------------------------------ */
 /*                                                       useful */
 /* ------------------------------------------------------------ */
 
-template <typename T>
-bool sortScorePairDescend(const std::pair<float, T>& pairA,
-                          const std::pair<float, T>& pairB) {
-    return pairA.first > pairB.first ;
-}
-
-typedef struct NormalizedBox {
-    float xmin ;
-    float ymin ;
-    float xmax ;
-    float ymax ;
-    int label ;
-    bool difficult ;
-    float score ;
-    float size ;
-} NormalizedBox ;
-
-typedef std::vector<NormalizedBox> BoxVector ;
-typedef std::map<int, BoxVector> Label2BoxesMap ;
-typedef std::map<int, std::vector<float> > Label2ScoreMap ;
-typedef std::map<int, std::vector<int> > Label2PriorIndexMap ;
-typedef std::map<int, std::vector<int> >::iterator indexIter ;
-
-void getIntersection(const NormalizedBox &boxA, 
-                     const NormalizedBox &boxB,
-                     NormalizedBox* intersection) 
+// The detector works on flat, structure-of-arrays (SoA) buffers rather
+// than per-image maps of boxes and scores. Decoded boxes are stored as
+// four coordinate arrays indexed by prior, and the candidates which pass
+// the confidence threshold are stored class-major (CSR-style): the
+// candidates for class c occupy [classOffsets[c], classOffsets[c+1]) of
+// the flat score/prior arrays.  All buffers are sized once per call, so
+// there is no per-element heap traffic, and they are kept in a workspace
+// across calls (see multiboxworkspace.hpp), so that a call of a size seen
+// before does not allocate.  The decoding itself is done by 
+// the vectorised decoder in boxdecoder.hpp, against a table of prior 
+// geometry which is computed once per call (or taken from the cache).
+// The predictions are read through the readers of predformats.hpp, so
+// that those stored in reduced precision are only widened to float once
+// they are needed: scores when they pass the threshold, and location
+// offsets just before their boxes are decoded.
+
+typedef vl::impl::MultiboxCandidates Candidates ;
+
+// The largest foreground key of the scores of a prior.  The generic 
+// version skips the background class at runtime.  For a number of 
+// classes NumClasses fixed at compile time, with the background first 
+// (see getCandidates), the loop has fixed bounds and keeps LANES 
+// independent maxima, so that it is unrolled and vectorised rather than 
+// bound by the latency of a single chain of comparisons.
+template <int NumClasses, typename ConfPreds>
+struct ForegroundMax
 {
-    // The intersection is computed as a box
-    if (boxB.xmin > boxA.xmax || boxB.xmax < boxA.xmin ||
-        boxB.ymin > boxA.ymax || boxB.ymax < boxA.ymin) {
-      // Return [0, 0, 0, 0] if there is no intersection.
-      intersection->xmin = 0 ;
-      intersection->ymin = 0 ;
-      intersection->xmax = 0 ;
-      intersection->ymax = 0 ;
-    } else {
-      intersection->xmin = std::max(boxA.xmin, boxB.xmin) ;
-      intersection->ymin = std::max(boxA.ymin, boxB.ymin) ;
-      intersection->xmax = std::min(boxA.xmax, boxB.xmax) ;
-      intersection->ymax = std::min(boxA.ymax, boxB.ymax) ;
+    typedef typename ConfPreds::Key Key ;
+    enum { LANES = 8 } ;
+
+    static Key get(const ConfPreds &scores, int numClasses, int background)
+    {
+        Key best [LANES] ;
+        for (int j = 0 ; j < LANES ; ++j) {
+            best[j] = ConfPreds::lowestKey() ;
+        }
+        int c = 1 ;
+        for ( ; c + LANES <= NumClasses ; c += LANES) {
+            for (int j = 0 ; j < LANES ; ++j) {
+                best[j] = std::max(best[j], scores.key(c + j)) ;
+            }
+        }
+        for (int j = 0 ; c + j < NumClasses ; ++j) {
+            best[j] = std::max(best[j], scores.key(c + j)) ;
+        }
+        for (int j = 1 ; j < LANES ; ++j) {
+            best[0] = std::max(best[0], best[j]) ;
+        }
+        return best[0] ;
     }
-}
+} ;
 
-float getBoxSize(const NormalizedBox box) 
+template <typename ConfPreds>
+struct ForegroundMax<0, ConfPreds>
 {
-    float width = box.xmax - box.xmin ;
-    float height = box.ymax - box.ymin ;
-    if (width < 0 || height < 0) {
-        return 0 ;
-    } else {
-        return width * height ;
-    }
-}
+    typedef typename ConfPreds::Key Key ;
 
-void getMaxScoreIndex(const std::vector<float>& scores, 
-                      const float thresh,
-                      const int topK, 
-                      std::vector<std::pair<float, int>> *scoreIndexPairs) 
+    static Key get(const ConfPreds &scores, int numClasses, int background)
+    {
+        Key best = ConfPreds::lowestKey() ;
+        for (int c = 0 ; c < background ; ++c) {
+            best = std::max(best, scores.key(c)) ;
+        }
+        for (int c = background + 1 ; c < numClasses ; ++c) {
+            best = std::max(best, scores.key(c)) ;
+        }
+        return best ;
+    }
+} ;
+
+// Gather, for every foreground class, the priors whose score exceeds 
+// the confidence threshold. The confidences of a single image are stored 
+// prior-major ([c + p * numClasses]) so they are read in place and 
+// contiguously.  A first pass over all priors finds the (typically few) 
+// live priors whose best foreground score exceeds the threshold, and 
+// counts their candidates per class; only those are visited by the 
+// second pass, which fills the class-major buffers (in ascending prior 
+// order).
+// Scores are compared by their keys, in the precision of the predictions.
+//
+// If NumClasses is not zero, the kernel is specialised for that number 
+// of classes (which must equal numClasses) with the background as the 
+// first class: the strides and loop bounds are constants, the background 
+// is skipped by the loop bounds and the fill pointers are on the stack.
+template <int NumClasses, typename ConfPreds>
+void getCandidates(const ConfPreds &confData, 
+                   const int numPriors, 
+                   const int numClassesArg,
+                   const int backgroundLabel,
+                   const float confThresh,
+                   std::vector<int> &live,
+                   Candidates *candidates) 
 {
-    // generate index score pairs for sufficiently high scores
-    for (int i = 0; i < scores.size(); ++i) {
-        if (scores[i] > thresh) {
-            scoreIndexPairs->push_back(std::make_pair(scores[i], i)) ;
+    typedef typename ConfPreds::Key Key ;
+    const Key thresh = confData.thresholdKey(confThresh) ;
+    const int numClasses = NumClasses ? NumClasses : numClassesArg ;
+    const int firstClass = NumClasses ? 1 : 0 ;
+
+    // ignore background class (-1 for MATLAB offset)
+    const int background = NumClasses ? 0 : 
+                           (backgroundLabel >= 1 && 
+                            backgroundLabel <= numClasses) ? 
+                            backgroundLabel - 1 : numClasses ;
+    std::vector<int> &offsets = candidates->classOffsets ;
+    offsets.assign(numClasses + 1, 0) ;
+    int fixedCounts [NumClasses ? NumClasses : 1] = { 0 } ;
+    int *counts = NumClasses ? fixedCounts : offsets.data() + 1 ;
+    live.clear() ;
+    for (int p = 0 ; p < numPriors ; ++p) {
+        const ConfPreds scores = confData.offset(p * numClasses) ;
+        Key best = ForegroundMax<NumClasses, ConfPreds>::get(scores, 
+                                                             numClasses, 
+                                                             background) ;
+        if (best > thresh) {
+            // count the candidates while the scores are in the cache
+            live.push_back(p) ;
+            for (int c = firstClass ; c < numClasses ; ++c) {
+                counts[c] += (scores.key(c) > thresh) ;
+            }
         }
     }
-
-    // sort the score pair according to the scores in descending order
-    std::stable_sort(scoreIndexPairs->begin(), scoreIndexPairs->end(), 
-                                       sortScorePairDescend<int>) ;
-
-    //printf("num boxes after conf threshold: %d \n", scoreIndexPairs->size()) ;
-    // Keep top k scores if needed.
-    if (topK > -1 && topK < scoreIndexPairs->size()) {
-      scoreIndexPairs->resize(topK) ;
+    if (NumClasses) {
+        std::copy(fixedCounts, fixedCounts + numClasses, offsets.begin() + 1) ;
+    }
+    if (background < numClasses) {
+        offsets[background + 1] = 0 ;
+    }
+    for (int c = 0 ; c < numClasses ; ++c) {
+        offsets[c + 1] += offsets[c] ;
     }
-    //printf("num boxes after conf threshold & topk: %d \n", scoreIndexPairs->size()) ;
-}
 
-float jaccardOverlap(const NormalizedBox &boxA, 
-                     const NormalizedBox &boxB) 
-{
-    NormalizedBox intersection;
-    getIntersection(boxA, boxB, &intersection);
-    float width = intersection.xmax - intersection.xmin ;
-    float height = intersection.ymax - intersection.ymin ;
-    if (width > 0 && height > 0) {
-        float intersectArea = width * height;
-        float unionArea = getBoxSize(boxA) + getBoxSize(boxB) - intersectArea ;
-        return intersectArea / unionArea ;
-    } else {
-        return 0.;
+    int numCandidates = offsets[numClasses] ;
+    candidates->scores.resize(numCandidates) ;
+    candidates->priorIdx.resize(numCandidates) ;
+    int fixedFill [NumClasses ? NumClasses : 1] ;
+    std::vector<int> dynamicFill(NumClasses ? 0 : numClasses) ;
+    int *fill = NumClasses ? fixedFill : dynamicFill.data() ;
+    std::copy(offsets.begin(), offsets.end() - 1, fill) ;
+    for (int l = 0 ; l < live.size() ; ++l) {
+        const int p = live[l] ;
+        const ConfPreds scores = confData.offset(p * numClasses) ;
+        for (int c = firstClass ; c < numClasses ; ++c) {
+            if (scores.key(c) > thresh && c != background) {
+                candidates->scores[fill[c]] = scores.value(c) ;
+                candidates->priorIdx[fill[c]] = p ;
+                fill[c]++ ;
+            }
+        }
     }
 }
 
-void applyFastNMS(const BoxVector &boxes,
-                  const std::vector<float>& scores, 
-                  const float confThresh,
-                  const float nmsThresh, 
-                  const int keepTopK,
-                  std::vector<int> *indices) 
+// The candidate kernel for numClasses and backgroundLabel: one of the
+// kernels specialised for the standard models (PASCAL VOC with 21 
+// classes and COCO with 81, with the background first), or the generic 
+// kernel otherwise.
+template <typename ConfPreds>
+struct CandidateKernel
 {
-    assert(boxes.size() == scores.size()) ;
+    typedef void (*Type)(const ConfPreds &, const int, const int, 
+                         const int, const float, std::vector<int> &,
+                         Candidates *) ;
 
-    // retrieve top k scores (with corresponding indices).
-    std::vector<std::pair<float, int>> scoreIndexPairs ;
-    getMaxScoreIndex(scores, confThresh, keepTopK, &scoreIndexPairs) ;
-
-    // run the nms - note we don't use adaptive NMS here
-    int eta = 1 ;
-    float adaptiveThresh = nmsThresh ;
-    int numBoxes = boxes.size() ;
-    //printf("num boxes total %d \n", numBoxes) ;
-    //printf("num filtered boxes after thresh %d \n", scoreIndexPairs.size()) ;
-    indices->clear() ;
-    while (scoreIndexPairs.size() != 0) {
-        const int idx = scoreIndexPairs.front().second ;
-        bool keep = true ;
-        for (int k = 0 ; k < indices->size() ; ++k) {
-            if (keep) {
-                const int keptIdx = (*indices)[k] ;
-                float overlap = jaccardOverlap(boxes[idx], boxes[keptIdx]) ;
-                //printf("overlap: %f \n", overlap) ;
-                keep = overlap <= adaptiveThresh ;
-            } else {
-                break ;
+    static Type select(int numClasses, int backgroundLabel)
+    {
+        if (backgroundLabel == 1) {
+            switch (numClasses) {
+                case 21 : return &getCandidates<21, ConfPreds> ;
+                case 81 : return &getCandidates<81, ConfPreds> ;
+                default : break ;
             }
         }
-        if (keep) {
-            indices->push_back(idx) ;
-        }
-        scoreIndexPairs.erase(scoreIndexPairs.begin()) ;
-        if (keep && eta < 1 && adaptiveThresh > 0.5) {
-            adaptiveThresh *= eta ;
-        }
+        return &getCandidates<0, ConfPreds> ;
+    }
+} ;
+
+// Rank the candidates of a single class in descending order of score 
+// (ties are broken by prior index, as for a stable sort) and keep the 
+// top k (by partial selection).  The prior indices of the ranked 
+// candidates are written to `order`.
+void rankCandidates(const float* scores, 
+                    const int* priorIdx, 
+                    const int numCandidates,
+                    const int topK,
+                    std::vector<std::pair<float, int> > &scoreIndexPairs,
+                    std::vector<int> *order) 
+{
+    scoreIndexPairs.resize(numCandidates) ;
+    for (int i = 0 ; i < numCandidates ; ++i) {
+        scoreIndexPairs[i] = std::make_pair(scores[i], priorIdx[i]) ;
+    }
+    vl::impl::selectTopK(scoreIndexPairs, topK) ;
+    int numRanked = scoreIndexPairs.size() ;
+    order->resize(numRanked) ;
+    for (int i = 0 ; i < numRanked ; ++i) {
+        (*order)[i] = scoreIndexPairs[i].second ;
     }
-    //printf("num passing %d \n", indices->size()) ;
 }
 
-template <typename T>
-void getConfScores(const T* confData, 
-                   const int batchSize,
-                   const int numPriors, 
-                   const int numClasses,
-                   std::vector<std::map<int, std::vector<float>>>* confPreds) 
+// Run greedy NMS over the ranked candidates of a single class.  The 
+// indices of at most maxKeep kept priors are appended to `kept`.
+void applyFastNMS(const vl::impl::DecodedBoxes &boxes,
+                  const std::vector<int> &order,
+                  const float nmsThresh, 
+                  const int maxKeep,
+                  vl::impl::NMSWorkspace<float> &workspace,
+                  std::vector<int> *kept) 
 {
-    confPreds->clear();
-    confPreds->resize(batchSize);
-    for (int i = 0; i < batchSize; ++i) {
-        std::map<int, std::vector<float>> &labelScores = (*confPreds)[i];
-        for (int p = 0; p < numPriors; ++p) {
-            int startIdx = p * numClasses;
-            for (int c = 0; c < numClasses; ++c) {
-                // MATLAB is column major ....
-                //labelScores[c].push_back(confData[numPriors * c + p]);
-                labelScores[c].push_back(confData[startIdx + c]);
-            }
-        }
-        confData += numPriors * numClasses;
-    }
-    //printf("score batch 1 %f\n", (*confPreds)[0][0][0]) ;
-    //printf("score batch 2 %f\n", (*confPreds)[1][0][0]) ;
+    // run the nms - note we don't use adaptive NMS here
+    vl::impl::greedyNMS(boxes.xmin, boxes.ymin, boxes.xmax, boxes.ymax, 1,
+                        order.data(), order.size(), nmsThresh, maxKeep, 
+                        workspace, kept) ;
 }
 
-template<typename T>
-void getLocPreds(const T* locData, 
-                 const int batchSize, 
-                 const int numPriors, 
-                 std::vector<std::map<int, std::vector<NormalizedBox>>> *locPreds) 
+// For lazy decoding, priors are decoded in blocks of DECODE_BLOCK (a 
+// multiple of the SIMD width): a block is decoded if any of its priors 
+// is ranked for some class, and it is decoded only once, however many 
+// classes refer to it.  `needed` holds one flag per block.
+enum { DECODE_BLOCK = 16 } ;
+
+void markNeededBlocks(const std::vector<int> *ranked,
+                      const int numClasses,
+                      std::vector<unsigned char> *needed) 
 {
-    locPreds->clear() ;
-    locPreds->resize(batchSize) ;
-    for (int i = 0 ; i < batchSize ; i++) {
-        Label2BoxesMap &labelBox = (*locPreds)[i] ;
-        for (int p = 0; p < numPriors; ++p) {
-            int startIdx = p * 4 ;
-            int label = -1 ; 
-            if (labelBox.find(label) == labelBox.end()) {
-              labelBox[label].resize(numPriors) ;
-            }
-            labelBox[label][p].xmin = locData[startIdx];
-            labelBox[label][p].ymin = locData[startIdx + 1] ;
-            labelBox[label][p].xmax = locData[startIdx + 2] ;
-            labelBox[label][p].ymax = locData[startIdx + 3] ;
+    for (int c = 0 ; c < numClasses ; ++c) {
+        const std::vector<int> &order = ranked[c] ;
+        for (int k = 0 ; k < order.size() ; ++k) {
+            (*needed)[order[k] / DECODE_BLOCK] = 1 ;
         }
-        locData += numPriors * 4 ;
     }
 }
 
+// Decode the boxes of priors [begin, end).  Predictions in full 
+// precision are decoded in place, while the others are first widened to 
+// float into `buffer` (at the same offsets).
 template <typename T>
-void getPriorBoxes(const T* priors, 
-                   const int numPriors,
-                   BoxVector* priorBoxes,
-                   std::vector<std::vector<float>>* priorVars) 
+void decodeRange(const vl::impl::PriorTable &priorTable,
+                 const vl::impl::NativePreds<T> &locPreds,
+                 const int begin,
+                 const int end,
+                 const vl::impl::DecodedBoxes &boxes,
+                 std::vector<float> &buffer) 
 {
-    priorBoxes->clear() ;
-    priorVars->clear() ;
-    for (int p = 0; p < numPriors; ++p) {
-        int startIdx = p * 4 ;
-        NormalizedBox box ;
-        box.xmin = priors[startIdx] ;
-        box.ymin = priors[startIdx + 1] ;
-        box.xmax = priors[startIdx + 2] ;
-        box.ymax = priors[startIdx + 3] ;
-        box.size = getBoxSize(box) ;
-        priorBoxes->push_back(box) ;
-    }
-
-    for (int p = 0; p < numPriors; ++p) {
-        int startIdx = (numPriors + p) * 4;
-        std::vector<float> var;
-        for (int j = 0; j < 4; ++j) {
-            var.push_back(priors[startIdx + j]);
-        }
-        priorVars->push_back(var);
-    }
+    vl::impl::decodeBoxes(priorTable, locPreds.data, begin, end, boxes) ;
 }
 
-void decodeBox(const NormalizedBox& priorBox, 
-               const std::vector<float>& priorVar,
-               const NormalizedBox& box,
-               NormalizedBox* decodedBox) 
+template <typename LocPreds>
+void decodeRange(const vl::impl::PriorTable &priorTable,
+                 const LocPreds &locPreds,
+                 const int begin,
+                 const int end,
+                 const vl::impl::DecodedBoxes &boxes,
+                 std::vector<float> &buffer) 
 {
-    float priorWidth = priorBox.xmax - priorBox.xmin ;
-    float priorHeight = priorBox.ymax - priorBox.ymin ;
-    float priorCenterX = (priorBox.xmin + priorBox.xmax) / 2. ;
-    float priorCenterY = (priorBox.ymin + priorBox.ymax) / 2.;
-    assert(priorWidth > 0) ;
-    assert(priorHeight > 0) ;
-
-    float decodedCenterX, decodedCenterY, decodedWidth, decodedHeight ;
-    decodedCenterX = priorVar[0] * box.xmin * priorWidth + priorCenterX ;
-    decodedCenterY = priorVar[1] * box.ymin * priorHeight + priorCenterY ;
-    decodedWidth = exp(priorVar[2] * box.xmax) * priorWidth ;
-    decodedHeight = exp(priorVar[3] * box.ymax) * priorHeight ;
-
-    decodedBox->xmin = (decodedCenterX - decodedWidth / 2.) ;
-    decodedBox->ymin = (decodedCenterY - decodedHeight / 2.) ;
-    decodedBox->xmax = (decodedCenterX + decodedWidth / 2.) ;
-    decodedBox->ymax = (decodedCenterY + decodedHeight / 2.) ;
-    decodedBox->size = getBoxSize(*decodedBox) ;
+    buffer.resize(priorTable.numPriors * 4) ;
+    locPreds.toFloat(begin * 4, end * 4, buffer.data()) ;
+    vl::impl::decodeBoxes(priorTable, buffer.data(), begin, end, boxes) ;
 }
 
-void decodeBoxes(const BoxVector &priorBoxes,
-                 const std::vector<std::vector<float>>& priorVars,
-                 const BoxVector& boxes,
-                 BoxVector* decodedBoxes) 
+// Decode the needed blocks of priors in [begin, end), where begin is a 
+// multiple of DECODE_BLOCK.  Runs of consecutive needed blocks are 
+// decoded by a single call, to keep the vectorised loops long.
+template <typename LocPreds>
+void decodeNeededBlocks(const vl::impl::PriorTable &priorTable,
+                        const LocPreds &locPreds,
+                        const std::vector<unsigned char> &needed,
+                        const int begin,
+                        const int end,
+                        const vl::impl::DecodedBoxes &boxes,
+                        std::vector<float> &buffer) 
 {
-    assert(priorBoxes.size() == priorVars.size()) ;
-    assert(priorBoxes.size() == boxes.size()) ;
-    int numBoxes = priorBoxes.size();
-    if (numBoxes >= 1) {
-        assert(priorVars[0].size() == 4) ;
+    int block = begin / DECODE_BLOCK ;
+    const int endBlock = (end + DECODE_BLOCK - 1) / DECODE_BLOCK ;
+    while (block < endBlock) {
+        if (!needed[block]) {
+            ++block ;
+            continue ;
+        }
+        int runEnd = block + 1 ;
+        while (runEnd < endBlock && needed[runEnd]) {
+            ++runEnd ;
+        }
+        decodeRange(priorTable, locPreds, block * DECODE_BLOCK, 
+                    std::min(runEnd * DECODE_BLOCK, end), boxes, buffer) ;
+        block = runEnd ;
     }
-    decodedBoxes->clear();
-     for (int i = 0; i < numBoxes; ++i) {
-        NormalizedBox decodedBox;
-        decodeBox(priorBoxes[i], priorVars[i], boxes[i], &decodedBox);
-        decodedBoxes->push_back(decodedBox);
-     }
 }
 
-void decodeBoxesBatch(const std::vector<Label2BoxesMap>& locPredsBatch,
-                 const BoxVector &priorBoxes,
-                 const std::vector<std::vector<float> >& priorVars,
-                 const int batchSize, 
-                 std::vector<Label2BoxesMap> *decodedBoxesBatch) 
+// Rank the candidates of all classes of an image together (batched NMS):
+// the top k of each class are kept and sorted by a single sort.
+void rankBatchedCandidates(const Candidates &cands,
+                           const int numClasses,
+                           const int topK,
+                           std::vector<vl::impl::LabelledScore> *ranked) 
 {
-    assert(locPredsBatch.size() == batchSize) ;
-    decodedBoxesBatch->clear() ;
-    decodedBoxesBatch->resize(batchSize) ;
-    for (int i = 0 ; i < batchSize ; ++i) {
-        // Decode predictions into bboxes.
-        Label2BoxesMap& decodedBoxes = (*decodedBoxesBatch)[i] ;
-        int label = -1 ;
-        if (locPredsBatch[i].find(label) == locPredsBatch[i].end()) {
-            printf("Unable to find location preds for label %d", label) ;
+    ranked->resize(cands.scores.size()) ;
+    for (int c = 0 ; c < numClasses ; ++c) {
+        for (int j = cands.classOffsets[c] ; j < cands.classOffsets[c + 1] ; ++j) {
+            vl::impl::LabelledScore cand = { cands.scores[j], c, cands.priorIdx[j] } ;
+            (*ranked)[j] = cand ;
         }
-        const BoxVector &labelLocPreds = locPredsBatch[i].find(label)->second ;
-        decodeBoxes(priorBoxes, priorVars, labelLocPreds, &(decodedBoxes[label])) ;
     }
-    //printf("decoded box for label %d xmin: %f\n", (*decodedBoxesBatch)[0][-1][0].xmin) ;
-    //printf("decoded box for label %d ymin: %f\n", (*decodedBoxesBatch)[0][-1][0].ymin) ;
-    //printf("decoded box for label %d xmax: %f\n", (*decodedBoxesBatch)[0][-1][0].xmax) ;
-    //printf("decoded box for label %d ymax: %f\n", (*decodedBoxesBatch)[0][-1][0].ymax) ;
+    vl::impl::selectBatchedTopK(*ranked, cands.classOffsets.data(), 
+                                numClasses, topK) ;
 }
 
+// Run a single NMS pass over the ranked candidates of all classes of an 
+// image, keeping at most maxKeep boxes in total.  Unless the NMS is 
+// class-agnostic, boxes only suppress boxes of their own class.  The 
+// prior indices of the boxes kept for class c are written to kept[c], in 
+// rank order.
+void applyBatchedNMS(const vl::impl::DecodedBoxes &boxes,
+                     const std::vector<vl::impl::LabelledScore> &ranked,
+                     const int numClasses,
+                     const bool classAgnostic,
+                     const float nmsThresh, 
+                     const int maxKeep,
+                     std::vector<int> &order,
+                     std::vector<int> &labels,
+                     std::vector<int> &keptRanks,
+                     vl::impl::NMSWorkspace<float> &workspace,
+                     std::vector<int> *kept) 
+{
+    const int numRanked = ranked.size() ;
+    order.resize(numRanked) ;
+    labels.resize(numRanked) ;
+    for (int i = 0 ; i < numRanked ; ++i) {
+        order[i] = ranked[i].index ;
+        labels[i] = ranked[i].label ;
+    }
+    keptRanks.clear() ;
+    vl::impl::batchedGreedyNMS(boxes.xmin, boxes.ymin, boxes.xmax, boxes.ymax, 1,
+                               order.data(), 
+                               classAgnostic ? NULL : labels.data(), 
+                               numClasses, numRanked, nmsThresh, maxKeep, 
+                               workspace, &keptRanks) ;
+    for (int c = 0 ; c < numClasses ; ++c) {
+        kept[c].clear() ;
+    }
+    for (int k = 0 ; k < keptRanks.size() ; ++k) {
+        kept[labels[keptRanks[k]]].push_back(order[keptRanks[k]]) ;
+    }
+}
+
+// Per-worker scratch space, reused across the tasks run by a worker
+typedef vl::impl::MultiboxWorkerScratch WorkerScratch ;
+
 namespace vl { namespace impl {
 
   template<typename T>
   struct multiboxdetector<vl::VLDT_CPU,T>
   {
 
+    // The detector proper, for predictions read through LocPreds and 
+    // ConfPreds (see predformats.hpp)
+    template<typename LocPreds, typename ConfPreds>
+    static vl::ErrorCode
+    detect(T* output,
+           T* counts,
+           LocPreds const& locPreds,
+           ConfPreds const& confPreds,
+           T const* priors,
+           int nmsTopK,
+           int keepTopK,
+           int numClasses,
+           float nmsThresh,
+           float confThresh, 
+           int backgroundLabel, 
+           MultiboxNMSMethod nmsMethod,
+           bool compact,
+           size_t outHeight, 
+           size_t batchSize, 
+           size_t numPriors,
+           int numThreads,
+           bool lazyDecode,
+           PriorCache *priorCache,
+           MultiboxWorkspace *workspace,
+           MultiboxStats *stats) 
+    {
+      // The work is split into stages of independent tasks:
+      //
+      // 1. gathering the candidates of each image (and, unless decoding 
+      //    is lazy, decoding chunks of boxes)
+      // 2. ranking the candidates of each (image, class) pair, or of each
+      //    image for batched NMS
+      // 3. for lazy decoding, decoding chunks of boxes, skipping the 
+      //    blocks of priors that were not ranked for any class
+      // 4. NMS for each (image, class) pair, or of each image for batched
+      //    NMS (in which case the keepTopK selection is part of the NMS)
+      // 5. the keepTopK merge for each image
+      // 6. the output scatter for each image
+      //
+      // Every task writes to its own slot of the buffers below, so the 
+      // result does not depend on the number of threads.  Since a box is 
+      // only ever read by NMS and the output scatter after it has been 
+      // ranked, lazy decoding does not change the result either.  When 
+      // `stats` is given, the time spent in each stage is recorded in it,
+      // and if it asks for them the counters of each (image, class) pair
+      // are written by the task that owns the pair.
+      MultiboxStageTimer timer(stats) ;
+      const bool counting = stats && stats->counting ;
+      if (counting) {
+        stats->resetCounters(numClasses, batchSize) ;
+      }
+      const int decodeChunk = 4096 ;
+      const int numChunks = (numPriors + decodeChunk - 1) / decodeChunk ;
+      const int numBlocks = (numPriors + DECODE_BLOCK - 1) / DECODE_BLOCK ;
+      const int numStageTasks = std::max(batchSize * (numChunks + 1), 
+                                         batchSize * numClasses) ;
+      const int numWorkers = getNumWorkers(numThreads, numStageTasks) ;
+
+      // The buffers are taken from the workspace, or from a workspace of 
+      // this call only.  Boxes are decoded on demand, so their buffer is 
+      // left uninitialised.
+      MultiboxWorkspace localWorkspace ;
+      MultiboxWorkspace &buffers = workspace ? *workspace : localWorkspace ;
+      const bool batched = (nmsMethod != vlMultiboxNMSPerClass) ;
+      float *boxData = buffers.host.allocate<float>(batchSize * numPriors * 4) ;
+      int *take = buffers.host.allocate<int>(batchSize * numClasses) ;
+      int *outOffsets = buffers.host.allocate<int>(batchSize + 1) ;
+      DecodedBoxes *boxes = buffers.host.allocate<DecodedBoxes>(batchSize) ;
+      if (!boxData || !take || !outOffsets || !boxes) {
+          buffers.finish() ;
+          return VLE_OutOfMemory ;
+      }
+      sizeUp(buffers.candidates, batchSize) ;
+      sizeUp(buffers.ranked, batched ? 0 : batchSize * numClasses) ;
+      sizeUp(buffers.batchedRanked, batched ? batchSize : 0) ;
+      sizeUp(buffers.kept, batchSize * numClasses) ;
+      sizeUp(buffers.needed, lazyDecode ? batchSize : 0) ;
+      sizeUp(buffers.scratch, numWorkers) ;
+      std::vector<Candidates> &candidates = buffers.candidates ;
+      std::vector<std::vector<int> > &ranked = buffers.ranked ;
+      std::vector<std::vector<LabelledScore> > &batchedRanked = buffers.batchedRanked ;
+      std::vector<std::vector<int> > &kept = buffers.kept ;
+      std::vector<std::vector<unsigned char> > &needed = buffers.needed ;
+      std::vector<WorkerScratch> &scratch = buffers.scratch ;
+      for (int w = 0 ; w < numWorkers ; ++w) {
+          scratch[w].nms.countOverlaps = counting ;
+      }
+
+      for (int i = 0 ; i < batchSize ; ++i) {
+          boxes[i].xmin = boxData + numPriors * 4 * i ;
+          boxes[i].ymin = boxes[i].xmin + numPriors ;
+          boxes[i].xmax = boxes[i].ymin + numPriors ;
+          boxes[i].ymax = boxes[i].xmax + numPriors ;
+      }
+
+      // The prior geometry is reused from the cache when one is given
+      PriorTable localTable ;
+      PriorTable const *priorTable = &localTable ;
+      if (priorCache) {
+        priorTable = &priorCache->get(priors, numPriors) ;
+      } else {
+        localTable.init(priors, numPriors) ;
+      }
+      typename CandidateKernel<ConfPreds>::Type getCandidatesKernel = 
+        CandidateKernel<ConfPreds>::select(numClasses, backgroundLabel) ;
+      timer.lap(vlMultiboxStageSetup) ;
+
+      // Gather candidates (and decode all boxes, unless decoding is lazy)
+      const int numDecodeTasks = lazyDecode ? 0 : numChunks ;
+      parallelFor(numWorkers, batchSize * (numDecodeTasks + 1), 
+                  [&](int task, int worker) {
+          const int i = task / (numDecodeTasks + 1) ;
+          const int chunk = task % (numDecodeTasks + 1) ;
+          if (chunk < numDecodeTasks) {
+              const int begin = chunk * decodeChunk ;
+              const int end = std::min(begin + decodeChunk, (int)numPriors) ;
+              decodeRange(*priorTable, locPreds.offset(numPriors * 4 * i), 
+                          begin, end, boxes[i], scratch[worker].locData) ;
+          } else {
+              getCandidatesKernel(confPreds.offset(numPriors * numClasses * i), 
+                                  numPriors, numClasses, backgroundLabel,
+                                  confThresh, scratch[worker].live, 
+                                  &candidates[i]) ;
+              if (counting) {
+                  const std::vector<int> &offsets = candidates[i].classOffsets ;
+                  for (int c = 0 ; c < numClasses ; ++c) {
+                      stats->numCandidates[c + numClasses * i] = 
+                        offsets[c + 1] - offsets[c] ;
+                  }
+              }
+          }
+      }) ;
+      timer.lap(vlMultiboxStageCandidates) ;
+
+      // Per-class (or per-image) ranking
+      if (batched) {
+          parallelFor(numWorkers, batchSize, [&](int i, int worker) {
+              rankBatchedCandidates(candidates[i], numClasses, nmsTopK, 
+                                    &batchedRanked[i]) ;
+              if (counting) {
+                  for (int k = 0 ; k < batchedRanked[i].size() ; ++k) {
+                      stats->numRanked[batchedRanked[i][k].label 
+                                       + numClasses * i]++ ;
+                  }
+              }
+          }) ;
+      } else {
+          parallelFor(numWorkers, batchSize * numClasses, 
+                      [&](int task, int worker) {
+              const int i = task / numClasses ;
+              const int c = task % numClasses ;
+              const Candidates &cands = candidates[i] ;
+              int offset = cands.classOffsets[c] ;
+              rankCandidates(cands.scores.data() + offset, 
+                             cands.priorIdx.data() + offset, 
+                             cands.classOffsets[c + 1] - offset, 
+                             nmsTopK, 
+                             scratch[worker].scoreIndexPairs, 
+                             &ranked[task]) ;
+              if (counting) {
+                  stats->numRanked[task] = ranked[task].size() ;
+              }
+          }) ;
+      }
+      timer.lap(vlMultiboxStageRanking) ;
+
+      // Decode the blocks of priors that were ranked for some class
+      if (lazyDecode) {
+          parallelFor(numWorkers, batchSize, [&](int i, int worker) {
+              needed[i].assign(numBlocks, 0) ;
+              if (batched) {
+                  for (int k = 0 ; k < batchedRanked[i].size() ; ++k) {
+                      needed[i][batchedRanked[i][k].index / DECODE_BLOCK] = 1 ;
+                  }
+              } else {
+                  markNeededBlocks(&ranked[i * numClasses], numClasses, 
+                                   &needed[i]) ;
+              }
+          }) ;
+          parallelFor(numWorkers, batchSize * numChunks, 
+                      [&](int task, int worker) {
+              const int i = task / numChunks ;
+              const int begin = (task % numChunks) * decodeChunk ;
+              const int end = std::min(begin + decodeChunk, (int)numPriors) ;
+              decodeNeededBlocks(*priorTable, locPreds.offset(numPriors * 4 * i), 
+                                 needed[i], begin, end, boxes[i], 
+                                 scratch[worker].locData) ;
+          }) ;
+          timer.lap(vlMultiboxStageDecode) ;
+      }
+
+      // Per-class (or batched) NMS
+      if (batched) {
+          parallelFor(numWorkers, batchSize, [&](int i, int worker) {
+              WorkerScratch &ws = scratch[worker] ;
+              applyBatchedNMS(boxes[i], 
+                              batchedRanked[i], 
+                              numClasses, 
+                              nmsMethod == vlMultiboxNMSClassAgnostic, 
+                              nmsThresh, 
+                              keepTopK, 
+                              ws.order, 
+                              ws.labels, 
+                              ws.keptRanks, 
+                              ws.nms, 
+                              &kept[i * numClasses]) ;
+              if (counting) {
+                  for (int c = 0 ; c < numClasses ; ++c) {
+                      stats->numKept[c + numClasses * i] = 
+                        kept[i * numClasses + c].size() ;
+                  }
+                  for (int k = 0 ; k < ws.keptRanks.size() ; ++k) {
+                      stats->numOverlaps[ws.labels[ws.keptRanks[k]] 
+                                         + numClasses * i] += ws.nms.overlaps[k] ;
+                  }
+              }
+          }) ;
+      } else {
+          parallelFor(numWorkers, batchSize * numClasses, 
+                      [&](int task, int worker) {
+              const int i = task / numClasses ;
+              kept[task].clear() ;
+              applyFastNMS(boxes[i], 
+                           ranked[task], 
+                           nmsThresh, 
+                           keepTopK, 
+                           scratch[worker].nms, 
+                           &kept[task]) ;
+              if (counting) {
+                  const std::vector<int> &overlaps = scratch[worker].nms.overlaps ;
+                  stats->numKept[task] = kept[task].size() ;
+                  for (int k = 0 ; k < overlaps.size() ; ++k) {
+                      stats->numOverlaps[task] += overlaps[k] ;
+                  }
+              }
+          }) ;
+      }
+      timer.lap(vlMultiboxStageNMS) ;
+
+      // Merge the classes of each image
+      parallelFor(numWorkers, batchSize, [&](int i, int worker) {
+          const ConfPreds confData = confPreds.offset(numPriors * numClasses * i) ;
+          WorkerScratch &ws = scratch[worker] ;
+
+          // gather the scores of the kept detections in (label, descending 
+          // score) order
+          ws.keptScores.clear() ;
+          ws.keptOffsets.resize(numClasses + 1) ;
+          ws.keptOffsets[0] = 0 ;
+          for (int c = 0 ; c < numClasses ; ++c) {
+              const std::vector<int> &labelKept = kept[i * numClasses + c] ;
+              for (int k = 0 ; k < labelKept.size() ; ++k) {
+                  ws.keptScores.push_back(confData.value(labelKept[k] * numClasses + c)) ;
+              }
+              ws.keptOffsets[c + 1] = ws.keptScores.size() ;
+          }
+          int numDetections = ws.keptScores.size() ;
+
+          // Keep top k results per image. Each class list is already sorted, 
+          // so the top k is a prefix of each list, found by a k-way merge.
+          ws.take.assign(numClasses, 0) ;
+          for (int c = 0 ; c < numClasses ; ++c) {
+              ws.take[c] = ws.keptOffsets[c + 1] - ws.keptOffsets[c] ;
+          }
+          if (keepTopK > -1 && numDetections > keepTopK) {
+              mergeTopK(ws.keptScores.data(), ws.keptOffsets.data(), 
+                        numClasses, keepTopK, &ws.take, ws.heap) ;
+          }
+
+          // at most outHeight detections fit, taken in label order
+          int count = 0 ;
+          for (int c = 0 ; c < numClasses ; ++c) {
+              int n = std::min(ws.take[c], (int)outHeight - count) ;
+              take[i * numClasses + c] = n ;
+              count += n ;
+              if (counting) {
+                  stats->numOutput[i * numClasses + c] = n ;
+              }
+          }
+          outOffsets[i + 1] = count ;
+      }) ;
+      timer.lap(vlMultiboxStageMerge) ;
+
+      // Fixed size outputs hold outHeight rows per image.  Compact outputs 
+      // hold one [label score xmin ymin xmax ymax] record per detection, 
+      // packed contiguously in image order.
+      outOffsets[0] = 0 ;
+      for (int i = 0 ; i < batchSize ; ++i) {
+          if (counts) {
+              counts[i] = outOffsets[i + 1] ;
+          }
+          outOffsets[i + 1] += outOffsets[i] ;
+      }
+
+      // Write the outputs, in label order
+      parallelFor(numWorkers, batchSize, [&](int i, int worker) {
+          const ConfPreds confData = confPreds.offset(numPriors * numClasses * i) ;
+          const DecodedBoxes &imBoxes = boxes[i] ;
+          int count = 0 ;
+          for (int c = 0 ; c < numClasses ; ++c) {
+              const std::vector<int> &labelKept = kept[i * numClasses + c] ;
+              const int numTake = take[i * numClasses + c] ;
+              if (compact) {
+                  T* out = output + outOffsets[i] * 6 ;
+                  for (int k = 0 ; k < numTake ; ++k) {
+                      const int idx = labelKept[k] ;
+                      T* record = out + (count + k) * 6 ;
+                      record[0] = c + 1 ; // MATLAB +1
+                      record[1] = confData.at(idx * numClasses + c) ;
+                      record[2] = imBoxes.xmin[idx] ;
+                      record[3] = imBoxes.ymin[idx] ;
+                      record[4] = imBoxes.xmax[idx] ;
+                      record[5] = imBoxes.ymax[idx] ;
+                  }
+              } else {
+                  T* out = output + outHeight * i * 6 + count ;
+                  for (int k = 0 ; k < numTake ; ++k) {
+                      const int idx = labelKept[k] ;
+                      out[k] = c + 1 ; // MATLAB +1
+                      out[outHeight + k] = confData.at(idx * numClasses + c) ;
+                      out[outHeight * 2 + k] = imBoxes.xmin[idx] ;
+                      out[outHeight * 3 + k] = imBoxes.ymin[idx] ;
+                      out[outHeight * 4 + k] = imBoxes.xmax[idx] ;
+                      out[outHeight * 5 + k] = imBoxes.ymax[idx] ;
+                  }
+              }
+              count += numTake ;
+          }
+      }) ;
+      timer.lap(vlMultiboxStageOutput) ;
+      buffers.finish() ;
+      return VLE_Success ;
+   }
+
     static vl::ErrorCode
     forward(Context& context,
             T* output,
+            T* counts,
             T const* locPreds,
             T const* confPreds,
             T const* priors,
@@ -332,150 +733,223 @@ namespace vl { namespace impl {
             float nmsThresh,
             float confThresh, 
             int backgroundLabel, 
+            MultiboxNMSMethod nmsMethod,
+            bool compact,
             size_t outHeight, 
             size_t outWidth, 
             size_t batchSize, 
-            size_t numPriors) 
+            size_t numPriors,
+            int numThreads,
+            bool lazyDecode,
+            PriorCache *priorCache,
+            MultiboxWorkspace *workspace,
+            MultiboxStats *stats) 
     {
-      //printf("cpu version running\n") ;
-      //printf("vl_multiboxdetector: nmsTopK: %d\n", nmsTopK) ;
-      //printf("vl_multiboxdetector: keepTopK: %d\n", keepTopK) ;
-      //printf("vl_multiboxdetector: numClasses: %d\n", numClasses) ;
-      //printf("vl_multiboxdetector: nmsThresh: %f\n", nmsThresh) ;
-      //printf("vl_multiboxdetector: confThresh: %f\n", confThresh) ;
-      //printf("vl_multiboxdetector: backgroundLabel: %d\n", backgroundLabel) ;
-      //printf("vl_multiboxdetector: outHeight: %d\n", outHeight) ;
-      //printf("vl_multiboxdetector: outWidth: %d\n", outWidth) ;
-      //printf("vl_multiboxdetector: batchSize: %d\n", batchSize) ;
-      //printf("vl_multiboxdetector: num priors: %d\n", numPriors) ;
-
-      std::vector<Label2BoxesMap> locPredsBatch ;
-      getLocPreds(locPreds, batchSize, numPriors, &locPredsBatch) ;
-
-      // TODO: Check indexing order (over priors vs over classes)
-      std::vector<Label2ScoreMap> confScoresBatch ;
-      getConfScores(confPreds, batchSize, numPriors, numClasses, &confScoresBatch) ;
-
-      // Retrieve all prior boxes. It is the same within a batch since we 
-      // assume all images in a batch are of same dimension.
-      BoxVector priorBoxes ;
-      std::vector<std::vector<float> > priorVars ;
-      getPriorBoxes(priors, numPriors, &priorBoxes, &priorVars) ;
-
-
-      // Decode all location predictions to boxes.
-      std::vector<Label2BoxesMap> decodedBoxesBatch ;
-      decodeBoxesBatch(locPredsBatch, priorBoxes, priorVars, 
-                                        batchSize, &decodedBoxesBatch) ;
-
-      int numKept = 0 ;
-      std::vector<Label2PriorIndexMap> batchIndices ;
-      for (int i = 0 ; i < batchSize ; ++i) {
-          const Label2BoxesMap& decodedBoxes = decodedBoxesBatch[i] ;
-          const Label2ScoreMap &confScores = confScoresBatch[i] ;
-          Label2PriorIndexMap indices ;
-          int numDetections = 0 ;
-
-          // boxes are shared so we just retrieve them once
-          int label = -1 ;
-          if (decodedBoxes.find(label) == decodedBoxes.end()) {
-              printf("Could not find loc predictions for label %d", label) ;
-          }
-          const BoxVector &boxes = decodedBoxes.find(label)->second ;
+      return detect(output, counts, 
+                    NativePreds<T>(locPreds), NativePreds<T>(confPreds), 
+                    priors, nmsTopK, keepTopK, numClasses, nmsThresh, 
+                    confThresh, backgroundLabel, nmsMethod, compact, 
+                    outHeight, batchSize, numPriors, numThreads, 
+                    lazyDecode, priorCache, workspace, stats) ;
+    }
 
-          for (int c = 0 ; c < numClasses ; ++c) {
-              if ((c + 1) == backgroundLabel) { // +1 for MATLAB offset 
-                  // Ignore background class.
-                  continue ;
-              }
-              if (confScores.find(c) == confScores.end()) {
-                  printf("Could not find conf predictions for label %d", c) ;
-              }
-              const std::vector<float> &scores = confScores.find(c)->second ;
-              applyFastNMS(boxes, scores, confThresh, nmsThresh, nmsTopK, &(indices[c])) ;
-              numDetections += indices[c].size();
-          }
-          if (keepTopK > -1 && numDetections > keepTopK) {
-              std::vector<std::pair<float, std::pair<int, int>>> scoreIndexPairs ;
-              for (indexIter it = indices.begin() ; it != indices.end() ; ++it) {
-                  int label = it->first ;
-                  const std::vector<int> &labelIndices = it->second ;
-                  if (confScores.find(label) == confScores.end()) {
-                      // Something bad happened for current label.
-                      printf("Could not find location predictions for %d", label) ;
-                      continue;
-                  }
-                  const std::vector<float> &scores = confScores.find(label)->second ;
-                  for (int j = 0 ; j < labelIndices.size() ; ++j) {
-                      int idx = labelIndices[j] ;
-                      assert(idx < scores.size()) ;
-                      scoreIndexPairs.push_back(
-                         std::make_pair(scores[idx], std::make_pair(label, idx))) ;
+#define DETECT(loc, conf) \
+detect(output, counts, loc, conf, priors, nmsTopK, keepTopK, numClasses, \
+       nmsThresh, confThresh, backgroundLabel, nmsMethod, compact, \
+       outHeight, batchSize, numPriors, numThreads, lazyDecode, \
+       priorCache, workspace, stats)
+
+#define DETECT_CONF(loc) \
+switch (confPreds.type) { \
+  case vlMultiboxPredHalf : \
+    return DETECT(loc, HalfPreds((uint16_t const*)confPreds.data)) ; \
+  case vlMultiboxPredUInt8 : \
+    return DETECT(loc, UInt8Preds((uint8_t const*)confPreds.data, \
+                                  confPreds.scale, confPreds.zeroPoint)) ; \
+  default : \
+    return DETECT(loc, NativePreds<T>((T const*)confPreds.data)) ; \
+}
+
+    static vl::ErrorCode
+    forward(Context& context,
+            T* output,
+            T* counts,
+            MultiboxPreds const& locPreds,
+            MultiboxPreds const& confPreds,
+            T const* priors,
+            int nmsTopK,
+            int keepTopK,
+            int numClasses,
+            float nmsThresh,
+            float confThresh, 
+            int backgroundLabel, 
+            MultiboxNMSMethod nmsMethod,
+            bool compact,
+            size_t outHeight, 
+            size_t outWidth, 
+            size_t batchSize, 
+            size_t numPriors,
+            int numThreads,
+            bool lazyDecode,
+            PriorCache *priorCache,
+            MultiboxWorkspace *workspace,
+            MultiboxStats *stats) 
+    {
+      // uint8 predictions must have a positive scale (see UInt8Preds)
+      switch (locPreds.type) {
+        case vlMultiboxPredHalf : {
+          HalfPreds loc((uint16_t const*)locPreds.data) ;
+          DETECT_CONF(loc) ;
+        }
+        case vlMultiboxPredUInt8 : {
+          UInt8Preds loc((uint8_t const*)locPreds.data, 
+                         locPreds.scale, locPreds.zeroPoint) ;
+          DETECT_CONF(loc) ;
+        }
+        default : {
+          NativePreds<T> loc((T const*)locPreds.data) ;
+          DETECT_CONF(loc) ;
+        }
+      }
+    }
+
+#undef DETECT_CONF
+#undef DETECT
+ } ;
+} } // namespace vl::impl
+
+// Per-worker scratch space of the multiscale merge
+typedef vl::impl::MultiboxMergeScratch MergeScratch ;
+
+namespace vl { namespace impl {
+
+  template<typename T>
+  struct multiboxmerge<vl::VLDT_CPU,T>
+  {
+
+    static vl::ErrorCode
+    forward(Context& context,
+            T* output,
+            T* counts,
+            T const* const* inputs,
+            size_t const* inputHeights,
+            size_t numInputs,
+            float nmsThresh,
+            size_t outHeight,
+            size_t batchSize,
+            int numThreads,
+            MultiboxWorkspace *workspace)
+    {
+      // The MATLAB code runs NMS on the detections of each label, keeping
+      // at most outHeight of them, and then keeps the outHeight best
+      // detections over all labels, with ties in (label, input, row) 
+      // order.  A single batched NMS pass over the detections ranked in 
+      // that order, which stops after outHeight boxes, gives the same 
+      // result.  The scratch space of the workers is kept in the 
+      // workspace, if one is given.
+      const int numWorkers = getNumWorkers(numThreads, batchSize) ;
+      MultiboxWorkspace localWorkspace ;
+      MultiboxWorkspace &buffers = workspace ? *workspace : localWorkspace ;
+      sizeUp(buffers.mergeScratch, numWorkers) ;
+      std::vector<MergeScratch> &scratch = buffers.mergeScratch ;
+
+      parallelFor(numWorkers, batchSize, [&](int i, int worker) {
+          MergeScratch &ws = scratch[worker] ;
+
+          // count the detections of each label
+          int numLabels = 0 ;
+          ws.labelOffsets.assign(1, 0) ;
+          for (int s = 0 ; s < numInputs ; ++s) {
+              const size_t height = inputHeights[s] ;
+              T const* data = inputs[s] + height * 6 * i ;
+              for (int r = 0 ; r < height ; ++r) {
+                  if (!(data[r] >= 1)) { continue ; }
+                  const int label = (int)data[r] ;
+                  if (label > numLabels) {
+                      numLabels = label ;
+                      ws.labelOffsets.resize(numLabels + 1, 0) ;
                   }
+                  ws.labelOffsets[label] += 1 ;
               }
-              // Keep top k results per image.
-              std::sort(scoreIndexPairs.begin(), 
-                        scoreIndexPairs.end(),
-                        sortScorePairDescend<std::pair<int, int>>) ;
-              scoreIndexPairs.resize(keepTopK) ;
-
-              // Store the new indices.
-              Label2PriorIndexMap newIndices;
-              for (int j = 0 ; j < scoreIndexPairs.size() ; ++j) {
-                  int label = scoreIndexPairs[j].second.first ;
-                  int idx = scoreIndexPairs[j].second.second ;
-                  newIndices[label].push_back(idx) ;
+          }
+          for (int c = 1 ; c <= numLabels ; ++c) {
+              ws.labelOffsets[c] += ws.labelOffsets[c - 1] ;
+          }
+          const int numCandidates = ws.labelOffsets[numLabels] ;
+
+          // pool them in (label, input, row) order; sources holds the 
+          // input and row of each detection as input * maxHeight + row
+          ws.xmin.resize(numCandidates) ;
+          ws.ymin.resize(numCandidates) ;
+          ws.xmax.resize(numCandidates) ;
+          ws.ymax.resize(numCandidates) ;
+          ws.labels.resize(numCandidates) ;
+          ws.sources.resize(numCandidates) ;
+          ws.scoreIndexPairs.resize(numCandidates) ;
+          size_t maxHeight = 0 ;
+          for (int s = 0 ; s < numInputs ; ++s) {
+              maxHeight = std::max(maxHeight, inputHeights[s]) ;
+          }
+          for (int s = 0 ; s < numInputs ; ++s) {
+              const size_t height = inputHeights[s] ;
+              T const* data = inputs[s] + height * 6 * i ;
+              for (int r = 0 ; r < height ; ++r) {
+                  if (!(data[r] >= 1)) { continue ; }
+                  const int label = (int)data[r] ;
+                  const int j = ws.labelOffsets[label - 1]++ ;
+                  ws.xmin[j] = data[height * 2 + r] ;
+                  ws.ymin[j] = data[height * 3 + r] ;
+                  ws.xmax[j] = data[height * 4 + r] ;
+                  ws.ymax[j] = data[height * 5 + r] ;
+                  ws.labels[j] = label - 1 ;
+                  ws.sources[j] = s * maxHeight + r ;
+                  ws.scoreIndexPairs[j] = std::make_pair((float)data[height + r], j) ;
               }
-              batchIndices.push_back(newIndices) ;
-              numKept += keepTopK ;
-          } else {
-              batchIndices.push_back(indices) ;
-              numKept += numDetections ;
           }
-      }
 
-      for (int i = 0 ; i < batchSize ; ++i) {
-          int count = 0 ; // fixed size outputs
-          const Label2ScoreMap &confScores = confScoresBatch[i] ;
-          const Label2BoxesMap &decodedBoxes = decodedBoxesBatch[i] ;
-
-          for (indexIter it = batchIndices[i].begin() ; 
-                                 it != batchIndices[i].end(); ++it) {
-              int label = it->first ;
-              if (confScores.find(label) == confScores.end()) {
-                  printf("Could not find conf preds for %d", label) ;
-                  continue;
-              }
-              const std::vector<float> &scores = confScores.find(label)->second ;
-              int locLabel = -1 ;
-              if (decodedBoxes.find(locLabel) == decodedBoxes.end()) {
-                  printf("Could not find loc preds for %d", locLabel) ;
-                  continue;
-              }
-              const BoxVector &boxes = decodedBoxes.find(locLabel)->second ;
-              std::vector<int> &indices = it->second ;
-
-              int numIndices = indices.size() ;
-              for (int j = 0 ; j < numIndices ; ++j) {
-                  int idx = indices[j] ;
-                  const NormalizedBox& box = boxes[idx] ;
-                  output[outHeight * i * 6 + count ] = label + 1 ; // MATLAB +1
-                  output[outHeight * i * 6 + outHeight + 1 * count] = scores[idx] ;
-                  output[outHeight * i * 6 + outHeight * 2 + count] = box.xmin ;
-                  output[outHeight * i * 6 + outHeight * 3 + count] = box.ymin ;
-                  output[outHeight * i * 6 + outHeight * 4 + count] = box.xmax ;
-                  output[outHeight * i * 6 + outHeight * 5 + count] = box.ymax ;
-                ++count;
+          // rank them and run NMS within each label
+          std::sort(ws.scoreIndexPairs.begin(), ws.scoreIndexPairs.end(), 
+                    scoreIndexDescend) ;
+          ws.order.resize(numCandidates) ;
+          ws.orderLabels.resize(numCandidates) ;
+          for (int k = 0 ; k < numCandidates ; ++k) {
+              ws.order[k] = ws.scoreIndexPairs[k].second ;
+              ws.orderLabels[k] = ws.labels[ws.order[k]] ;
+          }
+          ws.keptRanks.clear() ;
+          batchedGreedyNMS(ws.xmin.data(), ws.ymin.data(), 
+                           ws.xmax.data(), ws.ymax.data(), 1,
+                           ws.order.data(), ws.orderLabels.data(), 
+                           numLabels, numCandidates, nmsThresh, 
+                           (int)outHeight, ws.nms, &ws.keptRanks) ;
+
+          // copy the kept rows, in rank order
+          const int numKept = std::min(ws.keptRanks.size(), outHeight) ;
+          T* out = output + outHeight * 6 * i ;
+          for (int k = 0 ; k < numKept ; ++k) {
+              const int source = ws.sources[ws.order[ws.keptRanks[k]]] ;
+              const size_t s = source / maxHeight ;
+              const size_t r = source % maxHeight ;
+              const size_t height = inputHeights[s] ;
+              T const* data = inputs[s] + height * 6 * i + r ;
+              for (int j = 0 ; j < 6 ; ++j) {
+                  out[outHeight * j + k] = data[height * j] ;
               }
           }
-      }
+          if (counts) {
+              counts[i] = numKept ;
+          }
+      }) ;
+      buffers.finish() ;
       return VLE_Success ;
-   }
- } ;
+    }
+  } ;
 } } // namespace vl::impl
 
 template struct vl::impl::multiboxdetector<vl::VLDT_CPU, float> ;
+template struct vl::impl::multiboxmerge<vl::VLDT_CPU, float> ;
 
 #ifdef ENABLE_DOUBLE
 template struct vl::impl::multiboxdetector<vl::VLDT_CPU, double> ;
+template struct vl::impl::multiboxmerge<vl::VLDT_CPU, double> ;
 #endif
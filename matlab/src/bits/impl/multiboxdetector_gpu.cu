@@ -13,6 +13,8 @@ the terms of the BSD license (see the COPYING file).
 */
 
 #include "multiboxdetector.hpp"
+#include "multiboxhost.hpp"
+#include "multiboxworkspace.hpp"
 #include <bits/data.hpp>
 #include <assert.h>
 #include <float.h>
@@ -20,7 +22,6 @@ the terms of the BSD license (see the COPYING file).
 #include <algorithm>
 #include <math.h>
 #include <string.h>
-#include <map>
 #include <vector>
 
 /* ------------------------------------------------------------ */
@@ -160,124 +161,6 @@ void permuteConfsGPU(const int numThreads,
     }
 }  
 
-/* ------------------------------------------------------------ */
-/*                                             non kernel utils */
-/* ------------------------------------------------------------ */
-
-template <typename T>
-bool sortScorePairDescend(const std::pair<float, T>& pairA,
-                          const std::pair<float, T>& pairB) 
-{
-    return pairA.first > pairB.first ;
-}
-
-template <typename T>
-T getBoxSize(const T* box) {
-    T boxSize ;
-    if (box[2] < box[0] || box[3] < box[1]) {
-        // return 0 for invalid boxes
-        boxSize = T(0.) ;
-    } else {
-        const T width = box[2] - box[0];
-        const T height = box[3] - box[1];
-        boxSize = width * height;
-    }
-    return boxSize ;
-}
-
-template <typename T>
-T jaccardOverlap(const T* boxA, const T* boxB) 
-{
-    if (boxB[0] > boxA[2] || 
-        boxB[2] < boxA[0] ||
-        boxB[1] > boxA[3] || 
-        boxB[3] < boxA[1]) {
-        // return 0 for invalid boxes
-        return T(0.) ;
-    } else {
-        const T xminIntersection = std::max(boxA[0], boxB[0]) ;
-        const T yminIntersection = std::max(boxA[1], boxB[1]) ;
-        const T xmaxIntersection = std::min(boxA[2], boxB[2]) ;
-        const T ymaxIntersection = std::min(boxA[3], boxB[3]) ;
-
-        const T widthIntersection = xmaxIntersection - xminIntersection;
-        const T heightIntersection = ymaxIntersection - yminIntersection;
-        const T sizeIntersection = widthIntersection * heightIntersection;
-
-        const T sizeBoxA = getBoxSize(boxA);
-        const T sizeBoxB = getBoxSize(boxB);
-
-        return sizeIntersection / (sizeBoxA + sizeBoxB - sizeIntersection);
-    }
-}
-
-template <typename T>
-void getMaxScoreIndexCPU(const T* scores, 
-                         const float thresh,
-                         const int numPriors,
-                         const int topK, 
-                         std::vector<std::pair<float, int> > *scoreIndexPairs) 
-{
-    // generate index score pairs for sufficiently high scores
-    for (int i = 0 ; i < numPriors ; ++i) {
-        if (scores[i] > thresh) {
-            scoreIndexPairs->push_back(std::make_pair(scores[i], i)) ;
-        }
-    }
-
-    // sort the score pair according to the scores in descending order
-    std::stable_sort(scoreIndexPairs->begin(), scoreIndexPairs->end(), 
-                                       sortScorePairDescend<int>) ;
-
-    // Keep top k scores if needed.
-    if (topK > -1 && topK < scoreIndexPairs->size()) {
-      scoreIndexPairs->resize(topK) ;
-    }
-}
-
-template <typename T>
-void applyFastNMSCPU(const T* boxes,
-                     const T* scores, 
-                     const float confThresh,
-                     const float nmsThresh, 
-                     const int numPriors,
-                     const int keepTopK,
-                     std::vector<int> *indices) 
-{
-    // retrieve top k scores (with corresponding indices).
-    std::vector<std::pair<float, int> > scoreIndexPairs ;
-    getMaxScoreIndexCPU(scores, confThresh, numPriors, keepTopK, &scoreIndexPairs) ;
-
-    // run the nms - note we don't use adaptive NMS here
-    int eta = 1 ;
-    float adaptiveThresh = nmsThresh ;
-    indices->clear() ;
-
-    while (scoreIndexPairs.size() != 0) {
-        const int idx = scoreIndexPairs.front().second ;
-        bool keep = true ;
-        int sz = indices->size() ;
-        for (int k = 0 ; k < indices->size() ; ++k) {
-            if (keep) {
-                const int keptIdx = (*indices)[k] ;
-                float overlap = jaccardOverlap(boxes + idx * 4, 
-                                               boxes + keptIdx * 4) ;
-                keep = overlap <= adaptiveThresh ;
-            } else {
-                break ;
-            }
-        }
-        if (keep) {
-            indices->push_back(idx) ;
-        }
-        scoreIndexPairs.erase(scoreIndexPairs.begin()) ;
-        if (keep && eta < 1 && adaptiveThresh > 0.5) {
-            adaptiveThresh *= eta ;
-        }
-    }
-}
-
-
 /* ------------------------------------------------------------ */
 /*                                                      forward */
 /* ------------------------------------------------------------ */
@@ -291,6 +174,7 @@ namespace vl { namespace impl {
     static vl::ErrorCode
     forward(Context& context,
             T* output,
+            T* counts,
             T const* locPreds,
             T const* confPreds,
             T const* priors,
@@ -300,10 +184,17 @@ namespace vl { namespace impl {
             float nmsThresh,
             float confThresh, 
             int backgroundLabel, 
+            MultiboxNMSMethod nmsMethod,
+            bool compact,
             size_t outHeight, 
             size_t outWidth, 
             size_t batchSize, 
-            size_t numPriors) 
+            size_t numPriors,
+            int numThreads,
+            bool lazyDecode,
+            PriorCache *priorCache,
+            MultiboxWorkspace *workspace,
+            MultiboxStats *stats) 
 {
     // The first two steps of the forward pass are performed on the GPU i.e.
     //
@@ -311,12 +202,26 @@ namespace vl { namespace impl {
     // 2. Permuting the confidence scores
     //
     // Following this, the data is returned to the CPU and the NMS is run 
-    // serially - this can be updated when we have time :)
+    // serially - this can be updated when we have time :) (numThreads,
+    // lazyDecode, priorCache and stats are currently only used by the CPU 
+    // implementation, since all boxes are decoded in place on the device)
+    //
+    // The device buffers and their host copies are taken from the 
+    // workspace, which keeps them from one call to the next
+
+    MultiboxWorkspace localWorkspace ;
+    MultiboxWorkspace &buffers = workspace ? *workspace : localWorkspace ;
 
     const int BOXES_ARRAY_SIZE = numPriors * 4 * batchSize ;
     const int BOXES_ARRAY_BYTES = BOXES_ARRAY_SIZE * sizeof(T) ;
-    T * decodedBoxes ;
-    cudaMalloc( (void **) &decodedBoxes, BOXES_ARRAY_BYTES) ;
+    T * decodedBoxes = buffers.device.allocate<T>(BOXES_ARRAY_SIZE) ;
+    const int CONF_ARRAY_SIZE = numPriors * numClasses * batchSize ;
+    const int CONF_ARRAY_BYTES = CONF_ARRAY_SIZE * sizeof(T) ;
+    T * permutedConfPreds = buffers.device.allocate<T>(CONF_ARRAY_SIZE) ;
+    if (decodedBoxes == NULL || permutedConfPreds == NULL) {
+      buffers.finish() ;
+      return VLE_OutOfGPUMemeory ;
+    }
 
     const int numLocPreds = numPriors * 4 * batchSize ;
     decodeBoxesGPU<T>(numLocPreds, 
@@ -326,11 +231,6 @@ namespace vl { namespace impl {
                       decodedBoxes) ;
 
     // permute the confidence predictions to allow contiguous access
-    const int CONF_ARRAY_SIZE = numPriors * numClasses * batchSize ;
-    const int CONF_ARRAY_BYTES = CONF_ARRAY_SIZE * sizeof(T) ;
-    T * permutedConfPreds ;
-    cudaMalloc( (void **) &permutedConfPreds, CONF_ARRAY_BYTES) ;
-
     const int numConfPreds = numPriors * numClasses * batchSize ;
     permuteConfsGPU<T>(numConfPreds, 
                        numClasses, 
@@ -338,107 +238,26 @@ namespace vl { namespace impl {
                        confPreds,
                        permutedConfPreds) ;
 
-    // allocate on host, copy data back and free up the GPU
-    T* h_decodedBoxes = new T [BOXES_ARRAY_SIZE] ;
-    T*  h_permutedConfPreds = new T [CONF_ARRAY_SIZE] ;
+    // copy the data back to the host
+    T* h_decodedBoxes = buffers.host.allocate<T>(BOXES_ARRAY_SIZE) ;
+    T* h_permutedConfPreds = buffers.host.allocate<T>(CONF_ARRAY_SIZE) ;
+    if (h_decodedBoxes == NULL || h_permutedConfPreds == NULL) {
+      buffers.finish() ;
+      return VLE_OutOfMemory ;
+    }
 
     cudaMemcpy(h_decodedBoxes, decodedBoxes, 
                BOXES_ARRAY_BYTES, cudaMemcpyDeviceToHost) ;
     cudaMemcpy(h_permutedConfPreds, permutedConfPreds, 
                CONF_ARRAY_BYTES, cudaMemcpyDeviceToHost) ;
-    cudaFree(decodedBoxes) ;
-    cudaFree(permutedConfPreds) ;
-
-    int numKept = 0 ;
-    std::vector<std::map<int, std::vector<int> > > batchIndices ;
-
-    for (int i = 0; i < batchSize; ++i) {
-
-        int numDetections = 0 ;
-        std::map<int, std::vector<int> > indices ;
-        int confIdxOffset = numClasses * numPriors * i ;
-        int boxIdxOffset = numPriors * 4 * i ;
-
-        for (int c = 0 ; c < numClasses ; ++c) {
-          if ((c + 1) == backgroundLabel) { // ignore background (MATLAB indexing)
-            continue ;
-          }
-          T* boxes_ = h_decodedBoxes + boxIdxOffset;
-          T* confPreds_ = h_permutedConfPreds + confIdxOffset + c * numPriors ;
-
-
-          applyFastNMSCPU(boxes_, 
-                          confPreds_, 
-                          confThresh, 
-                          nmsThresh, 
-                          numPriors, 
-                          nmsTopK, 
-                          &(indices[c])) ;
-          numDetections += indices[c].size() ;
-        }
 
-        if (keepTopK > -1 && numDetections > keepTopK) {
-            std::vector<std::pair<float, std::pair<int, int> > > scoreIndexPairs ;
-            for (std::map<int, std::vector<int> >::iterator it = indices.begin() ;
-                 it != indices.end(); ++it) {
-                int label = it->first ;
-                const std::vector<int>& labelIndices = it->second ;
-                for (int j = 0; j < labelIndices.size(); ++j) {
-                  int idx = labelIndices[j] ;
-                  float score = h_permutedConfPreds[confIdxOffset + label * numPriors + idx] ;
-                  scoreIndexPairs.push_back(std::make_pair(
-                                         score, std::make_pair(label, idx))) ;
-                }
-            }
-
-            // Keep top k results per image.
-            std::sort(scoreIndexPairs.begin(), scoreIndexPairs.end(),
-                      sortScorePairDescend<std::pair<int, int> >);
-            scoreIndexPairs.resize(keepTopK);
-
-            // Store the new indices.
-            std::map<int, std::vector<int> > newIndices;
-            for (int j = 0; j < scoreIndexPairs.size(); ++j) {
-                int label = scoreIndexPairs[j].second.first;
-                int idx = scoreIndexPairs[j].second.second;
-                newIndices[label].push_back(idx);
-            }
-            batchIndices.push_back(newIndices);
-            numKept += keepTopK;
-          } else {
-              batchIndices.push_back(indices);
-              numKept += numDetections;
-        }
-    }
-
-    for (int i = 0 ; i < batchSize ; ++i) {
-        int count = 0 ; // fixed size outputs
-        int boxIdxOffset = numPriors * 4 * i ;
-        int confIdxOffset = numClasses * numPriors * i ;
-
-        for (std::map<int, std::vector<int> >::iterator it 
-             = batchIndices[i].begin() ; it != batchIndices[i].end() ; ++it) {
-
-            int label = it->first ;
-            std::vector<int> &indices = it->second ;
-            T* boxes_ = h_decodedBoxes + boxIdxOffset;
-            T* confPreds_ = h_permutedConfPreds + confIdxOffset + label * numPriors ;
-
-            int numIndices = indices.size() ;
-            for (int j = 0 ; j < numIndices ; ++j) {
-                int idx = indices[j] ;
-                output[outHeight * i * 6 + count ] = label + 1 ; // MATLAB +1
-                output[outHeight * i * 6 + outHeight + 1 * count] = confPreds_[idx] ;
-                output[outHeight * i * 6 + outHeight * 2 + count] = boxes_[idx * 4] ;
-                output[outHeight * i * 6 + outHeight * 3 + count] = boxes_[idx * 4 + 1] ;
-                output[outHeight * i * 6 + outHeight * 4 + count] = boxes_[idx * 4 + 2] ;
-                output[outHeight * i * 6 + outHeight * 5 + count] = boxes_[idx * 4 + 3] ;
-              ++count;
-            }
-        }
-    }
-    delete[] h_decodedBoxes ;
-    delete[] h_permutedConfPreds ;
+    // run NMS and write the outputs on the host, with the lists of 
+    // indices and the scratch space kept in the workspace
+    multiboxHostDetections(output, counts, h_decodedBoxes, h_permutedConfPreds,
+                           nmsTopK, keepTopK, numClasses, nmsThresh, 
+                           confThresh, backgroundLabel, nmsMethod, compact, 
+                           outHeight, batchSize, numPriors, buffers) ;
+    buffers.finish() ;
 
     return VLE_Success ;
    }
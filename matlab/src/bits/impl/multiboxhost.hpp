@@ -0,0 +1,278 @@
+// @file multiboxhost.hpp
+// @brief Host stage of the GPU multibox detector: NMS and output
+// @author Samuel Albanie
+// @author Andrea Vedaldi
+
+/*
+Copyright (C) 2017- Samuel Albanie and Andrea Vedaldi.
+All rights reserved.
+
+This file is part of the VLFeat library and is made available under
+the terms of the BSD license (see the COPYING file).
+*/
+
+#ifndef VL_MULTIBOXHOST_H
+#define VL_MULTIBOXHOST_H
+
+#include "../nnmultiboxdetector.hpp"
+#include "multiboxworkspace.hpp"
+#include "nms.hpp"
+#include "topk.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+namespace vl { namespace impl {
+
+  // The NMS scratch of a worker for boxes of type T
+  template <typename T>
+  NMSWorkspace<T> & getNMSWorkspace(MultiboxWorkerScratch &ws) ;
+
+  template <>
+  inline NMSWorkspace<float> & getNMSWorkspace<float>(MultiboxWorkerScratch &ws)
+  {
+    return ws.nms ;
+  }
+
+  template <>
+  inline NMSWorkspace<double> & getNMSWorkspace<double>(MultiboxWorkerScratch &ws)
+  {
+    return ws.nmsDouble ;
+  }
+
+  template <typename T>
+  void getMaxScoreIndexCPU(const T* scores,
+                           const float thresh,
+                           const int numPriors,
+                           const int topK,
+                           std::vector<std::pair<float, int> > *scoreIndexPairs)
+  {
+    // generate index score pairs for sufficiently high scores
+    scoreIndexPairs->clear() ;
+    for (int i = 0 ; i < numPriors ; ++i) {
+      if (scores[i] > thresh) {
+        scoreIndexPairs->push_back(std::make_pair(scores[i], i)) ;
+      }
+    }
+
+    // sort the score pairs in descending order, keeping the top k scores
+    // if needed (only the kept pairs are fully sorted)
+    selectTopK(*scoreIndexPairs, topK) ;
+  }
+
+  template <typename T>
+  void applyFastNMSCPU(const T* boxes,
+                       const T* scores,
+                       const float confThresh,
+                       const float nmsThresh,
+                       const int numPriors,
+                       const int topK,
+                       const int maxKeep,
+                       MultiboxWorkerScratch &ws,
+                       std::vector<int> *indices)
+  {
+    // retrieve top k scores (with corresponding indices).
+    getMaxScoreIndexCPU(scores, confThresh, numPriors, topK,
+                        &ws.scoreIndexPairs) ;
+    ws.order.resize(ws.scoreIndexPairs.size()) ;
+    for (int i = 0 ; i < ws.order.size() ; ++i) {
+      ws.order[i] = ws.scoreIndexPairs[i].second ;
+    }
+
+    // run the nms over the interleaved boxes - note we don't use
+    // adaptive NMS here
+    indices->clear() ;
+    greedyNMS(boxes, boxes + 1, boxes + 2, boxes + 3, 4,
+              ws.order.data(), (int)ws.order.size(), nmsThresh,
+              maxKeep, getNMSWorkspace<T>(ws), indices) ;
+  }
+
+  // The kept boxes of each class are written to kept[c]
+  template <typename T>
+  void applyBatchedNMSCPU(const T* boxes,
+                          const T* scores,
+                          const float confThresh,
+                          const float nmsThresh,
+                          const int numPriors,
+                          const int numClasses,
+                          const int backgroundLabel,
+                          const bool classAgnostic,
+                          const int topK,
+                          const int maxKeep,
+                          std::vector<LabelledScore> &ranked,
+                          MultiboxWorkerScratch &ws,
+                          std::vector<int> *kept)
+  {
+    // gather the candidates of every foreground class (the scores are
+    // stored class-major) and rank them all with a single sort
+    ranked.clear() ;
+    ws.keptOffsets.assign(1, 0) ;
+    for (int c = 0 ; c < numClasses ; ++c) {
+      if ((c + 1) != backgroundLabel) { // MATLAB indexing
+        const T* classScores = scores + c * numPriors ;
+        for (int i = 0 ; i < numPriors ; ++i) {
+          if (classScores[i] > confThresh) {
+            LabelledScore cand = { (float)classScores[i], c, i } ;
+            ranked.push_back(cand) ;
+          }
+        }
+      }
+      ws.keptOffsets.push_back(ranked.size()) ;
+    }
+    selectBatchedTopK(ranked, ws.keptOffsets.data(), numClasses, topK) ;
+
+    ws.order.resize(ranked.size()) ;
+    ws.labels.resize(ranked.size()) ;
+    for (int i = 0 ; i < ws.order.size() ; ++i) {
+      ws.order[i] = ranked[i].index ;
+      ws.labels[i] = ranked[i].label ;
+    }
+
+    // run a single nms pass over the interleaved boxes of all classes,
+    // which also selects the top maxKeep detections
+    ws.keptRanks.clear() ;
+    batchedGreedyNMS(boxes, boxes + 1, boxes + 2, boxes + 3, 4,
+                     ws.order.data(),
+                     classAgnostic ? NULL : ws.labels.data(),
+                     numClasses, (int)ws.order.size(), nmsThresh,
+                     maxKeep, getNMSWorkspace<T>(ws), &ws.keptRanks) ;
+    for (int c = 0 ; c < numClasses ; ++c) {
+      kept[c].clear() ;
+    }
+    for (int k = 0 ; k < ws.keptRanks.size() ; ++k) {
+      kept[ws.labels[ws.keptRanks[k]]].push_back(ws.order[ws.keptRanks[k]]) ;
+    }
+  }
+
+  // Run NMS on the boxes decoded by the GPU detector and write its
+  // outputs.  `boxes` holds the interleaved [xmin ymin xmax ymax] boxes of
+  // each image (numPriors x 4 x batchSize) and `scores` the class-major
+  // scores of each image (numPriors x numClasses x batchSize), both in
+  // host memory.  The lists of indices and the scratch space are taken
+  // from the workspace, so that repeated calls do not allocate.
+  template <typename T>
+  void multiboxHostDetections(T* output,
+                              T* counts,
+                              T const* boxes,
+                              T const* scores,
+                              int nmsTopK,
+                              int keepTopK,
+                              int numClasses,
+                              float nmsThresh,
+                              float confThresh,
+                              int backgroundLabel,
+                              MultiboxNMSMethod nmsMethod,
+                              bool compact,
+                              size_t outHeight,
+                              size_t batchSize,
+                              size_t numPriors,
+                              MultiboxWorkspace &buffers)
+  {
+    sizeUp(buffers.kept, batchSize * numClasses) ;
+    sizeUp(buffers.batchedRanked, 1) ;
+    sizeUp(buffers.scratch, 1) ;
+    MultiboxWorkerScratch &ws = buffers.scratch[0] ;
+    getNMSWorkspace<T>(ws).countOverlaps = false ;
+
+    for (int i = 0 ; i < batchSize ; ++i) {
+      std::vector<int> *kept = &buffers.kept[i * numClasses] ;
+      T const* boxes_ = boxes + numPriors * 4 * i ;
+      T const* scores_ = scores + numClasses * numPriors * i ;
+
+      // batched NMS keeps at most keepTopK detections by itself
+      if (nmsMethod != vlMultiboxNMSPerClass) {
+        applyBatchedNMSCPU(boxes_,
+                           scores_,
+                           confThresh,
+                           nmsThresh,
+                           numPriors,
+                           numClasses,
+                           backgroundLabel,
+                           nmsMethod == vlMultiboxNMSClassAgnostic,
+                           nmsTopK,
+                           keepTopK,
+                           buffers.batchedRanked[0],
+                           ws,
+                           kept) ;
+        continue ;
+      }
+
+      int numDetections = 0 ;
+      for (int c = 0 ; c < numClasses ; ++c) {
+        kept[c].clear() ;
+        if ((c + 1) == backgroundLabel) { // ignore background (MATLAB indexing)
+          continue ;
+        }
+        applyFastNMSCPU(boxes_,
+                        scores_ + c * numPriors,
+                        confThresh,
+                        nmsThresh,
+                        numPriors,
+                        nmsTopK,
+                        keepTopK,
+                        ws,
+                        &kept[c]) ;
+        numDetections += kept[c].size() ;
+      }
+
+      // Keep top k results per image. The indices of each label are
+      // already sorted by score, so the top k form a prefix of each
+      // list, which is found with a k-way merge.
+      if (keepTopK > -1 && numDetections > keepTopK) {
+        ws.keptScores.clear() ;
+        ws.keptOffsets.assign(1, 0) ;
+        for (int c = 0 ; c < numClasses ; ++c) {
+          for (int k = 0 ; k < kept[c].size() ; ++k) {
+            ws.keptScores.push_back(scores_[c * numPriors + kept[c][k]]) ;
+          }
+          ws.keptOffsets.push_back(ws.keptScores.size()) ;
+        }
+        mergeTopK(ws.keptScores.data(), ws.keptOffsets.data(), numClasses,
+                  keepTopK, &ws.take, ws.heap) ;
+        for (int c = 0 ; c < numClasses ; ++c) {
+          kept[c].resize(ws.take[c]) ;
+        }
+      }
+    }
+
+    int outOffset = 0 ; // compact outputs are packed in image order
+    for (int i = 0 ; i < batchSize ; ++i) {
+      int count = 0 ; // fixed size outputs
+      T const* boxes_ = boxes + numPriors * 4 * i ;
+      for (int c = 0 ; c < numClasses ; ++c) {
+        std::vector<int> const &indices = buffers.kept[i * numClasses + c] ;
+        T const* scores_ = scores + numClasses * numPriors * i + c * numPriors ;
+        int numIndices = indices.size() ;
+        for (int j = 0 ; j < numIndices && count < outHeight ; ++j) {
+          int idx = indices[j] ;
+          if (compact) {
+            T* record = output + (outOffset + count) * 6 ;
+            record[0] = c + 1 ; // MATLAB +1
+            record[1] = scores_[idx] ;
+            record[2] = boxes_[idx * 4] ;
+            record[3] = boxes_[idx * 4 + 1] ;
+            record[4] = boxes_[idx * 4 + 2] ;
+            record[5] = boxes_[idx * 4 + 3] ;
+          } else {
+            T* out = output + outHeight * i * 6 + count ;
+            out[0] = c + 1 ; // MATLAB +1
+            out[outHeight] = scores_[idx] ;
+            out[outHeight * 2] = boxes_[idx * 4] ;
+            out[outHeight * 3] = boxes_[idx * 4 + 1] ;
+            out[outHeight * 4] = boxes_[idx * 4 + 2] ;
+            out[outHeight * 5] = boxes_[idx * 4 + 3] ;
+          }
+          ++count ;
+        }
+      }
+      if (counts) {
+        counts[i] = count ;
+      }
+      outOffset += count ;
+    }
+  }
+
+} }
+
+#endif /* defined(VL_MULTIBOXHOST_H) */
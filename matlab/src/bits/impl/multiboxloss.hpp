@@ -0,0 +1,83 @@
+// @file multiboxloss.hpp
+// @brief Multibox Loss
+// @author Samuel Albanie
+// @author Andrea Vedaldi
+
+/*
+Copyright (C) 2017- Samuel Albanie and Andrea Vedaldi.
+All rights reserved.
+
+This file is part of the VLFeat library and is made available under
+the terms of the BSD license (see the COPYING file).
+*/
+
+#ifndef VL_MULTIBOXLOSS_H
+#define VL_MULTIBOXLOSS_H
+
+#include <bits/data.hpp>
+#include <cstddef>
+
+namespace vl { namespace impl {
+
+  class PriorCache ;
+
+  // The training targets of an image.  Prior positives[k] (0-based) is
+  // matched to ground truth box assignments[k], and the negatives are the
+  // (hard negative) priors which are trained towards the background.  The
+  // numGtBoxes boxes are stored column-major as a numGtBoxes x 4
+  // [xmin ymin xmax ymax] matrix, and gtLabels holds their (0-based)
+  // classes.
+  struct MultiboxLossImage
+  {
+    int const *positives ;
+    int const *assignments ;
+    int numPositives ;
+    int const *negatives ;
+    int numNegatives ;
+    double const *gtBoxes ;
+    int const *gtLabels ;
+    int numGtBoxes ;
+  } ;
+
+  // The terms of the loss, as computed by the MATLAB layers: the softmax
+  // log-loss of the positives and negatives and the smooth L1 (Huber)
+  // loss of the encoded boxes of the positives, both divided by the
+  // total number of positives in the batch.
+  struct MultiboxLossValues
+  {
+    double conf ;
+    double loc ;
+    double total ; // conf + locWeight * loc
+  } ;
+
+  template<vl::DeviceType dev, typename T>
+  struct multiboxloss {
+
+    // Computes the loss (if `values` is not NULL) and/or its derivatives
+    // (if derLocPreds and derConfPreds are not NULL), scaled by derOutput,
+    // in a single pass over the matched and negative priors.  The
+    // derivative buffers must be zero-filled: only the entries of the
+    // priors that take part in the loss are written.
+    static vl::ErrorCode
+    compute(Context& context,
+            MultiboxLossValues *values,
+            T* derLocPreds,
+            T* derConfPreds,
+            T const* locPreds,
+            T const* confPreds,
+            T const* priors,
+            MultiboxLossImage const* images,
+            size_t batchSize,
+            size_t numPriors,
+            int numClasses,
+            int backgroundLabel,
+            float locWeight,
+            float sigma,
+            T derOutput,
+            int numThreads,
+            PriorCache *priorCache) ;
+  } ;
+
+} }
+
+#endif /* defined(VL_MULTIBOXLOSS_H) */
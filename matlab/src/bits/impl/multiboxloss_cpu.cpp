@@ -0,0 +1,191 @@
+// @file multiboxloss_cpu.cpp
+// @brief Multibox Loss CPU implementation (a fused version of the
+// vl_nnmultiboxcoder, vl_nnloss, vl_nnhuberloss and vl_nnmultiboxloss
+// layers)
+// @author Samuel Albanie
+// @author Andrea Vedaldi
+
+/*
+Copyright (C) 2017- Samuel Albanie and Andrea Vedaldi.
+All rights reserved.
+
+This file is part of the VLFeat library and is made available under
+the terms of the BSD license (see the COPYING file).
+*/
+
+#include "multiboxloss.hpp"
+#include "boxdecoder.hpp"
+#include "priorcache.hpp"
+#include "parallel.hpp"
+#include <bits/data.hpp>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+/* ------------------------------------------------------------ */
+/*                                                       useful */
+/* ------------------------------------------------------------ */
+
+// Softmax log-loss of the scores x of a prior against `label` (as in
+// vl_nnloss 'softmaxlog'), adding scale * (softmax(x) - onehot(label)) to
+// der if it is not NULL
+template<typename T>
+static double softmaxLogLoss(T const *x, int numClasses, int label,
+                             T *der, double scale)
+{
+  double maxScore = x[0] ;
+  for (int c = 1 ; c < numClasses ; ++c) {
+    maxScore = std::max(maxScore, (double)x[c]) ;
+  }
+  double sum = 0 ;
+  for (int c = 0 ; c < numClasses ; ++c) {
+    sum += std::exp(x[c] - maxScore) ;
+  }
+  if (der) {
+    for (int c = 0 ; c < numClasses ; ++c) {
+      double prob = std::exp(x[c] - maxScore) / sum ;
+      der[c] += (T)(scale * (prob - (c == label))) ;
+    }
+  }
+  return maxScore + std::log(sum) - x[label] ;
+}
+
+// Smooth L1 loss of the prediction errors d of a box (as in
+// vl_nnhuberloss), adding scale times its derivative to der if it is not
+// NULL
+template<typename T>
+static double smoothL1Loss(double const *d, double sigma2, T *der,
+                           double scale)
+{
+  double loss = 0 ;
+  for (int k = 0 ; k < 4 ; ++k) {
+    double a = std::abs(d[k]) ;
+    if (a > 1. / sigma2) {
+      loss += a - 0.5 / sigma2 ;
+      if (der) { der[k] += (T)(scale * ((d[k] > 0) - (d[k] < 0))) ; }
+    } else {
+      loss += 0.5 * sigma2 * a * a ;
+      if (der) { der[k] += (T)(scale * sigma2 * d[k]) ; }
+    }
+  }
+  return loss ;
+}
+
+namespace vl { namespace impl {
+
+  template<typename T>
+  struct multiboxloss<vl::VLDT_CPU,T>
+  {
+    static vl::ErrorCode
+    compute(Context& context,
+            MultiboxLossValues *values,
+            T* derLocPreds,
+            T* derConfPreds,
+            T const* locPreds,
+            T const* confPreds,
+            T const* priors,
+            MultiboxLossImage const* images,
+            size_t batchSize,
+            size_t numPriors,
+            int numClasses,
+            int backgroundLabel,
+            float locWeight,
+            float sigma,
+            T derOutput,
+            int numThreads,
+            PriorCache *priorCache)
+    {
+      // Both terms are averaged over the positives of the whole batch (the
+      // MATLAB layers would divide by zero if there were none)
+      int numPositives = 0 ;
+      for (int i = 0 ; i < batchSize ; ++i) {
+        numPositives += images[i].numPositives ;
+      }
+      const double norm = 1. / std::max(numPositives, 1) ;
+      const double sigma2 = (double)sigma * sigma ;
+      const bool backward = (derLocPreds != NULL && derConfPreds != NULL) ;
+      const double confScale = derOutput * norm ;
+      const double locScale = derOutput * norm * locWeight ;
+
+      PriorTable localTable ;
+      PriorTable const *priorTable = &localTable ;
+      if (priorCache) {
+        priorTable = &priorCache->get(priors, numPriors) ;
+      } else {
+        localTable.init(priors, numPriors) ;
+      }
+      float const *centerX = priorTable->field(PriorTable::CENTER_X) ;
+      float const *centerY = priorTable->field(PriorTable::CENTER_Y) ;
+      float const *width = priorTable->field(PriorTable::WIDTH) ;
+      float const *height = priorTable->field(PriorTable::HEIGHT) ;
+      float const *vars [4] ;
+      for (int k = 0 ; k < 4 ; ++k) {
+        vars[k] = priorTable->field(PriorTable::VAR0 + k) ;
+      }
+
+      // Every image reads and writes its own slices of the predictions
+      // and derivatives, and its terms are summed in order at the end, so
+      // the result does not depend on the number of threads
+      std::vector<double> confLoss(batchSize, 0) ;
+      std::vector<double> locLoss(batchSize, 0) ;
+      const int numWorkers = getNumWorkers(numThreads, batchSize) ;
+      parallelFor(numWorkers, batchSize, [&](int i, int worker) {
+          MultiboxLossImage const &im = images[i] ;
+          T const *loc = locPreds + numPriors * 4 * i ;
+          T const *conf = confPreds + numPriors * numClasses * i ;
+          T *derLoc = backward ? derLocPreds + numPriors * 4 * i : NULL ;
+          T *derConf = backward ? derConfPreds + numPriors * numClasses * i : NULL ;
+          const int G = im.numGtBoxes ;
+
+          for (int k = 0 ; k < im.numPositives ; ++k) {
+              const int p = im.positives[k] ;
+              const int g = im.assignments[k] ;
+
+              // encode the ground truth box relative to the prior (as
+              // bboxCoder and priorCoder), and compare with the prediction
+              double gtWidth = im.gtBoxes[g + 2 * G] - im.gtBoxes[g] ;
+              double gtHeight = im.gtBoxes[g + 3 * G] - im.gtBoxes[g + G] ;
+              double gtCenterX = im.gtBoxes[g] + gtWidth / 2 ;
+              double gtCenterY = im.gtBoxes[g + G] + gtHeight / 2 ;
+              double d [4] ;
+              d[0] = loc[p * 4] - (gtCenterX - centerX[p]) / (width[p] * vars[0][p]) ;
+              d[1] = loc[p * 4 + 1] - (gtCenterY - centerY[p]) / (height[p] * vars[1][p]) ;
+              d[2] = loc[p * 4 + 2] - std::log(gtWidth / width[p]) / vars[2][p] ;
+              d[3] = loc[p * 4 + 3] - std::log(gtHeight / height[p]) / vars[3][p] ;
+              locLoss[i] += smoothL1Loss(d, sigma2, backward ? derLoc + p * 4 : NULL,
+                                         locScale) ;
+
+              confLoss[i] += softmaxLogLoss(conf + p * numClasses, numClasses,
+                                            im.gtLabels[g],
+                                            backward ? derConf + p * numClasses : NULL,
+                                            confScale) ;
+          }
+          for (int k = 0 ; k < im.numNegatives ; ++k) {
+              const int p = im.negatives[k] ;
+              confLoss[i] += softmaxLogLoss(conf + p * numClasses, numClasses,
+                                            backgroundLabel,
+                                            backward ? derConf + p * numClasses : NULL,
+                                            confScale) ;
+          }
+      }) ;
+
+      if (values) {
+        values->conf = 0 ;
+        values->loc = 0 ;
+        for (int i = 0 ; i < batchSize ; ++i) {
+          values->conf += confLoss[i] * norm ;
+          values->loc += locLoss[i] * norm ;
+        }
+        values->total = values->conf + locWeight * values->loc ;
+      }
+      return VLE_Success ;
+    }
+  } ;
+
+} } // namespace vl::impl
+
+template struct vl::impl::multiboxloss<vl::VLDT_CPU, float> ;
+
+#ifdef ENABLE_DOUBLE
+template struct vl::impl::multiboxloss<vl::VLDT_CPU, double> ;
+#endif
@@ -0,0 +1,130 @@
+// @file multiboxstats.hpp
+// @brief Per-stage timings and counters of the multibox detector
+// @author Samuel Albanie
+// @author Andrea Vedaldi
+
+/*
+Copyright (C) 2017- Samuel Albanie and Andrea Vedaldi.
+All rights reserved.
+
+This file is part of the VLFeat library and is made available under
+the terms of the BSD license (see the COPYING file).
+*/
+
+#ifndef VL_MULTIBOXSTATS_H
+#define VL_MULTIBOXSTATS_H
+
+#include <chrono>
+#include <vector>
+
+namespace vl { namespace impl {
+
+  // The stages of a forward pass of the detector, in execution order
+  enum MultiboxStage {
+    vlMultiboxStageSetup = 0,    // buffers and the prior table (or cache lookup)
+    vlMultiboxStageCandidates,   // thresholding (and eager box decoding)
+    vlMultiboxStageRanking,      // nmsTopK selection
+    vlMultiboxStageDecode,       // lazy box decoding
+    vlMultiboxStageNMS,          // non-maximum suppression
+    vlMultiboxStageMerge,        // keepTopK selection across classes
+    vlMultiboxStageOutput,       // writing the output tensor
+    vlMultiboxNumStages
+  } ;
+
+  inline char const * multiboxStageName(int stage)
+  {
+    static char const * names [vlMultiboxNumStages] = {
+      "setup", "candidates", "ranking", "decode", "nms", "merge", "output"
+    } ;
+    return (stage >= 0 && stage < vlMultiboxNumStages) ? names[stage] : "?" ;
+  }
+
+  // Wall-clock time (in seconds) spent in each stage of the last forward
+  // pass.  The detector only fills it in when one is passed, so there is
+  // no cost otherwise.
+  //
+  // If `counting` is set, the (CPU) detector also counts, for each image i
+  // and label c (0-based), at [c + numClasses * i]:
+  //
+  //   numCandidates  the scores above confThresh
+  //   numRanked      the candidates ranked for NMS (at most nmsTopK)
+  //   numKept        the boxes kept by NMS (for batched NMS, which selects
+  //                  the keepTopK detections itself, at most keepTopK in
+  //                  total)
+  //   numOutput      the detections written to the output (after the
+  //                  keepTopK selection)
+  //   numOverlaps    the overlaps (IoUs) computed by NMS, in whole tiles,
+  //                  charged to the label of the suppressing box
+  //
+  // The background label counts nothing.
+  struct MultiboxStats
+  {
+    double seconds [vlMultiboxNumStages] ;
+
+    bool counting ;
+    int numClasses ;
+    int batchSize ;
+    std::vector<int> numCandidates ;
+    std::vector<int> numRanked ;
+    std::vector<int> numKept ;
+    std::vector<int> numOutput ;
+    std::vector<long long> numOverlaps ;
+
+    MultiboxStats() : counting(false), numClasses(0), batchSize(0) { clear() ; }
+
+    void resetCounters(int numClasses, int batchSize)
+    {
+      this->numClasses = numClasses ;
+      this->batchSize = batchSize ;
+      size_t n = (size_t)numClasses * batchSize ;
+      numCandidates.assign(n, 0) ;
+      numRanked.assign(n, 0) ;
+      numKept.assign(n, 0) ;
+      numOutput.assign(n, 0) ;
+      numOverlaps.assign(n, 0) ;
+    }
+
+    void clear()
+    {
+      for (int s = 0 ; s < vlMultiboxNumStages ; ++s) { seconds[s] = 0 ; }
+    }
+
+    double total() const
+    {
+      double t = 0 ;
+      for (int s = 0 ; s < vlMultiboxNumStages ; ++s) { t += seconds[s] ; }
+      return t ;
+    }
+  } ;
+
+  // Charges the time between successive calls to lap() to the given
+  // stages of `stats`; does nothing if `stats` is NULL.
+  class MultiboxStageTimer
+  {
+  public:
+    typedef std::chrono::steady_clock Clock ;
+
+    explicit MultiboxStageTimer(MultiboxStats *stats) : stats(stats)
+    {
+      if (stats) {
+        stats->clear() ;
+        last = Clock::now() ;
+      }
+    }
+
+    void lap(MultiboxStage stage)
+    {
+      if (!stats) { return ; }
+      Clock::time_point now = Clock::now() ;
+      stats->seconds[stage] += std::chrono::duration<double>(now - last).count() ;
+      last = now ;
+    }
+
+  private:
+    MultiboxStats *stats ;
+    Clock::time_point last ;
+  } ;
+
+} }
+
+#endif /* defined(VL_MULTIBOXSTATS_H) */
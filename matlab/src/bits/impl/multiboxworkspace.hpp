@@ -0,0 +1,404 @@
+// @file multiboxworkspace.hpp
+// @brief Memory of the multibox detector which is reused across calls
+// @author Samuel Albanie
+// @author Andrea Vedaldi
+
+/*
+Copyright (C) 2017- Samuel Albanie and Andrea Vedaldi.
+All rights reserved.
+
+This file is part of the VLFeat library and is made available under
+the terms of the BSD license (see the COPYING file).
+*/
+
+#ifndef VL_MULTIBOXWORKSPACE_H
+#define VL_MULTIBOXWORKSPACE_H
+
+#include "nms.hpp"
+#include "topk.hpp"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <cstddef>
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+#if ENABLE_GPU
+#include <cuda_runtime.h>
+#endif
+
+namespace vl { namespace impl {
+
+  /* ---------------------------------------------------------------- */
+  /*                                                           arenas */
+  /* ---------------------------------------------------------------- */
+
+  struct HostAllocator
+  {
+    static void * allocate(size_t bytes) { return malloc(bytes) ; }
+    static void release(void *memory) { free(memory) ; }
+  } ;
+
+#if ENABLE_GPU
+  struct DeviceAllocator
+  {
+    static void * allocate(size_t bytes)
+    {
+      void *memory = NULL ;
+      if (cudaMalloc(&memory, bytes) != cudaSuccess) { return NULL ; }
+      return memory ;
+    }
+    static void release(void *memory) { cudaFree(memory) ; }
+  } ;
+#endif
+
+  // A block of memory from which the flat buffers of a call are carved
+  // by bumping an offset.  Buffers which do not fit in the block get a
+  // chunk of their own, and at the end of the call (recycle) the chunks
+  // are freed and the block is grown to hold everything the call asked
+  // for.  The block therefore only grows, and once it has reached the
+  // size of the calls at hand they do not allocate at all.  The block is
+  // not grown beyond the limit: larger calls keep using chunks, which
+  // are returned at the end of each call.
+  template <class Allocator>
+  class WorkspaceArena
+  {
+  public:
+    enum { ALIGNMENT = 64 } ;
+
+    WorkspaceArena()
+    : block(NULL), capacity(0), used(0), demand(0),
+      limit((size_t)-1), numAllocations(0) { }
+
+    ~WorkspaceArena() { release() ; }
+
+    // A buffer of n elements of T, aligned to ALIGNMENT bytes and valid
+    // until the next call to recycle() or release(), or NULL if there is
+    // not enough memory
+    template <typename T>
+    T * allocate(size_t n)
+    {
+      const size_t bytes = roundUp(std::max(n * sizeof(T), (size_t)1)) ;
+      demand += bytes ;
+      if (used + bytes <= capacity) {
+        T *buffer = (T*)(align(block) + used) ;
+        used += bytes ;
+        return buffer ;
+      }
+      void *chunk = Allocator::allocate(bytes + ALIGNMENT) ;
+      if (chunk == NULL) { return NULL ; }
+      ++numAllocations ;
+      chunks.push_back(chunk) ;
+      return (T*)align(chunk) ;
+    }
+
+    // Reclaim the buffers of the call, growing the block to its demand
+    void recycle()
+    {
+      releaseChunks() ;
+      if (demand > capacity && demand <= limit) {
+        Allocator::release(block) ;
+        block = Allocator::allocate(demand + ALIGNMENT) ;
+        capacity = block ? demand : 0 ;
+        numAllocations += (block != NULL) ;
+      }
+      used = 0 ;
+      demand = 0 ;
+    }
+
+    // Bound the block to `bytes` (between calls)
+    void setLimit(size_t bytes)
+    {
+      limit = bytes ;
+      if (capacity > limit) { releaseBlock() ; }
+    }
+
+    size_t getLimit() const { return limit ; }
+
+    // Free all the memory (between calls)
+    void release()
+    {
+      releaseChunks() ;
+      releaseBlock() ;
+      used = 0 ;
+      demand = 0 ;
+    }
+
+    // the size of the block, which is kept between calls
+    size_t getCapacity() const { return capacity ; }
+
+    // the number of blocks and chunks allocated since construction
+    size_t getNumAllocations() const { return numAllocations ; }
+
+  private:
+    static size_t roundUp(size_t bytes)
+    {
+      return (bytes + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT ;
+    }
+
+    static char * align(void *memory)
+    {
+      return (char*)roundUp((size_t)(uintptr_t)memory) ;
+    }
+
+    void releaseChunks()
+    {
+      for (size_t k = 0 ; k < chunks.size() ; ++k) {
+        Allocator::release(chunks[k]) ;
+      }
+      chunks.clear() ;
+    }
+
+    void releaseBlock()
+    {
+      Allocator::release(block) ;
+      block = NULL ;
+      capacity = 0 ;
+    }
+
+    void *block ;
+    size_t capacity ;
+    size_t used ;
+    size_t demand ;
+    size_t limit ;
+    size_t numAllocations ;
+    std::vector<void*> chunks ;
+
+    WorkspaceArena(WorkspaceArena const &) ;
+    WorkspaceArena & operator=(WorkspaceArena const &) ;
+  } ;
+
+  /* ---------------------------------------------------------------- */
+  /*                                                 detector buffers */
+  /* ---------------------------------------------------------------- */
+
+  // Size a container of the workspace up to (at least) n elements, so
+  // that the elements keep their capacity when the calls vary in size
+  template <typename Container>
+  inline void sizeUp(Container &container, size_t n)
+  {
+    if (container.size() < n) {
+      container.resize(n) ;
+    }
+  }
+
+  template <typename T>
+  inline size_t capacityBytes(std::vector<T> const &v)
+  {
+    return v.capacity() * sizeof(T) ;
+  }
+
+  template <typename T>
+  inline size_t capacityBytes(std::vector<std::vector<T> > const &v)
+  {
+    size_t bytes = v.capacity() * sizeof(std::vector<T>) ;
+    for (size_t k = 0 ; k < v.size() ; ++k) {
+      bytes += capacityBytes(v[k]) ;
+    }
+    return bytes ;
+  }
+
+  template <typename T>
+  inline size_t capacityBytes(NMSWorkspace<T> const &nms)
+  {
+    return capacityBytes(nms.xmin) + capacityBytes(nms.ymin) +
+           capacityBytes(nms.xmax) + capacityBytes(nms.ymax) +
+           capacityBytes(nms.area) + capacityBytes(nms.suppressed) +
+           capacityBytes(nms.slots) + capacityBytes(nms.regions) +
+           capacityBytes(nms.regionFill) + capacityBytes(nms.overlaps) ;
+  }
+
+  // The candidates of an image which pass the confidence threshold,
+  // stored class-major (CSR-style): the candidates for class c occupy
+  // [classOffsets[c], classOffsets[c+1]) of the flat score/prior arrays
+  struct MultiboxCandidates
+  {
+    std::vector<int> classOffsets ;
+    std::vector<float> scores ;
+    std::vector<int> priorIdx ;
+
+    size_t getCapacityBytes() const
+    {
+      return capacityBytes(classOffsets) + capacityBytes(scores) +
+             capacityBytes(priorIdx) ;
+    }
+  } ;
+
+  // Scratch space of a worker, reused across the tasks run by the worker
+  // (the host stage of the GPU detector runs as a single worker, and
+  // suppresses boxes of the type of its output, hence nmsDouble)
+  struct MultiboxWorkerScratch
+  {
+    std::vector<int> live ;
+    std::vector<std::pair<float, int> > scoreIndexPairs ;
+    std::vector<int> order ;
+    std::vector<int> labels ;
+    std::vector<int> keptRanks ;
+    NMSWorkspace<float> nms ;
+    NMSWorkspace<double> nmsDouble ;
+    std::vector<float> keptScores ;
+    std::vector<int> keptOffsets ;
+    std::vector<int> take ;
+    std::vector<MergeHead> heap ;
+    std::vector<float> locData ;
+
+    size_t getCapacityBytes() const
+    {
+      return capacityBytes(live) + capacityBytes(scoreIndexPairs) +
+             capacityBytes(order) + capacityBytes(labels) +
+             capacityBytes(keptRanks) + capacityBytes(nms) +
+             capacityBytes(nmsDouble) + capacityBytes(keptScores) +
+             capacityBytes(keptOffsets) + capacityBytes(take) +
+             capacityBytes(heap) + capacityBytes(locData) ;
+    }
+  } ;
+
+  // Scratch space of a worker of the multiscale merge: the pooled
+  // detections of an image, in (label, input, row) order
+  struct MultiboxMergeScratch
+  {
+    std::vector<float> xmin ;
+    std::vector<float> ymin ;
+    std::vector<float> xmax ;
+    std::vector<float> ymax ;
+    std::vector<int> labels ;
+    std::vector<int> sources ;
+    std::vector<int> labelOffsets ;
+    std::vector<std::pair<float, int> > scoreIndexPairs ;
+    std::vector<int> order ;
+    std::vector<int> orderLabels ;
+    std::vector<int> keptRanks ;
+    NMSWorkspace<float> nms ;
+
+    size_t getCapacityBytes() const
+    {
+      return capacityBytes(xmin) + capacityBytes(ymin) +
+             capacityBytes(xmax) + capacityBytes(ymax) +
+             capacityBytes(labels) + capacityBytes(sources) +
+             capacityBytes(labelOffsets) + capacityBytes(scoreIndexPairs) +
+             capacityBytes(order) + capacityBytes(orderLabels) +
+             capacityBytes(keptRanks) + capacityBytes(nms) ;
+    }
+  } ;
+
+  // The intermediate buffers of the detector and of the multiscale merge,
+  // kept across calls (e.g. in the context of a MEX file).  The flat
+  // buffers (decoded boxes, output offsets, and the staging buffers of the
+  // GPU detector) are carved from the arenas, and the lists whose length
+  // is only known as they are filled (candidates, ranked and kept priors,
+  // and the per-worker scratch of NMS and of the keepTopK merge) are
+  // containers which keep their capacity from call to call.  After a few
+  // calls of a given size, neither the CPU detector, nor the host stage of
+  // the GPU detector, nor the merge makes any allocation.
+  //
+  // The memory kept between calls can be capped by setLimit(): the host
+  // arena and the containers, and (separately) the device arena, are
+  // trimmed to the limit at the end of each call, so a limit of zero
+  // releases everything after each call.  release() frees the memory
+  // at once.  A workspace must not be used by two calls at the same time.
+  class MultiboxWorkspace
+  {
+  public:
+    MultiboxWorkspace() : limit((size_t)-1) { }
+
+    void setLimit(size_t bytes)
+    {
+      limit = bytes ;
+      host.setLimit(bytes) ;
+#if ENABLE_GPU
+      device.setLimit(bytes) ;
+#endif
+      trim() ;
+    }
+
+    size_t getLimit() const { return limit ; }
+
+    // The host memory kept between calls
+    size_t getHostBytes() const
+    {
+      size_t bytes = host.getCapacity() ;
+      bytes += capacityBytes(candidates) ;
+      for (size_t i = 0 ; i < candidates.size() ; ++i) {
+        bytes += candidates[i].getCapacityBytes() ;
+      }
+      bytes += capacityBytes(ranked) + capacityBytes(kept) +
+               capacityBytes(batchedRanked) + capacityBytes(needed) ;
+      bytes += capacityBytes(scratch) ;
+      for (size_t w = 0 ; w < scratch.size() ; ++w) {
+        bytes += scratch[w].getCapacityBytes() ;
+      }
+      bytes += capacityBytes(mergeScratch) ;
+      for (size_t w = 0 ; w < mergeScratch.size() ; ++w) {
+        bytes += mergeScratch[w].getCapacityBytes() ;
+      }
+      return bytes ;
+    }
+
+#if ENABLE_GPU
+    size_t getDeviceBytes() const { return device.getCapacity() ; }
+#endif
+
+    // Reclaim the buffers of a call, which ends it
+    void finish()
+    {
+      host.recycle() ;
+#if ENABLE_GPU
+      device.recycle() ;
+#endif
+      trim() ;
+    }
+
+    void release()
+    {
+      host.release() ;
+#if ENABLE_GPU
+      device.release() ;
+#endif
+      releaseContainers() ;
+    }
+
+    WorkspaceArena<HostAllocator> host ;
+#if ENABLE_GPU
+    WorkspaceArena<DeviceAllocator> device ;
+#endif
+
+    // Containers of the detectors and of the merge, which are sized up
+    // (never down) by each call, so that their elements keep their
+    // capacity
+    std::vector<MultiboxCandidates> candidates ;
+    std::vector<std::vector<int> > ranked ;
+    std::vector<std::vector<LabelledScore> > batchedRanked ;
+    std::vector<std::vector<int> > kept ;
+    std::vector<std::vector<unsigned char> > needed ;
+    std::vector<MultiboxWorkerScratch> scratch ;
+    std::vector<MultiboxMergeScratch> mergeScratch ;
+
+  private:
+    void trim()
+    {
+      if (getHostBytes() > limit) {
+        releaseContainers() ;
+      }
+      if (getHostBytes() > limit) {
+        host.release() ;
+      }
+    }
+
+    void releaseContainers()
+    {
+      std::vector<MultiboxCandidates>().swap(candidates) ;
+      std::vector<std::vector<int> >().swap(ranked) ;
+      std::vector<std::vector<LabelledScore> >().swap(batchedRanked) ;
+      std::vector<std::vector<int> >().swap(kept) ;
+      std::vector<std::vector<unsigned char> >().swap(needed) ;
+      std::vector<MultiboxWorkerScratch>().swap(scratch) ;
+      std::vector<MultiboxMergeScratch>().swap(mergeScratch) ;
+    }
+
+    size_t limit ;
+  } ;
+
+} }
+
+#endif /* defined(VL_MULTIBOXWORKSPACE_H) */
@@ -0,0 +1,280 @@
+// @file nms.hpp
+// @brief Greedy non-maximum suppression engine (shared by the CPU
+// detector and the host-side stage of the GPU detector)
+// @author Samuel Albanie
+// @author Andrea Vedaldi
+
+/*
+Copyright (C) 2017- Samuel Albanie and Andrea Vedaldi.
+All rights reserved.
+
+This file is part of the VLFeat library and is made available under
+the terms of the BSD license (see the COPYING file).
+*/
+
+#ifndef VL_NMS_H
+#define VL_NMS_H
+
+#include <stdint.h>
+#include <cstddef>
+#include <algorithm>
+#include <limits>
+#include <vector>
+
+namespace vl { namespace impl {
+
+  // Scratch space for greedyNMS and batchedGreedyNMS. The candidate boxes
+  // are gathered into contiguous coordinate arrays (padded to a whole 
+  // number of tiles) and the suppression state is held as a bitmask, one 
+  // bit per candidate. A workspace can be reused across calls to avoid 
+  // reallocation.
+  //
+  // If `countOverlaps` is set, `overlaps[k]` is set to the number of
+  // overlaps (IoUs) computed for the k-th box kept by the last call, in
+  // whole tiles.
+  template <typename T>
+  struct NMSWorkspace
+  {
+    enum { TILE = 64 } ;
+    std::vector<T> xmin ;
+    std::vector<T> ymin ;
+    std::vector<T> xmax ;
+    std::vector<T> ymax ;
+    std::vector<T> area ;
+    std::vector<uint64_t> suppressed ;
+    std::vector<int> slots ;
+    std::vector<int> regions ;
+    std::vector<int> regionFill ;
+    bool countOverlaps ;
+    std::vector<int> overlaps ;
+
+    NMSWorkspace() : countOverlaps(false) { }
+  } ;
+
+  // Area of a box, with inverted boxes treated as empty
+  template <typename T>
+  inline T boxArea(T xmin, T ymin, T xmax, T ymax)
+  {
+    T width = xmax - xmin ;
+    T height = ymax - ymin ;
+    if (width < 0 || height < 0) {
+      return 0 ;
+    } else {
+      return width * height ;
+    }
+  }
+
+  // Compute the overlap between box `i` and one tile of TILE boxes starting
+  // at `start`, returning a bitmask of the boxes that box `i` suppresses.
+  // Box j is suppressed if their IoU is not below `nmsThresh`.  The
+  // arithmetic matches the original (pairwise) jaccard overlap exactly, but
+  // is written branch-free so that the loop can be vectorised.
+  template <typename T>
+  inline uint64_t suppressionTile(NMSWorkspace<T> const &ws,
+                                  int i, int start, float nmsThresh)
+  {
+    enum { TILE = NMSWorkspace<T>::TILE } ;
+    const T xmin = ws.xmin[i] ;
+    const T ymin = ws.ymin[i] ;
+    const T xmax = ws.xmax[i] ;
+    const T ymax = ws.ymax[i] ;
+    const T area = ws.area[i] ;
+    T const *xminB = &ws.xmin[start] ;
+    T const *yminB = &ws.ymin[start] ;
+    T const *xmaxB = &ws.xmax[start] ;
+    T const *ymaxB = &ws.ymax[start] ;
+    T const *areaB = &ws.area[start] ;
+
+    unsigned char flags [TILE] ;
+    for (int k = 0 ; k < TILE ; ++k) {
+      T width = std::min(xmax, xmaxB[k]) - std::max(xmin, xminB[k]) ;
+      T height = std::min(ymax, ymaxB[k]) - std::max(ymin, yminB[k]) ;
+      T intersection = width * height ;
+      T overlap = intersection / (areaB[k] + area - intersection) ;
+      flags[k] = (width > 0) & (height > 0) & !((float)overlap <= nmsThresh) ;
+    }
+    uint64_t bits = 0 ;
+    for (int k = 0 ; k < TILE ; ++k) {
+      bits |= (uint64_t)flags[k] << k ;
+    }
+    return bits ;
+  }
+
+  // Greedy NMS over `numCandidates` boxes, visited in the given `order`
+  // (indices into the box arrays, sorted by descending score).  Coordinates
+  // of box `idx` are read from xmin[idx * stride] etc., so both SoA
+  // (stride 1) and interleaved (stride 4) boxes are supported.
+  //
+  // Rather than testing every candidate against all of the boxes kept so
+  // far, each kept box suppresses the remaining candidates a tile at a time
+  // into a bitmask, so that suppressed candidates are skipped by a single
+  // bit test.  The search stops once `maxKeep` boxes have been kept
+  // (-1 for no limit).  The indices of the kept boxes are appended to
+  // `kept` and the number of kept boxes is returned.
+  template <typename T>
+  int greedyNMS(T const *xmin,
+                T const *ymin,
+                T const *xmax,
+                T const *ymax,
+                int stride,
+                int const *order,
+                int numCandidates,
+                float nmsThresh,
+                int maxKeep,
+                NMSWorkspace<T> &ws,
+                std::vector<int> *kept)
+  {
+    enum { TILE = NMSWorkspace<T>::TILE } ;
+    ws.overlaps.clear() ;
+    if (numCandidates <= 0 || maxKeep == 0) {
+      return 0 ;
+    }
+
+    // gather the candidates (in rank order) into padded tiles, where the
+    // padding boxes lie outside the image and so never overlap anything
+    const int numTiles = (numCandidates + TILE - 1) / TILE ;
+    const int padded = numTiles * TILE ;
+    const T far = std::numeric_limits<T>::max() ;
+    ws.xmin.resize(padded) ;
+    ws.ymin.resize(padded) ;
+    ws.xmax.resize(padded) ;
+    ws.ymax.resize(padded) ;
+    ws.area.resize(padded) ;
+    for (int i = 0 ; i < numCandidates ; ++i) {
+      const int idx = order[i] * stride ;
+      ws.xmin[i] = xmin[idx] ;
+      ws.ymin[i] = ymin[idx] ;
+      ws.xmax[i] = xmax[idx] ;
+      ws.ymax[i] = ymax[idx] ;
+      ws.area[i] = boxArea(ws.xmin[i], ws.ymin[i], ws.xmax[i], ws.ymax[i]) ;
+    }
+    for (int i = numCandidates ; i < padded ; ++i) {
+      ws.xmin[i] = far ;
+      ws.ymin[i] = far ;
+      ws.xmax[i] = far ;
+      ws.ymax[i] = far ;
+      ws.area[i] = 0 ;
+    }
+    ws.suppressed.assign(numTiles, 0) ;
+
+    int numKept = 0 ;
+    for (int i = 0 ; i < numCandidates ; ++i) {
+      if ((ws.suppressed[i / TILE] >> (i % TILE)) & 1) {
+        continue ;
+      }
+      kept->push_back(order[i]) ;
+      if (++numKept == maxKeep) {
+        if (ws.countOverlaps) { ws.overlaps.push_back(0) ; }
+        break ;
+      }
+      // Bits at or before i may be set as well - this is harmless since
+      // those candidates have already been visited.
+      int numTested = 0 ;
+      for (int t = i / TILE ; t < numTiles ; ++t) {
+        if (~ws.suppressed[t]) {
+          ws.suppressed[t] |= suppressionTile(ws, i, t * TILE, nmsThresh) ;
+          ++ numTested ;
+        }
+      }
+      if (ws.countOverlaps) { ws.overlaps.push_back(numTested * TILE) ; }
+    }
+    return numKept ;
+  }
+
+  // Greedy NMS over the candidates of several labels in a single pass.
+  // The candidates are visited in the given `order` (indices into the box
+  // arrays, sorted by descending score across all labels), and candidate
+  // i has label labels[i] in [0, numLabels).  A kept box only suppresses
+  // candidates with the same label, so the boxes kept for each label are
+  // those that greedyNMS would keep for that label alone; if `labels` is
+  // NULL, all candidates suppress each other (class-agnostic NMS).  The
+  // search stops once `maxKeep` boxes have been kept in total (-1 for no
+  // limit), which selects the top maxKeep of the per-label results.
+  //
+  // The candidates of each label are laid out in a region of their own, 
+  // padded to whole tiles, so that a kept box is only ever tested against
+  // the tiles of its label.  The ranks (positions in `order`) of the kept
+  // boxes are appended to `kept` and the number of kept boxes is returned.
+  template <typename T>
+  int batchedGreedyNMS(T const *xmin,
+                       T const *ymin,
+                       T const *xmax,
+                       T const *ymax,
+                       int stride,
+                       int const *order,
+                       int const *labels,
+                       int numLabels,
+                       int numCandidates,
+                       float nmsThresh,
+                       int maxKeep,
+                       NMSWorkspace<T> &ws,
+                       std::vector<int> *kept)
+  {
+    enum { TILE = NMSWorkspace<T>::TILE } ;
+    ws.overlaps.clear() ;
+    if (numCandidates <= 0 || maxKeep == 0) {
+      return 0 ;
+    }
+
+    // regions[r] is the first slot of the region of label r
+    const int numRegions = labels ? numLabels : 1 ;
+    ws.regions.assign(numRegions + 1, 0) ;
+    for (int i = 0 ; i < numCandidates ; ++i) {
+      ws.regions[(labels ? labels[i] : 0) + 1]++ ;
+    }
+    for (int r = 0 ; r < numRegions ; ++r) {
+      const int size = (ws.regions[r + 1] + TILE - 1) / TILE * TILE ;
+      ws.regions[r + 1] = ws.regions[r] + size ;
+    }
+    const int padded = ws.regions[numRegions] ;
+
+    // gather the candidates (in rank order within each region), where the 
+    // padding boxes lie outside the image and so never overlap anything
+    const T far = std::numeric_limits<T>::max() ;
+    ws.xmin.assign(padded, far) ;
+    ws.ymin.assign(padded, far) ;
+    ws.xmax.assign(padded, far) ;
+    ws.ymax.assign(padded, far) ;
+    ws.area.assign(padded, 0) ;
+    ws.slots.resize(numCandidates) ;
+    ws.regionFill.assign(ws.regions.begin(), ws.regions.end() - 1) ;
+    for (int i = 0 ; i < numCandidates ; ++i) {
+      const int slot = ws.regionFill[labels ? labels[i] : 0]++ ;
+      const int idx = order[i] * stride ;
+      ws.slots[i] = slot ;
+      ws.xmin[slot] = xmin[idx] ;
+      ws.ymin[slot] = ymin[idx] ;
+      ws.xmax[slot] = xmax[idx] ;
+      ws.ymax[slot] = ymax[idx] ;
+      ws.area[slot] = boxArea(ws.xmin[slot], ws.ymin[slot], 
+                              ws.xmax[slot], ws.ymax[slot]) ;
+    }
+    ws.suppressed.assign(padded / TILE, 0) ;
+
+    int numKept = 0 ;
+    for (int i = 0 ; i < numCandidates ; ++i) {
+      const int slot = ws.slots[i] ;
+      if ((ws.suppressed[slot / TILE] >> (slot % TILE)) & 1) {
+        continue ;
+      }
+      kept->push_back(i) ;
+      if (++numKept == maxKeep) {
+        if (ws.countOverlaps) { ws.overlaps.push_back(0) ; }
+        break ;
+      }
+      const int endTile = ws.regions[(labels ? labels[i] : 0) + 1] / TILE ;
+      int numTested = 0 ;
+      for (int t = slot / TILE ; t < endTile ; ++t) {
+        if (~ws.suppressed[t]) {
+          ws.suppressed[t] |= suppressionTile(ws, slot, t * TILE, nmsThresh) ;
+          ++ numTested ;
+        }
+      }
+      if (ws.countOverlaps) { ws.overlaps.push_back(numTested * TILE) ; }
+    }
+    return numKept ;
+  }
+
+} }
+
+#endif /* defined(VL_NMS_H) */
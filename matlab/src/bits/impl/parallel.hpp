@@ -0,0 +1,236 @@
+// @file parallel.hpp
+// @brief Persistent thread pool for multithreaded CPU kernels
+// @author Samuel Albanie
+// @author Andrea Vedaldi
+
+/*
+Copyright (C) 2017- Samuel Albanie and Andrea Vedaldi.
+All rights reserved.
+
+This file is part of the VLFeat library and is made available under
+the terms of the BSD license (see the COPYING file).
+*/
+
+#ifndef VL_PARALLEL_H
+#define VL_PARALLEL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+namespace vl { namespace impl {
+
+  // Number of workers to use for `numTasks` tasks when `numThreads` are
+  // requested. A non-positive request selects the number of hardware
+  // threads.
+  inline int getNumWorkers(int numThreads, int numTasks)
+  {
+    if (numThreads <= 0) {
+      numThreads = (int)std::thread::hardware_concurrency() ;
+    }
+    return std::max(1, std::min(numThreads, numTasks)) ;
+  }
+
+  // A set of threads which are started on demand and then wait for work,
+  // so that a kernel which runs several parallel stages per call does not
+  // start and join threads for each of them.  The pool only grows (up to
+  // the largest number of workers asked for) until shutdown(), which
+  // joins the threads; a MEX file must call it from its mexAtExit
+  // function, before the code of the threads is unloaded.
+  //
+  // One parallel loop runs at a time: a loop started while another is
+  // running runs its tasks in order on the calling thread.  A loop
+  // started by a task (nested) passes the worker of that task to all its
+  // tasks, so that they use the scratch space of the thread they run on;
+  // per-worker scratch shared by the two loops must then be sized for the
+  // workers of the outer one.  A loop started by another thread uses
+  // worker 0.
+  class ThreadPool
+  {
+  public:
+    ThreadPool()
+    : job(NULL), numJobWorkers(0), numPending(0), generation(0),
+      stopping(false), busy(false) { }
+
+    ~ThreadPool() { shutdown() ; }
+
+    // Run fn(task, worker) for every task in [0, numTasks) on up to
+    // `numWorkers` threads (including the calling thread) and wait for
+    // completion.  If a task throws, the remaining tasks are skipped and
+    // the first exception is rethrown on the calling thread once all the
+    // workers have stopped.
+    template <typename Func>
+    void run(int numWorkers, int numTasks, Func const &fn)
+    {
+      if (numWorkers <= 1 || numTasks <= 1 || busy.exchange(true)) {
+        const int worker = std::max(currentWorker(), 0) ;
+        for (int task = 0 ; task < numTasks ; ++task) {
+          fn(task, worker) ;
+        }
+        return ;
+      }
+      TaskJob<Func> taskJob(fn, numTasks) ;
+      {
+        std::unique_lock<std::mutex> lock(mutex) ;
+        numWorkers = std::min(numWorkers, grow(numWorkers - 1) + 1) ;
+        job = &taskJob ;
+        numJobWorkers = numWorkers ;
+        numPending = numWorkers - 1 ;
+        ++generation ;
+      }
+      wake.notify_all() ;
+      taskJob.work(0) ;
+      {
+        std::unique_lock<std::mutex> lock(mutex) ;
+        done.wait(lock, [this] { return numPending == 0 ; }) ;
+        job = NULL ;
+      }
+      busy = false ;
+      taskJob.rethrow() ;
+    }
+
+    // Join all the threads (between loops)
+    void shutdown()
+    {
+      {
+        std::unique_lock<std::mutex> lock(mutex) ;
+        stopping = true ;
+      }
+      wake.notify_all() ;
+      for (size_t t = 0 ; t < threads.size() ; ++t) {
+        threads[t].join() ;
+      }
+      threads.clear() ;
+      stopping = false ;
+    }
+
+    int getNumThreads() const { return (int)threads.size() ; }
+
+  private:
+    // The worker of the task run by this thread, or -1 outside tasks
+    static int & currentWorker()
+    {
+      static thread_local int worker = -1 ;
+      return worker ;
+    }
+
+    struct Job
+    {
+      virtual void work(int worker) = 0 ;
+    } ;
+
+    template <typename Func>
+    struct TaskJob : Job
+    {
+      TaskJob(Func const &fn, int numTasks)
+      : fn(fn), numTasks(numTasks), next(0) { }
+
+      void work(int worker)
+      {
+        const int enclosing = currentWorker() ;
+        currentWorker() = worker ;
+        for (int task = next++ ; task < numTasks ; task = next++) {
+          try {
+            fn(task, worker) ;
+          } catch (...) {
+            std::lock_guard<std::mutex> lock(errorMutex) ;
+            if (!error) { error = std::current_exception() ; }
+            next = numTasks ;
+          }
+        }
+        currentWorker() = enclosing ;
+      }
+
+      void rethrow()
+      {
+        if (error) { std::rethrow_exception(error) ; }
+      }
+
+      Func const &fn ;
+      const int numTasks ;
+      std::atomic<int> next ;
+      std::mutex errorMutex ;
+      std::exception_ptr error ;
+    } ;
+
+    // Start threads until there are `numThreads` of them, or as many as
+    // the system allows, and return their number (with the lock held)
+    int grow(int numThreads)
+    {
+      if ((int)threads.size() < numThreads) {
+        try {
+          threads.reserve(numThreads) ;
+          while ((int)threads.size() < numThreads) {
+            threads.push_back(std::thread(&ThreadPool::loop, this,
+                                          (int)threads.size() + 1,
+                                          generation)) ;
+          }
+        } catch (std::exception const &) {
+          // keep the threads that could be started
+        }
+      }
+      return std::min(numThreads, (int)threads.size()) ;
+    }
+
+    // The loop of a thread, which runs the jobs after the generation
+    // `seen` (the one at which it was started)
+    void loop(int worker, unsigned long seen)
+    {
+      std::unique_lock<std::mutex> lock(mutex) ;
+      for (;;) {
+        wake.wait(lock, [&] { return stopping || generation != seen ; }) ;
+        if (stopping) { return ; }
+        seen = generation ;
+        if (worker >= numJobWorkers) { continue ; }
+        Job *current = job ;
+        lock.unlock() ;
+        current->work(worker) ;
+        lock.lock() ;
+        if (--numPending == 0) { done.notify_one() ; }
+      }
+    }
+
+    std::mutex mutex ;
+    std::condition_variable wake ;
+    std::condition_variable done ;
+    std::vector<std::thread> threads ;
+    Job *job ;
+    int numJobWorkers ;
+    int numPending ;
+    unsigned long generation ;
+    bool stopping ;
+    std::atomic<bool> busy ;
+
+    ThreadPool(ThreadPool const &) ;
+    ThreadPool & operator=(ThreadPool const &) ;
+  } ;
+
+  // The pool of the module (e.g. of a MEX file)
+  inline ThreadPool & getThreadPool()
+  {
+    static ThreadPool pool ;
+    return pool ;
+  }
+
+  // Run fn(task, worker) for every task in [0, numTasks) on `numWorkers`
+  // threads of the pool (including the calling thread) and wait for
+  // completion.  Tasks are handed out dynamically from a shared counter,
+  // so the assignment of tasks to workers is not deterministic: callers
+  // should write results into per-task slots and use `worker` only to
+  // select per-worker scratch space.  With a single worker the tasks are
+  // run in order on the calling thread.  Exceptions thrown by the tasks
+  // are rethrown by parallelFor.
+  template <typename Func>
+  void parallelFor(int numWorkers, int numTasks, Func const &fn)
+  {
+    getThreadPool().run(numWorkers, numTasks, fn) ;
+  }
+
+} }
+
+#endif /* defined(VL_PARALLEL_H) */
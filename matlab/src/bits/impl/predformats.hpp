@@ -0,0 +1,298 @@
+// @file predformats.hpp
+// @brief Readers of network predictions stored in full precision, as
+// IEEE half floats or as affinely quantized bytes
+// @author Samuel Albanie
+// @author Andrea Vedaldi
+
+/*
+Copyright (C) 2017- Samuel Albanie and Andrea Vedaldi.
+All rights reserved.
+
+This file is part of the VLFeat library and is made available under
+the terms of the BSD license (see the COPYING file).
+*/
+
+#ifndef VL_PREDFORMATS_H
+#define VL_PREDFORMATS_H
+
+#include <stdint.h>
+#include <string.h>
+#include <float.h>
+#include <cstddef>
+
+// F16C is selected at runtime when the compiler supports per-function
+// targets, or at compile time when the whole unit is built with -mf16c
+#if defined(__F16C__)
+#define VL_PREDFORMATS_F16C 1
+#define VL_PREDFORMATS_F16C_TARGET
+#include <immintrin.h>
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define VL_PREDFORMATS_F16C 1
+#define VL_PREDFORMATS_F16C_TARGET __attribute__((target("avx,f16c")))
+#include <immintrin.h>
+#endif
+
+namespace vl { namespace impl {
+
+  /* ---------------------------------------------------------------- */
+  /*                                                     half floats */
+  /* ---------------------------------------------------------------- */
+
+  // Exact conversion of an IEEE half float (binary16) to float
+  inline float halfToFloat(uint16_t h)
+  {
+    uint32_t sign = (uint32_t)(h & 0x8000) << 16 ;
+    uint32_t exponent = (h >> 10) & 0x1f ;
+    uint32_t mantissa = h & 0x3ff ;
+    uint32_t bits ;
+    if (exponent == 0x1f) {
+      bits = sign | 0x7f800000 | (mantissa << 13) ;
+    } else if (exponent != 0) {
+      bits = sign | ((exponent + 112) << 23) | (mantissa << 13) ;
+    } else if (mantissa == 0) {
+      bits = sign ;
+    } else {
+      // subnormal: normalise the mantissa
+      exponent = 113 ;
+      while (!(mantissa & 0x400)) {
+        mantissa <<= 1 ;
+        --exponent ;
+      }
+      bits = sign | (exponent << 23) | ((mantissa & 0x3ff) << 13) ;
+    }
+    float x ;
+    memcpy(&x, &bits, sizeof(x)) ;
+    return x ;
+  }
+
+  // Conversion of a float to the nearest half float (ties to even), with
+  // overflows to infinity; NaNs stay NaNs
+  inline uint16_t floatToHalf(float x)
+  {
+    uint32_t bits ;
+    memcpy(&bits, &x, sizeof(bits)) ;
+    uint16_t sign = (uint16_t)((bits >> 16) & 0x8000) ;
+    uint32_t magnitude = bits & 0x7fffffff ;
+    if (magnitude > 0x7f800000) {
+      return sign | 0x7e00 ;
+    }
+    if (magnitude >= 0x477ff000) {
+      // at least 65520, which rounds to infinity
+      return sign | 0x7c00 ;
+    }
+    if (magnitude < 0x38800000) {
+      // below 2^-14: a subnormal half, i.e. a multiple of 2^-24
+      if (magnitude < 0x33000000) {
+        return sign ;
+      }
+      uint32_t exponent = magnitude >> 23 ;
+      uint32_t mantissa = (magnitude & 0x7fffff) | 0x800000 ;
+      uint32_t shift = 126 - exponent ;
+      uint32_t result = mantissa >> shift ;
+      uint32_t rest = mantissa & ((1u << shift) - 1) ;
+      uint32_t halfway = 1u << (shift - 1) ;
+      if (rest > halfway || (rest == halfway && (result & 1))) {
+        ++result ;
+      }
+      return sign | (uint16_t)result ;
+    }
+    uint32_t result = magnitude - 0x38000000 ;
+    uint32_t rest = result & 0x1fff ;
+    result >>= 13 ;
+    if (rest > 0x1000 || (rest == 0x1000 && (result & 1))) {
+      ++result ;
+    }
+    return sign | (uint16_t)result ;
+  }
+
+#ifdef VL_PREDFORMATS_F16C
+  VL_PREDFORMATS_F16C_TARGET
+  inline void halfToFloatF16C(float *out, uint16_t const *in, size_t n)
+  {
+    size_t k = 0 ;
+    for ( ; k + 8 <= n ; k += 8) {
+      __m128i h = _mm_loadu_si128((__m128i const*)(in + k)) ;
+      _mm256_storeu_ps(out + k, _mm256_cvtph_ps(h)) ;
+    }
+    for ( ; k < n ; ++k) {
+      out[k] = halfToFloat(in[k]) ;
+    }
+  }
+
+  inline bool hasF16C()
+  {
+#if defined(__F16C__)
+    return true ;
+#else
+    static const bool supported = __builtin_cpu_supports("f16c") ;
+    return supported ;
+#endif
+  }
+#endif
+
+  // Convert n half floats, using F16C if available
+  inline void halfToFloat(float *out, uint16_t const *in, size_t n)
+  {
+#ifdef VL_PREDFORMATS_F16C
+    if (hasF16C()) {
+      halfToFloatF16C(out, in, n) ;
+      return ;
+    }
+#endif
+    for (size_t k = 0 ; k < n ; ++k) {
+      out[k] = halfToFloat(in[k]) ;
+    }
+  }
+
+  /* ---------------------------------------------------------------- */
+  /*                                                         readers */
+  /* ---------------------------------------------------------------- */
+
+  // The detector reads its predictions through one of the readers below,
+  // which share the same interface:
+  //
+  //   at(i)             the value of element i, in the precision (Value)
+  //                     in which it is written to the output
+  //   value(i)          the value of element i as a float
+  //   key(i)            an ordered key of element i, in the native
+  //                     precision: the value of element i is above a
+  //                     threshold t if, and only if, key(i) is above
+  //                     thresholdKey(t), and no key is below lowestKey()
+  //   toFloat(b, e, o)  convert the elements [b, e) to o[b], ..., o[e-1]
+  //   offset(n)         a reader of the elements from n onwards
+  //
+  // so that scores are thresholded and compared without conversion, and
+  // only the surviving candidates are converted to float.  The values of
+  // the reduced precision formats are exact in float, so the ranking of
+  // the candidates does not depend on the format either.
+
+  // Predictions stored as T (float or double)
+  template <typename T>
+  struct NativePreds
+  {
+    typedef T Value ;
+    typedef float Key ;
+
+    T const *data ;
+
+    explicit NativePreds(T const *data) : data(data) { }
+    NativePreds offset(size_t n) const { return NativePreds(data + n) ; }
+
+    Value at(size_t i) const { return data[i] ; }
+    float value(size_t i) const { return (float)data[i] ; }
+    Key key(size_t i) const { return (float)data[i] ; }
+    static Key lowestKey() { return -FLT_MAX ; }
+    Key thresholdKey(float thresh) const { return thresh ; }
+
+    void toFloat(size_t begin, size_t end, float *out) const
+    {
+      for (size_t k = begin ; k < end ; ++k) {
+        out[k] = (float)data[k] ;
+      }
+    }
+  } ;
+
+  // Predictions stored as IEEE half floats.  The keys order the bit
+  // patterns by value: negative values map to [0x3ff, 0x7fff] (from -inf
+  // to -0), positive ones to [0x8000, 0xfc00] (from +0 to +inf) and NaNs
+  // to -1, so that they never pass a threshold.
+  struct HalfPreds
+  {
+    typedef float Value ;
+    typedef int Key ;
+
+    uint16_t const *data ;
+
+    explicit HalfPreds(uint16_t const *data) : data(data) { }
+    HalfPreds offset(size_t n) const { return HalfPreds(data + n) ; }
+
+    Value at(size_t i) const { return halfToFloat(data[i]) ; }
+    float value(size_t i) const { return halfToFloat(data[i]) ; }
+
+    static Key keyOf(uint16_t h)
+    {
+      if ((h & 0x7fff) > 0x7c00) { return -1 ; }
+      return (h & 0x8000) ? 0xffff - h : h + 0x8000 ;
+    }
+
+    static uint16_t bitsOf(Key key)
+    {
+      return (uint16_t)((key >= 0x8000) ? key - 0x8000 : 0xffff - key) ;
+    }
+
+    Key key(size_t i) const { return keyOf(data[i]) ; }
+    static Key lowestKey() { return -1 ; }
+
+    // The largest key of a value which is not above thresh
+    Key thresholdKey(float thresh) const
+    {
+      Key lo = 0x3ff ;
+      Key hi = 0xfc00 ;
+      if (!(halfToFloat(bitsOf(lo)) <= thresh) ||
+          halfToFloat(bitsOf(hi)) <= thresh) {
+        return hi ; // thresh is NaN or +inf: nothing passes
+      }
+      while (hi - lo > 1) {
+        Key mid = (lo + hi) / 2 ;
+        if (halfToFloat(bitsOf(mid)) <= thresh) {
+          lo = mid ;
+        } else {
+          hi = mid ;
+        }
+      }
+      return lo ;
+    }
+
+    void toFloat(size_t begin, size_t end, float *out) const
+    {
+      halfToFloat(out + begin, data + begin, end - begin) ;
+    }
+  } ;
+
+  // Predictions stored as bytes q, which stand for scale * (q - zeroPoint)
+  // with scale > 0 (so that the keys can be the bytes themselves)
+  struct UInt8Preds
+  {
+    typedef float Value ;
+    typedef int Key ;
+
+    uint8_t const *data ;
+    float scale ;
+    float zeroPoint ;
+
+    UInt8Preds(uint8_t const *data, float scale, float zeroPoint)
+      : data(data), scale(scale), zeroPoint(zeroPoint) { }
+    UInt8Preds offset(size_t n) const
+    {
+      return UInt8Preds(data + n, scale, zeroPoint) ;
+    }
+
+    float dequantize(int q) const { return scale * ((float)q - zeroPoint) ; }
+
+    Value at(size_t i) const { return dequantize(data[i]) ; }
+    float value(size_t i) const { return dequantize(data[i]) ; }
+    Key key(size_t i) const { return data[i] ; }
+    static Key lowestKey() { return -1 ; }
+
+    // The largest byte whose value is not above thresh
+    Key thresholdKey(float thresh) const
+    {
+      if (thresh != thresh) { return 255 ; }
+      Key q = 255 ;
+      while (q >= 0 && dequantize(q) > thresh) {
+        --q ;
+      }
+      return q ;
+    }
+
+    void toFloat(size_t begin, size_t end, float *out) const
+    {
+      for (size_t k = begin ; k < end ; ++k) {
+        out[k] = dequantize(data[k]) ;
+      }
+    }
+  } ;
+
+} }
+
+#endif /* defined(VL_PREDFORMATS_H) */
@@ -0,0 +1,126 @@
+// @file priorbox.hpp
+// @brief Prior box generation (a native version of matlab/vl_nnpriorbox.m)
+// @author Samuel Albanie
+// @author Andrea Vedaldi
+
+/*
+Copyright (C) 2017- Samuel Albanie and Andrea Vedaldi.
+All rights reserved.
+
+This file is part of the VLFeat library and is made available under
+the terms of the BSD license (see the COPYING file).
+*/
+
+#ifndef VL_PRIORBOX_H
+#define VL_PRIORBOX_H
+
+#include <stdint.h>
+#include <cstddef>
+#include <vector>
+
+namespace vl { namespace impl {
+
+  // The prior boxes of one source feature map, with the options of
+  // vl_nnpriorbox.m.  At each of the featureHeight x featureWidth
+  // locations (in row-major order) there is a box of size minSize, one of
+  // size sqrt(minSize * maxSize) if maxSize is positive, and one of area
+  // minSize^2 for each aspect ratio.  The aspect ratios are read as a
+  // column-major aspectRatioRows x K matrix; with flip, each of its columns
+  // is followed by the reciprocals of its ratios, as cat(1, r, 1 ./ r)
+  // orders them, so that a row of ratios [2 3] gives 2, 1/2, 3, 1/3.  A
+  // pixelStep of zero selects imageWidth / featureWidth, which must then
+  // equal imageHeight / featureHeight.
+  struct PriorBoxLayer
+  {
+    int featureHeight ;
+    int featureWidth ;
+    double minSize ;
+    double maxSize ;
+    std::vector<double> aspectRatios ;
+    int aspectRatioRows ;
+    bool flip ;
+    bool clip ;
+    double offset ;
+    double pixelStep ;
+    double variance [4] ;
+
+    // the defaults of vl_nnpriorbox.m, for a 1 x 1 feature map
+    PriorBoxLayer() ;
+
+    // the number of priors at each location
+    int getNumPriorsPerLocation() const ;
+    int getNumPriors() const ;
+  } ;
+
+  // NULL if the layer is valid for an image of the given size, or else
+  // a description of the problem.  Aspect ratios of (nearly) one are
+  // rejected, as the box of ratio one is always generated (the MATLAB code
+  // skips them, leaving zero boxes at the end of the layer).
+  char const * checkPriorBoxLayer(PriorBoxLayer const &layer,
+                                  int imageHeight, int imageWidth) ;
+
+  int countPriorBoxes(PriorBoxLayer const *layers, int numLayers) ;
+
+  // Generate the priors of all the layers, concatenated in the layout used
+  // by the detector: the numPriors [xmin ymin xmax ymax] boxes (relative to
+  // the image size) of the layers in turn, followed by their variances,
+  // i.e. the concatenation along the first dimension of the 4 * numPriors
+  // x 1 x 2 outputs of vl_nnpriorbox.m.  The layers must be valid.  The
+  // coordinates are computed in double precision as by the MATLAB code, so
+  // the results are the same.
+  template <typename T>
+  void makePriorBoxes(T *priors,
+                      PriorBoxLayer const *layers,
+                      int numLayers,
+                      int imageHeight,
+                      int imageWidth) ;
+
+  // The priors of previous calls, keyed by the image size, the layers and
+  // the element type.  The priors only depend on the sizes of the feature
+  // maps and of the image, so for a fixed input resolution they are built
+  // on the first call only, and later calls cost a comparison of the
+  // (small) keys.  A few entries are kept (e.g. for multiscale
+  // evaluation), replacing the least recently used one when full.
+  class PriorBoxCache
+  {
+  public:
+    enum { MAX_ENTRIES = 4 } ;
+
+    PriorBoxCache() : clock(0), numBuilds(0) { }
+
+    // Return the priors of the given (valid) layers, building them on a
+    // miss, and set *numPriors.  The pointer remains valid until the next
+    // call to get() or clear().
+    template <typename T>
+    T const * get(PriorBoxLayer const *layers, int numLayers,
+                  int imageHeight, int imageWidth, int *numPriors) ;
+
+    void clear() ;
+
+    // the number of misses since construction
+    size_t getNumBuilds() const { return numBuilds ; }
+
+  private:
+    struct Entry
+    {
+      std::vector<double> key ;
+      size_t elementSize ;
+      int numPriors ;
+      uint64_t lastUsed ;
+      std::vector<float> singles ;
+      std::vector<double> doubles ;
+    } ;
+
+    static std::vector<float> & buffer(Entry &entry, float const *)
+    { return entry.singles ; }
+    static std::vector<double> & buffer(Entry &entry, double const *)
+    { return entry.doubles ; }
+
+    std::vector<Entry> entries ;
+    uint64_t clock ;
+    size_t numBuilds ;
+  } ;
+
+} }
+
+#endif /* defined(VL_PRIORBOX_H) */
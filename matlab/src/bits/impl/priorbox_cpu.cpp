@@ -0,0 +1,324 @@
+// @file priorbox_cpu.cpp
+// @brief Prior box generation CPU implementation (a native version of
+// matlab/vl_nnpriorbox.m)
+// @author Samuel Albanie
+// @author Andrea Vedaldi
+
+/*
+Copyright (C) 2017- Samuel Albanie and Andrea Vedaldi.
+All rights reserved.
+
+This file is part of the VLFeat library and is made available under
+the terms of the BSD license (see the COPYING file).
+*/
+
+#include "priorbox.hpp"
+#include <math.h>
+#include <string.h>
+#include <vector>
+
+/* ------------------------------------------------------------ */
+/*                                                       useful */
+/* ------------------------------------------------------------ */
+
+static inline bool isFinite(double x)
+{
+  return x - x == 0 ;
+}
+
+// The aspect ratios of the boxes after the first one or two, in the
+// order in which vl_nnpriorbox.m visits them
+static void expandAspectRatios(vl::impl::PriorBoxLayer const &layer,
+                               std::vector<double> *ratios)
+{
+  const int numRows = layer.aspectRatioRows ;
+  const int numColumns = (int)layer.aspectRatios.size() / numRows ;
+  ratios->clear() ;
+  for (int c = 0 ; c < numColumns ; ++c) {
+    double const *column = layer.aspectRatios.data() + c * numRows ;
+    ratios->insert(ratios->end(), column, column + numRows) ;
+    if (layer.flip) {
+      for (int r = 0 ; r < numRows ; ++r) {
+        ratios->push_back(1.0 / column[r]) ;
+      }
+    }
+  }
+}
+
+static inline double clip01(double x)
+{
+  if (x < 0) { return 0 ; }
+  if (x > 1) { return 1 ; }
+  return x ;
+}
+
+// The priors of one layer.  The coordinates of a box only depend on the
+// column (x) or on the row (y) of its location, so they are computed once
+// per column and row and the boxes are then filled by copying.
+template <typename T>
+static void makeLayer(T *boxes,
+                      T *variances,
+                      vl::impl::PriorBoxLayer const &layer,
+                      int imageHeight,
+                      int imageWidth)
+{
+  std::vector<double> ratios ;
+  expandAspectRatios(layer, &ratios) ;
+  std::vector<double> widths, heights ;
+  widths.push_back(layer.minSize) ;
+  heights.push_back(layer.minSize) ;
+  if (layer.maxSize > 0) {
+    double length = sqrt(layer.minSize * layer.maxSize) ;
+    widths.push_back(length) ;
+    heights.push_back(length) ;
+  }
+  for (int k = 0 ; k < ratios.size() ; ++k) {
+    widths.push_back(layer.minSize * sqrt(ratios[k])) ;
+    heights.push_back(layer.minSize / sqrt(ratios[k])) ;
+  }
+  const int numBoxes = (int)widths.size() ;
+  const int height = layer.featureHeight ;
+  const int width = layer.featureWidth ;
+  double step = layer.pixelStep ;
+  if (step == 0) {
+    step = (double)imageWidth / width ;
+  }
+
+  // [min max] of each box at each column and row, with 1-based locations
+  // as in the MATLAB code
+  std::vector<T> xs(2 * width * numBoxes) ;
+  std::vector<T> ys(2 * height * numBoxes) ;
+  for (int j = 0 ; j < width ; ++j) {
+    double centre = ((j + 1) - layer.offset) * step ;
+    for (int b = 0 ; b < numBoxes ; ++b) {
+      double lo = (centre - widths[b] / 2) / imageWidth ;
+      double hi = (centre + widths[b] / 2) / imageWidth ;
+      if (layer.clip) { lo = clip01(lo) ; hi = clip01(hi) ; }
+      xs[2 * (j * numBoxes + b)] = (T)lo ;
+      xs[2 * (j * numBoxes + b) + 1] = (T)hi ;
+    }
+  }
+  for (int i = 0 ; i < height ; ++i) {
+    double centre = ((i + 1) - layer.offset) * step ;
+    for (int b = 0 ; b < numBoxes ; ++b) {
+      double lo = (centre - heights[b] / 2) / imageHeight ;
+      double hi = (centre + heights[b] / 2) / imageHeight ;
+      if (layer.clip) { lo = clip01(lo) ; hi = clip01(hi) ; }
+      ys[2 * (i * numBoxes + b)] = (T)lo ;
+      ys[2 * (i * numBoxes + b) + 1] = (T)hi ;
+    }
+  }
+
+  for (int i = 0 ; i < height ; ++i) {
+    T const *y = ys.data() + 2 * i * numBoxes ;
+    for (int j = 0 ; j < width ; ++j) {
+      T const *x = xs.data() + 2 * j * numBoxes ;
+      for (int b = 0 ; b < numBoxes ; ++b) {
+        boxes[0] = x[2 * b] ;
+        boxes[1] = y[2 * b] ;
+        boxes[2] = x[2 * b + 1] ;
+        boxes[3] = y[2 * b + 1] ;
+        boxes += 4 ;
+      }
+    }
+  }
+
+  const T variance [] = {
+    (T)layer.variance[0], (T)layer.variance[1],
+    (T)layer.variance[2], (T)layer.variance[3]
+  } ;
+  const int numPriors = height * width * numBoxes ;
+  for (int p = 0 ; p < numPriors ; ++p) {
+    memcpy(variances + 4 * p, variance, sizeof(variance)) ;
+  }
+}
+
+namespace vl { namespace impl {
+
+  /* ---------------------------------------------------------------- */
+  /*                                                           layers */
+  /* ---------------------------------------------------------------- */
+
+  PriorBoxLayer::PriorBoxLayer()
+  : featureHeight(1),
+    featureWidth(1),
+    minSize(0.1),
+    maxSize(0.2),
+    aspectRatios(1, 2.0),
+    aspectRatioRows(1),
+    flip(true),
+    clip(false),
+    offset(0.5),
+    pixelStep(1)
+  {
+    variance[0] = 0.1 ; variance[1] = 0.1 ;
+    variance[2] = 0.2 ; variance[3] = 0.2 ;
+  }
+
+  int PriorBoxLayer::getNumPriorsPerLocation() const
+  {
+    return 1 + (maxSize > 0) + (int)aspectRatios.size() * (flip ? 2 : 1) ;
+  }
+
+  int PriorBoxLayer::getNumPriors() const
+  {
+    return featureHeight * featureWidth * getNumPriorsPerLocation() ;
+  }
+
+  char const * checkPriorBoxLayer(PriorBoxLayer const &layer,
+                                  int imageHeight, int imageWidth)
+  {
+    if (imageHeight <= 0 || imageWidth <= 0) {
+      return "the image is empty" ;
+    }
+    if (layer.featureHeight <= 0 || layer.featureWidth <= 0) {
+      return "the feature map is empty" ;
+    }
+    if (!(layer.minSize > 0) || !isFinite(layer.minSize)) {
+      return "minSize is not a positive number" ;
+    }
+    if (!(layer.maxSize >= 0) || !isFinite(layer.maxSize)) {
+      return "maxSize is not a non-negative number" ;
+    }
+    if (layer.aspectRatioRows <= 0 ||
+        layer.aspectRatios.size() % layer.aspectRatioRows != 0) {
+      return "the aspect ratios are not a matrix" ;
+    }
+    std::vector<double> ratios ;
+    expandAspectRatios(layer, &ratios) ;
+    for (int k = 0 ; k < ratios.size() ; ++k) {
+      if (!(ratios[k] > 0) || !isFinite(ratios[k])) {
+        return "an aspect ratio is not a positive number" ;
+      }
+      if (fabs(ratios[k] - 1) < 1e-6) {
+        return "an aspect ratio is one (the box of ratio one is implicit)" ;
+      }
+    }
+    if (!isFinite(layer.offset)) {
+      return "offset is not finite" ;
+    }
+    if (!(layer.pixelStep >= 0) || !isFinite(layer.pixelStep)) {
+      return "pixelStep is not a non-negative number" ;
+    }
+    if (layer.pixelStep == 0 &&
+        (double)imageWidth / layer.featureWidth !=
+        (double)imageHeight / layer.featureHeight) {
+      return "a pixelStep of zero requires the same step along both axes" ;
+    }
+    return NULL ;
+  }
+
+  int countPriorBoxes(PriorBoxLayer const *layers, int numLayers)
+  {
+    int numPriors = 0 ;
+    for (int l = 0 ; l < numLayers ; ++l) {
+      numPriors += layers[l].getNumPriors() ;
+    }
+    return numPriors ;
+  }
+
+  template <typename T>
+  void makePriorBoxes(T *priors,
+                      PriorBoxLayer const *layers,
+                      int numLayers,
+                      int imageHeight,
+                      int imageWidth)
+  {
+    const int numPriors = countPriorBoxes(layers, numLayers) ;
+    T *boxes = priors ;
+    T *variances = priors + 4 * (size_t)numPriors ;
+    for (int l = 0 ; l < numLayers ; ++l) {
+      makeLayer(boxes, variances, layers[l], imageHeight, imageWidth) ;
+      boxes += 4 * (size_t)layers[l].getNumPriors() ;
+      variances += 4 * (size_t)layers[l].getNumPriors() ;
+    }
+  }
+
+  /* ---------------------------------------------------------------- */
+  /*                                                            cache */
+  /* ---------------------------------------------------------------- */
+
+  static void makeKey(PriorBoxLayer const *layers, int numLayers,
+                      int imageHeight, int imageWidth,
+                      std::vector<double> *key)
+  {
+    key->clear() ;
+    key->push_back(imageHeight) ;
+    key->push_back(imageWidth) ;
+    key->push_back(numLayers) ;
+    for (int l = 0 ; l < numLayers ; ++l) {
+      PriorBoxLayer const &layer = layers[l] ;
+      key->push_back(layer.featureHeight) ;
+      key->push_back(layer.featureWidth) ;
+      key->push_back(layer.minSize) ;
+      key->push_back(layer.maxSize) ;
+      key->push_back(layer.aspectRatioRows) ;
+      key->push_back(layer.aspectRatios.size()) ;
+      key->insert(key->end(), layer.aspectRatios.begin(),
+                  layer.aspectRatios.end()) ;
+      key->push_back(layer.flip) ;
+      key->push_back(layer.clip) ;
+      key->push_back(layer.offset) ;
+      key->push_back(layer.pixelStep) ;
+      key->insert(key->end(), layer.variance, layer.variance + 4) ;
+    }
+  }
+
+  template <typename T>
+  T const * PriorBoxCache::get(PriorBoxLayer const *layers, int numLayers,
+                               int imageHeight, int imageWidth,
+                               int *numPriors)
+  {
+    std::vector<double> key ;
+    makeKey(layers, numLayers, imageHeight, imageWidth, &key) ;
+    ++clock ;
+    for (size_t e = 0 ; e < entries.size() ; ++e) {
+      Entry &entry = entries[e] ;
+      if (entry.elementSize == sizeof(T) &&
+          entry.key.size() == key.size() &&
+          memcmp(entry.key.data(), key.data(),
+                 key.size() * sizeof(double)) == 0) {
+        entry.lastUsed = clock ;
+        *numPriors = entry.numPriors ;
+        return buffer(entry, (T const*)NULL).data() ;
+      }
+    }
+    size_t slot = entries.size() ;
+    if (slot < MAX_ENTRIES) {
+      entries.push_back(Entry()) ;
+    } else {
+      slot = 0 ;
+      for (size_t e = 1 ; e < entries.size() ; ++e) {
+        if (entries[e].lastUsed < entries[slot].lastUsed) { slot = e ; }
+      }
+      entries[slot] = Entry() ;
+    }
+    Entry &entry = entries[slot] ;
+    entry.key.swap(key) ;
+    entry.elementSize = sizeof(T) ;
+    entry.numPriors = countPriorBoxes(layers, numLayers) ;
+    entry.lastUsed = clock ;
+    std::vector<T> &priors = buffer(entry, (T const*)NULL) ;
+    priors.resize(8 * (size_t)entry.numPriors) ;
+    makePriorBoxes(priors.data(), layers, numLayers, imageHeight, imageWidth) ;
+    ++numBuilds ;
+    *numPriors = entry.numPriors ;
+    return priors.data() ;
+  }
+
+  void PriorBoxCache::clear()
+  {
+    entries.clear() ;
+    clock = 0 ;
+  }
+
+} }
+
+template void vl::impl::makePriorBoxes<float>(float *,
+  vl::impl::PriorBoxLayer const *, int, int, int) ;
+template void vl::impl::makePriorBoxes<double>(double *,
+  vl::impl::PriorBoxLayer const *, int, int, int) ;
+template float const * vl::impl::PriorBoxCache::get<float>(
+  vl::impl::PriorBoxLayer const *, int, int, int, int *) ;
+template double const * vl::impl::PriorBoxCache::get<double>(
+  vl::impl::PriorBoxLayer const *, int, int, int, int *) ;
@@ -0,0 +1,134 @@
+// @file priorcache.hpp
+// @brief Cache of tables derived from the priors that persists across
+// calls to the multibox detector and prior matcher
+// @author Samuel Albanie
+// @author Andrea Vedaldi
+
+/*
+Copyright (C) 2017- Samuel Albanie and Andrea Vedaldi.
+All rights reserved.
+
+This file is part of the VLFeat library and is made available under
+the terms of the BSD license (see the COPYING file).
+*/
+
+#ifndef VL_PRIORCACHE_H
+#define VL_PRIORCACHE_H
+
+#include "boxdecoder.hpp"
+
+#include <stdint.h>
+#include <string.h>
+#include <cstddef>
+#include <algorithm>
+#include <vector>
+
+namespace vl { namespace impl {
+
+  // FNV-1a style 64-bit hash of a sample of (at most) `maxSamples` evenly spaced
+  // 8-byte words of a block of memory, and of its size.  This is cheap
+  // enough to compute on every call and is used to select candidate cache
+  // entries, which are then validated against the full contents.
+  inline uint64_t sampleHash(void const *data, size_t numBytes,
+                             size_t maxSamples = 256)
+  {
+    const uint64_t prime = 0x100000001b3ULL ;
+    unsigned char const *bytes = (unsigned char const*)data ;
+    uint64_t hash = 0xcbf29ce484222325ULL ^ numBytes ;
+    const size_t numWords = numBytes / sizeof(uint64_t) ;
+    const size_t step = std::max((size_t)1, numWords / maxSamples) ;
+    for (size_t w = 0 ; w < numWords ; w += step) {
+      uint64_t word ;
+      memcpy(&word, bytes + w * sizeof(word), sizeof(word)) ;
+      hash = (hash ^ word) * prime ;
+    }
+    for (size_t j = numWords * sizeof(uint64_t) ; j < numBytes ; ++j) {
+      hash = (hash ^ bytes[j]) * prime ;
+    }
+    return hash ;
+  }
+
+  // Tables built from the priors of previous calls, keyed by the number
+  // of priors, the element size and a hash of the contents of the priors
+  // tensor.  As the hash only samples the priors, a match is confirmed by
+  // comparing against a copy of the priors held by the entry, so that a
+  // stale table is never returned.  The priors of a deployed model do not
+  // change between forward passes, so a table is normally built on the
+  // first call only and later calls cost a single memcmp.
+  // A few entries are kept so that several networks (e.g. for multiscale
+  // evaluation) can share the cache; when it is full, the least recently
+  // used entry is replaced.  A Table must provide
+  // `template <typename T> void init(T const *priors, int numPriors)`.
+  template <class Table>
+  class TableCache
+  {
+  public:
+    enum { MAX_ENTRIES = 4 } ;
+
+    TableCache() : clock(0) { }
+
+    // Return the table for the given priors, building it on a miss.  The
+    // reference remains valid until the next call to get() or clear().
+    template <typename T>
+    Table const & get(T const *priors, int numPriors)
+    {
+      const size_t numBytes = (size_t)numPriors * 8 * sizeof(T) ;
+      const uint64_t hash = sampleHash(priors, numBytes) ;
+      ++clock ;
+      for (size_t e = 0 ; e < entries.size() ; ++e) {
+        Entry &entry = entries[e] ;
+        if (entry.numPriors == numPriors &&
+            entry.elementSize == sizeof(T) &&
+            entry.hash == hash &&
+            memcmp(entry.contents.data(), priors, numBytes) == 0) {
+          entry.lastUsed = clock ;
+          return entry.table ;
+        }
+      }
+      size_t slot = entries.size() ;
+      if (slot < MAX_ENTRIES) {
+        entries.push_back(Entry()) ;
+      } else {
+        slot = 0 ;
+        for (size_t e = 1 ; e < entries.size() ; ++e) {
+          if (entries[e].lastUsed < entries[slot].lastUsed) { slot = e ; }
+        }
+      }
+      Entry &entry = entries[slot] ;
+      entry.numPriors = numPriors ;
+      entry.elementSize = sizeof(T) ;
+      entry.hash = hash ;
+      entry.lastUsed = clock ;
+      entry.contents.resize(numBytes) ;
+      memcpy(entry.contents.data(), priors, numBytes) ;
+      entry.table.init(priors, numPriors) ;
+      return entry.table ;
+    }
+
+    void clear()
+    {
+      entries.clear() ;
+      clock = 0 ;
+    }
+
+  private:
+    struct Entry
+    {
+      int numPriors ;
+      size_t elementSize ;
+      uint64_t hash ;
+      uint64_t lastUsed ;
+      std::vector<unsigned char> contents ;
+      Table table ;
+    } ;
+
+    std::vector<Entry> entries ;
+    uint64_t clock ;
+  } ;
+
+  // The prior geometry tables of the detector
+  class PriorCache : public TableCache<PriorTable> { } ;
+
+} }
+
+#endif /* defined(VL_PRIORCACHE_H) */
@@ -0,0 +1,207 @@
+// @file priorgrid.hpp
+// @brief Spatial index over a fixed set of prior boxes
+// @author Samuel Albanie
+// @author Andrea Vedaldi
+
+/*
+Copyright (C) 2017- Samuel Albanie and Andrea Vedaldi.
+All rights reserved.
+
+This file is part of the VLFeat library and is made available under
+the terms of the BSD license (see the COPYING file).
+*/
+
+#ifndef VL_PRIORGRID_H
+#define VL_PRIORGRID_H
+
+#include "priorcache.hpp"
+
+#include <math.h>
+#include <float.h>
+#include <algorithm>
+#include <vector>
+
+namespace vl { namespace impl {
+
+  // Finds the priors which may overlap a query box without testing every
+  // prior.  The priors of an SSD model come in a few scales, each tiled
+  // densely over the image, so they are split into levels by size (the
+  // priors of level k are at most 2^-k wide and high) and each level is
+  // bucketed into a uniform grid, by the centre of the priors, whose cells
+  // are about half as large as the priors themselves.  A prior of a level can
+  // only overlap a box if its centre lies within the box grown by the
+  // largest half-size of the priors of the level, so a query only visits
+  // the few cells around the box in each level.
+  //
+  // The priors are given in the layout used by the detector (numPriors
+  // [xmin ymin xmax ymax] boxes, followed by the variances, which are not
+  // used here), and are stored in double precision so that overlaps are
+  // computed exactly as from the original values.  Priors which cross the
+  // image boundary are flagged, so that they can be ignored by the prior
+  // matcher.
+  class PriorGrid
+  {
+  public:
+    PriorGrid() : numPriors(0) { }
+
+    template <typename T>
+    void init(T const *priors, int numPriors_)
+    {
+      numPriors = numPriors_ ;
+      xmin.resize(numPriors) ; ymin.resize(numPriors) ;
+      xmax.resize(numPriors) ; ymax.resize(numPriors) ;
+      boundary.resize(numPriors) ;
+      std::vector<int> levelOf(numPriors) ;
+      int numLevels = 1 ;
+      for (int p = 0 ; p < numPriors ; ++p) {
+        xmin[p] = priors[4 * p] ; ymin[p] = priors[4 * p + 1] ;
+        xmax[p] = priors[4 * p + 2] ; ymax[p] = priors[4 * p + 3] ;
+        boundary[p] = (priors[4 * p] < 0 || priors[4 * p + 1] < 0 ||
+                       priors[4 * p + 2] > 1 || priors[4 * p + 3] > 1) ;
+        double extent = std::max(xmax[p] - xmin[p], ymax[p] - ymin[p]) ;
+        int level = 0 ;
+        if (extent > 0 && extent < 1) {
+          level = std::min((int)floor(-log2(extent)), (int)MAX_LEVEL) ;
+        }
+        levelOf[p] = level ;
+        numLevels = std::max(numLevels, level + 1) ;
+      }
+
+      levels.assign(numLevels, Level()) ;
+      for (int p = 0 ; p < numPriors ; ++p) {
+        Level &level = levels[levelOf[p]] ;
+        double cx = (xmin[p] + xmax[p]) / 2 ;
+        double cy = (ymin[p] + ymax[p]) / 2 ;
+        level.originX = std::min(level.originX, cx) ;
+        level.originY = std::min(level.originY, cy) ;
+        level.endX = std::max(level.endX, cx) ;
+        level.endY = std::max(level.endY, cy) ;
+        level.halfWidth = std::max(level.halfWidth, (xmax[p] - xmin[p]) / 2) ;
+        level.halfHeight = std::max(level.halfHeight, (ymax[p] - ymin[p]) / 2) ;
+        level.numPriors++ ;
+      }
+
+      for (int l = 0 ; l < numLevels ; ++l) {
+        Level &level = levels[l] ;
+        if (level.numPriors == 0) { continue ; }
+        // cells half as large as the priors, but no more cells than priors
+        level.cellSize = ldexp(1.0, -l - 1) ;
+        while (true) {
+          level.numCellsX = (int)((level.endX - level.originX) / level.cellSize) + 1 ;
+          level.numCellsY = (int)((level.endY - level.originY) / level.cellSize) + 1 ;
+          if ((double)level.numCellsX * level.numCellsY <= level.numPriors) { break ; }
+          level.cellSize *= 2 ;
+        }
+        level.cellOffsets.assign(level.numCellsX * level.numCellsY + 1, 0) ;
+      }
+
+      // bucket the priors by cell, in ascending order within each cell
+      std::vector<int> cellOf(numPriors) ;
+      for (int p = 0 ; p < numPriors ; ++p) {
+        Level &level = levels[levelOf[p]] ;
+        int ix = cellIndex((xmin[p] + xmax[p]) / 2 - level.originX, level.cellSize, level.numCellsX) ;
+        int iy = cellIndex((ymin[p] + ymax[p]) / 2 - level.originY, level.cellSize, level.numCellsY) ;
+        cellOf[p] = ix + iy * level.numCellsX ;
+        level.cellOffsets[cellOf[p] + 1]++ ;
+      }
+      for (int l = 0 ; l < numLevels ; ++l) {
+        Level &level = levels[l] ;
+        for (int c = 1 ; c < level.cellOffsets.size() ; ++c) {
+          level.cellOffsets[c] += level.cellOffsets[c - 1] ;
+        }
+        level.priorIdx.resize(level.numPriors) ;
+      }
+      std::vector<std::vector<int> > fill(numLevels) ;
+      for (int l = 0 ; l < numLevels ; ++l) {
+        fill[l].assign(levels[l].cellOffsets.begin(), levels[l].cellOffsets.end()) ;
+      }
+      for (int p = 0 ; p < numPriors ; ++p) {
+        Level &level = levels[levelOf[p]] ;
+        level.priorIdx[fill[levelOf[p]][cellOf[p]]++] = p ;
+      }
+    }
+
+    int getNumPriors() const { return numPriors ; }
+
+    bool isBoundary(int p) const { return boundary[p] ; }
+
+    // Intersection over union of prior p and the box [x0 y0 x1 y1]
+    double overlap(int p, double x0, double y0, double x1, double y1) const
+    {
+      double w = std::min(xmax[p], x1) - std::max(xmin[p], x0) ;
+      double h = std::min(ymax[p], y1) - std::max(ymin[p], y0) ;
+      if (w <= 0 || h <= 0) { return 0 ; }
+      double inter = w * h ;
+      return inter / ((xmax[p] - xmin[p]) * (ymax[p] - ymin[p]) +
+                      (x1 - x0) * (y1 - y0) - inter) ;
+    }
+
+    // Call fn(p) for every prior p which may overlap the box [x0 y0 x1 y1].
+    // Every prior which does overlap it is visited exactly once (others
+    // may be visited too); the order of the visits is unspecified.
+    template <typename Func>
+    void forEachCandidate(double x0, double y0, double x1, double y1,
+                          Func const &fn) const
+    {
+      for (int l = 0 ; l < levels.size() ; ++l) {
+        Level const &level = levels[l] ;
+        if (level.numPriors == 0) { continue ; }
+        // a margin guards against rounding in the centres
+        const double mx = level.halfWidth * (1 + 1e-6) + 1e-9 ;
+        const double my = level.halfHeight * (1 + 1e-6) + 1e-9 ;
+        if (x1 + mx < level.originX || y1 + my < level.originY ||
+            x0 - mx > level.endX || y0 - my > level.endY) {
+          continue ;
+        }
+        const int ix0 = cellIndex(x0 - mx - level.originX, level.cellSize, level.numCellsX) ;
+        const int ix1 = cellIndex(x1 + mx - level.originX, level.cellSize, level.numCellsX) ;
+        const int iy0 = cellIndex(y0 - my - level.originY, level.cellSize, level.numCellsY) ;
+        const int iy1 = cellIndex(y1 + my - level.originY, level.cellSize, level.numCellsY) ;
+        for (int iy = iy0 ; iy <= iy1 ; ++iy) {
+          int const *offsets = level.cellOffsets.data() + iy * level.numCellsX ;
+          for (int k = offsets[ix0] ; k < offsets[ix1 + 1] ; ++k) {
+            fn(level.priorIdx[k]) ;
+          }
+        }
+      }
+    }
+
+  private:
+    enum { MAX_LEVEL = 12 } ;
+
+    struct Level
+    {
+      Level()
+      : numPriors(0), originX(DBL_MAX), originY(DBL_MAX),
+        endX(-DBL_MAX), endY(-DBL_MAX), halfWidth(0), halfHeight(0),
+        cellSize(1), numCellsX(0), numCellsY(0) { }
+
+      int numPriors ;
+      double originX, originY ; // smallest centre coordinates
+      double endX, endY ;       // largest centre coordinates
+      double halfWidth ;        // largest half-size of the priors
+      double halfHeight ;
+      double cellSize ;
+      int numCellsX, numCellsY ;
+      std::vector<int> cellOffsets ; // priors of cell c: [offsets[c], offsets[c+1])
+      std::vector<int> priorIdx ;
+    } ;
+
+    static int cellIndex(double offset, double cellSize, int numCells)
+    {
+      double i = floor(offset / cellSize) ;
+      return (int)std::max(0.0, std::min(i, (double)(numCells - 1))) ;
+    }
+
+    int numPriors ;
+    std::vector<double> xmin, ymin, xmax, ymax ;
+    std::vector<unsigned char> boundary ;
+    std::vector<Level> levels ;
+  } ;
+
+  // Grids of the priors of previous calls to the prior matcher
+  class PriorGridCache : public TableCache<PriorGrid> { } ;
+
+} }
+
+#endif /* defined(VL_PRIORGRID_H) */
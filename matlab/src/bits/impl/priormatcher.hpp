@@ -0,0 +1,74 @@
+// @file priormatcher.hpp
+// @brief Matching of prior boxes against ground truth boxes
+// @author Samuel Albanie
+// @author Andrea Vedaldi
+
+/*
+Copyright (C) 2017- Samuel Albanie and Andrea Vedaldi.
+All rights reserved.
+
+This file is part of the VLFeat library and is made available under
+the terms of the BSD license (see the COPYING file).
+*/
+
+#ifndef VL_PRIORMATCHER_H
+#define VL_PRIORMATCHER_H
+
+#include "priorgrid.hpp"
+#include <vector>
+
+namespace vl { namespace impl {
+
+  // The priors matched to each ground truth box of an image: idx[g] holds
+  // the (0-based, ascending) indices of the priors assigned to box g
+  struct PriorMatches
+  {
+    std::vector<std::vector<int> > idx ;
+  } ;
+
+  // Match the priors of `grid` against the ground truth boxes of an image,
+  // as done by matlab/matchPriors.m (with the 'overlap' match ranker):
+  //
+  // 1. every box is matched to its best overlapping prior, and to all
+  //    priors whose overlap with it exceeds `overlapThreshold`
+  // 2. each matched prior is assigned to the box it overlaps most
+  // 3. for as many rounds as there are boxes, the (prior, box) pair with
+  //    the largest overlap among the remaining priors and boxes is fixed,
+  //    so that (where possible) every box keeps at least one prior
+  //
+  // Ties are resolved in favour of the lowest prior and box indices, as
+  // by MATLAB's max.  If `ignoreBoundary` is true, priors which cross the
+  // image boundary have no overlap with any box.
+  //
+  // The numGtBoxes boxes are stored column-major as a numGtBoxes x 4
+  // [xmin ymin xmax ymax] matrix.  If `overlaps` is not NULL it must point
+  // to a zero-filled numGtBoxes x numPriors (column-major) matrix, which
+  // receives the overlap of every box with every prior.  Only the priors
+  // found by the grid near each box are tested.
+  template <typename T>
+  void matchPriors(PriorGrid const &grid,
+                   T const *gtBoxes,
+                   int numGtBoxes,
+                   double overlapThreshold,
+                   bool ignoreBoundary,
+                   double *overlaps,
+                   PriorMatches *matches) ;
+
+  // Match the images of a batch on `numThreads` threads (a non-positive
+  // value selects the number of hardware threads).  gtBoxes[i],
+  // numGtBoxes[i] and overlaps[i] describe image i as above (overlaps may
+  // be NULL).  The result does not depend on the number of threads.
+  template <typename T>
+  void matchPriorsBatch(PriorGrid const &grid,
+                        T const * const *gtBoxes,
+                        int const *numGtBoxes,
+                        int batchSize,
+                        double overlapThreshold,
+                        bool ignoreBoundary,
+                        double * const *overlaps,
+                        int numThreads,
+                        PriorMatches *matches) ;
+
+} }
+
+#endif /* defined(VL_PRIORMATCHER_H) */
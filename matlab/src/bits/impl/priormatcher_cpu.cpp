@@ -0,0 +1,167 @@
+// @file priormatcher_cpu.cpp
+// @brief Prior matching CPU implementation (a native version of
+// matlab/matchPriors.m)
+// @author Samuel Albanie
+// @author Andrea Vedaldi
+
+/*
+Copyright (C) 2017- Samuel Albanie and Andrea Vedaldi.
+All rights reserved.
+
+This file is part of the VLFeat library and is made available under
+the terms of the BSD license (see the COPYING file).
+*/
+
+#include "priormatcher.hpp"
+#include "parallel.hpp"
+#include <float.h>
+#include <algorithm>
+#include <vector>
+
+/* ------------------------------------------------------------ */
+/*                                                       useful */
+/* ------------------------------------------------------------ */
+
+// Overlap of prior p with a box, taking into account ignored priors
+static inline double priorOverlap(const vl::impl::PriorGrid &grid,
+                                  const int p,
+                                  const double *box,
+                                  const bool ignoreBoundary)
+{
+    if (ignoreBoundary && grid.isBoundary(p)) {
+        return 0 ;
+    }
+    return grid.overlap(p, box[0], box[1], box[2], box[3]) ;
+}
+
+namespace vl { namespace impl {
+
+  template <typename T>
+  void matchPriors(PriorGrid const &grid,
+                   T const *gtBoxes,
+                   int numGtBoxes,
+                   double overlapThreshold,
+                   bool ignoreBoundary,
+                   double *overlaps,
+                   PriorMatches *matches)
+  {
+    const int numGt = numGtBoxes ;
+    std::vector<double> boxes(numGt * 4) ;
+    for (int g = 0 ; g < numGt ; ++g) {
+      for (int k = 0 ; k < 4 ; ++k) {
+        boxes[4 * g + k] = gtBoxes[g + k * numGt] ;
+      }
+    }
+
+    // 1. The best prior of each box and the priors above the threshold.
+    // Every prior which is not visited has no overlap with the box, so
+    // the best prior of a box which overlaps no prior is the first one.
+    std::vector<int> matched ;
+    for (int g = 0 ; g < numGt ; ++g) {
+      const double *box = &boxes[4 * g] ;
+      int best = 0 ;
+      double bestOverlap = 0 ;
+      grid.forEachCandidate(box[0], box[1], box[2], box[3], [&](int p) {
+          double overlap = priorOverlap(grid, p, box, ignoreBoundary) ;
+          if (overlap <= 0) {
+              return ;
+          }
+          if (overlaps) {
+              overlaps[g + (size_t)p * numGt] = overlap ;
+          }
+          if (overlap > bestOverlap || (overlap == bestOverlap && p < best)) {
+              best = p ;
+              bestOverlap = overlap ;
+          }
+          if (overlap > overlapThreshold) {
+              matched.push_back(p) ;
+          }
+      }) ;
+      matched.push_back(best) ;
+    }
+    std::sort(matched.begin(), matched.end()) ;
+    matched.erase(std::unique(matched.begin(), matched.end()), matched.end()) ;
+    const int numMatched = matched.size() ;
+
+    // 2. Assign each matched prior to the box it overlaps most.  The
+    // overlaps of the matched priors are kept as a numMatched x numGt
+    // (column-major) matrix.
+    std::vector<double> matchOverlaps((size_t)numMatched * numGt) ;
+    std::vector<int> assignments(numMatched, 0) ;
+    for (int u = 0 ; u < numMatched ; ++u) {
+      double best = -DBL_MAX ;
+      for (int g = 0 ; g < numGt ; ++g) {
+        double overlap = priorOverlap(grid, matched[u], &boxes[4 * g],
+                                      ignoreBoundary) ;
+        matchOverlaps[u + (size_t)g * numMatched] = overlap ;
+        if (overlap > best) {
+          best = overlap ;
+          assignments[u] = g ;
+        }
+      }
+    }
+
+    // 3. Fix the pairs with the largest overlap in turn.  Used pairs are
+    // marked with -DBL_MAX (-Inf in MATLAB).  As in MATLAB, the first 
+    // maximum in column-major order is taken, and once all pairs are used
+    // up the maximum is the first element.
+    for (int round = 0 ; round < numGt ; ++round) {
+      int row = 0, col = 0 ;
+      double best = -DBL_MAX ;
+      for (int g = 0 ; g < numGt ; ++g) {
+        for (int u = 0 ; u < numMatched ; ++u) {
+          if (matchOverlaps[u + (size_t)g * numMatched] > best) {
+            best = matchOverlaps[u + (size_t)g * numMatched] ;
+            row = u ;
+            col = g ;
+          }
+        }
+      }
+      assignments[row] = col ;
+      for (int g = 0 ; g < numGt ; ++g) {
+        matchOverlaps[row + (size_t)g * numMatched] = -DBL_MAX ;
+      }
+      for (int u = 0 ; u < numMatched ; ++u) {
+        matchOverlaps[u + (size_t)col * numMatched] = -DBL_MAX ;
+      }
+    }
+
+    matches->idx.assign(numGt, std::vector<int>()) ;
+    for (int u = 0 ; u < numMatched ; ++u) {
+      matches->idx[assignments[u]].push_back(matched[u]) ;
+    }
+  }
+
+  template <typename T>
+  void matchPriorsBatch(PriorGrid const &grid,
+                        T const * const *gtBoxes,
+                        int const *numGtBoxes,
+                        int batchSize,
+                        double overlapThreshold,
+                        bool ignoreBoundary,
+                        double * const *overlaps,
+                        int numThreads,
+                        PriorMatches *matches)
+  {
+    const int numWorkers = getNumWorkers(numThreads, batchSize) ;
+    parallelFor(numWorkers, batchSize, [&](int i, int worker) {
+        matchPriors(grid, gtBoxes[i], numGtBoxes[i], overlapThreshold,
+                    ignoreBoundary, overlaps ? overlaps[i] : NULL,
+                    &matches[i]) ;
+    }) ;
+  }
+
+} } // namespace vl::impl
+
+// ground truth boxes are commonly stored in either precision,
+// independently of the precision of the network
+template void vl::impl::matchPriors<float>(vl::impl::PriorGrid const &,
+    float const *, int, double, bool, double *, vl::impl::PriorMatches *) ;
+template void vl::impl::matchPriors<double>(vl::impl::PriorGrid const &,
+    double const *, int, double, bool, double *, vl::impl::PriorMatches *) ;
+template void vl::impl::matchPriorsBatch<float>(vl::impl::PriorGrid const &,
+    float const * const *, int const *, int, double, bool, double * const *,
+    int, vl::impl::PriorMatches *) ;
+template void vl::impl::matchPriorsBatch<double>(vl::impl::PriorGrid const &,
+    double const * const *, int const *, int, double, bool, double * const *,
+    int, vl::impl::PriorMatches *) ;
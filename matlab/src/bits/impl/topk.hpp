@@ -0,0 +1,161 @@
+// @file topk.hpp
+// @brief Partial selection of the top scoring candidates (shared by the
+// CPU detector and the host-side stage of the GPU detector)
+// @author Samuel Albanie
+// @author Andrea Vedaldi
+
+/*
+Copyright (C) 2017- Samuel Albanie and Andrea Vedaldi.
+All rights reserved.
+
+This file is part of the VLFeat library and is made available under
+the terms of the BSD license (see the COPYING file).
+*/
+
+#ifndef VL_TOPK_H
+#define VL_TOPK_H
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+namespace vl { namespace impl {
+
+  // Descending order of score, with ties broken by ascending index.  When
+  // the pairs are generated in order of index, this is a strict total order
+  // which reproduces the order given by a stable sort on the score alone.
+  inline bool scoreIndexDescend(std::pair<float, int> const &pairA,
+                                std::pair<float, int> const &pairB)
+  {
+    return pairA.first > pairB.first ||
+           (pairA.first == pairB.first && pairA.second < pairB.second) ;
+  }
+
+  // Sort the (score, index) pairs in descending order of score and keep
+  // the first topK (-1 to keep all of them).  Only the top k elements are
+  // fully sorted: the rest are discarded after a linear-time selection.
+  inline void selectTopK(std::vector<std::pair<float, int> > &scoreIndexPairs,
+                         int topK)
+  {
+    if (topK > -1 && topK < (int)scoreIndexPairs.size()) {
+      std::nth_element(scoreIndexPairs.begin(),
+                       scoreIndexPairs.begin() + topK,
+                       scoreIndexPairs.end(), scoreIndexDescend) ;
+      scoreIndexPairs.resize(topK) ;
+    }
+    std::sort(scoreIndexPairs.begin(), scoreIndexPairs.end(),
+              scoreIndexDescend) ;
+  }
+
+  // Head of a list during a k-way merge
+  struct MergeHead
+  {
+    float score ;
+    int list ;
+    int pos ;
+  } ;
+
+  // Heap order for the k-way merge: the highest score comes out first,
+  // with ties broken by list, then by position in the list
+  inline bool mergeHeadAfter(MergeHead const &headA, MergeHead const &headB)
+  {
+    if (headA.score != headB.score) {
+      return headA.score < headB.score ;
+    }
+    if (headA.list != headB.list) {
+      return headA.list > headB.list ;
+    }
+    return headA.pos > headB.pos ;
+  }
+
+  // Select the k highest scoring elements across numLists lists, each of
+  // which is sorted in descending order of score.  List l occupies
+  // scores[offsets[l]] to scores[offsets[l+1] - 1].  Since the lists are
+  // sorted, the selection is a prefix of every list: on return, take[l]
+  // holds the length of the prefix of list l that was selected.  Ties are
+  // broken in favour of the lower list index (i.e. the selection matches a
+  // stable sort of the concatenated lists).  The cost is O(k log numLists).
+  inline void mergeTopK(float const *scores,
+                        int const *offsets,
+                        int numLists,
+                        int k,
+                        std::vector<int> *take,
+                        std::vector<MergeHead> &heap)
+  {
+    take->assign(numLists, 0) ;
+    heap.clear() ;
+    for (int l = 0 ; l < numLists ; ++l) {
+      if (offsets[l + 1] > offsets[l]) {
+        MergeHead head = { scores[offsets[l]], l, offsets[l] } ;
+        heap.push_back(head) ;
+      }
+    }
+    std::make_heap(heap.begin(), heap.end(), mergeHeadAfter) ;
+    for (int n = 0 ; n < k && !heap.empty() ; ++n) {
+      std::pop_heap(heap.begin(), heap.end(), mergeHeadAfter) ;
+      MergeHead &head = heap.back() ;
+      (*take)[head.list]++ ;
+      if (++head.pos < offsets[head.list + 1]) {
+        head.score = scores[head.pos] ;
+        std::push_heap(heap.begin(), heap.end(), mergeHeadAfter) ;
+      } else {
+        heap.pop_back() ;
+      }
+    }
+  }
+
+  // A scored candidate of some label, for ranking across labels
+  struct LabelledScore
+  {
+    float score ;
+    int label ;
+    int index ;
+  } ;
+
+  // Descending order of score, with ties broken by ascending label, then
+  // by ascending index.  Within a label this is the order given by
+  // scoreIndexDescend, and across labels it is the order in which
+  // mergeTopK selects from lists sorted by label.
+  inline bool labelledScoreDescend(LabelledScore const &candA,
+                                   LabelledScore const &candB)
+  {
+    if (candA.score != candB.score) {
+      return candA.score > candB.score ;
+    }
+    if (candA.label != candB.label) {
+      return candA.label < candB.label ;
+    }
+    return candA.index < candB.index ;
+  }
+
+  // Rank the candidates of numLabels labels with a single sort.  Label l
+  // occupies candidates[offsets[l]] to candidates[offsets[l+1] - 1].  The
+  // topK best candidates of each label (-1 to keep all of them) are found
+  // by partial selection, and are then sorted together in descending
+  // order of score.  `candidates` is compacted in place to hold the 
+  // ranked candidates.
+  inline void selectBatchedTopK(std::vector<LabelledScore> &candidates,
+                                int const *offsets,
+                                int numLabels,
+                                int topK)
+  {
+    int numRanked = 0 ;
+    for (int l = 0 ; l < numLabels ; ++l) {
+      std::vector<LabelledScore>::iterator begin = 
+        candidates.begin() + offsets[l] ;
+      std::vector<LabelledScore>::iterator end = 
+        candidates.begin() + offsets[l + 1] ;
+      if (topK > -1 && end - begin > topK) {
+        std::nth_element(begin, begin + topK, end, labelledScoreDescend) ;
+        end = begin + topK ;
+      }
+      std::copy(begin, end, candidates.begin() + numRanked) ;
+      numRanked += end - begin ;
+    }
+    candidates.resize(numRanked) ;
+    std::sort(candidates.begin(), candidates.end(), labelledScoreDescend) ;
+  }
+
+} }
+
+#endif /* defined(VL_TOPK_H) */
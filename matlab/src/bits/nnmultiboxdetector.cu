@@ -20,6 +20,7 @@ the terms of the BSD license (see the COPYING file).
 
 #include <cstdio>
 #include <assert.h>
+#include <vector>
 
 using namespace vl ;
 
@@ -27,10 +28,14 @@ using namespace vl ;
 /*                                         multiboxdetector_forward */
 /* ---------------------------------------------------------------- */
 
+// Fixed size outputs are keepTopK x 6 x 1 x batchSize, while compact 
+// outputs store (at most) keepTopK records of 6 values per image, i.e. 
+// they are 6 x keepTopK x 1 x batchSize before packing.
 #define DISPATCH(deviceType,T) \
 error = vl::impl::multiboxdetector<deviceType,T>::forward \
 (context, \
 (T*) output.getMemory(), \
+(T*) counts.getMemory(), \
 (T const*) locPreds.getMemory(), \
 (T const*) confPreds.getMemory(), \
 (T const*) priors.getMemory(), \
@@ -40,10 +45,17 @@ numClasses, \
 nmsThresh, \
 confThresh, \
 backgroundLabel, \
-output.getHeight(), \
-output.getWidth(), \
+nmsMethod, \
+compact, \
+compact ? output.getWidth() : output.getHeight(), \
+compact ? output.getHeight() : output.getWidth(), \
 locPreds.getSize(), \
-priors.getHeight()/4) ;
+priors.getHeight()/4, \
+numThreads, \
+lazyDecode, \
+priorCache, \
+workspace, \
+stats) ;
 
 #define DISPATCH2(deviceType) \
 switch (dataType) { \
@@ -58,6 +70,7 @@ return VLE_Unknown ; \
 vl::ErrorCode
 vl::nnmultiboxdetector_forward(vl::Context& context,
                                vl::Tensor output,
+                               vl::Tensor counts,
                                vl::Tensor locPreds,
                                vl::Tensor confPreds,
                                vl::Tensor priors,
@@ -66,7 +79,14 @@ vl::nnmultiboxdetector_forward(vl::Context& context,
                                int numClasses,
                                float nmsThresh,
                                float confThresh,
-                               int backgroundLabel)
+                               int backgroundLabel,
+                               MultiboxNMSMethod nmsMethod,
+                               bool compact,
+                               int numThreads,
+                               bool lazyDecode,
+                               vl::impl::PriorCache *priorCache,
+                               vl::impl::MultiboxWorkspace *workspace,
+                               vl::impl::MultiboxStats *stats)
 {
   vl::ErrorCode error = VLE_Success ;
   vl::DataType dataType = output.getDataType() ;
@@ -94,3 +114,128 @@ vl::nnmultiboxdetector_forward(vl::Context& context,
   }
   return context.passError(error, __func__);
 }
+
+// Predictions in reduced precision are only read by the CPU detector,
+// whose output is single (or double) precision like the priors
+#undef DISPATCH
+#define DISPATCH(deviceType,T) \
+error = vl::impl::multiboxdetector<deviceType,T>::forward \
+(context, \
+(T*) output.getMemory(), \
+(T*) counts.getMemory(), \
+locPreds, \
+confPreds, \
+(T const*) priors.getMemory(), \
+nmsTopK, \
+keepTopK, \
+numClasses, \
+nmsThresh, \
+confThresh, \
+backgroundLabel, \
+nmsMethod, \
+compact, \
+compact ? output.getWidth() : output.getHeight(), \
+compact ? output.getHeight() : output.getWidth(), \
+output.getSize(), \
+priors.getHeight()/4, \
+numThreads, \
+lazyDecode, \
+priorCache, \
+workspace, \
+stats) ;
+
+vl::ErrorCode
+vl::nnmultiboxdetector_forward(vl::Context& context,
+                               vl::Tensor output,
+                               vl::Tensor counts,
+                               MultiboxPreds const& locPreds,
+                               MultiboxPreds const& confPreds,
+                               vl::Tensor priors,
+                               int nmsTopK,
+                               int keepTopK,
+                               int numClasses,
+                               float nmsThresh,
+                               float confThresh,
+                               int backgroundLabel,
+                               MultiboxNMSMethod nmsMethod,
+                               bool compact,
+                               int numThreads,
+                               bool lazyDecode,
+                               vl::impl::PriorCache *priorCache,
+                               vl::impl::MultiboxWorkspace *workspace,
+                               vl::impl::MultiboxStats *stats)
+{
+  vl::ErrorCode error = VLE_Success ;
+  vl::DataType dataType = output.getDataType() ;
+
+  // the detector compares quantized scores by their bytes, which requires
+  // an increasing dequantization
+  if ((locPreds.type == vlMultiboxPredUInt8 && !(locPreds.scale > 0)) ||
+      (confPreds.type == vlMultiboxPredUInt8 && !(confPreds.scale > 0))) {
+    return context.passError(vl::VLE_IllegalArgument, __func__) ;
+  }
+  if (priors.getDeviceType() != vl::VLDT_CPU) {
+    return context.passError(vl::VLE_Unsupported, __func__) ;
+  }
+  DISPATCH2(vl::VLDT_CPU) ;
+  return context.passError(error, __func__);
+}
+
+/* ---------------------------------------------------------------- */
+/*                                           multiboxdetector_merge */
+/* ---------------------------------------------------------------- */
+
+#undef DISPATCH
+#define DISPATCH(deviceType,T) \
+{ \
+std::vector<T const*> inputData(numInputs) ; \
+for (int s = 0 ; s < numInputs ; ++s) { \
+inputData[s] = (T const*) inputs[s].getMemory() ; \
+} \
+error = vl::impl::multiboxmerge<deviceType,T>::forward \
+(context, \
+(T*) output.getMemory(), \
+(T*) counts.getMemory(), \
+inputData.data(), \
+inputHeights.data(), \
+numInputs, \
+nmsThresh, \
+output.getHeight(), \
+output.getSize(), \
+numThreads, \
+workspace) ; \
+}
+
+vl::ErrorCode
+vl::nnmultiboxdetector_merge(vl::Context& context,
+                             vl::Tensor output,
+                             vl::Tensor counts,
+                             vl::Tensor *inputs,
+                             int numInputs,
+                             float nmsThresh,
+                             int numThreads,
+                             vl::impl::MultiboxWorkspace *workspace)
+{
+  vl::ErrorCode error = VLE_Success ;
+  vl::DataType dataType = output.getDataType() ;
+  std::vector<size_t> inputHeights(numInputs) ;
+  for (int s = 0 ; s < numInputs ; ++s) {
+    if (inputs[s].getDeviceType() != vl::VLDT_CPU) {
+      return context.passError(vl::VLE_Unsupported, __func__) ;
+    }
+    inputHeights[s] = inputs[s].getHeight() ;
+  }
+
+  switch (output.getDeviceType())
+  {
+    case vl::VLDT_CPU:
+      DISPATCH2(vl::VLDT_CPU) ;
+      break ;
+
+    default:
+      assert(false);
+      error = vl::VLE_Unknown ;
+      break ;
+  }
+  return context.passError(error, __func__);
+}
@@ -18,9 +18,44 @@ the terms of the BSD license (see the COPYING file).
 
 namespace vl {
 
+  namespace impl {
+    class PriorCache ;
+    class MultiboxWorkspace ;
+    struct MultiboxStats ;
+  }
+
+  // NMS is run independently for each class (the default), in a single 
+  // pass over the candidates of all classes where boxes only suppress 
+  // boxes of the same class (with identical results), or in a single 
+  // class-agnostic pass where all boxes suppress each other
+  enum MultiboxNMSMethod {
+    vlMultiboxNMSPerClass = 0,
+    vlMultiboxNMSBatched,
+    vlMultiboxNMSClassAgnostic
+  } ;
+
+  // The storage of predictions in reduced precision: IEEE half floats 
+  // (held as uint16 bit patterns), or bytes q which stand for the values
+  // scale * (q - zeroPoint), with scale > 0.  Native predictions have the
+  // type of the output.
+  enum MultiboxPredType {
+    vlMultiboxPredNative = 0,
+    vlMultiboxPredHalf,
+    vlMultiboxPredUInt8
+  } ;
+
+  struct MultiboxPreds
+  {
+    void const *data ;
+    MultiboxPredType type ;
+    float scale ;
+    float zeroPoint ;
+  } ;
+
   vl::ErrorCode
   nnmultiboxdetector_forward(vl::Context& context,
                              vl::Tensor output,
+                             vl::Tensor counts,
                              vl::Tensor locPreds,
                              vl::Tensor confPreds,
                              vl::Tensor priors,
@@ -29,7 +64,51 @@ namespace vl {
                              int numClasses,
                              float nmsThresh,
                              float confThresh,
-                             int backgroundLabel) ;
+                             int backgroundLabel,
+                             MultiboxNMSMethod nmsMethod,
+                             bool compact,
+                             int numThreads,
+                             bool lazyDecode,
+                             vl::impl::PriorCache *priorCache,
+                             vl::impl::MultiboxWorkspace *workspace,
+                             vl::impl::MultiboxStats *stats) ;
+
+  // As above, for location and confidence predictions which may be in 
+  // reduced precision (and have the layout of locPreds and confPreds).  
+  // The batch size is that of the output.  CPU only.
+  vl::ErrorCode
+  nnmultiboxdetector_forward(vl::Context& context,
+                             vl::Tensor output,
+                             vl::Tensor counts,
+                             MultiboxPreds const& locPreds,
+                             MultiboxPreds const& confPreds,
+                             vl::Tensor priors,
+                             int nmsTopK,
+                             int keepTopK,
+                             int numClasses,
+                             float nmsThresh,
+                             float confThresh,
+                             int backgroundLabel,
+                             MultiboxNMSMethod nmsMethod,
+                             bool compact,
+                             int numThreads,
+                             bool lazyDecode,
+                             vl::impl::PriorCache *priorCache,
+                             vl::impl::MultiboxWorkspace *workspace,
+                             vl::impl::MultiboxStats *stats) ;
+
+  // Merge the fixed size outputs of nnmultiboxdetector_forward computed 
+  // on the same images at numInputs scales into output (outHeight x 6 x 
+  // 1 x batchSize), running NMS across the scales.  CPU only.
+  vl::ErrorCode
+  nnmultiboxdetector_merge(vl::Context& context,
+                           vl::Tensor output,
+                           vl::Tensor counts,
+                           vl::Tensor *inputs,
+                           int numInputs,
+                           float nmsThresh,
+                           int numThreads,
+                           vl::impl::MultiboxWorkspace *workspace) ;
 }
 
 #endif /* defined(__vl__nnmultiboxdetector__) */
@@ -0,0 +1,4 @@
+#ifdef ENABLE_GPU
+#error "The file nnmultiboxloss.cu should be compiled instead"
+#endif
+#include "nnmultiboxloss.cu"
@@ -0,0 +1,134 @@
+// @file nnmultiboxloss.cu
+// @brief Multibox Loss block
+// @author Samuel Albanie
+// @author Andrea Vedaldi
+
+/*
+Copyright (C) 2017- Samuel Albanie and Andrea Vedaldi.
+All rights reserved.
+
+This file is part of the VLFeat library and is made available under
+the terms of the BSD license (see the COPYING file).
+*/
+
+#include "nnmultiboxloss.hpp"
+#include "impl/multiboxloss.hpp"
+
+#include <cstdio>
+#include <assert.h>
+
+using namespace vl ;
+
+/* ---------------------------------------------------------------- */
+/*                                             multiboxloss_compute */
+/* ---------------------------------------------------------------- */
+
+// The loss is only implemented on the CPU: the inputs are 1 x 1 x C x N
+// arrays, so the number of elements of the third dimension gives the
+// number of priors
+#define DISPATCH(deviceType,T) \
+error = vl::impl::multiboxloss<deviceType,T>::compute \
+(context, \
+values, \
+(T*) derLocPreds.getMemory(), \
+(T*) derConfPreds.getMemory(), \
+(T const*) locPreds.getMemory(), \
+(T const*) confPreds.getMemory(), \
+(T const*) priors.getMemory(), \
+images, \
+locPreds.getSize(), \
+priors.getHeight()/4, \
+numClasses, \
+backgroundLabel, \
+locWeight, \
+sigma, \
+(T) derOutput, \
+numThreads, \
+priorCache) ;
+
+#define DISPATCH2(deviceType) \
+switch (dataType) { \
+case VLDT_Float : DISPATCH(deviceType, float) ; \
+break ; \
+IF_DOUBLE(case VLDT_Double : DISPATCH(deviceType, double) ; \
+break ;) \
+default: assert(false) ; \
+return VLE_Unknown ; \
+}
+
+static vl::ErrorCode
+multiboxloss_compute(vl::Context& context,
+                     vl::impl::MultiboxLossValues *values,
+                     vl::Tensor derLocPreds,
+                     vl::Tensor derConfPreds,
+                     vl::Tensor locPreds,
+                     vl::Tensor confPreds,
+                     vl::Tensor priors,
+                     vl::impl::MultiboxLossImage const *images,
+                     double derOutput,
+                     int numClasses,
+                     int backgroundLabel,
+                     float locWeight,
+                     float sigma,
+                     int numThreads,
+                     vl::impl::PriorCache *priorCache)
+{
+  vl::ErrorCode error = VLE_Success ;
+  vl::DataType dataType = locPreds.getDataType() ;
+
+  switch (locPreds.getDeviceType())
+  {
+    case vl::VLDT_CPU:
+      DISPATCH2(vl::VLDT_CPU) ;
+      break ;
+
+    default:
+      error = vl::VLE_Unsupported ;
+      break ;
+  }
+  return context.passError(error, __func__);
+}
+
+vl::ErrorCode
+vl::nnmultiboxloss_forward(vl::Context& context,
+                           vl::impl::MultiboxLossValues *values,
+                           vl::Tensor derLocPreds,
+                           vl::Tensor derConfPreds,
+                           vl::Tensor locPreds,
+                           vl::Tensor confPreds,
+                           vl::Tensor priors,
+                           vl::impl::MultiboxLossImage const *images,
+                           int numClasses,
+                           int backgroundLabel,
+                           float locWeight,
+                           float sigma,
+                           int numThreads,
+                           vl::impl::PriorCache *priorCache)
+{
+  return multiboxloss_compute(context, values, derLocPreds, derConfPreds,
+                              locPreds, confPreds, priors, images, 1.0,
+                              numClasses, backgroundLabel, locWeight, sigma,
+                              numThreads, priorCache) ;
+}
+
+vl::ErrorCode
+vl::nnmultiboxloss_backward(vl::Context& context,
+                            vl::Tensor derLocPreds,
+                            vl::Tensor derConfPreds,
+                            vl::Tensor locPreds,
+                            vl::Tensor confPreds,
+                            vl::Tensor priors,
+                            vl::impl::MultiboxLossImage const *images,
+                            double derOutput,
+                            int numClasses,
+                            int backgroundLabel,
+                            float locWeight,
+                            float sigma,
+                            int numThreads,
+                            vl::impl::PriorCache *priorCache)
+{
+  return multiboxloss_compute(context, NULL, derLocPreds, derConfPreds,
+                              locPreds, confPreds, priors, images, derOutput,
+                              numClasses, backgroundLabel, locWeight, sigma,
+                              numThreads, priorCache) ;
+}
@@ -0,0 +1,64 @@
+// @file nnmultiboxloss.hpp
+// @brief Multibox Loss block
+// @author Samuel Albanie 
+// @author Andrea Vedaldi
+/*
+Copyright (C) 2017 Samuel Albanie and Andrea Vedaldi.
+All rights reserved.
+
+This file is part of the VLFeat library and is made available under
+the terms of the BSD license (see the COPYING file).
+*/
+
+#ifndef __vl__nnmultiboxloss__
+#define __vl__nnmultiboxloss__
+
+#include <bits/data.hpp>
+#include <stdio.h>
+
+namespace vl {
+
+  namespace impl {
+    class PriorCache ;
+    struct MultiboxLossImage ;
+    struct MultiboxLossValues ;
+  }
+
+  // Computes the loss and, if derLocPreds and derConfPreds are not empty,
+  // its derivatives in the same pass.  The derivatives must be zero-filled.
+  vl::ErrorCode
+  nnmultiboxloss_forward(vl::Context& context,
+                         vl::impl::MultiboxLossValues *values,
+                         vl::Tensor derLocPreds,
+                         vl::Tensor derConfPreds,
+                         vl::Tensor locPreds,
+                         vl::Tensor confPreds,
+                         vl::Tensor priors,
+                         vl::impl::MultiboxLossImage const *images,
+                         int numClasses,
+                         int backgroundLabel,
+                         float locWeight,
+                         float sigma,
+                         int numThreads,
+                         vl::impl::PriorCache *priorCache) ;
+
+  // Computes the derivatives of the loss, scaled by derOutput, into the
+  // zero-filled derLocPreds and derConfPreds
+  vl::ErrorCode
+  nnmultiboxloss_backward(vl::Context& context,
+                          vl::Tensor derLocPreds,
+                          vl::Tensor derConfPreds,
+                          vl::Tensor locPreds,
+                          vl::Tensor confPreds,
+                          vl::Tensor priors,
+                          vl::impl::MultiboxLossImage const *images,
+                          double derOutput,
+                          int numClasses,
+                          int backgroundLabel,
+                          float locWeight,
+                          float sigma,
+                          int numThreads,
+                          vl::impl::PriorCache *priorCache) ;
+}
+
+#endif /* defined(__vl__nnmultiboxloss__) */
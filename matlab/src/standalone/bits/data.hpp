@@ -0,0 +1,75 @@
+// @file data.hpp
+// @brief Minimal stand-in for MatConvNet's bits/data.hpp, used to build
+// the CPU detector without MATLAB
+// @author Samuel Albanie
+// @author Andrea Vedaldi
+
+/*
+Copyright (C) 2017- Samuel Albanie and Andrea Vedaldi.
+All rights reserved.
+
+This file is part of the VLFeat library and is made available under
+the terms of the BSD license (see the COPYING file).
+*/
+
+#ifndef VL_STANDALONE_DATA_H
+#define VL_STANDALONE_DATA_H
+
+#include <cstddef>
+
+// The CPU detector kernels only use the device and error enumerations and
+// (nominally) the context of MatConvNet.  This header provides just those,
+// with the same names and values, so that the kernels can be compiled
+// unchanged as a plain C++ library.  Tensors are only declared, as the
+// MATLAB-facing wrappers that use them are not part of the library.
+
+namespace vl {
+
+  enum DeviceType { VLDT_CPU = 0, VLDT_GPU } ;
+
+  enum DataType { VLDT_Char, VLDT_Float, VLDT_Double } ;
+
+  enum ErrorCode {
+    VLE_Success = 0,
+    VLE_Unsupported,
+    VLE_Cuda,
+    VLE_Cudnn,
+    VLE_Cublas,
+    VLE_OutOfMemory,
+    VLE_OutOfGPUMemeory,
+    VLE_IllegalArgument,
+    VLE_Timeout,
+    VLE_NoData,
+    VLE_IllegalMessage,
+    VLE_Interrupted,
+    VLE_Unknown
+  } ;
+
+  class Tensor ;
+
+  class Context
+  {
+  public:
+    Context() : lastError(VLE_Success) { }
+
+    ErrorCode setError(ErrorCode error, char const *message = NULL)
+    {
+      lastError = error ;
+      return error ;
+    }
+
+    ErrorCode passError(ErrorCode error, char const *message = NULL)
+    {
+      if (error != VLE_Success) { lastError = error ; }
+      return error ;
+    }
+
+    ErrorCode getLastError() const { return lastError ; }
+
+  private:
+    ErrorCode lastError ;
+  } ;
+
+}
+
+#endif /* defined(VL_STANDALONE_DATA_H) */
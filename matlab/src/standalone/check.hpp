@@ -0,0 +1,50 @@
+// @file check.hpp
+// @brief Checks shared by the standalone tests
+// @author Samuel Albanie
+// @author Andrea Vedaldi
+
+/*
+Copyright (C) 2017- Samuel Albanie and Andrea Vedaldi.
+All rights reserved.
+
+This file is part of the VLFeat library and is made available under
+the terms of the BSD license (see the COPYING file).
+*/
+
+#ifndef VL_STANDALONE_CHECK_H
+#define VL_STANDALONE_CHECK_H
+
+#include <stdio.h>
+
+namespace vl { namespace standalone {
+
+  // The number of checks of the test (an executable) which have failed
+  inline int & getNumFailures()
+  {
+    static int numFailures = 0 ;
+    return numFailures ;
+  }
+
+  // Print the outcome of the checks and return the exit status of the
+  // test
+  inline int finishChecks()
+  {
+    if (getNumFailures()) {
+      fprintf(stderr, "%d check(s) failed\n", getNumFailures()) ;
+      return 1 ;
+    }
+    printf("all checks passed\n") ;
+    return 0 ;
+  }
+
+} }
+
+// Report a failed check with a printf-style message and carry on, so
+// that a test reports all of its failures
+#define CHECK(cond, ...) \
+do { if (!(cond)) { \
+  fprintf(stderr, "FAILED %s:%d: ", __FILE__, __LINE__) ; \
+  fprintf(stderr, __VA_ARGS__) ; fprintf(stderr, "\n") ; \
+  ++vl::standalone::getNumFailures() ; } } while (0)
+
+#endif /* defined(VL_STANDALONE_CHECK_H) */
@@ -0,0 +1,392 @@
+// @file multibox_benchmark.cpp
+// @brief Benchmark of the CPU multibox detector on synthetic SSD workloads
+// @author Samuel Albanie
+// @author Andrea Vedaldi
+
+/*
+Copyright (C) 2017- Samuel Albanie and Andrea Vedaldi.
+All rights reserved.
+
+This file is part of the VLFeat library and is made available under
+the terms of the BSD license (see the COPYING file).
+*/
+
+#include "workload.hpp"
+#include <bits/impl/multiboxdetector.hpp>
+#include <bits/impl/multiboxstats.hpp>
+#include <bits/impl/priorcache.hpp>
+#include <bits/impl/multiboxworkspace.hpp>
+#include <bits/impl/predformats.hpp>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdint.h>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+
+using namespace vl ;
+using namespace vl::impl ;
+using namespace vl::standalone ;
+
+/* ---------------------------------------------------------------- */
+/*                                                          options */
+/* ---------------------------------------------------------------- */
+
+struct Options
+{
+  std::vector<std::string> models ;
+  std::vector<std::string> datasets ;
+  std::vector<int> batchSizes ;
+  int reps ;
+  int warmup ;
+  int numThreads ;
+  int nmsTopK ;
+  int keepTopK ;
+  float nmsThresh ;
+  float confThresh ;
+  MultiboxNMSMethod nmsMethod ;
+  MultiboxPredType predType ;
+  bool compact ;
+  bool lazyDecode ;
+  bool usePriorCache ;
+  bool useWorkspace ;
+  bool csv ;
+  unsigned long long seed ;
+
+  Options()
+  : reps(50), warmup(5), numThreads(1), nmsTopK(400), keepTopK(200),
+    nmsThresh(0.45f), confThresh(0.01f), nmsMethod(vlMultiboxNMSPerClass),
+    predType(vlMultiboxPredNative), compact(false), lazyDecode(true), usePriorCache(true),
+    useWorkspace(true), csv(false),
+    seed(0)
+  { }
+} ;
+
+static void usage()
+{
+  printf(
+  "usage: multibox_benchmark [options]\n"
+  "  --model M        ssd300, ssd512 or all (default: all)\n"
+  "  --dataset D      voc (21 classes), coco (81 classes) or all (default: all)\n"
+  "  --batch B[,B..]  batch sizes (default: 1,8)\n"
+  "  --reps N         timed calls per configuration (default: 50)\n"
+  "  --warmup N       untimed calls per configuration (default: 5)\n"
+  "  --threads N      detector threads, 0 for all cores (default: 1)\n"
+  "  --nms-topk K     (default: 400)\n"
+  "  --keep-topk K    (default: 200)\n"
+  "  --nms-thresh T   (default: 0.45)\n"
+  "  --conf-thresh T  (default: 0.01)\n"
+  "  --nms METHOD     perclass, batched or agnostic (default: perclass)\n"
+  "  --preds FORMAT   single, half or uint8 predictions (default: single)\n"
+  "  --compact        use the compact output layout\n"
+  "  --eager          decode all boxes rather than the ranked ones\n"
+  "  --no-cache       rebuild the prior table on every call\n"
+  "  --no-workspace   allocate the detector buffers on every call\n"
+  "  --seed S         seed of the synthetic inputs (default: 0)\n"
+  "  --csv            print comma separated values\n") ;
+}
+
+static std::vector<std::string> split(char const *list)
+{
+  std::vector<std::string> items ;
+  std::string s(list) ;
+  size_t start = 0 ;
+  while (start <= s.size()) {
+    size_t end = s.find(',', start) ;
+    if (end == std::string::npos) { end = s.size() ; }
+    if (end > start) { items.push_back(s.substr(start, end - start)) ; }
+    start = end + 1 ;
+  }
+  return items ;
+}
+
+static bool parseOptions(int argc, char **argv, Options *opts)
+{
+  for (int a = 1 ; a < argc ; ++a) {
+    std::string arg(argv[a]) ;
+    bool hasValue = (a + 1 < argc) ;
+    char const *value = hasValue ? argv[a + 1] : "" ;
+    if (arg == "--compact") { opts->compact = true ; continue ; }
+    if (arg == "--eager") { opts->lazyDecode = false ; continue ; }
+    if (arg == "--no-cache") { opts->usePriorCache = false ; continue ; }
+    if (arg == "--no-workspace") { opts->useWorkspace = false ; continue ; }
+    if (arg == "--csv") { opts->csv = true ; continue ; }
+    if (arg == "--help" || arg == "-h") { return false ; }
+    if (!hasValue) {
+      fprintf(stderr, "missing value for %s\n", arg.c_str()) ;
+      return false ;
+    }
+    ++a ;
+    if (arg == "--model") {
+      opts->models = split(value) ;
+    } else if (arg == "--dataset") {
+      opts->datasets = split(value) ;
+    } else if (arg == "--batch") {
+      std::vector<std::string> items = split(value) ;
+      opts->batchSizes.clear() ;
+      for (int i = 0 ; i < items.size() ; ++i) {
+        opts->batchSizes.push_back(atoi(items[i].c_str())) ;
+      }
+    } else if (arg == "--reps") {
+      opts->reps = atoi(value) ;
+    } else if (arg == "--warmup") {
+      opts->warmup = atoi(value) ;
+    } else if (arg == "--threads") {
+      opts->numThreads = atoi(value) ;
+    } else if (arg == "--nms-topk") {
+      opts->nmsTopK = atoi(value) ;
+    } else if (arg == "--keep-topk") {
+      opts->keepTopK = atoi(value) ;
+    } else if (arg == "--nms-thresh") {
+      opts->nmsThresh = (float)atof(value) ;
+    } else if (arg == "--conf-thresh") {
+      opts->confThresh = (float)atof(value) ;
+    } else if (arg == "--seed") {
+      opts->seed = strtoull(value, NULL, 10) ;
+    } else if (arg == "--preds") {
+      std::string format(value) ;
+      if (format == "single") {
+        opts->predType = vlMultiboxPredNative ;
+      } else if (format == "half") {
+        opts->predType = vlMultiboxPredHalf ;
+      } else if (format == "uint8") {
+        opts->predType = vlMultiboxPredUInt8 ;
+      } else {
+        fprintf(stderr, "unknown prediction format %s\n", value) ;
+        return false ;
+      }
+    } else if (arg == "--nms") {
+      std::string method(value) ;
+      if (method == "perclass") {
+        opts->nmsMethod = vlMultiboxNMSPerClass ;
+      } else if (method == "batched") {
+        opts->nmsMethod = vlMultiboxNMSBatched ;
+      } else if (method == "agnostic") {
+        opts->nmsMethod = vlMultiboxNMSClassAgnostic ;
+      } else {
+        fprintf(stderr, "unknown NMS method %s\n", value) ;
+        return false ;
+      }
+    } else {
+      fprintf(stderr, "unknown option %s\n", arg.c_str()) ;
+      return false ;
+    }
+  }
+  if (opts->models.empty() || opts->models[0] == "all") {
+    opts->models.clear() ;
+    opts->models.push_back("ssd300") ;
+    opts->models.push_back("ssd512") ;
+  }
+  if (opts->datasets.empty() || opts->datasets[0] == "all") {
+    opts->datasets.clear() ;
+    opts->datasets.push_back("voc") ;
+    opts->datasets.push_back("coco") ;
+  }
+  if (opts->batchSizes.empty()) {
+    opts->batchSizes.push_back(1) ;
+    opts->batchSizes.push_back(8) ;
+  }
+  if (opts->keepTopK <= 0 || opts->reps <= 0) {
+    fprintf(stderr, "keepTopK and reps must be positive\n") ;
+    return false ;
+  }
+  for (int m = 0 ; m < opts->models.size() ; ++m) {
+    if (opts->models[m] != "ssd300" && opts->models[m] != "ssd512") {
+      fprintf(stderr, "unknown model %s\n", opts->models[m].c_str()) ;
+      return false ;
+    }
+  }
+  for (int d = 0 ; d < opts->datasets.size() ; ++d) {
+    if (opts->datasets[d] != "voc" && opts->datasets[d] != "coco") {
+      fprintf(stderr, "unknown dataset %s\n", opts->datasets[d].c_str()) ;
+      return false ;
+    }
+  }
+  for (int b = 0 ; b < opts->batchSizes.size() ; ++b) {
+    if (opts->batchSizes[b] <= 0) {
+      fprintf(stderr, "batch sizes must be positive\n") ;
+      return false ;
+    }
+  }
+  return true ;
+}
+
+/* ---------------------------------------------------------------- */
+/*                                                        benchmark */
+/* ---------------------------------------------------------------- */
+
+struct Result
+{
+  double stageSeconds [vlMultiboxNumStages] ;
+  double meanSeconds ;
+  double minSeconds ;
+  double detections ;
+} ;
+
+// Store the predictions of the workload in the format of the options
+// (the uint8 scales suit the synthetic workloads)
+struct Predictions
+{
+  std::vector<uint16_t> halfData [2] ;
+  std::vector<uint8_t> byteData [2] ;
+  MultiboxPreds loc ;
+  MultiboxPreds conf ;
+} ;
+
+static void convert(Options const &opts, Workload const &workload,
+                    Predictions *preds)
+{
+  std::vector<float> const *values [2] = { &workload.locPreds,
+                                           &workload.confPreds } ;
+  MultiboxPreds *formats [2] = { &preds->loc, &preds->conf } ;
+  const float scales [2] = { 0.02f, 1.0f / 255 } ;
+  const float zeroPoints [2] = { 128.0f, 0.0f } ;
+  for (int k = 0 ; k < 2 ; ++k) {
+    std::vector<float> const &x = *values[k] ;
+    MultiboxPreds &format = *formats[k] ;
+    format.type = opts.predType ;
+    format.scale = scales[k] ;
+    format.zeroPoint = zeroPoints[k] ;
+    switch (opts.predType) {
+      case vlMultiboxPredHalf :
+        preds->halfData[k].resize(x.size()) ;
+        for (size_t j = 0 ; j < x.size() ; ++j) {
+          preds->halfData[k][j] = floatToHalf(x[j]) ;
+        }
+        format.data = preds->halfData[k].data() ;
+        break ;
+      case vlMultiboxPredUInt8 :
+        preds->byteData[k].resize(x.size()) ;
+        for (size_t j = 0 ; j < x.size() ; ++j) {
+          float q = roundf(x[j] / scales[k] + zeroPoints[k]) ;
+          preds->byteData[k][j] = (uint8_t)std::min(std::max(q, 0.0f), 255.0f) ;
+        }
+        format.data = preds->byteData[k].data() ;
+        break ;
+      default :
+        format.data = x.data() ;
+        break ;
+    }
+  }
+}
+
+static Result run(Options const &opts, Workload const &workload)
+{
+  typedef std::chrono::steady_clock Clock ;
+  const int batchSize = workload.batchSize ;
+  std::vector<float> output((size_t)opts.keepTopK * 6 * batchSize) ;
+  std::vector<float> counts(batchSize) ;
+  Context context ;
+  PriorCache priorCache ;
+  MultiboxWorkspace workspace ;
+  MultiboxStats stats ;
+  Predictions preds ;
+  convert(opts, workload, &preds) ;
+
+  Result result ;
+  for (int s = 0 ; s < vlMultiboxNumStages ; ++s) { result.stageSeconds[s] = 0 ; }
+  result.meanSeconds = 0 ;
+  result.minSeconds = 1e30 ;
+  result.detections = 0 ;
+
+  for (int r = 0 ; r < opts.warmup + opts.reps ; ++r) {
+    Clock::time_point start = Clock::now() ;
+    multiboxdetector<VLDT_CPU,float>::forward
+      (context, output.data(), counts.data(),
+       preds.loc, preds.conf, workload.priors.data(),
+       opts.nmsTopK, opts.keepTopK, workload.numClasses,
+       opts.nmsThresh, opts.confThresh, 1, opts.nmsMethod, opts.compact,
+       opts.keepTopK, 6, batchSize, workload.numPriors,
+       opts.numThreads, opts.lazyDecode,
+       opts.usePriorCache ? &priorCache : NULL,
+       opts.useWorkspace ? &workspace : NULL, &stats) ;
+    double elapsed = std::chrono::duration<double>(Clock::now() - start).count() ;
+    if (r < opts.warmup) { continue ; }
+    for (int s = 0 ; s < vlMultiboxNumStages ; ++s) {
+      result.stageSeconds[s] += stats.seconds[s] / opts.reps ;
+    }
+    result.meanSeconds += elapsed / opts.reps ;
+    result.minSeconds = std::min(result.minSeconds, elapsed) ;
+    for (int i = 0 ; i < batchSize ; ++i) {
+      result.detections += counts[i] / opts.reps ;
+    }
+  }
+  return result ;
+}
+
+int main(int argc, char **argv)
+{
+  Options opts ;
+  if (!parseOptions(argc, argv, &opts)) {
+    usage() ;
+    return 1 ;
+  }
+
+  char const *methods [] = { "perclass", "batched", "agnostic" } ;
+  char const *formats [] = { "single", "half", "uint8" } ;
+  if (opts.csv) {
+    printf("model,dataset,batch,threads,nms") ;
+    for (int s = 0 ; s < vlMultiboxNumStages ; ++s) {
+      printf(",%s_ms", multiboxStageName(s)) ;
+    }
+    printf(",mean_ms,min_ms,images_per_s,detections_per_image\n") ;
+  } else {
+    printf("# nmsTopK %d keepTopK %d nmsThresh %g confThresh %g nms %s "
+           "preds %s decode %s cache %s workspace %s output %s threads %d reps %d\n",
+           opts.nmsTopK, opts.keepTopK, opts.nmsThresh, opts.confThresh,
+           methods[opts.nmsMethod], formats[opts.predType],
+           opts.lazyDecode ? "lazy" : "eager",
+           opts.usePriorCache ? "on" : "off",
+           opts.useWorkspace ? "on" : "off",
+           opts.compact ? "compact" : "padded", opts.numThreads, opts.reps) ;
+    printf("%-12s %5s", "workload", "batch") ;
+    for (int s = 0 ; s < vlMultiboxNumStages ; ++s) {
+      printf(" %10s", multiboxStageName(s)) ;
+    }
+    printf(" %10s %10s %10s %8s\n", "mean", "min", "images/s", "dets/im") ;
+  }
+
+  for (int m = 0 ; m < opts.models.size() ; ++m) {
+    PriorSpec const *spec = (opts.models[m] == "ssd300") ? ssd300() : ssd512() ;
+    for (int d = 0 ; d < opts.datasets.size() ; ++d) {
+      const bool coco = (opts.datasets[d] == "coco") ;
+      const int numClasses = coco ? 81 : 21 ;
+      const int objectsPerImage = coco ? 7 : 3 ;
+      for (int b = 0 ; b < opts.batchSizes.size() ; ++b) {
+        const int batchSize = opts.batchSizes[b] ;
+        Workload workload ;
+        makeWorkload(*spec, numClasses, batchSize, objectsPerImage,
+                      opts.seed, &workload) ;
+        Result result = run(opts, workload) ;
+        const double throughput = batchSize / result.meanSeconds ;
+        const double detections = result.detections / batchSize ;
+        if (opts.csv) {
+          printf("%s,%s,%d,%d,%s", spec->name, opts.datasets[d].c_str(),
+                 batchSize, opts.numThreads, methods[opts.nmsMethod]) ;
+          for (int s = 0 ; s < vlMultiboxNumStages ; ++s) {
+            printf(",%.4f", result.stageSeconds[s] * 1e3) ;
+          }
+          printf(",%.4f,%.4f,%.1f,%.1f\n", result.meanSeconds * 1e3,
+                 result.minSeconds * 1e3, throughput, detections) ;
+        } else {
+          std::string name = std::string(spec->name) + "-" + opts.datasets[d] ;
+          printf("%-12s %5d", name.c_str(), batchSize) ;
+          for (int s = 0 ; s < vlMultiboxNumStages ; ++s) {
+            printf(" %10.3f", result.stageSeconds[s] * 1e3) ;
+          }
+          printf(" %10.3f %10.3f %10.1f %8.1f\n", result.meanSeconds * 1e3,
+                 result.minSeconds * 1e3, throughput, detections) ;
+        }
+        fflush(stdout) ;
+      }
+    }
+  }
+  if (!opts.csv) {
+    printf("# stage, mean and min latencies are in ms per call\n") ;
+  }
+  return 0 ;
+}
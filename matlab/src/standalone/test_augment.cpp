@@ -0,0 +1,287 @@
+// @file test_augment.cpp
+// @brief Tests of the native training data augmentation
+// @author Samuel Albanie
+// @author Andrea Vedaldi
+
+/*
+Copyright (C) 2017- Samuel Albanie and Andrea Vedaldi.
+All rights reserved.
+
+This file is part of the VLFeat library and is made available under
+the terms of the BSD license (see the COPYING file).
+*/
+
+#include "check.hpp"
+#include "workload.hpp"
+#include <bits/impl/augment.hpp>
+
+#include <stdio.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <memory>
+#include <vector>
+
+using namespace vl::impl ;
+using namespace vl::standalone ;
+
+// The settings of pascal/ssd_pascal_train.m, with all the augmentations
+// enabled
+static AugmentOptions pascalOptions()
+{
+  AugmentOptions opts ;
+  opts.height = 300 ; opts.width = 300 ;
+  opts.resizeMethods.clear() ;
+  opts.resizeMethods.push_back(RESIZE_BILINEAR) ;
+  opts.resizeMethods.push_back(RESIZE_BOX) ;
+  opts.resizeMethods.push_back(RESIZE_NEAREST) ;
+  opts.resizeMethods.push_back(RESIZE_BICUBIC) ;
+  opts.resizeMethods.push_back(RESIZE_LANCZOS2) ;
+  opts.brightnessProb = 0.5 ; opts.brightnessDelta = 32 ;
+  opts.contrastProb = 0.5 ; opts.contrastLower = 0.5 ; opts.contrastUpper = 1.5 ;
+  opts.saturationProb = 0.5 ; opts.saturationLower = 0.5 ; opts.saturationUpper = 1.5 ;
+  opts.hueProb = 0.5 ; opts.hueDelta = 18 ;
+  opts.zoomProb = 0.5 ; opts.zoomMinScale = 1 ; opts.zoomMaxScale = 4 ;
+  opts.patchNumTrials = 50 ;
+  opts.clipTargets = true ;
+  opts.flipProb = 0.5 ;
+  return opts ;
+}
+
+// An image of the given size whose boxes are painted with `inside` over a
+// background of `outside`, with some random texture
+static void makeImage(int height, int width, int numBoxes, float inside,
+                      float outside, Random &random, AugmentImage *image)
+{
+  image->height = height ;
+  image->width = width ;
+  image->depth = 3 ;
+  image->pixels.assign((size_t)height * width * 3, outside) ;
+  image->boxes.resize(4 * numBoxes) ;
+  image->labels.resize(numBoxes) ;
+  for (int b = 0 ; b < numBoxes ; ++b) {
+    double w = 0.2 + 0.5 * random.uniform() ;
+    double h = 0.2 + 0.5 * random.uniform() ;
+    double x = (1 - w) * random.uniform() ;
+    double y = (1 - h) * random.uniform() ;
+    image->boxes[b] = x ; image->boxes[b + numBoxes] = y ;
+    image->boxes[b + 2 * numBoxes] = x + w ;
+    image->boxes[b + 3 * numBoxes] = y + h ;
+    image->labels[b] = 1 + random.index(20) ;
+    for (int u = (int)std::ceil(x * width) ; u < (x + w) * width ; ++u) {
+      for (int v = (int)std::ceil(y * height) ; v < (y + h) * height ; ++v) {
+        for (int c = 0 ; c < 3 ; ++c) {
+          image->pixels[v + (size_t)height * u + (size_t)height * width * c] = inside ;
+        }
+      }
+    }
+  }
+}
+
+static void makeBatch(AugmentOptions const &opts, int batchSize, uint64_t seed,
+                      AugmentBatch *batch)
+{
+  Random random(seed) ;
+  batch->init(opts, batchSize) ;
+  for (int i = 0 ; i < batchSize ; ++i) {
+    makeImage(300 + random.index(200), 300 + random.index(200),
+              1 + random.index(4), 200, 40, random, &batch->images[i]) ;
+    for (size_t k = 0 ; k < batch->images[i].pixels.size() ; ++k) {
+      batch->images[i].pixels[k] += 10 * random.uniform() ;
+    }
+    batch->images[i].seed = random.next() ;
+  }
+}
+
+static bool sameResult(AugmentBatch const &a, AugmentBatch const &b)
+{
+  if (a.data != b.data) { return false ; }
+  for (size_t i = 0 ; i < a.annotations.size() ; ++i) {
+    if (a.annotations[i].boxes != b.annotations[i].boxes ||
+        a.annotations[i].labels != b.annotations[i].labels) {
+      return false ;
+    }
+  }
+  return true ;
+}
+
+/* ---------------------------------------------------------------- */
+/*                                                            tests */
+/* ---------------------------------------------------------------- */
+
+// Resizing as imresize: identity, constant images and a known value
+static void testResize()
+{
+  const ResizeMethod methods [] = { RESIZE_NEAREST, RESIZE_BILINEAR,
+    RESIZE_BICUBIC, RESIZE_BOX, RESIZE_LANCZOS2, RESIZE_LANCZOS3 } ;
+  Random random(7) ;
+  for (int m = 0 ; m < 6 ; ++m) {
+    AugmentOptions opts ;
+    opts.resizeMethods.assign(1, methods[m]) ;
+    opts.average[0] = opts.average[1] = opts.average[2] = 0 ;
+
+    // same size: the image is unchanged
+    AugmentImage image ;
+    makeImage(opts.height, opts.width, 2, 200, 40, random, &image) ;
+    image.seed = 1 ;
+    std::vector<float> output((size_t)opts.height * opts.width * 3) ;
+    AugmentAnnotations annotations ;
+    augmentImage(opts, image, output.data(), &annotations) ;
+    double diff = 0 ;
+    for (size_t k = 0 ; k < output.size() ; ++k) {
+      diff = std::max(diff, (double)std::abs(output[k] - image.pixels[k])) ;
+    }
+    CHECK(diff < 1e-3, "method %d does not preserve the image (%g)", m, diff) ;
+    CHECK(annotations.boxes == image.boxes, "method %d changes the boxes", m) ;
+
+    // constant images remain constant
+    image.height = 123 ; image.width = 457 ;
+    image.pixels.assign((size_t)image.height * image.width * 3, 77.f) ;
+    augmentImage(opts, image, output.data(), &annotations) ;
+    diff = 0 ;
+    for (size_t k = 0 ; k < output.size() ; ++k) {
+      diff = std::max(diff, (double)std::abs(output[k] - 77)) ;
+    }
+    CHECK(diff < 1e-3, "method %d changes a constant image (%g)", m, diff) ;
+  }
+
+  // imresize(1:4, [1 2]) is [1.625 3.375]
+  AugmentOptions opts ;
+  opts.height = 1 ; opts.width = 2 ;
+  opts.average[0] = opts.average[1] = opts.average[2] = 0 ;
+  AugmentImage image ;
+  image.height = 1 ; image.width = 4 ; image.depth = 1 ; image.seed = 1 ;
+  for (int k = 0 ; k < 4 ; ++k) { image.pixels.push_back(k + 1) ; }
+  std::vector<float> output(6) ;
+  AugmentAnnotations annotations ;
+  augmentImage(opts, image, output.data(), &annotations) ;
+  CHECK(std::abs(output[0] - 1.625) < 1e-5 && std::abs(output[1] - 3.375) < 1e-5,
+        "imresize(1:4, [1 2]) = [%g %g]", output[0], output[1]) ;
+  CHECK(output[4] == output[0] && output[5] == output[1],
+        "grayscale images are not replicated") ;
+}
+
+// The boxes follow the content of the image through zooming, patch
+// sampling, resizing and flipping
+static void testGeometry()
+{
+  AugmentOptions opts = pascalOptions() ;
+  opts.brightnessProb = opts.contrastProb = opts.saturationProb = opts.hueProb = 0 ;
+  opts.resizeMethods.assign(1, RESIZE_NEAREST) ;
+  opts.average[0] = opts.average[1] = opts.average[2] = 0 ;
+  int numChecked = 0 ;
+  for (int trial = 0 ; trial < 200 ; ++trial) {
+    Random random(100 + trial) ;
+    AugmentImage image ;
+    makeImage(200 + random.index(300), 200 + random.index(300),
+              1 + random.index(3), 200, 40, random, &image) ;
+    image.seed = random.next() ;
+    std::vector<float> output((size_t)opts.height * opts.width * 3) ;
+    AugmentAnnotations a ;
+    augmentImage(opts, image, output.data(), &a) ;
+
+    const int M = a.labels.size() ;
+    CHECK(M >= 1 && M <= (int)image.labels.size(), "trial %d: %d boxes", trial, M) ;
+    for (int k = 0 ; k < M ; ++k) {
+      CHECK(std::find(image.labels.begin(), image.labels.end(), a.labels[k])
+            != image.labels.end(), "trial %d: unknown label", trial) ;
+      double x0 = a.boxes[k], y0 = a.boxes[k + M] ;
+      double x1 = a.boxes[k + 2 * M], y1 = a.boxes[k + 3 * M] ;
+      CHECK(0 <= x0 && x0 <= x1 && x1 <= 1 && 0 <= y0 && y0 <= y1 && y1 <= 1,
+            "trial %d: box %d is not clipped", trial, k) ;
+      // the (clipped) box is large enough to test its centre
+      if ((x1 - x0) * opts.width < 8 || (y1 - y0) * opts.height < 8) { continue ; }
+      int u = (int)((x0 + x1) / 2 * opts.width) ;
+      int v = (int)((y0 + y1) / 2 * opts.height) ;
+      float value = output[v + (size_t)opts.height * u] ;
+      CHECK(value == 200, "trial %d: the centre of box %d has value %g",
+            trial, k, value) ;
+      ++numChecked ;
+    }
+  }
+  CHECK(numChecked > 100, "only %d boxes were checked", numChecked) ;
+}
+
+// Patches lie in the image and keep the boxes whose centre they contain
+static void testPatches()
+{
+  AugmentOptions opts = pascalOptions() ;
+  for (int trial = 0 ; trial < 500 ; ++trial) {
+    Random random(1000 + trial) ;
+    AugmentImage image ;
+    makeImage(10, 10, 1 + random.index(5), 1, 0, random, &image) ;
+    AugmentRandom sampler(trial) ;
+    double patch [4] ;
+    AugmentAnnotations a ;
+    samplePatch(opts, image.boxes.data(), image.labels.data(),
+                image.labels.size(), sampler, patch, &a) ;
+    CHECK(0 <= patch[0] && patch[0] < patch[2] && patch[2] <= 1 + 1e-12 &&
+          0 <= patch[1] && patch[1] < patch[3] && patch[3] <= 1 + 1e-12,
+          "trial %d: invalid patch", trial) ;
+    const int N = image.labels.size() ;
+    int numInside = 0 ;
+    for (int b = 0 ; b < N ; ++b) {
+      double cx = (image.boxes[b] + image.boxes[b + 2 * N]) / 2 ;
+      double cy = (image.boxes[b + N] + image.boxes[b + 3 * N]) / 2 ;
+      numInside += (patch[0] <= cx && cx <= patch[2] &&
+                    patch[1] <= cy && cy <= patch[3]) ;
+    }
+    CHECK(numInside > 0 && numInside == (int)a.labels.size(),
+          "trial %d: %d boxes kept, %d inside", trial, (int)a.labels.size(),
+          numInside) ;
+  }
+}
+
+// The result only depends on the seeds, and not on the number of threads
+// or on the use of the prefetching queue
+static void testReproducibility()
+{
+  const int batchSize = 32 ;
+  AugmentOptions opts = pascalOptions() ;
+  AugmentBatch serial ;
+  makeBatch(opts, batchSize, 1, &serial) ;
+  AugmentBatch input(serial) ;
+
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now() ;
+  augmentBatch(&serial, 1) ;
+  std::chrono::steady_clock::time_point mid = std::chrono::steady_clock::now() ;
+  AugmentBatch parallel(input) ;
+  augmentBatch(&parallel, 4) ;
+  std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now() ;
+  CHECK(sameResult(serial, parallel), "the number of threads changes the result") ;
+
+  AugmentQueue queue ;
+  queue.setNumThreads(3) ;
+  queue.setCapacity(2) ;
+  std::vector<double> keys [3] = { {1, 2}, {3, 4}, {5, 6} } ;
+  for (int b = 0 ; b < 3 ; ++b) {
+    queue.submit(keys[b], std::make_shared<AugmentBatch>(input)) ;
+  }
+  CHECK(!queue.take(keys[0]), "the queue exceeds its capacity") ;
+  CHECK(!queue.take(std::vector<double>(1, 7)), "an unknown batch was found") ;
+  for (int b = 1 ; b < 3 ; ++b) {
+    std::shared_ptr<AugmentBatch> batch = queue.take(keys[b]) ;
+    CHECK(batch && sameResult(serial, *batch), "the queue changes the result") ;
+    CHECK(batch && batch->images[0].pixels.empty(), "the queue keeps the images") ;
+  }
+  CHECK(!queue.take(keys[1]), "a batch was taken twice") ;
+
+  AugmentBatch other(input) ;
+  for (int i = 0 ; i < batchSize ; ++i) { other.images[i].seed += 1 ; }
+  augmentBatch(&other, 4) ;
+  CHECK(other.data != serial.data, "the seeds do not change the result") ;
+
+  printf("augment: %d images, %.2f ms (1 thread), %.2f ms (4 threads)\n",
+         batchSize,
+         std::chrono::duration<double>(mid - start).count() * 1e3,
+         std::chrono::duration<double>(end - mid).count() * 1e3) ;
+}
+
+int main(int argc, char **argv)
+{
+  testResize() ;
+  testGeometry() ;
+  testPatches() ;
+  testReproducibility() ;
+  return finishChecks() ;
+}
@@ -0,0 +1,133 @@
+// @file test_boxdecoder.cpp
+// @brief Comparison of the scalar and SIMD box decoders
+// @author Samuel Albanie
+// @author Andrea Vedaldi
+
+/*
+Copyright (C) 2017- Samuel Albanie and Andrea Vedaldi.
+All rights reserved.
+
+This file is part of the VLFeat library and is made available under
+the terms of the BSD license (see the COPYING file).
+*/
+
+#include "check.hpp"
+#include "workload.hpp"
+#include <bits/impl/boxdecoder.hpp>
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+using namespace vl::impl ;
+using namespace vl::standalone ;
+
+// The SSE2 and AVX2 decoders must produce the same bits as the scalar
+// one, which only holds if the multiply-adds of the scalar code are not
+// contracted into FMAs (the build passes -ffp-contract=off).  The inputs
+// cover the whole range of fastExp, including the clamped values.
+
+// The decoded corners of the priors [0, numPriors), one array per corner
+struct Corners
+{
+  std::vector<float> data ;
+
+  bool operator==(Corners const &other) const
+  {
+    return data.size() == other.data.size() &&
+           memcmp(data.data(), other.data.data(),
+                  data.size() * sizeof(float)) == 0 ;
+  }
+
+  DecodedBoxes get(int numPriors)
+  {
+    data.assign((size_t)numPriors * 4, 0.0f) ;
+    DecodedBoxes out = {&data[0], &data[numPriors], &data[2 * numPriors],
+                        &data[3 * numPriors]} ;
+    return out ;
+  }
+} ;
+
+static void makeInputs(int numPriors, uint64_t seed, PriorTable *table,
+                       std::vector<float> *locData)
+{
+  Random random(seed) ;
+  std::vector<float> priors(numPriors * 8) ;
+  for (int p = 0 ; p < numPriors ; ++p) {
+    float x = random.uniform(), y = random.uniform() ;
+    priors[p * 4] = x ;
+    priors[p * 4 + 1] = y ;
+    priors[p * 4 + 2] = x + 0.01f + random.uniform() ;
+    priors[p * 4 + 3] = y + 0.01f + random.uniform() ;
+    for (int k = 0 ; k < 4 ; ++k) {
+      priors[numPriors * 4 + p * 4 + k] = (k < 2) ? 0.1f : 0.2f ;
+    }
+  }
+  table->init(priors.data(), numPriors) ;
+
+  // offsets from the typical range up to values which overflow exp
+  locData->resize(numPriors * 4) ;
+  for (int k = 0 ; k < numPriors * 4 ; ++k) {
+    float scale = (k % 7 == 0) ? 600.0f : 3.0f ;
+    (*locData)[k] = scale * random.normal() ;
+  }
+}
+
+static void testFastExp()
+{
+  for (int k = -1000 ; k <= 1000 ; ++k) {
+    float x [8] ;
+    for (int j = 0 ; j < 8 ; ++j) {
+      x[j] = (k * 8 + j) * (95.0f / 8000.0f) ;
+    }
+    float expected [8] ;
+    for (int j = 0 ; j < 8 ; ++j) {
+      expected[j] = fastExp(x[j]) ;
+    }
+#ifdef VL_BOXDECODER_SSE2
+    float sse2 [8] ;
+    _mm_storeu_ps(sse2, fastExp(_mm_loadu_ps(x))) ;
+    _mm_storeu_ps(sse2 + 4, fastExp(_mm_loadu_ps(x + 4))) ;
+    CHECK(memcmp(sse2, expected, sizeof(expected)) == 0,
+          "SSE2 fastExp differs from the scalar one near %g", x[0]) ;
+#endif
+  }
+}
+
+static void testDecoders(int numPriors, uint64_t seed)
+{
+  PriorTable table ;
+  std::vector<float> locData ;
+  makeInputs(numPriors, seed, &table, &locData) ;
+
+  // decode a range which does not start at a multiple of the SIMD width
+  const int begin = 3 ;
+  Corners expected ;
+  decodeBoxesScalar(table, locData.data(), begin, numPriors,
+                    expected.get(numPriors)) ;
+#ifdef VL_BOXDECODER_SSE2
+  Corners sse2 ;
+  decodeBoxesSSE2(table, locData.data(), begin, numPriors,
+                  sse2.get(numPriors)) ;
+  CHECK(sse2 == expected,
+        "%d priors: the SSE2 decoder differs from the scalar one", numPriors) ;
+#endif
+#ifdef VL_BOXDECODER_AVX2
+  if (hasAVX2()) {
+    Corners avx2 ;
+    decodeBoxesAVX2(table, locData.data(), begin, numPriors,
+                    avx2.get(numPriors)) ;
+    CHECK(avx2 == expected,
+          "%d priors: the AVX2 decoder differs from the scalar one", numPriors) ;
+  }
+#endif
+}
+
+int main(int argc, char **argv)
+{
+  testFastExp() ;
+  testDecoders(8732, 1) ;
+  testDecoders(24564, 2) ;
+  testDecoders(37, 3) ;
+  return finishChecks() ;
+}
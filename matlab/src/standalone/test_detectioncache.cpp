@@ -0,0 +1,376 @@
+// @file test_detectioncache.cpp
+// @brief Round trip tests of the binary detection cache
+// @author Samuel Albanie
+// @author Andrea Vedaldi
+
+/*
+Copyright (C) 2017- Samuel Albanie and Andrea Vedaldi.
+All rights reserved.
+
+This file is part of the VLFeat library and is made available under
+the terms of the BSD license (see the COPYING file).
+*/
+
+#include "check.hpp"
+#include "workload.hpp"
+#include <bits/impl/detectioncache.hpp>
+#include <bits/impl/detectioneval.hpp>
+
+#include <stdio.h>
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <vector>
+
+using namespace vl::impl ;
+using namespace vl::standalone ;
+
+// Detections are appended in batches, in the fixed layout of the detector
+// or in its compact layout, and read back from the mapping: the image
+// sections must hold the rows of each image without the padding, the
+// class sections the detections of each label ranked as a stable sort by
+// descending score would, and evaluating the mapped images in place must
+// give the same average precision as evaluating the detector output.
+
+static char const *cachePath = "test_detectioncache.bin" ;
+
+// Detections in the fixed layout (height x 6 x 1 x numImages) with a
+// random amount of padding, and ground truth boxes for the evaluation
+struct Batch
+{
+  int numClasses ;
+  int height ;
+  int numImages ;
+  std::vector<float> detections ;
+  std::vector<std::vector<float> > boxes ;
+  std::vector<std::vector<float> > labels ;
+
+  float det(int i, int r, int j) const
+  {
+    return detections[(size_t)height * (6 * i + j) + r] ;
+  }
+} ;
+
+static void makeBatch(int numImages, int numClasses, int height,
+                      uint64_t seed, Batch *batch)
+{
+  Random random(seed) ;
+  batch->numClasses = numClasses ;
+  batch->height = height ;
+  batch->numImages = numImages ;
+  batch->detections.assign((size_t)height * 6 * numImages, 0.0f) ;
+  batch->boxes.resize(numImages) ;
+  batch->labels.resize(numImages) ;
+  for (int i = 0 ; i < numImages ; ++i) {
+    const int numObjects = random.index(5) ;
+    batch->boxes[i].resize(4 * numObjects) ;
+    batch->labels[i].resize(numObjects) ;
+    for (int g = 0 ; g < numObjects ; ++g) {
+      float x = 0.6f * random.uniform(), y = 0.6f * random.uniform() ;
+      batch->boxes[i][g] = x ;
+      batch->boxes[i][numObjects + g] = y ;
+      batch->boxes[i][2 * numObjects + g] = x + 0.1f + 0.3f * random.uniform() ;
+      batch->boxes[i][3 * numObjects + g] = y + 0.1f + 0.3f * random.uniform() ;
+      batch->labels[i][g] = (float)(1 + random.index(numClasses)) ;
+    }
+
+    // valid rows interleaved with padding (label 0 or -1, as written by
+    // the detector and by the merge); coarse scores make ties frequent
+    float *dets = batch->detections.data() + (size_t)height * 6 * i ;
+    for (int r = 0 ; r < height ; ++r) {
+      float u = random.uniform() ;
+      if (u < 0.3f) {
+        dets[r] = (u < 0.15f) ? 0.0f : -1.0f ;
+        continue ;
+      }
+      float x = 0.7f * random.uniform(), y = 0.7f * random.uniform() ;
+      dets[r] = (float)(1 + random.index(numClasses)) ;
+      dets[height + r] = (1 + random.index(10)) * 0.1f ;
+      dets[2 * height + r] = x ;
+      dets[3 * height + r] = y ;
+      dets[4 * height + r] = x + 0.3f * random.uniform() ;
+      dets[5 * height + r] = y + 0.3f * random.uniform() ;
+    }
+  }
+}
+
+/* ---------------------------------------------------------------- */
+/* ---------------------------------------------------------------- */
+
+// Write the batch in chunks of the given sizes, alternating the fixed
+// and the compact layouts if mixed is true
+static bool writeBatch(Batch const &batch, std::vector<int> const &chunks,
+                       bool mixed)
+{
+  DetectionCacheWriter writer ;
+  if (!writer.open(cachePath, batch.numClasses)) { return false ; }
+  int begin = 0 ;
+  for (size_t k = 0 ; k < chunks.size() ; ++k) {
+    int count = std::min(chunks[k], batch.numImages - begin) ;
+    bool ok ;
+    if (mixed && k % 2 == 1) {
+      std::vector<float> records, counts ;
+      for (int i = begin ; i < begin + count ; ++i) {
+        int n = 0 ;
+        for (int r = 0 ; r < batch.height ; ++r) {
+          if (batch.det(i, r, 0) < 1) { continue ; }
+          for (int j = 0 ; j < 6 ; ++j) {
+            records.push_back(batch.det(i, r, j)) ;
+          }
+          ++ n ;
+        }
+        counts.push_back((float)n) ;
+      }
+      ok = writer.appendCompact(records.data(), counts.data(), count) ;
+    } else {
+      ok = writer.append(batch.detections.data()
+                         + (size_t)batch.height * 6 * begin,
+                         batch.height, count) ;
+    }
+    if (!ok) { return false ; }
+    begin += count ;
+  }
+  CHECK((int)writer.getNumImages() == batch.numImages,
+        "the writer has %d images, expected %d",
+        (int)writer.getNumImages(), batch.numImages) ;
+  return writer.finish() ;
+}
+
+typedef std::pair<float, std::pair<int, int> > RankedRow ;
+
+static bool scoreAscend(RankedRow const &a, RankedRow const &b)
+{
+  return a.first < b.first ;
+}
+
+static void checkSections(char const *name, Batch const &batch,
+                          DetectionCache const &cache)
+{
+  CHECK(cache.getNumClasses() == batch.numClasses,
+        "%s: %d classes", name, cache.getNumClasses()) ;
+  CHECK((int)cache.getNumImages() == batch.numImages,
+        "%s: %d images", name, (int)cache.getNumImages()) ;
+
+  // image sections
+  size_t total = 0 ;
+  for (int i = 0 ; i < batch.numImages ; ++i) {
+    float const *dets ;
+    size_t n = cache.getImageDetections(i, &dets) ;
+    size_t k = 0 ;
+    for (int r = 0 ; r < batch.height ; ++r) {
+      if (batch.det(i, r, 0) < 1) { continue ; }
+      if (k < n) {
+        bool same = true ;
+        for (int j = 0 ; j < 6 ; ++j) {
+          same &= (dets[k + n * j] == batch.det(i, r, j)) ;
+        }
+        CHECK(same, "%s: image %d, row %d differs", name, i, r) ;
+      }
+      ++ k ;
+    }
+    CHECK(k == n, "%s: image %d has %d rows, expected %d",
+          name, i, (int)n, (int)k) ;
+    total += n ;
+  }
+  CHECK(total == cache.getNumDetections(), "%s: %d detections, expected %d",
+        name, (int)cache.getNumDetections(), (int)total) ;
+
+  // class sections, against a stable sort of the detections of each label
+  for (int c = 1 ; c <= batch.numClasses ; ++c) {
+    std::vector<RankedRow> expected ;
+    for (int i = 0 ; i < batch.numImages ; ++i) {
+      for (int r = 0 ; r < batch.height ; ++r) {
+        if (batch.det(i, r, 0) != c) { continue ; }
+        expected.push_back(std::make_pair(-batch.det(i, r, 1),
+                                          std::make_pair(i, r))) ;
+      }
+    }
+    std::stable_sort(expected.begin(), expected.end(), scoreAscend) ;
+    float const *dets ;
+    size_t m = cache.getClassDetections(c, &dets) ;
+    CHECK(m == expected.size(), "%s: label %d has %d detections, expected %d",
+          name, c, (int)m, (int)expected.size()) ;
+    for (size_t k = 0 ; k < std::min(m, expected.size()) ; ++k) {
+      int i = expected[k].second.first ;
+      int r = expected[k].second.second ;
+      bool same = (dets[k] == (float)(i + 1)) ;
+      for (int j = 1 ; j < 6 ; ++j) {
+        same &= (dets[k + m * j] == batch.det(i, r, j)) ;
+      }
+      CHECK(same, "%s: label %d, rank %d differs", name, c, (int)k) ;
+    }
+  }
+
+  // indices beyond the cache have no detections
+  float const *dets = batch.detections.data() ;
+  CHECK(cache.getImageDetections(batch.numImages, &dets) == 0 && dets == NULL,
+        "%s: image %d is beyond the cache, but has detections", name,
+        batch.numImages) ;
+  dets = batch.detections.data() ;
+  CHECK(cache.getClassDetections(0, &dets) == 0 && dets == NULL &&
+        cache.getClassDetections(batch.numClasses + 1, &dets) == 0 &&
+        dets == NULL,
+        "%s: a label beyond the classes has detections", name) ;
+}
+
+// Evaluating the mapped images must match evaluating the detector output
+static void checkEvaluation(char const *name, Batch const &batch,
+                            DetectionCache const &cache)
+{
+  std::vector<DetectionEvalImage> direct(batch.numImages) ;
+  std::vector<DetectionEvalImage> mapped(batch.numImages) ;
+  for (int i = 0 ; i < batch.numImages ; ++i) {
+    direct[i].detections = batch.detections.data()
+      + (size_t)batch.height * 6 * i ;
+    direct[i].numDetections = batch.height ;
+    direct[i].boxes = batch.boxes[i].data() ;
+    direct[i].labels = batch.labels[i].data() ;
+    direct[i].flags = NULL ;
+    direct[i].numObjects = batch.labels[i].size() ;
+    mapped[i] = direct[i] ;
+    mapped[i].numDetections = cache.getImageDetections(i, &mapped[i].detections) ;
+  }
+  APMetric metrics [] = {AP_VOC07, AP_VOC12, AP_COCO} ;
+  for (int t = 0 ; t < 3 ; ++t) {
+    DetectionEvalOptions options ;
+    options.metric = metrics[t] ;
+    if (metrics[t] == AP_COCO) {
+      options.iouThresholds.clear() ;
+      for (int k = 0 ; k < 10 ; ++k) {
+        options.iouThresholds.push_back(0.5 + 0.05 * k) ;
+      }
+      options.maxDetections = 100 ;
+    }
+    DetectionEvalResult a, b ;
+    evaluateDetections(direct.data(), batch.numImages, batch.numClasses,
+                       options, &a) ;
+    evaluateDetections(mapped.data(), batch.numImages, batch.numClasses,
+                       options, &b) ;
+    bool same = (a.numPositives == b.numPositives) ;
+    for (size_t k = 0 ; k < a.ap.size() ; ++k) {
+      same &= (a.ap[k] == b.ap[k]) || (a.ap[k] != a.ap[k] && b.ap[k] != b.ap[k]) ;
+    }
+    CHECK(same, "%s: the AP of the mapped images differs (metric %d)",
+          name, t) ;
+  }
+}
+
+static void checkRoundTrip(char const *name, Batch const &batch,
+                           std::vector<int> const &chunks, bool mixed)
+{
+  bool ok = writeBatch(batch, chunks, mixed) ;
+  CHECK(ok, "%s: could not write the cache", name) ;
+  DetectionCache cache ;
+  ok = ok && cache.open(cachePath) ;
+  CHECK(ok, "%s: could not open the cache: %s", name,
+        cache.getLastError().c_str()) ;
+  if (!ok) { return ; }
+  checkSections(name, batch, cache) ;
+  checkEvaluation(name, batch, cache) ;
+}
+
+/* ---------------------------------------------------------------- */
+/* ---------------------------------------------------------------- */
+
+static void patchFile(long offset, void const *bytes, size_t size)
+{
+  FILE *file = fopen(cachePath, "r+b") ;
+  fseek(file, offset, SEEK_SET) ;
+  fwrite(bytes, 1, size, file) ;
+  fclose(file) ;
+}
+
+static void checkRejected(char const *name)
+{
+  DetectionCache cache ;
+  CHECK(!cache.open(cachePath), "%s: the cache was accepted", name) ;
+  CHECK(!cache.isOpen(), "%s: the cache is still open", name) ;
+  CHECK(!cache.getLastError().empty(), "%s: no error message", name) ;
+}
+
+static void checkErrors(Batch const &batch)
+{
+  std::vector<int> chunks(1, batch.numImages) ;
+
+  // a writer which is not finished leaves an incomplete file
+  {
+    DetectionCacheWriter writer ;
+    writer.open(cachePath, batch.numClasses) ;
+    writer.append(batch.detections.data(), batch.height, batch.numImages) ;
+  }
+  checkRejected("unfinished") ;
+
+  uint32_t version = DETECTION_CACHE_VERSION + 1 ;
+  writeBatch(batch, chunks, false) ;
+  patchFile(offsetof(DetectionCacheHeader, version), &version, sizeof(version)) ;
+  checkRejected("version") ;
+
+  writeBatch(batch, chunks, false) ;
+  patchFile(0, "XXXX", 4) ;
+  checkRejected("magic") ;
+
+  uint64_t numImages = batch.numImages + 1 ;
+  writeBatch(batch, chunks, false) ;
+  patchFile(offsetof(DetectionCacheHeader, numImages),
+            &numImages, sizeof(numImages)) ;
+  checkRejected("layout") ;
+
+  uint64_t offset = 1000000 ;
+  writeBatch(batch, chunks, false) ;
+  {
+    DetectionCache cache ;
+    cache.open(cachePath) ;
+    long indexOffset = (long)(sizeof(DetectionCacheHeader)
+                              + 24 * cache.getNumDetections())
+                       + 8 * 2 ;
+    cache.close() ;
+    patchFile(indexOffset, &offset, sizeof(offset)) ;
+  }
+  checkRejected("index") ;
+
+  fclose(fopen(cachePath, "wb")) ;
+  checkRejected("empty file") ;
+
+  // labels beyond the number of classes are an error
+  {
+    DetectionCacheWriter writer ;
+    writer.open(cachePath, batch.numClasses - 1) ;
+    bool ok = writer.append(batch.detections.data(), batch.height,
+                            batch.numImages) ;
+    CHECK(!ok && !writer.isOpen(), "a label beyond the classes was accepted") ;
+  }
+  checkRejected("bad label") ;
+
+  // so are labels which are not integers
+  {
+    std::vector<float> detections = batch.detections ;
+    size_t r = 0 ;
+    while (detections[r] < 1) { ++ r ; }
+    detections[r] += 0.5f ;
+    DetectionCacheWriter writer ;
+    writer.open(cachePath, batch.numClasses + 1) ;
+    bool ok = writer.append(detections.data(), batch.height,
+                            batch.numImages) ;
+    CHECK(!ok && !writer.isOpen(), "a fractional label was accepted") ;
+  }
+  checkRejected("fractional label") ;
+}
+
+int main(int argc, char **argv)
+{
+  Batch batch ;
+  makeBatch(50, 5, 40, 1, &batch) ;
+  checkRoundTrip("one batch", batch, std::vector<int>(1, 50), false) ;
+  int chunks [] = {8, 0, 8, 1, 13, 8, 8, 4} ;
+  std::vector<int> uneven(chunks, chunks + 8) ;
+  checkRoundTrip("uneven batches", batch, uneven, false) ;
+  checkRoundTrip("mixed layouts", batch, uneven, true) ;
+  makeBatch(120, 21, 200, 2, &batch) ;
+  checkRoundTrip("voc", batch, std::vector<int>(15, 8), true) ;
+  makeBatch(0, 3, 10, 3, &batch) ;
+  checkRoundTrip("empty", batch, std::vector<int>(), false) ;
+  makeBatch(30, 4, 20, 4, &batch) ;
+  checkErrors(batch) ;
+  remove(cachePath) ;
+  return finishChecks() ;
+}
@@ -0,0 +1,525 @@
+// @file test_detectioneval.cpp
+// @brief Comparison of the detection evaluation with the VOC and COCO code
+// @author Samuel Albanie
+// @author Andrea Vedaldi
+
+/*
+Copyright (C) 2017- Samuel Albanie and Andrea Vedaldi.
+All rights reserved.
+
+This file is part of the VLFeat library and is made available under
+the terms of the BSD license (see the COPYING file).
+*/
+
+#include "check.hpp"
+#include "workload.hpp"
+#include <bits/impl/detectioneval.hpp>
+
+#include <stdio.h>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+using namespace vl::impl ;
+using namespace vl::standalone ;
+
+// The references are direct translations of VOCevaldet.m of the VOC
+// devkit (with its stable sort of all the detections of a class, and NaN
+// precisions at the ignored detections ranked first) and of the
+// evaluateImg and accumulate methods of pycocotools.  The engine must give
+// the same average precision at every threshold, whatever the number of
+// threads.
+
+// A set of images with detections in the detector layout and ground truth
+struct Dataset
+{
+  int numClasses ;
+  int height ;
+  std::vector<float> detections ; // height x 6 x 1 x numImages
+  std::vector<std::vector<float> > boxes ;
+  std::vector<std::vector<float> > labels ;
+  std::vector<std::vector<unsigned char> > flags ;
+
+  int numImages() const { return boxes.size() ; }
+
+  std::vector<DetectionEvalImage> images() const
+  {
+    std::vector<DetectionEvalImage> images(numImages()) ;
+    for (int i = 0 ; i < numImages() ; ++i) {
+      images[i].detections = detections.data() + (size_t)height * 6 * i ;
+      images[i].numDetections = height ;
+      images[i].boxes = boxes[i].data() ;
+      images[i].labels = labels[i].data() ;
+      images[i].flags = flags[i].data() ;
+      images[i].numObjects = labels[i].size() ;
+    }
+    return images ;
+  }
+
+  float det(int i, int r, int j) const
+  {
+    return detections[(size_t)height * (6 * i + j) + r] ;
+  }
+
+  double box(int i, int g, int j) const
+  {
+    return boxes[i][labels[i].size() * j + g] ;
+  }
+} ;
+
+static bool isNaN(double x) { return x != x ; }
+
+/* ---------------------------------------------------------------- */
+/*                                                    VOC reference */
+/* ---------------------------------------------------------------- */
+
+struct VocDetection
+{
+  double score ;
+  int image ;
+  double bb [4] ;
+} ;
+
+static bool vocScoreDescend(VocDetection const &a, VocDetection const &b)
+{
+  return a.score > b.score ;
+}
+
+static double vocReference(Dataset const &data, int label, double minOverlap,
+                           bool voc07, bool pixelCoordinates)
+{
+  const double one = pixelCoordinates ? 1 : 0 ;
+  std::vector<VocDetection> dets ;
+  for (int i = 0 ; i < data.numImages() ; ++i) {
+    for (int r = 0 ; r < data.height ; ++r) {
+      if ((int)data.det(i, r, 0) != label) { continue ; }
+      VocDetection d = { data.det(i, r, 1), i,
+        { data.det(i, r, 2), data.det(i, r, 3),
+          data.det(i, r, 4), data.det(i, r, 5) } } ;
+      dets.push_back(d) ;
+    }
+  }
+  std::stable_sort(dets.begin(), dets.end(), vocScoreDescend) ;
+
+  int npos = 0 ;
+  std::vector<std::vector<bool> > detected(data.numImages()) ;
+  for (int i = 0 ; i < data.numImages() ; ++i) {
+    detected[i].assign(data.labels[i].size(), false) ;
+    for (int g = 0 ; g < data.labels[i].size() ; ++g) {
+      npos += ((int)data.labels[i][g] == label && !data.flags[i][g]) ;
+    }
+  }
+
+  const int nd = dets.size() ;
+  std::vector<double> tp(nd, 0), fp(nd, 0) ;
+  for (int d = 0 ; d < nd ; ++d) {
+    const int i = dets[d].image ;
+    double const *bb = dets[d].bb ;
+    double ovmax = -std::numeric_limits<double>::infinity() ;
+    int jmax = -1 ;
+    for (int g = 0 ; g < data.labels[i].size() ; ++g) {
+      if ((int)data.labels[i][g] != label) { continue ; }
+      double bbgt [4] ;
+      for (int j = 0 ; j < 4 ; ++j) { bbgt[j] = data.box(i, g, j) ; }
+      double bi [4] = { std::max(bb[0], bbgt[0]), std::max(bb[1], bbgt[1]),
+                        std::min(bb[2], bbgt[2]), std::min(bb[3], bbgt[3]) } ;
+      double iw = bi[2] - bi[0] + one ;
+      double ih = bi[3] - bi[1] + one ;
+      if (iw > 0 && ih > 0) {
+        double ua = (bb[2] - bb[0] + one) * (bb[3] - bb[1] + one) +
+                    (bbgt[2] - bbgt[0] + one) * (bbgt[3] - bbgt[1] + one) -
+                    iw * ih ;
+        double ov = iw * ih / ua ;
+        if (ov > ovmax) { ovmax = ov ; jmax = g ; }
+      }
+    }
+    if (ovmax >= minOverlap) {
+      if (!data.flags[i][jmax]) {
+        if (!detected[i][jmax]) {
+          tp[d] = 1 ;
+          detected[i][jmax] = true ;
+        } else {
+          fp[d] = 1 ;
+        }
+      }
+    } else {
+      fp[d] = 1 ;
+    }
+  }
+
+  if (npos == 0) { return std::numeric_limits<double>::quiet_NaN() ; }
+  std::vector<double> rec(nd), prec(nd) ;
+  double tpSum = 0, fpSum = 0 ;
+  for (int d = 0 ; d < nd ; ++d) {
+    tpSum += tp[d] ; fpSum += fp[d] ;
+    rec[d] = tpSum / npos ;
+    prec[d] = tpSum / (fpSum + tpSum) ; // NaN before the first tp or fp
+  }
+
+  double ap = 0 ;
+  if (voc07) {
+    for (int k = 0 ; k <= 10 ; ++k) {
+      double t = (k <= 5) ? k * 0.1 : 1 - (10 - k) * 0.1 ; // as 0:0.1:1
+      double p = -std::numeric_limits<double>::infinity() ;
+      bool any = false ;
+      for (int d = 0 ; d < nd ; ++d) {
+        if (rec[d] >= t && !isNaN(prec[d])) { p = std::max(p, prec[d]) ; any = true ; }
+      }
+      if (!any) { p = 0 ; }
+      ap += p / 11 ;
+    }
+  } else {
+    // VOCap: MATLAB's max ignores NaNs
+    std::vector<double> mrec(1, 0), mpre(1, 0) ;
+    mrec.insert(mrec.end(), rec.begin(), rec.end()) ; mrec.push_back(1) ;
+    mpre.insert(mpre.end(), prec.begin(), prec.end()) ; mpre.push_back(0) ;
+    for (int k = mpre.size() - 2 ; k >= 0 ; --k) {
+      if (isNaN(mpre[k])) { mpre[k] = mpre[k + 1] ; }
+      else if (!isNaN(mpre[k + 1])) { mpre[k] = std::max(mpre[k], mpre[k + 1]) ; }
+    }
+    for (int k = 1 ; k < mrec.size() ; ++k) {
+      if (mrec[k] != mrec[k - 1]) { ap += (mrec[k] - mrec[k - 1]) * mpre[k] ; }
+    }
+  }
+  return ap ;
+}
+
+/* ---------------------------------------------------------------- */
+/*                                                   COCO reference */
+/* ---------------------------------------------------------------- */
+
+struct CocoDetection
+{
+  double score ;
+  bool matched ;
+  bool ignored ;
+} ;
+
+static bool cocoScoreDescend(CocoDetection const &a, CocoDetection const &b)
+{
+  return a.score > b.score ;
+}
+
+static double cocoReference(Dataset const &data, int label, double threshold,
+                            int maxDets)
+{
+  std::vector<CocoDetection> all ;
+  int npig = 0 ;
+  for (int i = 0 ; i < data.numImages() ; ++i) {
+    // evaluateImg
+    std::vector<int> gt ;
+    for (int pass = 0 ; pass < 2 ; ++pass) {
+      for (int g = 0 ; g < data.labels[i].size() ; ++g) {
+        if ((int)data.labels[i][g] == label && data.flags[i][g] == pass) {
+          gt.push_back(g) ;
+        }
+      }
+    }
+    std::vector<std::pair<double, int> > dt ;
+    for (int r = 0 ; r < data.height ; ++r) {
+      if ((int)data.det(i, r, 0) == label) {
+        dt.push_back(std::make_pair(-(double)data.det(i, r, 1), r)) ;
+      }
+    }
+    std::stable_sort(dt.begin(), dt.end(),
+                     [](std::pair<double, int> const &a,
+                        std::pair<double, int> const &b) {
+                       return a.first < b.first ; }) ;
+    if (dt.size() > maxDets) { dt.resize(maxDets) ; }
+
+    std::vector<int> gtm(gt.size(), -1) ;
+    for (int j = 0 ; j < gt.size() ; ++j) { npig += !data.flags[i][gt[j]] ; }
+    for (int d = 0 ; d < dt.size() ; ++d) {
+      const int r = dt[d].second ;
+      double a [4] = { data.det(i, r, 2), data.det(i, r, 3),
+                       data.det(i, r, 4), data.det(i, r, 5) } ;
+      double iou = std::min(threshold, 1 - 1e-10) ;
+      int m = -1 ;
+      for (int j = 0 ; j < gt.size() ; ++j) {
+        const int g = gt[j] ;
+        const bool crowd = data.flags[i][g] ;
+        if (gtm[j] >= 0 && !crowd) { continue ; }
+        if (m > -1 && !data.flags[i][gt[m]] && crowd) { break ; }
+        // maskUtils.iou of [x y w h] boxes
+        double b [4] ;
+        for (int k = 0 ; k < 4 ; ++k) { b[k] = data.box(i, g, k) ; }
+        double w = std::min(a[2], b[2]) - std::max(a[0], b[0]) ;
+        double h = std::min(a[3], b[3]) - std::max(a[1], b[1]) ;
+        double o = 0 ;
+        if (w > 0 && h > 0) {
+          double inter = w * h ;
+          double da = (a[2] - a[0]) * (a[3] - a[1]) ;
+          double db = (b[2] - b[0]) * (b[3] - b[1]) ;
+          o = inter / (crowd ? da : da + db - inter) ;
+        }
+        if (o < iou) { continue ; }
+        iou = o ;
+        m = j ;
+      }
+      CocoDetection det = { -dt[d].first, m >= 0,
+                            m >= 0 && data.flags[i][gt[m]] } ;
+      if (m >= 0) { gtm[m] = d ; }
+      all.push_back(det) ;
+    }
+  }
+
+  // accumulate
+  if (npig == 0) { return std::numeric_limits<double>::quiet_NaN() ; }
+  std::stable_sort(all.begin(), all.end(), cocoScoreDescend) ;
+  const int nd = all.size() ;
+  std::vector<double> rc(nd), pr(nd) ;
+  double tp = 0, fp = 0 ;
+  for (int d = 0 ; d < nd ; ++d) {
+    tp += (all[d].matched && !all[d].ignored) ;
+    fp += (!all[d].matched && !all[d].ignored) ;
+    rc[d] = tp / npig ;
+    pr[d] = tp / (fp + tp + 2.220446049250313e-16) ;
+  }
+  for (int d = nd - 1 ; d > 0 ; --d) {
+    if (pr[d] > pr[d - 1]) { pr[d - 1] = pr[d] ; }
+  }
+  double ap = 0 ;
+  for (int k = 0 ; k <= 100 ; ++k) {
+    double level = (k < 100) ? k * 0.01 : 1.0 ;
+    int index = std::lower_bound(rc.begin(), rc.end(), level) - rc.begin() ;
+    ap += (index < nd) ? pr[index] : 0 ;
+  }
+  return ap / 101 ;
+}
+
+/* ---------------------------------------------------------------- */
+/*                                                           checks */
+/* ---------------------------------------------------------------- */
+
+static void makeDataset(int numImages, int numClasses, int height,
+                        uint64_t seed, float scale, float flagRate,
+                        Dataset *data)
+{
+  Random random(seed) ;
+  data->numClasses = numClasses ;
+  data->height = height ;
+  data->detections.assign((size_t)height * 6 * numImages, 0.0f) ;
+  data->boxes.resize(numImages) ;
+  data->labels.resize(numImages) ;
+  data->flags.resize(numImages) ;
+  for (int i = 0 ; i < numImages ; ++i) {
+    const int numObjects = random.index(7) ;
+    std::vector<float> boxes(numObjects * 4) ;
+    data->labels[i].resize(numObjects) ;
+    data->flags[i].resize(numObjects) ;
+    for (int g = 0 ; g < numObjects ; ++g) {
+      float x = 0.7f * random.uniform(), y = 0.7f * random.uniform() ;
+      boxes[g] = x * scale ;
+      boxes[numObjects + g] = y * scale ;
+      boxes[2 * numObjects + g] = (x + 0.05f + 0.25f * random.uniform()) * scale ;
+      boxes[3 * numObjects + g] = (y + 0.05f + 0.25f * random.uniform()) * scale ;
+      data->labels[i][g] = (float)(2 + random.index(numClasses - 1)) ;
+      data->flags[i][g] = (random.uniform() < flagRate) ;
+    }
+    data->boxes[i] = boxes ;
+
+    // jittered (and duplicated) detections of the objects, false
+    // positives, and padding; coarse scores make ties frequent
+    float *dets = data->detections.data() + (size_t)height * 6 * i ;
+    const int count = height - random.index(height / 3) ;
+    for (int r = 0 ; r < count ; ++r) {
+      int g = random.index(numObjects + 2) ;
+      float label, b [4] ;
+      if (g < numObjects) {
+        label = (random.uniform() < 0.9f) ? data->labels[i][g]
+                                          : (float)(2 + random.index(numClasses - 1)) ;
+        for (int k = 0 ; k < 4 ; ++k) {
+          b[k] = boxes[numObjects * k + g] + 0.04f * scale * random.normal() ;
+        }
+      } else {
+        label = (float)(2 + random.index(numClasses - 1)) ;
+        float x = 0.8f * random.uniform(), y = 0.8f * random.uniform() ;
+        b[0] = x * scale ; b[1] = y * scale ;
+        b[2] = (x + 0.2f * random.uniform()) * scale ;
+        b[3] = (y + 0.2f * random.uniform()) * scale ;
+      }
+      dets[r] = label ;
+      dets[height + r] = (1 + random.index(20)) * 0.05f ;
+      for (int k = 0 ; k < 4 ; ++k) { dets[height * (2 + k) + r] = b[k] ; }
+    }
+  }
+}
+
+static void checkDataset(char const *name, Dataset const &data,
+                         APMetric metric, bool pixelCoordinates)
+{
+  DetectionEvalOptions options ;
+  options.metric = metric ;
+  options.pixelCoordinates = pixelCoordinates ;
+  options.iouThresholds.clear() ;
+  for (int t = 0 ; t < 10 ; ++t) {
+    options.iouThresholds.push_back(t * ((0.95 - 0.5) / 9) + 0.5) ;
+  }
+  if (metric == AP_COCO) { options.maxDetections = 10 ; }
+  std::vector<DetectionEvalImage> images = data.images() ;
+
+  DetectionEvalResult first ;
+  int threadCounts [] = {1, 3, 8} ;
+  for (int n = 0 ; n < 3 ; ++n) {
+    DetectionEvalResult result ;
+    options.numThreads = threadCounts[n] ;
+    evaluateDetections(images.data(), images.size(), data.numClasses,
+                       options, &result) ;
+    if (n > 0) {
+      bool same = result.numPositives == first.numPositives ;
+      for (int k = 0 ; k < result.ap.size() ; ++k) {
+        same &= (result.ap[k] == first.ap[k]) ||
+                (isNaN(result.ap[k]) && isNaN(first.ap[k])) ;
+      }
+      CHECK(same, "%s: %d threads change the result", name, threadCounts[n]) ;
+      continue ;
+    }
+    first = result ;
+    for (int t = 0 ; t < options.iouThresholds.size() ; ++t) {
+      for (int c = 0 ; c < data.numClasses ; ++c) {
+        double expected = (metric == AP_COCO) ?
+          cocoReference(data, c + 1, options.iouThresholds[t], options.maxDetections) :
+          vocReference(data, c + 1, options.iouThresholds[t],
+                       metric == AP_VOC07, pixelCoordinates) ;
+        double ap = result.ap[(size_t)data.numClasses * t + c] ;
+        CHECK((isNaN(ap) && isNaN(expected)) || std::fabs(ap - expected) < 1e-12,
+              "%s: label %d, IoU %g: AP %.15g, expected %.15g", name, c + 1,
+              options.iouThresholds[t], ap, expected) ;
+      }
+    }
+  }
+}
+
+// One image, two boxes, detections ranked TP, FP, TP: the precision is
+// [1 1/2 2/3] at recall [1/2 1/2 1]
+static void checkExample()
+{
+  float boxes [] = {0.0f, 0.5f, 0.0f, 0.5f, 0.4f, 0.9f, 0.4f, 0.9f} ;
+  float labels [] = {2, 2} ;
+  float dets [] = {2, 2, 2, 0.9f, 0.8f, 0.7f,
+                   0.0f, 0.6f, 0.5f, 0.0f, 0.0f, 0.5f,
+                   0.4f, 0.9f, 0.9f, 0.4f, 0.4f, 0.9f} ;
+  DetectionEvalImage image = {dets, 3, boxes, labels, NULL, 2} ;
+  DetectionEvalOptions options ;
+  DetectionEvalResult result ;
+  double expected [] = {(6 + 5 * 2 / 3.0) / 11, 0.5 + 0.5 * 2 / 3.0,
+                        (51 + 50 * 2 / 3.0) / 101} ;
+  for (int metric = AP_VOC07 ; metric <= AP_COCO ; ++metric) {
+    options.metric = (APMetric)metric ;
+    evaluateDetections(&image, 1, 2, options, &result) ;
+    CHECK(isNaN(result.ap[0]) && result.numPositives[1] == 2 &&
+          std::fabs(result.ap[1] - expected[metric]) < 1e-12,
+          "example: metric %d: AP %g, expected %g", metric, result.ap[1],
+          expected[metric]) ;
+  }
+}
+
+// Clipping the detections while matching them gives the AP of a clipped
+// copy of the detections
+static void checkRecallLevels()
+{
+  // ten objects side by side, detected by three true positives, a false
+  // positive, seven true positives and a duplicate, so that the recall
+  // is exactly 0.3 (as a double) at a precision of 1
+  const int numObjects = 10, numDetections = 12 ;
+  const int order [numDetections] = {0, 1, 2, -1, 3, 4, 5, 6, 7, 8, 9, 9} ;
+  std::vector<float> boxes(numObjects * 4), labels(numObjects, 2) ;
+  std::vector<float> dets(numDetections * 6) ;
+  for (int g = 0 ; g < numObjects ; ++g) {
+    boxes[g] = 0.1f * g ;
+    boxes[numObjects + g] = 0.0f ;
+    boxes[numObjects * 2 + g] = 0.1f * g + 0.08f ;
+    boxes[numObjects * 3 + g] = 0.5f ;
+  }
+  for (int d = 0 ; d < numDetections ; ++d) {
+    const int g = order[d] ;
+    dets[d] = 2 ;
+    dets[numDetections + d] = 1.0f - 0.05f * d ;
+    for (int j = 0 ; j < 4 ; ++j) {
+      dets[numDetections * (2 + j) + d] = (g >= 0) ? boxes[numObjects * j + g]
+                                                   : 0.6f + 0.3f * (j >= 2) ;
+    }
+  }
+  DetectionEvalImage image = {dets.data(), numDetections, boxes.data(),
+                              labels.data(), NULL, numObjects} ;
+  DetectionEvalOptions options ;
+  DetectionEvalResult result ;
+  options.metric = AP_VOC07 ;
+  evaluateDetections(&image, 1, 2, options, &result) ;
+
+  // MATLAB's fourth recall level 0.30000000000000004 is only reached at
+  // the precision 10/11 of the eleventh detection; the level 3 / 10.0 would
+  // count the precision 1 instead
+  const double expected = (3 + 8 * 10 / 11.0) / 11 ;
+  CHECK(std::fabs(result.ap[1] - expected) < 1e-12,
+        "recall levels: AP %.17g, expected %.17g", result.ap[1], expected) ;
+  Dataset data ;
+  data.numClasses = 2 ;
+  data.height = numDetections ;
+  data.detections = dets ;
+  data.boxes.assign(1, boxes) ;
+  data.labels.assign(1, labels) ;
+  data.flags.assign(1, std::vector<unsigned char>(numObjects, 0)) ;
+  const double reference = vocReference(data, 2, 0.5, true, false) ;
+  CHECK(std::fabs(reference - expected) < 1e-12,
+        "recall levels: reference AP %.17g, expected %.17g", reference,
+        expected) ;
+}
+
+static void checkClipping()
+{
+  // push some of the detections out of the image
+  Dataset data, clipped ;
+  makeDataset(100, 6, 30, 6, 1.0f, 0.15f, &data) ;
+  for (int i = 0 ; i < data.numImages() ; ++i) {
+    float *dets = data.detections.data() + (size_t)data.height * 6 * i ;
+    for (int k = data.height * 2 ; k < data.height * 6 ; ++k) {
+      dets[k] = (dets[k] - 0.1f) * 1.3f ;
+    }
+  }
+  clipped = data ;
+  for (int i = 0 ; i < data.numImages() ; ++i) {
+    float *dets = clipped.detections.data() + (size_t)data.height * 6 * i ;
+    for (int k = data.height * 2 ; k < data.height * 6 ; ++k) {
+      dets[k] = std::min(std::max(dets[k], 0.0f), 1.0f) ;
+    }
+  }
+  std::vector<DetectionEvalImage> images = data.images() ;
+  std::vector<DetectionEvalImage> clippedImages = clipped.images() ;
+  for (int metric = AP_VOC07 ; metric <= AP_COCO ; ++metric) {
+    DetectionEvalOptions options ;
+    DetectionEvalResult result, expected ;
+    options.metric = (APMetric)metric ;
+    evaluateDetections(clippedImages.data(), clippedImages.size(),
+                       data.numClasses, options, &expected) ;
+    options.clipBoxes = true ;
+    evaluateDetections(images.data(), images.size(), data.numClasses,
+                       options, &result) ;
+    bool same = true ;
+    for (int k = 0 ; k < result.ap.size() ; ++k) {
+      same &= (result.ap[k] == expected.ap[k]) ||
+              (isNaN(result.ap[k]) && isNaN(expected.ap[k])) ;
+    }
+    CHECK(same, "clipping: metric %d: the AP differs from that of clipped "
+          "detections", metric) ;
+  }
+}
+
+int main(int argc, char **argv)
+{
+  checkExample() ;
+  checkRecallLevels() ;
+  checkClipping() ;
+  Dataset data ;
+  makeDataset(200, 6, 30, 3, 1.0f, 0.15f, &data) ;
+  checkDataset("voc07", data, AP_VOC07, false) ;
+  checkDataset("voc12", data, AP_VOC12, false) ;
+  checkDataset("coco", data, AP_COCO, false) ;
+  makeDataset(200, 4, 30, 4, 1.0f, 0.5f, &data) ;
+  checkDataset("coco, crowds", data, AP_COCO, false) ;
+  makeDataset(100, 21, 40, 5, 500.0f, 0.15f, &data) ;
+  checkDataset("voc07, pixels", data, AP_VOC07, true) ;
+  checkDataset("voc12, pixels", data, AP_VOC12, true) ;
+  return finishChecks() ;
+}
@@ -0,0 +1,173 @@
+// @file test_hardnegatives.cpp
+// @brief Comparison of hard negative mining with a full sort reference
+// @author Samuel Albanie
+// @author Andrea Vedaldi
+
+/*
+Copyright (C) 2017- Samuel Albanie and Andrea Vedaldi.
+All rights reserved.
+
+This file is part of the VLFeat library and is made available under
+the terms of the BSD license (see the COPYING file).
+*/
+
+#include "check.hpp"
+#include "workload.hpp"
+#include <bits/impl/hardnegatives.hpp>
+
+#include <stdio.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+using namespace vl::impl ;
+using namespace vl::standalone ;
+
+// The reference is a direct translation of matlab/utils/compute_hard_negs.m,
+// using a stable sort of all the priors as MATLAB's sort does.  The miner
+// must select the same priors in the same order, whatever the number of
+// threads.
+
+/* ---------------------------------------------------------------- */
+/*                                                        reference */
+/* ---------------------------------------------------------------- */
+
+static void referenceMine(float const *confPreds, int numPriors,
+                          int numClasses, int backgroundLabel,
+                          double negPosRatio, HardNegativeImage const &image,
+                          std::vector<int> *hardNegs)
+{
+  std::vector<float> loss(numPriors) ;
+  for (int p = 0 ; p < numPriors ; ++p) {
+    float const *x = confPreds + (size_t)p * numClasses ;
+    float maxScore = *std::max_element(x, x + numClasses) ;
+    float sum = 0 ;
+    for (int c = 0 ; c < numClasses ; ++c) {
+      sum += std::exp(x[c] - maxScore) ;
+    }
+    loss[p] = maxScore + std::log(sum) - x[backgroundLabel] ;
+  }
+  for (int k = 0 ; k < image.numPositives ; ++k) {
+    loss[image.positives[k]] = -std::numeric_limits<float>::infinity() ;
+  }
+  for (int k = 0 ; k < image.numIgnored ; ++k) {
+    loss[image.ignored[k]] = -std::numeric_limits<float>::infinity() ;
+  }
+
+  // sort(loss, 'descend'), with NaNs first
+  std::vector<int> ranked(numPriors) ;
+  for (int p = 0 ; p < numPriors ; ++p) { ranked[p] = p ; }
+  std::stable_sort(ranked.begin(), ranked.end(), [&](int a, int b) {
+    if (std::isnan(loss[a]) || std::isnan(loss[b])) {
+      return std::isnan(loss[a]) && !std::isnan(loss[b]) ;
+    }
+    return loss[a] > loss[b] ;
+  }) ;
+  int numNeg = std::min((int)std::round(negPosRatio * image.numPositives),
+                        numPriors - image.numPositives) ;
+  hardNegs->assign(ranked.begin(), ranked.begin() + numNeg) ;
+}
+
+/* ---------------------------------------------------------------- */
+/*                                                            tests */
+/* ---------------------------------------------------------------- */
+
+// Random positives (unique, as produced by the matcher) and ignored
+// priors (which may include positives)
+static void makeImage(Random &random, int numPriors, int numPositives,
+                      int numIgnored, std::vector<int> *positives,
+                      std::vector<int> *ignored, HardNegativeImage *image)
+{
+  std::vector<char> used(numPriors, 0) ;
+  positives->clear() ;
+  while ((int)positives->size() < numPositives) {
+    int p = random.index(numPriors) ;
+    if (!used[p]) { used[p] = 1 ; positives->push_back(p) ; }
+  }
+  ignored->clear() ;
+  for (int k = 0 ; k < numIgnored ; ++k) {
+    ignored->push_back(random.index(numPriors)) ;
+  }
+  image->positives = positives->data() ;
+  image->numPositives = numPositives ;
+  image->ignored = ignored->data() ;
+  image->numIgnored = numIgnored ;
+}
+
+static void testModel(PriorSpec const &spec, int numClasses, int batchSize,
+                      uint64_t seed)
+{
+  Workload w ;
+  makeWorkload(spec, numClasses, batchSize, 6, seed, &w) ;
+  Random random(seed) ;
+
+  // the workload holds class probabilities, whereas the loss is computed
+  // from the (unnormalised) scores of the network
+  for (size_t k = 0 ; k < w.confPreds.size() ; ++k) {
+    w.confPreds[k] = std::log(std::max(w.confPreds[k], 1e-30f)) ;
+  }
+
+  // a few ties and NaNs, which must be ranked as MATLAB does
+  for (int k = 0 ; k < 50 ; ++k) {
+    size_t p = random.index(w.numPriors * batchSize) ;
+    size_t q = random.index(w.numPriors * batchSize) ;
+    std::copy(&w.confPreds[p * numClasses], &w.confPreds[(p + 1) * numClasses],
+              &w.confPreds[q * numClasses]) ;
+  }
+  w.confPreds[random.index(w.numPriors) * numClasses] = NAN ;
+
+  std::vector<std::vector<int> > positives(batchSize), ignored(batchSize) ;
+  std::vector<HardNegativeImage> images(batchSize) ;
+  for (int i = 0 ; i < batchSize ; ++i) {
+    // image 0 has no positives, image 1 so many that all the remaining
+    // priors (including ignored ones) are selected
+    int numPositives = (i == 0) ? 0 : (i == 1) ? w.numPriors / 3
+                                    : 1 + random.index(60) ;
+    int numIgnored = (i % 2) ? random.index(w.numPriors / 4) : 0 ;
+    makeImage(random, w.numPriors, numPositives, numIgnored,
+              &positives[i], &ignored[i], &images[i]) ;
+  }
+
+  const double negPosRatio = 3 ;
+  std::vector<std::vector<int> > expected(batchSize) ;
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now() ;
+  for (int i = 0 ; i < batchSize ; ++i) {
+    referenceMine(&w.confPreds[(size_t)i * w.numPriors * numClasses],
+                  w.numPriors, numClasses, 0, negPosRatio, images[i],
+                  &expected[i]) ;
+  }
+  std::chrono::steady_clock::time_point mid = std::chrono::steady_clock::now() ;
+  std::vector<std::vector<int> > hardNegs(batchSize) ;
+  mineHardNegativesBatch(w.confPreds.data(), w.numPriors, numClasses, 0,
+                         negPosRatio, images.data(), batchSize, 1,
+                         hardNegs.data()) ;
+  std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now() ;
+
+  for (int i = 0 ; i < batchSize ; ++i) {
+    CHECK(hardNegs[i] == expected[i], "%s image %d: different hard negatives "
+          "(%d vs %d)", spec.name, i, (int)hardNegs[i].size(),
+          (int)expected[i].size()) ;
+  }
+  const int numThreads [] = { 2, 4, 0 } ;
+  for (int t = 0 ; t < 3 ; ++t) {
+    std::vector<std::vector<int> > threaded(batchSize) ;
+    mineHardNegativesBatch(w.confPreds.data(), w.numPriors, numClasses, 0,
+                           negPosRatio, images.data(), batchSize,
+                           numThreads[t], threaded.data()) ;
+    CHECK(threaded == hardNegs, "%s: %d threads change the hard negatives",
+          spec.name, numThreads[t]) ;
+  }
+  printf("%s: %d images, reference %.3f ms, miner %.3f ms per image\n",
+         spec.name, batchSize,
+         std::chrono::duration<double>(mid - start).count() * 1e3 / batchSize,
+         std::chrono::duration<double>(end - mid).count() * 1e3 / batchSize) ;
+}
+
+int main(int argc, char **argv)
+{
+  testModel(*ssd300(), 21, 16, 1) ;
+  testModel(*ssd512(), 81, 8, 2) ;
+  return finishChecks() ;
+}
@@ -0,0 +1,559 @@
+// @file test_multiboxdetector.cpp
+// @brief Golden output regression test of the CPU multibox detector
+// @author Samuel Albanie
+// @author Andrea Vedaldi
+
+/*
+Copyright (C) 2017- Samuel Albanie and Andrea Vedaldi.
+All rights reserved.
+
+This file is part of the VLFeat library and is made available under
+the terms of the BSD license (see the COPYING file).
+*/
+
+#include "check.hpp"
+#include "workload.hpp"
+#include <bits/impl/multiboxdetector.hpp>
+#include <bits/impl/multiboxstats.hpp>
+#include <bits/impl/predformats.hpp>
+#include <bits/impl/priorcache.hpp>
+
+#include <algorithm>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+using namespace vl ;
+using namespace vl::impl ;
+using namespace vl::standalone ;
+
+// The detections of each configuration are compared with those stored in
+// golden/<name>.txt, one [image label score xmin ymin xmax ymax] record
+// per line.  Labels and counts must match exactly; scores and boxes are
+// compared with a small tolerance, to allow for differences in the libm
+// and SIMD paths of different machines.  The golden files were produced
+// by the original (map based) CPU detector, so that they pin its results;
+// run with --update to regenerate them after an intended change.
+
+/* ---------------------------------------------------------------- */
+/*                                                          helpers */
+/* ---------------------------------------------------------------- */
+
+struct Config
+{
+  char const *name ;
+  PriorSpec const *spec ;
+  int numClasses ;
+  int batchSize ;
+  int objectsPerImage ;
+  int nmsTopK ;
+  int keepTopK ;
+  float nmsThresh ;
+  float confThresh ;
+} ;
+
+struct Detections
+{
+  std::vector<float> records ; // 7 values per detection, image first
+  std::vector<float> counts ;
+} ;
+
+// Gather the detections of the output, as records
+static void collect(Config const &config,
+                    std::vector<float> const &output,
+                    bool compact,
+                    Detections *detections)
+{
+  const int batchSize = (int)detections->counts.size() ;
+  const int keepTopK = config.keepTopK ;
+  detections->records.clear() ;
+  int offset = 0 ;
+  for (int i = 0 ; i < batchSize ; ++i) {
+    const int count = (int)detections->counts[i] ;
+    for (int k = 0 ; k < count ; ++k) {
+      detections->records.push_back((float)(i + 1)) ;
+      for (int j = 0 ; j < 6 ; ++j) {
+        float value = compact ? output[(offset + k) * 6 + j]
+                              : output[keepTopK * (6 * i + j) + k] ;
+        detections->records.push_back(value) ;
+      }
+    }
+    if (!compact) {
+      // the padding rows must be left zero
+      for (int k = count ; k < keepTopK ; ++k) {
+        CHECK(output[keepTopK * 6 * i + k] == 0,
+              "%s: image %d row %d is not padding", config.name, i + 1, k + 1) ;
+      }
+    }
+    offset += count ;
+  }
+}
+
+static void detect(Config const &config,
+                   Workload const &workload,
+                   MultiboxNMSMethod nmsMethod,
+                   bool compact,
+                   int numThreads,
+                   bool lazyDecode,
+                   PriorCache *priorCache,
+                   Detections *detections,
+                   MultiboxStats *stats = NULL,
+                   MultiboxWorkspace *workspace = NULL)
+{
+  const int batchSize = workload.batchSize ;
+  const int keepTopK = config.keepTopK ;
+  std::vector<float> output((size_t)keepTopK * 6 * batchSize, 0.0f) ;
+  detections->counts.assign(batchSize, 0.0f) ;
+  Context context ;
+  multiboxdetector<VLDT_CPU,float>::forward
+    (context, output.data(), detections->counts.data(),
+     workload.locPreds.data(), workload.confPreds.data(),
+     workload.priors.data(),
+     config.nmsTopK, keepTopK, workload.numClasses,
+     config.nmsThresh, config.confThresh, 1, nmsMethod, compact,
+     keepTopK, 6, batchSize, workload.numPriors,
+     numThreads, lazyDecode, priorCache, workspace, stats) ;
+  collect(config, output, compact, detections) ;
+}
+
+// As detect(), for predictions which may be in reduced precision
+static void detectReduced(Config const &config,
+                          Workload const &workload,
+                          MultiboxPreds const &locPreds,
+                          MultiboxPreds const &confPreds,
+                          int numThreads,
+                          bool lazyDecode,
+                          Detections *detections)
+{
+  const int batchSize = workload.batchSize ;
+  const int keepTopK = config.keepTopK ;
+  std::vector<float> output((size_t)keepTopK * 6 * batchSize, 0.0f) ;
+  detections->counts.assign(batchSize, 0.0f) ;
+  Context context ;
+  multiboxdetector<VLDT_CPU,float>::forward
+    (context, output.data(), detections->counts.data(),
+     locPreds, confPreds, workload.priors.data(),
+     config.nmsTopK, keepTopK, workload.numClasses,
+     config.nmsThresh, config.confThresh, 1, vlMultiboxNMSPerClass, false,
+     keepTopK, 6, batchSize, workload.numPriors,
+     numThreads, lazyDecode, NULL, NULL, NULL) ;
+  collect(config, output, false, detections) ;
+}
+
+static bool identical(Detections const &a, Detections const &b)
+{
+  return a.counts == b.counts && a.records == b.records ;
+}
+
+static bool writeGolden(std::string const &path, Config const &config,
+                        Detections const &detections)
+{
+  FILE *f = fopen(path.c_str(), "w") ;
+  if (!f) { return false ; }
+  fprintf(f, "# %s: %s, %d classes, batch %d, nmsTopK %d, keepTopK %d, "
+          "nmsThresh %g, confThresh %g\n", config.name, config.spec->name,
+          config.numClasses, config.batchSize, config.nmsTopK,
+          config.keepTopK, config.nmsThresh, config.confThresh) ;
+  fprintf(f, "# image label score xmin ymin xmax ymax\n") ;
+  for (size_t r = 0 ; r < detections.records.size() ; r += 7) {
+    float const *d = &detections.records[r] ;
+    fprintf(f, "%d %d %.9g %.9g %.9g %.9g %.9g\n",
+            (int)d[0], (int)d[1], d[2], d[3], d[4], d[5], d[6]) ;
+  }
+  fclose(f) ;
+  return true ;
+}
+
+static bool readGolden(std::string const &path, std::vector<float> *records)
+{
+  FILE *f = fopen(path.c_str(), "r") ;
+  if (!f) { return false ; }
+  char line [512] ;
+  records->clear() ;
+  while (fgets(line, sizeof(line), f)) {
+    if (line[0] == '#' || line[0] == '\n') { continue ; }
+    float d [7] ;
+    if (sscanf(line, "%f %f %f %f %f %f %f",
+               d, d + 1, d + 2, d + 3, d + 4, d + 5, d + 6) != 7) {
+      fclose(f) ;
+      return false ;
+    }
+    records->insert(records->end(), d, d + 7) ;
+  }
+  fclose(f) ;
+  return true ;
+}
+
+/* ---------------------------------------------------------------- */
+/*                                                            tests */
+/* ---------------------------------------------------------------- */
+
+static void testGolden(Config const &config, Workload const &workload,
+                       std::string const &goldenDir, bool update)
+{
+  Detections detections ;
+  detect(config, workload, vlMultiboxNMSPerClass, false, 1, true, NULL,
+         &detections) ;
+  std::string path = goldenDir + "/" + config.name + ".txt" ;
+  if (update) {
+    CHECK(writeGolden(path, config, detections),
+          "could not write %s", path.c_str()) ;
+    printf("updated %s (%d detections)\n", path.c_str(),
+           (int)detections.records.size() / 7) ;
+    return ;
+  }
+
+  std::vector<float> golden ;
+  if (!readGolden(path, &golden)) {
+    CHECK(false, "could not read %s", path.c_str()) ;
+    return ;
+  }
+  const std::vector<float> &records = detections.records ;
+  CHECK(golden.size() == records.size(),
+        "%s: %d detections, expected %d", config.name,
+        (int)records.size() / 7, (int)golden.size() / 7) ;
+  const size_t n = std::min(golden.size(), records.size()) ;
+  int numMismatches = 0 ;
+  for (size_t r = 0 ; r < n ; r += 7) {
+    bool match = (golden[r] == records[r]) && (golden[r + 1] == records[r + 1]) ;
+    match &= fabsf(golden[r + 2] - records[r + 2]) <= 1e-5f * golden[r + 2] + 1e-7f ;
+    for (int j = 3 ; j < 7 ; ++j) {
+      match &= fabsf(golden[r + j] - records[r + j]) <= 1e-5f ;
+    }
+    if (!match && numMismatches++ < 5) {
+      CHECK(false, "%s: detection %d is [%g %g %g %g %g %g %g], expected "
+            "[%g %g %g %g %g %g %g]", config.name, (int)r / 7 + 1,
+            records[r], records[r + 1], records[r + 2], records[r + 3],
+            records[r + 4], records[r + 5], records[r + 6],
+            golden[r], golden[r + 1], golden[r + 2], golden[r + 3],
+            golden[r + 4], golden[r + 5], golden[r + 6]) ;
+    }
+  }
+  CHECK(numMismatches == 0, "%s: %d mismatched detections", config.name,
+        numMismatches) ;
+}
+
+// The options of the detector that only affect its speed must not change
+// its output, bit for bit.
+static void testInvariance(Config const &config, Workload const &workload)
+{
+  Detections reference ;
+  detect(config, workload, vlMultiboxNMSPerClass, false, 1, true, NULL,
+         &reference) ;
+
+  PriorCache priorCache ;
+  for (int t = 0 ; t < 2 ; ++t) {
+    Detections detections ;
+    detect(config, workload, vlMultiboxNMSPerClass, false, 1, true,
+           &priorCache, &detections) ;
+    CHECK(identical(reference, detections), "%s: prior cache (call %d) "
+          "changes the output", config.name, t + 1) ;
+  }
+
+  const int numThreads [] = { 2, 4 } ;
+  for (int t = 0 ; t < 2 ; ++t) {
+    Detections detections ;
+    detect(config, workload, vlMultiboxNMSPerClass, false, numThreads[t],
+           true, NULL, &detections) ;
+    CHECK(identical(reference, detections), "%s: %d threads change the "
+          "output", config.name, numThreads[t]) ;
+  }
+
+  Detections eager ;
+  detect(config, workload, vlMultiboxNMSPerClass, false, 1, false, NULL,
+         &eager) ;
+  CHECK(identical(reference, eager), "%s: eager decoding changes the "
+        "output", config.name) ;
+
+  Detections compact ;
+  detect(config, workload, vlMultiboxNMSPerClass, true, 1, true, NULL,
+         &compact) ;
+  CHECK(identical(reference, compact), "%s: the compact layout changes "
+        "the output", config.name) ;
+
+  Detections batched ;
+  detect(config, workload, vlMultiboxNMSBatched, false, 1, true, NULL,
+         &batched) ;
+  CHECK(identical(reference, batched), "%s: batched NMS changes the "
+        "output", config.name) ;
+
+  // The detector has kernels specialised for 21 and 81 classes.  An extra
+  // class which never scores selects the generic kernel instead.
+  Workload padded = workload ;
+  const int numClasses = workload.numClasses ;
+  padded.numClasses = numClasses + 1 ;
+  padded.confPreds.assign((size_t)padded.numClasses * workload.numPriors *
+                          workload.batchSize, 0.0f) ;
+  for (size_t p = 0 ; p < (size_t)workload.numPriors * workload.batchSize ; ++p) {
+    std::copy(workload.confPreds.begin() + numClasses * p,
+              workload.confPreds.begin() + numClasses * (p + 1),
+              padded.confPreds.begin() + padded.numClasses * p) ;
+  }
+  Detections generic ;
+  detect(config, padded, vlMultiboxNMSPerClass, false, 2, true, NULL,
+         &generic) ;
+  CHECK(identical(reference, generic), "%s: the generic and the "
+        "specialised kernels differ", config.name) ;
+}
+
+// The counters must not depend on the number of threads, and must agree
+// with the inputs and with the detections they describe.
+static void testCounters(Config const &config, Workload const &workload)
+{
+  const int numClasses = workload.numClasses ;
+  const int batchSize = workload.batchSize ;
+  Detections reference ;
+  detect(config, workload, vlMultiboxNMSPerClass, false, 1, true, NULL,
+         &reference) ;
+
+  MultiboxStats stats ;
+  stats.counting = true ;
+  Detections detections ;
+  detect(config, workload, vlMultiboxNMSPerClass, false, 1, true, NULL,
+         &detections, &stats) ;
+  CHECK(identical(reference, detections), "%s: counting changes the "
+        "output", config.name) ;
+
+  MultiboxStats threaded ;
+  threaded.counting = true ;
+  detect(config, workload, vlMultiboxNMSPerClass, false, 4, true, NULL,
+         &detections, &threaded) ;
+  CHECK(stats.numCandidates == threaded.numCandidates &&
+        stats.numRanked == threaded.numRanked &&
+        stats.numKept == threaded.numKept &&
+        stats.numOutput == threaded.numOutput &&
+        stats.numOverlaps == threaded.numOverlaps,
+        "%s: the counters depend on the number of threads", config.name) ;
+
+  std::vector<int> labels(numClasses * batchSize, 0) ;
+  for (size_t r = 0 ; r < reference.records.size() ; r += 7) {
+    const int i = (int)reference.records[r] - 1 ;
+    const int c = (int)reference.records[r + 1] - 1 ; // labels are 1-based
+    labels[c + numClasses * i]++ ;
+  }
+
+  for (int i = 0 ; i < batchSize ; ++i) {
+    int numOutput = 0 ;
+    for (int c = 0 ; c < numClasses ; ++c) {
+      const int t = c + numClasses * i ;
+      int numCandidates = 0 ;
+      if (c != 0) {
+        float const *scores = workload.confPreds.data()
+          + (size_t)workload.numPriors * numClasses * i ;
+        for (int p = 0 ; p < workload.numPriors ; ++p) {
+          numCandidates += (scores[c + numClasses * p] > config.confThresh) ;
+        }
+      }
+      CHECK(stats.numCandidates[t] == numCandidates, "%s: image %d class "
+            "%d has %d candidates, expected %d", config.name, i + 1, c,
+            stats.numCandidates[t], numCandidates) ;
+      CHECK(stats.numRanked[t] == std::min(numCandidates, config.nmsTopK),
+            "%s: image %d class %d ranks %d candidates", config.name, i + 1,
+            c, stats.numRanked[t]) ;
+      CHECK(stats.numKept[t] <= stats.numRanked[t] &&
+            stats.numOutput[t] <= stats.numKept[t],
+            "%s: image %d class %d counts increase after NMS", config.name,
+            i + 1, c) ;
+      CHECK(stats.numOutput[t] == labels[t], "%s: image %d class %d "
+            "outputs %d detections, not %d", config.name, i + 1, c,
+            stats.numOutput[t], labels[t]) ;
+      CHECK(stats.numOverlaps[t] % 64 == 0 &&
+            (stats.numKept[t] < 2 || stats.numOverlaps[t] >= 64),
+            "%s: image %d class %d has %lld overlaps", config.name, i + 1,
+            c, stats.numOverlaps[t]) ;
+      numOutput += stats.numOutput[t] ;
+    }
+    CHECK(numOutput == (int)reference.counts[i], "%s: image %d outputs %d "
+          "detections, not %d", config.name, i + 1, numOutput,
+          (int)reference.counts[i]) ;
+  }
+
+  MultiboxStats batched ;
+  batched.counting = true ;
+  detect(config, workload, vlMultiboxNMSBatched, false, 2, true, NULL,
+         &detections, &batched) ;
+  CHECK(batched.numCandidates == stats.numCandidates &&
+        batched.numRanked == stats.numRanked &&
+        batched.numKept == batched.numOutput &&
+        batched.numOutput == stats.numOutput,
+        "%s: batched NMS counts differ", config.name) ;
+}
+
+// The readers of predictions in reduced precision must convert them
+// exactly, and their keys must give the same thresholds as the values.
+static void testPredFormats()
+{
+  const float inf = HUGE_VALF ;
+  const float thresholds [] = { -inf, -1.0f, -0.0f, 0.0f, 1e-6f, 0.01f,
+                                0.2f, 0.5f, 1.0f, 65504.0f, inf, NAN } ;
+  const int numThresholds = sizeof(thresholds) / sizeof(thresholds[0]) ;
+
+  std::vector<uint16_t> halfs(65536) ;
+  std::vector<float> converted(65536) ;
+  for (int h = 0 ; h < 65536 ; ++h) {
+    halfs[h] = (uint16_t)h ;
+  }
+  halfToFloat(converted.data(), halfs.data(), halfs.size()) ;
+  HalfPreds half(halfs.data()) ;
+  int numErrors = 0 ;
+  for (int h = 0 ; h < 65536 ; ++h) {
+    const int exponent = (h >> 10) & 0x1f ;
+    const int mantissa = h & 0x3ff ;
+    const float sign = (h & 0x8000) ? -1.0f : 1.0f ;
+    const float x = half.value(h) ;
+    if (exponent == 0x1f) {
+      numErrors += (mantissa ? !isnan(x) : (x != sign * inf)) ;
+      numErrors += (mantissa ? !isnan(converted[h]) : (converted[h] != x)) ;
+      continue ;
+    }
+    const float expected = (exponent == 0) ?
+      sign * ldexpf((float)mantissa, -24) :
+      sign * ldexpf((float)(mantissa + 1024), exponent - 25) ;
+    numErrors += (x != expected || converted[h] != x) ;
+    numErrors += (floatToHalf(x) != h) ;
+    for (int t = 0 ; t < numThresholds ; ++t) {
+      numErrors += ((half.key(h) > half.thresholdKey(thresholds[t])) !=
+                    (x > thresholds[t])) ;
+    }
+  }
+  CHECK(numErrors == 0, "%d errors in the conversion of half floats",
+        numErrors) ;
+  CHECK(floatToHalf(65519.0f) == 0x7bff && floatToHalf(65520.0f) == 0x7c00 &&
+        floatToHalf(1.0f + 1.0f / 2048) == 0x3c00 &&
+        floatToHalf(1.0f + 3.0f / 2048) == 0x3c02 &&
+        floatToHalf(ldexpf(1.0f, -25)) == 0 &&
+        floatToHalf(ldexpf(1.5f, -25)) == 1,
+        "floatToHalf does not round to nearest even") ;
+
+  std::vector<uint8_t> bytes(256) ;
+  for (int q = 0 ; q < 256 ; ++q) {
+    bytes[q] = (uint8_t)q ;
+  }
+  const float scales [] = { 1.0f / 255, 0.02f, 3.0f } ;
+  const float zeroPoints [] = { 0.0f, 128.0f, 7.5f } ;
+  numErrors = 0 ;
+  for (int k = 0 ; k < 3 ; ++k) {
+    UInt8Preds quantized(bytes.data(), scales[k], zeroPoints[k]) ;
+    for (int q = 0 ; q < 256 ; ++q) {
+      const float x = scales[k] * ((float)q - zeroPoints[k]) ;
+      numErrors += (quantized.value(q) != x) ;
+      for (int t = 0 ; t < numThresholds ; ++t) {
+        numErrors += ((quantized.key(q) > quantized.thresholdKey(thresholds[t])) !=
+                      (x > thresholds[t])) ;
+      }
+    }
+  }
+  CHECK(numErrors == 0, "%d errors in the thresholds of uint8 predictions",
+        numErrors) ;
+}
+
+// Predictions in reduced precision must give the same detections as the
+// single precision values which they stand for.
+static void testReducedPrecision(Config const &config, Workload const &workload)
+{
+  const size_t numLoc = workload.locPreds.size() ;
+  const size_t numConf = workload.confPreds.size() ;
+  const float locScale = 0.02f ;
+  const float locZeroPoint = 128.0f ;
+  const float confScale = 1.0f / 255 ;
+
+  std::vector<uint16_t> halfLoc(numLoc), halfConf(numConf) ;
+  std::vector<uint8_t> byteLoc(numLoc), byteConf(numConf) ;
+  Workload halfWorkload = workload ;
+  Workload byteWorkload = workload ;
+  for (size_t k = 0 ; k < numLoc ; ++k) {
+    halfLoc[k] = floatToHalf(workload.locPreds[k]) ;
+    halfWorkload.locPreds[k] = halfToFloat(halfLoc[k]) ;
+    float q = roundf(workload.locPreds[k] / locScale + locZeroPoint) ;
+    byteLoc[k] = (uint8_t)std::min(std::max(q, 0.0f), 255.0f) ;
+    byteWorkload.locPreds[k] = locScale * ((float)byteLoc[k] - locZeroPoint) ;
+  }
+  for (size_t k = 0 ; k < numConf ; ++k) {
+    halfConf[k] = floatToHalf(workload.confPreds[k]) ;
+    halfWorkload.confPreds[k] = halfToFloat(halfConf[k]) ;
+    byteConf[k] = (uint8_t)roundf(workload.confPreds[k] / confScale) ;
+    byteWorkload.confPreds[k] = confScale * (float)byteConf[k] ;
+  }
+
+  MultiboxPreds half = { NULL, vlMultiboxPredHalf, 1, 0 } ;
+  MultiboxPreds byte = { NULL, vlMultiboxPredUInt8, 1, 0 } ;
+  MultiboxPreds native = { NULL, vlMultiboxPredNative, 1, 0 } ;
+
+  Detections expected, detections ;
+  detect(config, halfWorkload, vlMultiboxNMSPerClass, false, 1, true, NULL,
+         &expected) ;
+  MultiboxPreds loc = half, conf = half ;
+  loc.data = halfLoc.data() ;
+  conf.data = halfConf.data() ;
+  for (int lazy = 0 ; lazy < 2 ; ++lazy) {
+    detectReduced(config, workload, loc, conf, 2, lazy, &detections) ;
+    CHECK(identical(expected, detections), "%s: half predictions (lazy "
+          "decoding %d) change the output", config.name, lazy) ;
+  }
+  CHECK(!expected.records.empty(), "%s: no detections in half precision",
+        config.name) ;
+
+  detect(config, byteWorkload, vlMultiboxNMSPerClass, false, 1, true, NULL,
+         &expected) ;
+  loc = byte ;
+  loc.data = byteLoc.data() ;
+  loc.scale = locScale ;
+  loc.zeroPoint = locZeroPoint ;
+  conf = byte ;
+  conf.data = byteConf.data() ;
+  conf.scale = confScale ;
+  for (int lazy = 0 ; lazy < 2 ; ++lazy) {
+    detectReduced(config, workload, loc, conf, 2, lazy, &detections) ;
+    CHECK(identical(expected, detections), "%s: uint8 predictions (lazy "
+          "decoding %d) change the output", config.name, lazy) ;
+  }
+
+  // mixed formats, with the locations in single precision
+  Workload mixedWorkload = byteWorkload ;
+  mixedWorkload.locPreds = workload.locPreds ;
+  detect(config, mixedWorkload, vlMultiboxNMSPerClass, false, 1, true, NULL,
+         &expected) ;
+  loc = native ;
+  loc.data = workload.locPreds.data() ;
+  detectReduced(config, workload, loc, conf, 1, true, &detections) ;
+  CHECK(identical(expected, detections), "%s: single and uint8 predictions "
+        "change the output", config.name) ;
+}
+
+int main(int argc, char **argv)
+{
+  if (argc < 2) {
+    fprintf(stderr, "usage: test_multiboxdetector <golden dir> [--update]\n") ;
+    return 2 ;
+  }
+  const std::string goldenDir(argv[1]) ;
+  const bool update = (argc > 2 && strcmp(argv[2], "--update") == 0) ;
+
+  const Config configs [] = {
+    { "ssd300_voc", ssd300(), 21, 2, 3, 400, 200, 0.45f, 0.01f },
+    { "ssd512_coco", ssd512(), 81, 1, 7, 400, 200, 0.45f, 0.01f },
+    { "ssd300_coco_strict", ssd300(), 81, 3, 5, 100, 50, 0.3f, 0.2f },
+  } ;
+  const int numConfigs = sizeof(configs) / sizeof(configs[0]) ;
+
+  testPredFormats() ;
+
+  for (int c = 0 ; c < numConfigs ; ++c) {
+    Workload workload ;
+    makeWorkload(*configs[c].spec, configs[c].numClasses,
+                 configs[c].batchSize, configs[c].objectsPerImage,
+                 1000 + c, &workload) ;
+    testGolden(configs[c], workload, goldenDir, update) ;
+    if (!update) {
+      testInvariance(configs[c], workload) ;
+      testCounters(configs[c], workload) ;
+      testReducedPrecision(configs[c], workload) ;
+    }
+  }
+
+  return finishChecks() ;
+}
@@ -0,0 +1,313 @@
+// @file test_multiboxloss.cpp
+// @brief Comparison of the fused multibox loss with the MATLAB layers
+// @author Samuel Albanie
+// @author Andrea Vedaldi
+
+/*
+Copyright (C) 2017- Samuel Albanie and Andrea Vedaldi.
+All rights reserved.
+
+This file is part of the VLFeat library and is made available under
+the terms of the BSD license (see the COPYING file).
+*/
+
+#include "check.hpp"
+#include "workload.hpp"
+#include <bits/impl/multiboxloss.hpp>
+#include <bits/impl/priorcache.hpp>
+#include <bits/impl/priormatcher.hpp>
+#include <bits/impl/hardnegatives.hpp>
+
+#include <stdio.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <vector>
+
+using namespace vl ;
+using namespace vl::impl ;
+using namespace vl::standalone ;
+
+// The reference follows the MATLAB training graph step by step: the
+// encoded targets (vl_nnmatchpriors), the gathered predictions
+// (vl_nnmultiboxcoder), the weighted softmax log-loss (vl_nnloss) and
+// smooth L1 loss (vl_nnhuberloss), their sum (vl_nnmultiboxloss) and the
+// scatter of the derivatives back into full-size arrays.  The targets of
+// the images are produced by the native matcher and hard negative miner.
+
+struct Targets
+{
+  std::vector<std::vector<double> > gtBoxes ;
+  std::vector<std::vector<int> > gtLabels ;
+  std::vector<std::vector<int> > positives ;
+  std::vector<std::vector<int> > assignments ;
+  std::vector<std::vector<int> > negatives ;
+  std::vector<MultiboxLossImage> images ;
+} ;
+
+/* ---------------------------------------------------------------- */
+/*                                                        reference */
+/* ---------------------------------------------------------------- */
+
+static double reference(Workload const &w, Targets const &t, int numClasses,
+                        float locWeight, double derOutput,
+                        std::vector<double> *derLoc,
+                        std::vector<double> *derConf)
+{
+  const int P = w.numPriors ;
+  const int C = numClasses ;
+  int numPos = 0 ;
+  for (int i = 0 ; i < w.batchSize ; ++i) { numPos += t.positives[i].size() ; }
+  const double weight = 1. / std::max(numPos, 1) ;
+
+  derLoc->assign(w.locPreds.size(), 0) ;
+  derConf->assign(w.confPreds.size(), 0) ;
+  double confLoss = 0, locLoss = 0 ;
+  for (int i = 0 ; i < w.batchSize ; ++i) {
+    float const *loc = &w.locPreds[(size_t)i * P * 4] ;
+    float const *conf = &w.confPreds[(size_t)i * P * C] ;
+    const int G = t.gtLabels[i].size() ;
+
+    // instances: positives (with their labels) then negatives
+    std::vector<int> inst(t.positives[i]) ;
+    std::vector<int> labels ;
+    for (int k = 0 ; k < t.positives[i].size() ; ++k) {
+      labels.push_back(t.gtLabels[i][t.assignments[i][k]]) ;
+    }
+    inst.insert(inst.end(), t.negatives[i].begin(), t.negatives[i].end()) ;
+    labels.resize(inst.size(), 0) ;
+    for (int k = 0 ; k < inst.size() ; ++k) {
+      float const *x = conf + (size_t)inst[k] * C ;
+      double xmax = *std::max_element(x, x + C) ;
+      double z = 0 ;
+      for (int c = 0 ; c < C ; ++c) { z += std::exp(x[c] - xmax) ; }
+      confLoss += weight * (xmax + std::log(z) - x[labels[k]]) ;
+      for (int c = 0 ; c < C ; ++c) {
+        (*derConf)[((size_t)i * P + inst[k]) * C + c] += derOutput * weight *
+          (std::exp(x[c] - xmax) / z - (c == labels[k])) ;
+      }
+    }
+
+    for (int k = 0 ; k < t.positives[i].size() ; ++k) {
+      const int p = t.positives[i][k] ;
+      const int g = t.assignments[i][k] ;
+      double const *b = &t.gtBoxes[i][0] ;
+      float const *q = &w.priors[4 * p] ;
+      float const *v = &w.priors[4 * P + 4 * p] ;
+      double pw = q[2] - q[0], ph = q[3] - q[1] ;
+      double pcx = q[0] + pw / 2, pcy = q[1] + ph / 2 ;
+      double gw = b[g + 2 * G] - b[g], gh = b[g + 3 * G] - b[g + G] ;
+      double gcx = b[g] + gw / 2, gcy = b[g + G] + gh / 2 ;
+      double target [4] = {
+        (gcx - pcx) / (pw * v[0]), (gcy - pcy) / (ph * v[1]),
+        std::log(gw / pw) / v[2], std::log(gh / ph) / v[3] } ;
+      for (int c = 0 ; c < 4 ; ++c) {
+        double d = loc[4 * p + c] - target[c] ;
+        bool linear = std::abs(d) > 1 ;
+        locLoss += weight * (linear ? std::abs(d) - 0.5 : 0.5 * d * d) ;
+        (*derLoc)[((size_t)i * P + p) * 4 + c] += derOutput * locWeight * weight *
+          (linear ? (d > 0) - (d < 0) : d) ;
+      }
+    }
+  }
+  return confLoss + locWeight * locLoss ;
+}
+
+/* ---------------------------------------------------------------- */
+/*                                                            tests */
+/* ---------------------------------------------------------------- */
+
+// Ground truth boxes scattered over the image, matched to the priors and
+// mined for hard negatives as during training
+static void makeTargets(Workload const &w, int numClasses, uint64_t seed,
+                        Targets *t)
+{
+  Random random(seed) ;
+  const int N = w.batchSize ;
+  t->gtBoxes.assign(N, std::vector<double>()) ;
+  t->gtLabels.assign(N, std::vector<int>()) ;
+  t->positives.assign(N, std::vector<int>()) ;
+  t->assignments.assign(N, std::vector<int>()) ;
+  t->negatives.assign(N, std::vector<int>()) ;
+  t->images.resize(N) ;
+
+  PriorGrid grid ;
+  grid.init(w.priors.data(), w.numPriors) ;
+  for (int i = 0 ; i < N ; ++i) {
+    const int G = (i == 0) ? 0 : 1 + random.index(6) ;
+    t->gtBoxes[i].resize(4 * G) ;
+    for (int g = 0 ; g < G ; ++g) {
+      double bw = 0.05 + 0.6 * random.uniform() ;
+      double bh = 0.05 + 0.6 * random.uniform() ;
+      double x0 = (1 - bw) * random.uniform() ;
+      double y0 = (1 - bh) * random.uniform() ;
+      t->gtBoxes[i][g] = x0 ; t->gtBoxes[i][g + G] = y0 ;
+      t->gtBoxes[i][g + 2 * G] = x0 + bw ; t->gtBoxes[i][g + 3 * G] = y0 + bh ;
+      t->gtLabels[i].push_back(1 + random.index(numClasses - 1)) ;
+    }
+    PriorMatches matches ;
+    matchPriors(grid, t->gtBoxes[i].data(), G, 0.5, false, (double*)NULL,
+                &matches) ;
+    for (int g = 0 ; g < G ; ++g) {
+      t->positives[i].insert(t->positives[i].end(), matches.idx[g].begin(),
+                             matches.idx[g].end()) ;
+      t->assignments[i].resize(t->positives[i].size(), g) ;
+    }
+    HardNegativeImage negImage = { t->positives[i].data(),
+                                   (int)t->positives[i].size(), NULL, 0 } ;
+    mineHardNegatives(&w.confPreds[(size_t)i * w.numPriors * numClasses],
+                      w.numPriors, numClasses, 0, 3.0, negImage,
+                      &t->negatives[i]) ;
+
+    MultiboxLossImage &im = t->images[i] ;
+    im.positives = t->positives[i].data() ;
+    im.assignments = t->assignments[i].data() ;
+    im.numPositives = t->positives[i].size() ;
+    im.negatives = t->negatives[i].data() ;
+    im.numNegatives = t->negatives[i].size() ;
+    im.gtBoxes = t->gtBoxes[i].data() ;
+    im.gtLabels = t->gtLabels[i].data() ;
+    im.numGtBoxes = G ;
+  }
+}
+
+static double maxAbsDifference(std::vector<float> const &a,
+                               std::vector<double> const &b)
+{
+  double diff = 0 ;
+  for (size_t k = 0 ; k < a.size() ; ++k) {
+    diff = std::max(diff, std::abs(a[k] - b[k])) ;
+  }
+  return diff ;
+}
+
+static void testModel(PriorSpec const &spec, int numClasses, int batchSize,
+                      uint64_t seed)
+{
+  Workload w ;
+  makeWorkload(spec, numClasses, batchSize, 6, seed, &w) ;
+  // the loss is computed from the (unnormalised) scores of the network
+  for (size_t k = 0 ; k < w.confPreds.size() ; ++k) {
+    w.confPreds[k] = std::log(std::max(w.confPreds[k], 1e-30f)) ;
+  }
+  Targets t ;
+  makeTargets(w, numClasses, seed, &t) ;
+
+  const float locWeight = 1.5f ;
+  const double derOutput = 0.7 ;
+  Context context ;
+  PriorCache cache ;
+  std::vector<double> refLoc, refConf ;
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now() ;
+  double refLoss = reference(w, t, numClasses, locWeight, derOutput,
+                             &refLoc, &refConf) ;
+  std::chrono::steady_clock::time_point mid = std::chrono::steady_clock::now() ;
+
+  // fused forward and backward
+  MultiboxLossValues values ;
+  std::vector<float> derLoc(w.locPreds.size(), 0) ;
+  std::vector<float> derConf(w.confPreds.size(), 0) ;
+  multiboxloss<VLDT_CPU,float>::compute
+    (context, &values, derLoc.data(), derConf.data(), w.locPreds.data(),
+     w.confPreds.data(), w.priors.data(), t.images.data(), batchSize,
+     w.numPriors, numClasses, 0, locWeight, 1.0f, (float)derOutput, 1, &cache) ;
+  std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now() ;
+
+  CHECK(std::abs(values.total - refLoss) <= 1e-5 * std::abs(refLoss),
+        "%s: loss %g, expected %g", spec.name, values.total, refLoss) ;
+  CHECK(std::abs(values.conf + locWeight * values.loc - values.total) <= 1e-9 *
+        std::abs(values.total), "%s: terms do not add up", spec.name) ;
+  CHECK(maxAbsDifference(derLoc, refLoc) < 1e-6, "%s: location derivatives "
+        "differ by %g", spec.name, maxAbsDifference(derLoc, refLoc)) ;
+  CHECK(maxAbsDifference(derConf, refConf) < 1e-6, "%s: confidence derivatives "
+        "differ by %g", spec.name, maxAbsDifference(derConf, refConf)) ;
+
+  // the loss alone, the derivatives alone, threads and cache do not
+  // change the result
+  const int numThreads [] = { 1, 2, 4, 0 } ;
+  for (int r = 0 ; r < 4 ; ++r) {
+    MultiboxLossValues other ;
+    std::vector<float> otherLoc(w.locPreds.size(), 0) ;
+    std::vector<float> otherConf(w.confPreds.size(), 0) ;
+    multiboxloss<VLDT_CPU,float>::compute
+      (context, &other, NULL, NULL, w.locPreds.data(), w.confPreds.data(),
+       w.priors.data(), t.images.data(), batchSize, w.numPriors, numClasses,
+       0, locWeight, 1.0f, 1.0f, numThreads[r], (r % 2) ? &cache : NULL) ;
+    multiboxloss<VLDT_CPU,float>::compute
+      (context, NULL, otherLoc.data(), otherConf.data(), w.locPreds.data(),
+       w.confPreds.data(), w.priors.data(), t.images.data(), batchSize,
+       w.numPriors, numClasses, 0, locWeight, 1.0f, (float)derOutput,
+       numThreads[r], (r % 2) ? &cache : NULL) ;
+    CHECK(other.total == values.total, "%s: %d threads change the loss",
+          spec.name, numThreads[r]) ;
+    CHECK(otherLoc == derLoc && otherConf == derConf, "%s: %d threads change "
+          "the derivatives", spec.name, numThreads[r]) ;
+  }
+  printf("%s: %d images, reference %.3f ms, fused %.3f ms per batch\n",
+         spec.name, batchSize,
+         std::chrono::duration<double>(mid - start).count() * 1e3,
+         std::chrono::duration<double>(end - mid).count() * 1e3) ;
+}
+
+// Central differences of the loss agree with its derivatives
+static void testDerivatives(uint64_t seed)
+{
+  Workload w ;
+  makeWorkload(*ssd300(), 5, 2, 3, seed, &w) ;
+  for (size_t k = 0 ; k < w.confPreds.size() ; ++k) {
+    w.confPreds[k] = std::log(std::max(w.confPreds[k], 1e-30f)) ;
+  }
+  Targets t ;
+  makeTargets(w, 5, seed, &t) ;
+  Context context ;
+
+  std::vector<float> derLoc(w.locPreds.size(), 0) ;
+  std::vector<float> derConf(w.confPreds.size(), 0) ;
+  multiboxloss<VLDT_CPU,float>::compute
+    (context, NULL, derLoc.data(), derConf.data(), w.locPreds.data(),
+     w.confPreds.data(), w.priors.data(), t.images.data(), 2, w.numPriors, 5,
+     0, 1.0f, 1.0f, 1.0f, 1, NULL) ;
+
+  auto loss = [&]() {
+    MultiboxLossValues values ;
+    multiboxloss<VLDT_CPU,float>::compute
+      (context, &values, NULL, NULL, w.locPreds.data(), w.confPreds.data(),
+       w.priors.data(), t.images.data(), 2, w.numPriors, 5, 0, 1.0f, 1.0f,
+       1.0f, 1, NULL) ;
+    return values.total ;
+  } ;
+  auto check = [&](std::vector<float> &x, std::vector<float> const &der,
+                   int p, int dim, char const *name) {
+    for (int k = 0 ; k < dim ; ++k) {
+      float &v = x[(size_t)p * dim + k] ;
+      const float saved = v ;
+      const float h = 1e-2f ;
+      v = saved + h ; double up = loss() ;
+      v = saved - h ; double down = loss() ;
+      v = saved ;
+      double numeric = (up - down) / (2 * h) ;
+      CHECK(std::abs(numeric - der[(size_t)p * dim + k]) < 2e-3,
+            "%s derivative of prior %d: %g, numerically %g", name, p,
+            der[(size_t)p * dim + k], numeric) ;
+    }
+  } ;
+  for (int i = 0 ; i < 2 ; ++i) {
+    for (int k = 0 ; k < std::min(5, (int)t.positives[i].size()) ; ++k) {
+      int p = i * w.numPriors + t.positives[i][k] ;
+      check(w.locPreds, derLoc, p, 4, "location") ;
+      check(w.confPreds, derConf, p, 5, "confidence") ;
+    }
+    for (int k = 0 ; k < std::min(5, (int)t.negatives[i].size()) ; ++k) {
+      check(w.confPreds, derConf, i * w.numPriors + t.negatives[i][k], 5,
+            "confidence") ;
+    }
+  }
+}
+
+int main(int argc, char **argv)
+{
+  testModel(*ssd300(), 21, 8, 1) ;
+  testModel(*ssd512(), 81, 4, 2) ;
+  testDerivatives(3) ;
+  return finishChecks() ;
+}
@@ -0,0 +1,226 @@
+// @file test_multiboxmerge.cpp
+// @brief Comparison of the multiscale merge with the MATLAB merge
+// @author Samuel Albanie
+// @author Andrea Vedaldi
+
+/*
+Copyright (C) 2017- Samuel Albanie and Andrea Vedaldi.
+All rights reserved.
+
+This file is part of the VLFeat library and is made available under
+the terms of the BSD license (see the COPYING file).
+*/
+
+#include "check.hpp"
+#include "workload.hpp"
+#include <bits/impl/multiboxdetector.hpp>
+#include <bits/impl/multiboxworkspace.hpp>
+
+#include <stdio.h>
+#include <algorithm>
+#include <vector>
+
+using namespace vl ;
+using namespace vl::impl ;
+using namespace vl::standalone ;
+
+// The reference is a direct translation of mergeMultiscalePredictions in
+// core/ssd_evaluation.m: the detections of each label are gathered in
+// (scale, row) order, suppressed by a greedy NMS keeping at most outHeight
+// of them, concatenated in label order and stably sorted by descending
+// score, of which the first outHeight are kept.  The merge must produce
+// exactly the same rows, whatever the number of threads.
+
+// The fixed size detections of a batch at one scale
+struct Scale
+{
+  int height ;
+  std::vector<float> data ; // height x 6 x 1 x batchSize
+} ;
+
+typedef std::vector<float> Row ;
+
+/* ---------------------------------------------------------------- */
+/*                                                        reference */
+/* ---------------------------------------------------------------- */
+
+static bool suppresses(Row const &a, Row const &b, float nmsThresh)
+{
+  float width = std::min(a[4], b[4]) - std::max(a[2], b[2]) ;
+  float height = std::min(a[5], b[5]) - std::max(a[3], b[3]) ;
+  if (!(width > 0 && height > 0)) { return false ; }
+  float areaA = std::max(a[4] - a[2], 0.0f) * std::max(a[5] - a[3], 0.0f) ;
+  float areaB = std::max(b[4] - b[2], 0.0f) * std::max(b[5] - b[3], 0.0f) ;
+  float intersection = width * height ;
+  return !(intersection / (areaB + areaA - intersection) <= nmsThresh) ;
+}
+
+static bool scoreDescend(Row const &a, Row const &b)
+{
+  return a[1] > b[1] ;
+}
+
+static void referenceMerge(std::vector<Scale> const &scales, int image,
+                           float nmsThresh, int outHeight,
+                           std::vector<Row> *merged)
+{
+  int numLabels = 0 ;
+  std::vector<Row> rows ;
+  for (int s = 0 ; s < scales.size() ; ++s) {
+    const int height = scales[s].height ;
+    float const *data = scales[s].data.data() + (size_t)height * 6 * image ;
+    for (int r = 0 ; r < height ; ++r) {
+      Row row(6) ;
+      for (int j = 0 ; j < 6 ; ++j) { row[j] = data[height * j + r] ; }
+      rows.push_back(row) ;
+      numLabels = std::max(numLabels, (int)row[0]) ;
+    }
+  }
+
+  merged->clear() ;
+  for (int label = 1 ; label <= numLabels ; ++label) {
+    std::vector<Row> candidates ;
+    for (int k = 0 ; k < rows.size() ; ++k) {
+      if ((int)rows[k][0] == label) { candidates.push_back(rows[k]) ; }
+    }
+    std::stable_sort(candidates.begin(), candidates.end(), scoreDescend) ;
+    std::vector<Row> kept ;
+    for (int k = 0 ; k < candidates.size() && kept.size() < outHeight ; ++k) {
+      bool suppressed = false ;
+      for (int q = 0 ; q < kept.size() && !suppressed ; ++q) {
+        suppressed = suppresses(kept[q], candidates[k], nmsThresh) ;
+      }
+      if (!suppressed) { kept.push_back(candidates[k]) ; }
+    }
+    merged->insert(merged->end(), kept.begin(), kept.end()) ;
+  }
+  std::stable_sort(merged->begin(), merged->end(), scoreDescend) ;
+  if (merged->size() > outHeight) { merged->resize(outHeight) ; }
+}
+
+/* ---------------------------------------------------------------- */
+/*                                                           checks */
+/* ---------------------------------------------------------------- */
+
+static void checkMerge(char const *name, std::vector<Scale> const &scales,
+                       int batchSize, float nmsThresh, int outHeight)
+{
+  std::vector<float const*> inputs ;
+  std::vector<size_t> heights ;
+  for (int s = 0 ; s < scales.size() ; ++s) {
+    inputs.push_back(scales[s].data.data()) ;
+    heights.push_back(scales[s].height) ;
+  }
+
+  // the workspace is reused by the calls with different numbers of
+  // threads
+  MultiboxWorkspace workspace ;
+  std::vector<float> first ;
+  int threadCounts [] = {1, 3, 8} ;
+  for (int t = 0 ; t < 3 ; ++t) {
+    std::vector<float> output((size_t)outHeight * 6 * batchSize, 0.0f) ;
+    std::vector<float> counts(batchSize, -1.0f) ;
+    Context context ;
+    multiboxmerge<VLDT_CPU,float>::forward
+      (context, output.data(), counts.data(), inputs.data(), heights.data(),
+       scales.size(), nmsThresh, outHeight, batchSize, threadCounts[t],
+       &workspace) ;
+
+    if (t == 0) {
+      first = output ;
+      for (int i = 0 ; i < batchSize ; ++i) {
+        std::vector<Row> expected ;
+        referenceMerge(scales, i, nmsThresh, outHeight, &expected) ;
+        CHECK(counts[i] == expected.size(), "%s: image %d has %g rows, "
+              "expected %d", name, i + 1, counts[i], (int)expected.size()) ;
+        float const *out = output.data() + (size_t)outHeight * 6 * i ;
+        for (int k = 0 ; k < outHeight ; ++k) {
+          for (int j = 0 ; j < 6 ; ++j) {
+            float value = (k < expected.size()) ? expected[k][j] : 0.0f ;
+            CHECK(out[outHeight * j + k] == value, "%s: image %d row %d "
+                  "column %d is %g, expected %g", name, i + 1, k + 1, j + 1,
+                  out[outHeight * j + k], value) ;
+          }
+        }
+      }
+    } else {
+      CHECK(output == first, "%s: %d threads change the result",
+            name, threadCounts[t]) ;
+    }
+  }
+}
+
+// Detector outputs of the same batch at three scales, simulated by
+// perturbing the box regressions of one workload
+static void detectorScales()
+{
+  Workload workload ;
+  makeWorkload(*ssd300(), 21, 4, 3, 7, &workload) ;
+  const int keepTopK = 200 ;
+  std::vector<Scale> scales(3) ;
+  for (int s = 0 ; s < scales.size() ; ++s) {
+    Workload perturbed = workload ;
+    Random random(100 + s) ;
+    for (int k = 0 ; k < perturbed.locPreds.size() ; ++k) {
+      perturbed.locPreds[k] += 0.1f * random.normal() ;
+    }
+    scales[s].height = keepTopK ;
+    scales[s].data.assign((size_t)keepTopK * 6 * workload.batchSize, 0.0f) ;
+    std::vector<float> counts(workload.batchSize) ;
+    Context context ;
+    multiboxdetector<VLDT_CPU,float>::forward
+      (context, scales[s].data.data(), counts.data(),
+       perturbed.locPreds.data(), perturbed.confPreds.data(),
+       perturbed.priors.data(), 400, keepTopK, workload.numClasses,
+       0.45f, 0.01f, 1, vlMultiboxNMSPerClass, false,
+       keepTopK, 6, workload.batchSize, workload.numPriors,
+       1, true, NULL, NULL, NULL) ;
+  }
+  checkMerge("ssd300", scales, workload.batchSize, 0.45f, keepTopK) ;
+  checkMerge("ssd300, keepTopK 50", scales, workload.batchSize, 0.45f, 50) ;
+}
+
+// Scales of different heights with coarsely quantised scores and repeated
+// rows, so that the order of ties matters, and with padding rows
+static void tiedScales()
+{
+  const int batchSize = 3 ;
+  const int heights [] = {40, 25, 60} ;
+  Random random(11) ;
+  std::vector<Scale> scales(3) ;
+  for (int s = 0 ; s < scales.size() ; ++s) {
+    const int height = heights[s] ;
+    scales[s].height = height ;
+    scales[s].data.assign((size_t)height * 6 * batchSize, 0.0f) ;
+    for (int i = 0 ; i < batchSize ; ++i) {
+      float *data = scales[s].data.data() + (size_t)height * 6 * i ;
+      const int count = (i == 2) ? 0 : height - random.index(10) ;
+      for (int r = 0 ; r < count ; ++r) {
+        if (r > 0 && random.uniform() < 0.2f) {
+          for (int j = 0 ; j < 6 ; ++j) {
+            data[height * j + r] = data[height * j + r - 1] ;
+          }
+          continue ;
+        }
+        float x = 0.6f * random.uniform() ;
+        float y = 0.6f * random.uniform() ;
+        data[r] = (float)(2 + random.index(4)) ;
+        data[height + r] = (1 + random.index(5)) * 0.125f ;
+        data[height * 2 + r] = x ;
+        data[height * 3 + r] = y ;
+        data[height * 4 + r] = x + 0.1f + 0.3f * random.uniform() ;
+        data[height * 5 + r] = y + 0.1f + 0.3f * random.uniform() ;
+      }
+    }
+  }
+  checkMerge("ties", scales, batchSize, 0.3f, 40) ;
+  checkMerge("ties, keepTopK 10", scales, batchSize, 0.3f, 10) ;
+  checkMerge("ties, keepTopK 200", scales, batchSize, 0.3f, 200) ;
+}
+
+int main(int argc, char **argv)
+{
+  detectorScales() ;
+  tiedScales() ;
+  return finishChecks() ;
+}
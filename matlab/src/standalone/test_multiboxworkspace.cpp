@@ -0,0 +1,358 @@
+// @file test_multiboxworkspace.cpp
+// @brief Tests of the workspace reused across calls of the detectors
+// @author Samuel Albanie
+// @author Andrea Vedaldi
+
+/*
+Copyright (C) 2017- Samuel Albanie and Andrea Vedaldi.
+All rights reserved.
+
+This file is part of the VLFeat library and is made available under
+the terms of the BSD license (see the COPYING file).
+*/
+
+#include "check.hpp"
+#include "workload.hpp"
+#include <bits/impl/multiboxdetector.hpp>
+#include <bits/impl/multiboxworkspace.hpp>
+#include <bits/impl/multiboxhost.hpp>
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+using namespace vl ;
+using namespace vl::impl ;
+using namespace vl::standalone ;
+
+// The arena must hand out aligned, disjoint buffers and stop allocating
+// once it has grown to the size of the calls, and the CPU detector and
+// the host stage of the GPU detector must give the same detections with
+// a workspace (reused by calls of various sizes, or bounded by a limit)
+// as without one.
+
+/* ---------------------------------------------------------------- */
+/*                                                            arena */
+/* ---------------------------------------------------------------- */
+
+typedef WorkspaceArena<HostAllocator> Arena ;
+
+static bool aligned(void const *p)
+{
+  return (uintptr_t)p % Arena::ALIGNMENT == 0 ;
+}
+
+// Carve the buffers of a call of the given size and fill them, so that
+// overlapping buffers (or buffers out of bounds, under the sanitizers)
+// are detected
+static bool fill(Arena &arena, int size)
+{
+  const int counts [] = { 4 * size, size, 3 } ;
+  float *buffers [3] ;
+  for (int k = 0 ; k < 3 ; ++k) {
+    buffers[k] = arena.allocate<float>(counts[k]) ;
+    if (buffers[k] == NULL || !aligned(buffers[k])) { return false ; }
+    for (int j = 0 ; j < counts[k] ; ++j) { buffers[k][j] = (float)k ; }
+  }
+  for (int k = 0 ; k < 3 ; ++k) {
+    for (int j = 0 ; j < counts[k] ; ++j) {
+      if (buffers[k][j] != (float)k) { return false ; }
+    }
+  }
+  return true ;
+}
+
+static void testArena()
+{
+  Arena arena ;
+  CHECK(arena.getCapacity() == 0, "a new arena holds memory") ;
+
+  // the first call allocates a chunk per buffer, after which the block
+  // holds all of them
+  CHECK(fill(arena, 1000), "bad buffers on the first call") ;
+  CHECK(arena.getNumAllocations() == 3,
+        "%d allocations on the first call", (int)arena.getNumAllocations()) ;
+  arena.recycle() ;
+  size_t capacity = arena.getCapacity() ;
+  CHECK(capacity >= 5000 * sizeof(float), "block of %d bytes not grown",
+        (int)capacity) ;
+  CHECK(capacity % Arena::ALIGNMENT == 0, "block not padded") ;
+
+  // calls of the same size or smaller do not allocate
+  size_t numAllocations = arena.getNumAllocations() ;
+  for (int size = 1000 ; size > 0 ; size /= 3) {
+    CHECK(fill(arena, size), "bad buffers in a call of %d", size) ;
+    arena.recycle() ;
+  }
+  CHECK(arena.getNumAllocations() == numAllocations,
+        "a call which fits in the block allocated") ;
+  CHECK(arena.getCapacity() == capacity, "the block changed") ;
+
+  // a larger call grows the block once
+  CHECK(fill(arena, 3000), "bad buffers in a larger call") ;
+  arena.recycle() ;
+  CHECK(arena.getCapacity() > capacity, "the block was not grown") ;
+  numAllocations = arena.getNumAllocations() ;
+  CHECK(fill(arena, 3000), "bad buffers in a repeated call") ;
+  arena.recycle() ;
+  CHECK(arena.getNumAllocations() == numAllocations,
+        "a repeated call allocated") ;
+
+  // a limit below the block releases it, and calls beyond the limit use
+  // chunks which are freed at the end of the call
+  arena.setLimit(1024) ;
+  CHECK(arena.getCapacity() == 0, "the block was kept beyond the limit") ;
+  CHECK(fill(arena, 1000), "bad buffers beyond the limit") ;
+  arena.recycle() ;
+  CHECK(arena.getCapacity() == 0, "the block was grown beyond the limit") ;
+  CHECK(fill(arena, 10), "bad buffers within the limit") ;
+  arena.recycle() ;
+  CHECK(arena.getCapacity() > 0 && arena.getCapacity() <= 1024,
+        "block of %d bytes within a limit of 1024", (int)arena.getCapacity()) ;
+
+  arena.release() ;
+  CHECK(arena.getCapacity() == 0, "release() kept the block") ;
+  CHECK(arena.allocate<char>(0) != NULL, "empty buffer is NULL") ;
+  arena.recycle() ;
+}
+
+/* ---------------------------------------------------------------- */
+/*                                                         detector */
+/* ---------------------------------------------------------------- */
+
+struct Call
+{
+  Workload const *workload ;
+  MultiboxNMSMethod nmsMethod ;
+  int numThreads ;
+  bool lazyDecode ;
+} ;
+
+static std::vector<float> detect(Call const &call,
+                                 MultiboxWorkspace *workspace)
+{
+  Workload const &workload = *call.workload ;
+  const int keepTopK = 200 ;
+  const int batchSize = workload.batchSize ;
+  std::vector<float> output((size_t)keepTopK * 6 * batchSize, -1.0f) ;
+  std::vector<float> counts(batchSize) ;
+  Context context ;
+  ErrorCode error = multiboxdetector<VLDT_CPU,float>::forward
+    (context, output.data(), counts.data(),
+     workload.locPreds.data(), workload.confPreds.data(),
+     workload.priors.data(), 400, keepTopK, workload.numClasses,
+     0.45f, 0.01f, 1, call.nmsMethod, false,
+     keepTopK, 6, batchSize, workload.numPriors,
+     call.numThreads, call.lazyDecode, NULL, workspace, NULL) ;
+  CHECK(error == VLE_Success, "the detector failed") ;
+  output.insert(output.end(), counts.begin(), counts.end()) ;
+  return output ;
+}
+
+static bool identical(std::vector<float> const &a, std::vector<float> const &b)
+{
+  return a.size() == b.size() &&
+         memcmp(a.data(), b.data(), a.size() * sizeof(float)) == 0 ;
+}
+
+static void testDetector()
+{
+  Workload voc, coco, vocBatch ;
+  makeWorkload(*ssd300(), 21, 2, 3, 7, &voc) ;
+  makeWorkload(*ssd512(), 81, 1, 7, 8, &coco) ;
+  makeWorkload(*ssd300(), 21, 4, 5, 9, &vocBatch) ;
+
+  // calls of different sizes, numbers of classes and NMS methods, which
+  // grow and shrink the containers of the workspace
+  const Call calls [] = {
+    { &voc, vlMultiboxNMSPerClass, 1, true },
+    { &coco, vlMultiboxNMSPerClass, 2, true },
+    { &voc, vlMultiboxNMSBatched, 1, false },
+    { &vocBatch, vlMultiboxNMSPerClass, 3, true },
+    { &coco, vlMultiboxNMSClassAgnostic, 2, true },
+    { &voc, vlMultiboxNMSPerClass, 1, false },
+  } ;
+  const int numCalls = sizeof(calls) / sizeof(calls[0]) ;
+
+  std::vector<std::vector<float> > expected(numCalls) ;
+  for (int c = 0 ; c < numCalls ; ++c) {
+    expected[c] = detect(calls[c], NULL) ;
+  }
+
+  MultiboxWorkspace workspace ;
+  for (int c = 0 ; c < numCalls ; ++c) {
+    CHECK(identical(detect(calls[c], &workspace), expected[c]),
+          "call %d changed by the workspace", c + 1) ;
+  }
+
+  // once the workspace has seen every call, repeating them does not
+  // allocate from the arena.  The containers do not grow either, except
+  // for the scratch of the workers, whose tasks depend on the scheduling
+  // when there are several threads.
+  size_t numAllocations = workspace.host.getNumAllocations() ;
+  size_t hostBytes = workspace.getHostBytes() ;
+  CHECK(hostBytes > 0, "the workspace kept no memory") ;
+  for (int c = 0 ; c < numCalls ; ++c) {
+    CHECK(identical(detect(calls[c], &workspace), expected[c]),
+          "repeated call %d changed by the workspace", c + 1) ;
+  }
+  CHECK(workspace.host.getNumAllocations() == numAllocations,
+        "%d arena allocations in repeated calls",
+        (int)(workspace.host.getNumAllocations() - numAllocations)) ;
+  hostBytes = workspace.getHostBytes() ;
+  for (int c = 0 ; c < numCalls ; ++c) {
+    if (calls[c].numThreads > 1) { continue ; }
+    detect(calls[c], &workspace) ;
+  }
+  CHECK(workspace.getHostBytes() == hostBytes,
+        "the workspace grew from %d to %d bytes in repeated calls",
+        (int)hostBytes, (int)workspace.getHostBytes()) ;
+
+  // with a limit of zero nothing is kept after a call, and with a small
+  // limit at most the limit is kept
+  workspace.setLimit(0) ;
+  CHECK(workspace.getHostBytes() == 0,
+        "%d bytes kept after setLimit(0)", (int)workspace.getHostBytes()) ;
+  for (int c = 0 ; c < numCalls ; ++c) {
+    CHECK(identical(detect(calls[c], &workspace), expected[c]),
+          "call %d changed by a limit of zero", c + 1) ;
+    CHECK(workspace.getHostBytes() == 0,
+          "%d bytes kept with a limit of zero", (int)workspace.getHostBytes()) ;
+  }
+  const size_t limit = hostBytes / 2 ;
+  workspace.setLimit(limit) ;
+  for (int c = 0 ; c < numCalls ; ++c) {
+    CHECK(identical(detect(calls[c], &workspace), expected[c]),
+          "call %d changed by a limit", c + 1) ;
+    CHECK(workspace.getHostBytes() <= limit,
+          "%d bytes kept with a limit of %d",
+          (int)workspace.getHostBytes(), (int)limit) ;
+  }
+
+  // release() frees everything, and the workspace is usable afterwards
+  workspace.setLimit((size_t)-1) ;
+  workspace.release() ;
+  CHECK(workspace.getHostBytes() == 0,
+        "%d bytes kept after release()", (int)workspace.getHostBytes()) ;
+  CHECK(identical(detect(calls[0], &workspace), expected[0]),
+        "call changed after release()") ;
+}
+
+/* ---------------------------------------------------------------- */
+/*                                         host stage of GPU detector */
+/* ---------------------------------------------------------------- */
+
+// The inputs of the host stage: interleaved boxes (here the priors) and
+// class-major scores, as they are copied back from the device
+struct HostInputs
+{
+  std::vector<float> boxes ;
+  std::vector<float> scores ;
+} ;
+
+static void makeHostInputs(Workload const &workload, HostInputs *inputs)
+{
+  const int numPriors = workload.numPriors ;
+  const int numClasses = workload.numClasses ;
+  inputs->boxes.clear() ;
+  inputs->scores.resize(workload.confPreds.size()) ;
+  for (int i = 0 ; i < workload.batchSize ; ++i) {
+    inputs->boxes.insert(inputs->boxes.end(), workload.priors.begin(),
+                         workload.priors.begin() + numPriors * 4) ;
+    float const *conf = workload.confPreds.data() + numPriors * numClasses * i ;
+    float *scores = inputs->scores.data() + numPriors * numClasses * i ;
+    for (int p = 0 ; p < numPriors ; ++p) {
+      for (int c = 0 ; c < numClasses ; ++c) {
+        scores[c * numPriors + p] = conf[c + numClasses * p] ;
+      }
+    }
+  }
+}
+
+static std::vector<float> detectOnHost(Workload const &workload,
+                                       HostInputs const &inputs,
+                                       MultiboxNMSMethod nmsMethod,
+                                       bool compact,
+                                       MultiboxWorkspace &workspace)
+{
+  const int keepTopK = 200 ;
+  const int batchSize = workload.batchSize ;
+  std::vector<float> output((size_t)keepTopK * 6 * batchSize, -1.0f) ;
+  std::vector<float> counts(batchSize) ;
+  multiboxHostDetections(output.data(), counts.data(),
+                         inputs.boxes.data(), inputs.scores.data(),
+                         400, keepTopK, workload.numClasses, 0.45f, 0.01f,
+                         1, nmsMethod, compact, keepTopK, batchSize,
+                         workload.numPriors, workspace) ;
+  workspace.finish() ;
+  output.insert(output.end(), counts.begin(), counts.end()) ;
+  return output ;
+}
+
+static void testHost()
+{
+  Workload voc, coco ;
+  makeWorkload(*ssd300(), 21, 3, 5, 11, &voc) ;
+  makeWorkload(*ssd512(), 81, 2, 7, 12, &coco) ;
+  HostInputs vocInputs, cocoInputs ;
+  makeHostInputs(voc, &vocInputs) ;
+  makeHostInputs(coco, &cocoInputs) ;
+
+  struct HostCall {
+    Workload const *workload ;
+    HostInputs const *inputs ;
+    MultiboxNMSMethod nmsMethod ;
+    bool compact ;
+  } ;
+  const HostCall calls [] = {
+    { &voc, &vocInputs, vlMultiboxNMSPerClass, false },
+    { &coco, &cocoInputs, vlMultiboxNMSBatched, false },
+    { &voc, &vocInputs, vlMultiboxNMSClassAgnostic, true },
+    { &coco, &cocoInputs, vlMultiboxNMSPerClass, true },
+    { &voc, &vocInputs, vlMultiboxNMSBatched, false },
+  } ;
+  const int numCalls = sizeof(calls) / sizeof(calls[0]) ;
+
+  // a fresh workspace for each call, then one reused by all of them
+  std::vector<std::vector<float> > expected(numCalls) ;
+  for (int c = 0 ; c < numCalls ; ++c) {
+    MultiboxWorkspace fresh ;
+    expected[c] = detectOnHost(*calls[c].workload, *calls[c].inputs,
+                               calls[c].nmsMethod, calls[c].compact, fresh) ;
+  }
+  MultiboxWorkspace workspace ;
+  for (int c = 0 ; c < numCalls ; ++c) {
+    CHECK(identical(detectOnHost(*calls[c].workload, *calls[c].inputs,
+                                 calls[c].nmsMethod, calls[c].compact,
+                                 workspace), expected[c]),
+          "host call %d changed by the workspace", c + 1) ;
+  }
+
+  // batched NMS gives the detections of per-class NMS
+  CHECK(identical(expected[0], expected[4]),
+        "batched and per-class NMS differ on the host") ;
+
+  // once the workspace has seen every call, repeating them does not grow
+  // it
+  size_t hostBytes = workspace.getHostBytes() ;
+  CHECK(hostBytes > 0, "the workspace kept no memory") ;
+  for (int c = 0 ; c < numCalls ; ++c) {
+    CHECK(identical(detectOnHost(*calls[c].workload, *calls[c].inputs,
+                                 calls[c].nmsMethod, calls[c].compact,
+                                 workspace), expected[c]),
+          "repeated host call %d changed by the workspace", c + 1) ;
+  }
+  CHECK(workspace.getHostBytes() == hostBytes,
+        "the workspace grew from %d to %d bytes in repeated host calls",
+        (int)hostBytes, (int)workspace.getHostBytes()) ;
+}
+
+int main(int argc, char **argv)
+{
+  testArena() ;
+  testDetector() ;
+  testHost() ;
+
+  return finishChecks() ;
+}
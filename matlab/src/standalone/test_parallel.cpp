@@ -0,0 +1,163 @@
+// @file test_parallel.cpp
+// @brief Tests of the thread pool of the multithreaded CPU kernels
+// @author Samuel Albanie
+// @author Andrea Vedaldi
+
+/*
+Copyright (C) 2017- Samuel Albanie and Andrea Vedaldi.
+All rights reserved.
+
+This file is part of the VLFeat library and is made available under
+the terms of the BSD license (see the COPYING file).
+*/
+
+#include "check.hpp"
+#include <bits/impl/parallel.hpp>
+
+#include <stdio.h>
+#include <atomic>
+#include <new>
+#include <stdexcept>
+#include <vector>
+
+using namespace vl::impl ;
+using namespace vl::standalone ;
+
+// Every task must be run exactly once whatever the number of workers,
+// the threads must be reused by later loops rather than started again,
+// a loop nested in a task must run on the worker of that task, and an
+// exception thrown by a task (on any thread) must reach the caller, after
+// which the pool must still work.
+
+// Run a loop and check that each task ran once on a valid worker
+static bool runOnce(ThreadPool &pool, int numWorkers, int numTasks)
+{
+  std::vector<int> runs(numTasks, 0) ;
+  std::atomic<int> badWorkers(0) ;
+  pool.run(numWorkers, numTasks, [&](int task, int worker) {
+    if (worker < 0 || worker >= numWorkers) { ++badWorkers ; }
+    ++runs[task] ;
+  }) ;
+  for (int task = 0 ; task < numTasks ; ++task) {
+    if (runs[task] != 1) { return false ; }
+  }
+  return badWorkers == 0 ;
+}
+
+static void testTasks()
+{
+  ThreadPool pool ;
+  const int workers [] = { 1, 2, 4, 8 } ;
+  const int tasks [] = { 0, 1, 3, 64, 1000 } ;
+  for (int w = 0 ; w < 4 ; ++w) {
+    for (int t = 0 ; t < 5 ; ++t) {
+      CHECK(runOnce(pool, workers[w], tasks[t]),
+            "bad loop with %d workers and %d tasks", workers[w], tasks[t]) ;
+    }
+  }
+
+  // the threads are started once, for the largest loop
+  int numThreads = pool.getNumThreads() ;
+  CHECK(numThreads <= 7, "%d threads for at most 8 workers", numThreads) ;
+  for (int r = 0 ; r < 200 ; ++r) {
+    CHECK(runOnce(pool, 1 + r % 8, 50), "bad loop %d", r) ;
+  }
+  CHECK(pool.getNumThreads() == numThreads,
+        "the pool grew from %d to %d threads", numThreads,
+        pool.getNumThreads()) ;
+
+  // a loop run by a task is run on the thread of the task, as its worker
+  std::vector<int> runs(16 * 16, 0) ;
+  pool.run(4, 16, [&](int outer, int outerWorker) {
+    pool.run(4, 16, [&](int inner, int worker) {
+      runs[outer * 16 + inner] += (worker == outerWorker) ;
+    }) ;
+  }) ;
+  for (int k = 0 ; k < 16 * 16 ; ++k) {
+    CHECK(runs[k] == 1, "nested task %d ran %d times", k, runs[k]) ;
+  }
+
+  // the threads are joined by shutdown(), after which they are started
+  // again on demand
+  pool.shutdown() ;
+  CHECK(pool.getNumThreads() == 0, "threads left after shutdown()") ;
+  CHECK(runOnce(pool, 4, 100), "bad loop after shutdown()") ;
+}
+
+// Nested loops which use the per-worker scratch of the outer loop, as the
+// kernels do: each worker must own its slot (a race shows up as a wrong
+// sum, or under the thread sanitizer)
+static void testNested()
+{
+  const int numWorkers = 4 ;
+  std::vector<long> scratch(numWorkers, 0) ;
+  std::vector<long> sums(32, 0) ;
+  parallelFor(numWorkers, 32, [&](int outer, int outerWorker) {
+    scratch[outerWorker] = 0 ;
+    parallelFor(numWorkers, 100, [&](int inner, int worker) {
+      CHECK(worker == outerWorker, "nested task on worker %d of task on "
+            "worker %d", worker, outerWorker) ;
+      scratch[worker] += outer * 100 + inner ;
+    }) ;
+    sums[outer] = scratch[outerWorker] ;
+  }) ;
+  for (int outer = 0 ; outer < 32 ; ++outer) {
+    long expected = outer * 100 * 100 + 99 * 100 / 2 ;
+    CHECK(sums[outer] == expected, "nested loop %d: sum %ld, expected %ld",
+          outer, sums[outer], expected) ;
+  }
+
+  // a loop run outside the tasks uses worker 0 again
+  parallelFor(1, 4, [&](int, int worker) {
+    CHECK(worker == 0, "worker %d after nested loops", worker) ;
+  }) ;
+}
+
+static void testExceptions()
+{
+  ThreadPool pool ;
+  for (int thrower = 0 ; thrower < 100 ; thrower += 33) {
+    std::atomic<int> numRun(0) ;
+    bool caught = false ;
+    try {
+      pool.run(4, 100, [&](int task, int) {
+        ++numRun ;
+        if (task == thrower) { throw std::runtime_error("task") ; }
+      }) ;
+    } catch (std::runtime_error const &) {
+      caught = true ;
+    }
+    CHECK(caught, "the exception of task %d was lost", thrower) ;
+    CHECK(numRun >= 1 && numRun <= 100, "%d tasks run", (int)numRun) ;
+    CHECK(runOnce(pool, 4, 100), "bad loop after an exception") ;
+  }
+
+  // only the first exception is rethrown, whatever its type
+  bool caught = false ;
+  try {
+    pool.run(8, 8, [&](int, int) { throw std::bad_alloc() ; }) ;
+  } catch (std::bad_alloc const &) {
+    caught = true ;
+  }
+  CHECK(caught, "bad_alloc was lost") ;
+
+  // the same holds on the serial path
+  caught = false ;
+  try {
+    parallelFor(1, 10, [&](int task, int) {
+      if (task == 5) { throw std::runtime_error("serial") ; }
+    }) ;
+  } catch (std::runtime_error const &) {
+    caught = true ;
+  }
+  CHECK(caught, "the exception of a serial loop was lost") ;
+}
+
+int main(int argc, char **argv)
+{
+  testTasks() ;
+  testNested() ;
+  testExceptions() ;
+
+  return finishChecks() ;
+}
@@ -0,0 +1,334 @@
+// @file test_priorbox.cpp
+// @brief Comparison of the prior box generator with a reference
+// @author Samuel Albanie
+// @author Andrea Vedaldi
+
+/*
+Copyright (C) 2017- Samuel Albanie and Andrea Vedaldi.
+All rights reserved.
+
+This file is part of the VLFeat library and is made available under
+the terms of the BSD license (see the COPYING file).
+*/
+
+#include "check.hpp"
+#include "workload.hpp"
+#include <bits/impl/priorbox.hpp>
+
+#include <stdio.h>
+#include <math.h>
+#include <string.h>
+#include <vector>
+
+using namespace vl::impl ;
+using namespace vl::standalone ;
+
+// The reference is a direct translation of matlab/vl_nnpriorbox.m, for a
+// single layer, followed by the concatenation done by the networks.  The
+// generator must produce the same bits, in single and double precision.
+
+/* ---------------------------------------------------------------- */
+/*                                                        reference */
+/* ---------------------------------------------------------------- */
+
+// y = vl_nnpriorbox(x, im, ...) as the column 4 * numBoxes x 2 (boxes,
+// then variances), in double precision
+static void referenceLayer(PriorBoxLayer const &opts,
+                           int imgHeight, int imgWidth,
+                           std::vector<double> *boxesOut,
+                           std::vector<double> *variancesOut)
+{
+  const int layerWidth = opts.featureWidth ;
+  const int layerHeight = opts.featureHeight ;
+
+  // aspectRatios = cat(1, aspectRatios, 1 ./ aspectRatios), column-major
+  const int rows = opts.aspectRatioRows ;
+  const int cols = (int)opts.aspectRatios.size() / rows ;
+  std::vector<double> aspectRatios ;
+  for (int c = 0 ; c < cols ; ++c) {
+    for (int r = 0 ; r < rows ; ++r) {
+      aspectRatios.push_back(opts.aspectRatios[c * rows + r]) ;
+    }
+    if (opts.flip) {
+      for (int r = 0 ; r < rows ; ++r) {
+        aspectRatios.push_back(1.0 / opts.aspectRatios[c * rows + r]) ;
+      }
+    }
+  }
+  const int numAspectRatios = 1 + (int)aspectRatios.size() ;
+  const int boxesPerPosition = numAspectRatios + (opts.maxSize != 0) ;
+  const int numBoxes = layerWidth * layerHeight * boxesPerPosition ;
+  std::vector<double> boxes(numBoxes * 4, 0.0) ;
+
+  double pixelStep = opts.pixelStep ;
+  if (pixelStep == 0) {
+    pixelStep = (double)imgWidth / layerWidth ;
+  }
+
+  int idx = 0 ;
+  for (int i = 1 ; i <= layerHeight ; ++i) {
+    for (int j = 1 ; j <= layerWidth ; ++j) {
+      double centreX = (j - opts.offset) * pixelStep ;
+      double centreY = (i - opts.offset) * pixelStep ;
+
+      double boxWidth = opts.minSize ;
+      double boxHeight = opts.minSize ;
+      boxes[idx++] = (centreX - boxWidth / 2) / imgWidth ;
+      boxes[idx++] = (centreY - boxHeight / 2) / imgHeight ;
+      boxes[idx++] = (centreX + boxWidth / 2) / imgWidth ;
+      boxes[idx++] = (centreY + boxHeight / 2) / imgHeight ;
+
+      if (opts.maxSize > 0) {
+        double length = sqrt(opts.minSize * opts.maxSize) ;
+        boxWidth = length ;
+        boxHeight = length ;
+        boxes[idx++] = (centreX - boxWidth / 2) / imgWidth ;
+        boxes[idx++] = (centreY - boxHeight / 2) / imgHeight ;
+        boxes[idx++] = (centreX + boxWidth / 2) / imgWidth ;
+        boxes[idx++] = (centreY + boxHeight / 2) / imgHeight ;
+      }
+
+      for (int k = 0 ; k < aspectRatios.size() ; ++k) {
+        if (fabs(aspectRatios[k] - 1) < 1e-6) {
+          continue ;
+        }
+        boxWidth = opts.minSize * sqrt(aspectRatios[k]) ;
+        boxHeight = opts.minSize / sqrt(aspectRatios[k]) ;
+        boxes[idx++] = (centreX - boxWidth/2) / imgWidth ;
+        boxes[idx++] = (centreY - boxHeight/2) / imgHeight ;
+        boxes[idx++] = (centreX + boxWidth/2) / imgWidth ;
+        boxes[idx++] = (centreY + boxHeight/2) / imgHeight ;
+      }
+    }
+  }
+
+  if (opts.clip) {
+    for (int k = 0 ; k < boxes.size() ; ++k) {
+      if (boxes[k] < 0) { boxes[k] = 0 ; }
+      if (boxes[k] > 1) { boxes[k] = 1 ; }
+    }
+  }
+
+  boxesOut->insert(boxesOut->end(), boxes.begin(), boxes.end()) ;
+  for (int p = 0 ; p < numBoxes ; ++p) {
+    variancesOut->insert(variancesOut->end(), opts.variance, opts.variance + 4) ;
+  }
+}
+
+// cast(cat(1, y1, y2, ...), 'like', x)
+template <typename T>
+static std::vector<T> reference(std::vector<PriorBoxLayer> const &layers,
+                                int imgHeight, int imgWidth)
+{
+  std::vector<double> boxes, variances ;
+  for (int l = 0 ; l < layers.size() ; ++l) {
+    referenceLayer(layers[l], imgHeight, imgWidth, &boxes, &variances) ;
+  }
+  std::vector<T> priors(boxes.begin(), boxes.end()) ;
+  priors.insert(priors.end(), variances.begin(), variances.end()) ;
+  return priors ;
+}
+
+/* ---------------------------------------------------------------- */
+/*                                                           models */
+/* ---------------------------------------------------------------- */
+
+// The layers of an SSD model as built by core/ssd_init.m, with the
+// aspect ratios given as row vectors
+static std::vector<PriorBoxLayer> modelLayers(PriorSpec const &spec)
+{
+  std::vector<PriorBoxLayer> layers(spec.numSources) ;
+  for (int s = 0 ; s < spec.numSources ; ++s) {
+    PriorBoxLayer &layer = layers[s] ;
+    layer.featureHeight = spec.featureSizes[s] ;
+    layer.featureWidth = spec.featureSizes[s] ;
+    layer.minSize = spec.minSizes[s] ;
+    layer.maxSize = spec.maxSizes[s] ;
+    layer.pixelStep = spec.pixelSteps[s] ;
+    layer.aspectRatios.assign(1, 2.0) ;
+    if (spec.numAspectRatios[s] == 2) {
+      layer.aspectRatios.push_back(3.0) ;
+    }
+    layer.aspectRatioRows = 1 ;
+  }
+  return layers ;
+}
+
+template <typename T>
+static void compare(char const *name,
+                    std::vector<PriorBoxLayer> const &layers,
+                    int imgHeight, int imgWidth)
+{
+  for (int l = 0 ; l < layers.size() ; ++l) {
+    char const *error = checkPriorBoxLayer(layers[l], imgHeight, imgWidth) ;
+    CHECK(error == NULL, "%s: layer %d rejected: %s", name, l, error) ;
+  }
+  std::vector<T> expected = reference<T>(layers, imgHeight, imgWidth) ;
+  const int numPriors = countPriorBoxes(layers.data(), layers.size()) ;
+  CHECK(8 * (size_t)numPriors == expected.size(),
+        "%s: %d priors instead of %d", name, numPriors,
+        (int)(expected.size() / 8)) ;
+  if (8 * (size_t)numPriors != expected.size()) { return ; }
+  std::vector<T> priors(8 * (size_t)numPriors, (T)-7) ;
+  makePriorBoxes(priors.data(), layers.data(), layers.size(),
+                 imgHeight, imgWidth) ;
+  int numDifferent = 0 ;
+  for (size_t k = 0 ; k < priors.size() ; ++k) {
+    numDifferent += memcmp(&priors[k], &expected[k], sizeof(T)) != 0 ;
+  }
+  CHECK(numDifferent == 0, "%s (%s): %d of %d values differ", name,
+        sizeof(T) == sizeof(float) ? "single" : "double",
+        numDifferent, (int)priors.size()) ;
+}
+
+static void testModels()
+{
+  std::vector<PriorBoxLayer> layers = modelLayers(*ssd300()) ;
+  CHECK(countPriorBoxes(layers.data(), layers.size()) == 8732,
+        "ssd300: %d priors", countPriorBoxes(layers.data(), layers.size())) ;
+  compare<float>("ssd300", layers, 300, 300) ;
+  compare<double>("ssd300", layers, 300, 300) ;
+  for (int l = 0 ; l < layers.size() ; ++l) { layers[l].clip = true ; }
+  compare<float>("ssd300 clipped", layers, 300, 300) ;
+
+  layers = modelLayers(*ssd512()) ;
+  CHECK(countPriorBoxes(layers.data(), layers.size()) == 24564,
+        "ssd512: %d priors", countPriorBoxes(layers.data(), layers.size())) ;
+  compare<float>("ssd512", layers, 512, 512) ;
+  compare<double>("ssd512", layers, 512, 512) ;
+}
+
+static void testOptions()
+{
+  PriorBoxLayer base ;
+  base.featureHeight = 10 ;
+  base.featureWidth = 17 ;
+  base.minSize = 45 ;
+  base.maxSize = 99 ;
+  base.pixelStep = 30 ;
+  base.aspectRatios.assign(1, 2.0) ;
+  base.aspectRatios.push_back(3.0) ;
+  base.aspectRatios.push_back(1.5) ;
+  base.aspectRatios.push_back(4.0) ;
+
+  std::vector<PriorBoxLayer> layers(1, base) ;
+  compare<float>("row ratios", layers, 300, 500) ;
+  layers[0].aspectRatioRows = 4 ;
+  compare<float>("column ratios", layers, 300, 500) ;
+  layers[0].aspectRatioRows = 2 ;
+  compare<float>("matrix ratios", layers, 300, 500) ;
+  layers[0].flip = false ;
+  compare<float>("no flip", layers, 300, 500) ;
+  layers[0].aspectRatios.clear() ;
+  compare<float>("no ratios", layers, 300, 500) ;
+
+  layers.assign(1, base) ;
+  layers[0].maxSize = 0 ;
+  compare<float>("no maxSize", layers, 300, 500) ;
+  layers[0].clip = true ;
+  layers[0].offset = 0 ;
+  compare<float>("clip, offset", layers, 300, 500) ;
+  layers[0].variance[0] = 0.25 ; layers[0].variance[3] = 1.0 / 3 ;
+  compare<double>("variance", layers, 300, 500) ;
+
+  // a step of zero is taken from the sizes of the image and feature map
+  layers.assign(1, base) ;
+  layers[0].pixelStep = 0 ;
+  layers[0].featureWidth = 15 ;
+  compare<float>("implicit step", layers, 320, 480) ;
+
+  // several layers at once
+  layers.assign(3, base) ;
+  layers[1].featureHeight = 5 ; layers[1].featureWidth = 9 ;
+  layers[1].aspectRatios.resize(1) ;
+  layers[2].featureHeight = 1 ; layers[2].featureWidth = 1 ;
+  layers[2].maxSize = 0 ; layers[2].clip = true ;
+  compare<float>("mixed layers", layers, 300, 500) ;
+}
+
+static void testChecks()
+{
+  PriorBoxLayer layer ;
+  CHECK(checkPriorBoxLayer(layer, 300, 300) == NULL, "defaults rejected") ;
+  CHECK(layer.getNumPriorsPerLocation() == 4, "%d default priors per location",
+        layer.getNumPriorsPerLocation()) ;
+
+  PriorBoxLayer bad = layer ;
+  bad.aspectRatios.push_back(1.0) ;
+  CHECK(checkPriorBoxLayer(bad, 300, 300) != NULL, "ratio one accepted") ;
+  bad = layer ;
+  bad.aspectRatios[0] = -2 ;
+  CHECK(checkPriorBoxLayer(bad, 300, 300) != NULL, "negative ratio accepted") ;
+  bad = layer ;
+  bad.aspectRatios.push_back(3.0) ;
+  bad.aspectRatios.push_back(4.0) ;
+  bad.aspectRatioRows = 2 ;
+  CHECK(checkPriorBoxLayer(bad, 300, 300) != NULL, "ragged ratios accepted") ;
+  bad = layer ;
+  bad.maxSize = -1 ;
+  CHECK(checkPriorBoxLayer(bad, 300, 300) != NULL, "negative maxSize accepted") ;
+  bad = layer ;
+  bad.featureWidth = 0 ;
+  CHECK(checkPriorBoxLayer(bad, 300, 300) != NULL, "empty map accepted") ;
+  CHECK(checkPriorBoxLayer(layer, 300, 0) != NULL, "empty image accepted") ;
+  bad = layer ;
+  bad.pixelStep = 0 ;
+  bad.featureHeight = 10 ;
+  bad.featureWidth = 10 ;
+  CHECK(checkPriorBoxLayer(bad, 300, 300) == NULL, "square implicit step rejected") ;
+  CHECK(checkPriorBoxLayer(bad, 300, 400) != NULL, "non-square implicit step accepted") ;
+}
+
+static void testCache()
+{
+  std::vector<PriorBoxLayer> layers = modelLayers(*ssd300()) ;
+  PriorBoxCache cache ;
+  int numPriors = 0 ;
+  float const *priors = cache.get<float>(layers.data(), layers.size(),
+                                         300, 300, &numPriors) ;
+  CHECK(numPriors == 8732 && cache.getNumBuilds() == 1,
+        "first call: %d priors, %d builds", numPriors, (int)cache.getNumBuilds()) ;
+  std::vector<float> expected = reference<float>(layers, 300, 300) ;
+  CHECK(memcmp(priors, expected.data(), expected.size() * sizeof(float)) == 0,
+        "cached priors differ from the reference") ;
+
+  float const *again = cache.get<float>(layers.data(), layers.size(),
+                                        300, 300, &numPriors) ;
+  CHECK(again == priors && cache.getNumBuilds() == 1 && numPriors == 8732,
+        "second call rebuilt the priors") ;
+
+  // the image size, the element type and every option are part of the key
+  cache.get<double>(layers.data(), layers.size(), 300, 300, &numPriors) ;
+  CHECK(cache.getNumBuilds() == 2, "double priors taken from float ones") ;
+  cache.get<float>(layers.data(), layers.size(), 300, 301, &numPriors) ;
+  CHECK(cache.getNumBuilds() == 3, "image size ignored") ;
+  layers[3].offset = 0.25 ;
+  cache.get<float>(layers.data(), layers.size(), 300, 300, &numPriors) ;
+  CHECK(cache.getNumBuilds() == 4, "offset ignored") ;
+  layers[3].offset = 0.5 ;
+
+  // the entries are replaced in least recently used order
+  priors = cache.get<float>(layers.data(), layers.size(), 300, 300, &numPriors) ;
+  CHECK(cache.getNumBuilds() == 4, "entry evicted too early") ;
+  cache.get<float>(layers.data(), layers.size() - 1, 300, 300, &numPriors) ;
+  CHECK(cache.getNumBuilds() == 5, "fewer layers ignored") ;
+  cache.get<float>(layers.data(), layers.size(), 300, 300, &numPriors) ;
+  CHECK(cache.getNumBuilds() == 5, "recently used entry evicted") ;
+  cache.get<double>(layers.data(), layers.size(), 300, 300, &numPriors) ;
+  CHECK(cache.getNumBuilds() == 6, "least recently used entry kept") ;
+
+  cache.clear() ;
+  priors = cache.get<float>(layers.data(), layers.size(), 300, 300, &numPriors) ;
+  CHECK(cache.getNumBuilds() == 7, "clear kept the entries") ;
+  CHECK(memcmp(priors, expected.data(), expected.size() * sizeof(float)) == 0,
+        "rebuilt priors differ from the reference") ;
+}
+
+int main(int argc, char **argv)
+{
+  testModels() ;
+  testOptions() ;
+  testChecks() ;
+  testCache() ;
+  return finishChecks() ;
+}
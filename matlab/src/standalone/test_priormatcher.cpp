@@ -0,0 +1,230 @@
+// @file test_priormatcher.cpp
+// @brief Comparison of the prior matcher with a dense reference
+// @author Samuel Albanie
+// @author Andrea Vedaldi
+
+/*
+Copyright (C) 2017- Samuel Albanie and Andrea Vedaldi.
+All rights reserved.
+
+This file is part of the VLFeat library and is made available under
+the terms of the BSD license (see the COPYING file).
+*/
+
+#include "check.hpp"
+#include "workload.hpp"
+#include <bits/impl/priormatcher.hpp>
+
+#include <stdio.h>
+#include <float.h>
+#include <chrono>
+#include <vector>
+
+using namespace vl::impl ;
+using namespace vl::standalone ;
+
+// The reference is a direct translation of matlab/matchPriors.m: it builds
+// the dense (numGtBoxes x numPriors) overlap matrix and works on it as the
+// MATLAB code does.  The matcher must produce the same matches and the
+// same overlap matrix, whatever the number of threads.
+
+/* ---------------------------------------------------------------- */
+/*                                                        reference */
+/* ---------------------------------------------------------------- */
+
+// MATLAB's [~, i] = max(x(:)): the first maximum, or 0 if all are -Inf
+static int argmax(std::vector<double> const &x)
+{
+  int best = 0 ;
+  for (int i = 1 ; i < x.size() ; ++i) {
+    if (x[i] > x[best]) { best = i ; }
+  }
+  return best ;
+}
+
+static void referenceMatch(std::vector<float> const &priors, int numPriors,
+                           std::vector<double> const &gt, int numGt,
+                           double overlapThreshold, bool ignoreBoundary,
+                           std::vector<double> *overlaps,
+                           std::vector<std::vector<int> > *idx)
+{
+  // boundary priors are replaced by boxes which cannot be matched
+  std::vector<double> boxes(priors.begin(), priors.begin() + 4 * numPriors) ;
+  if (ignoreBoundary) {
+    double x = *std::max_element(boxes.begin(), boxes.end()) + 1 ;
+    for (int p = 0 ; p < numPriors ; ++p) {
+      double const *b = &boxes[4 * p] ;
+      if (b[0] < 0 || b[1] < 0 || b[2] > 1 || b[3] > 1) {
+        boxes[4 * p] = x ; boxes[4 * p + 1] = x ;
+        boxes[4 * p + 2] = x + 1 ; boxes[4 * p + 3] = x + 1 ;
+      }
+    }
+  }
+
+  overlaps->assign((size_t)numGt * numPriors, 0) ;
+  for (int g = 0 ; g < numGt ; ++g) {
+    for (int p = 0 ; p < numPriors ; ++p) {
+      double const *b = &boxes[4 * p] ;
+      double x0 = gt[g], y0 = gt[g + numGt] ;
+      double x1 = gt[g + 2 * numGt], y1 = gt[g + 3 * numGt] ;
+      double w = std::min(b[2], x1) - std::max(b[0], x0) ;
+      double h = std::min(b[3], y1) - std::max(b[1], y0) ;
+      if (w <= 0 || h <= 0) { continue ; }
+      double inter = w * h ;
+      (*overlaps)[g + (size_t)p * numGt] =
+        inter / ((b[2] - b[0]) * (b[3] - b[1]) + (x1 - x0) * (y1 - y0) - inter) ;
+    }
+  }
+
+  std::vector<int> uniqueMatches ;
+  for (int g = 0 ; g < numGt ; ++g) {
+    std::vector<double> row(numPriors) ;
+    for (int p = 0 ; p < numPriors ; ++p) {
+      row[p] = (*overlaps)[g + (size_t)p * numGt] ;
+      if (row[p] > overlapThreshold) { uniqueMatches.push_back(p) ; }
+    }
+    uniqueMatches.push_back(argmax(row)) ;
+  }
+  std::sort(uniqueMatches.begin(), uniqueMatches.end()) ;
+  uniqueMatches.erase(std::unique(uniqueMatches.begin(), uniqueMatches.end()),
+                      uniqueMatches.end()) ;
+  const int numUnique = uniqueMatches.size() ;
+
+  // uniqueMatchOverlaps = overlaps(:, uniqueMatches)'
+  std::vector<double> m((size_t)numUnique * numGt) ;
+  std::vector<int> assignments(numUnique) ;
+  for (int u = 0 ; u < numUnique ; ++u) {
+    std::vector<double> row(numGt) ;
+    for (int g = 0 ; g < numGt ; ++g) {
+      row[g] = (*overlaps)[g + (size_t)uniqueMatches[u] * numGt] ;
+      m[u + (size_t)g * numUnique] = row[g] ;
+    }
+    assignments[u] = argmax(row) ;
+  }
+  for (int i = 0 ; i < numGt ; ++i) {
+    int ind = argmax(m) ;
+    int r = ind % numUnique, c = ind / numUnique ;
+    assignments[r] = c ;
+    for (int g = 0 ; g < numGt ; ++g) { m[r + (size_t)g * numUnique] = -HUGE_VAL ; }
+    for (int u = 0 ; u < numUnique ; ++u) { m[u + (size_t)c * numUnique] = -HUGE_VAL ; }
+  }
+
+  idx->assign(numGt, std::vector<int>()) ;
+  for (int u = 0 ; u < numUnique ; ++u) {
+    (*idx)[assignments[u]].push_back(uniqueMatches[u]) ;
+  }
+}
+
+/* ---------------------------------------------------------------- */
+/*                                                            tests */
+/* ---------------------------------------------------------------- */
+
+// Random ground truth, including boxes crossing the image boundary,
+// boxes outside the image, tiny boxes and duplicated boxes
+static void makeGroundTruth(Random &random, int numGt, std::vector<double> *gt)
+{
+  gt->assign(numGt * 4, 0) ;
+  for (int g = 0 ; g < numGt ; ++g) {
+    double x0, y0, x1, y1 ;
+    int kind = random.index(10) ;
+    if (kind == 0 && g > 0) {
+      int other = random.index(g) ;
+      x0 = (*gt)[other] ; y0 = (*gt)[other + numGt] ;
+      x1 = (*gt)[other + 2 * numGt] ; y1 = (*gt)[other + 3 * numGt] ;
+    } else {
+      double w = (kind == 1) ? 0.005 + 0.01 * random.uniform()
+                             : 0.02 + 0.9 * random.uniform() ;
+      double h = (kind == 1) ? 0.005 + 0.01 * random.uniform()
+                             : 0.02 + 0.9 * random.uniform() ;
+      double lo = (kind == 2) ? 1.05 : -0.1 ;
+      x0 = lo + (1.1 - w) * random.uniform() ;
+      y0 = -0.1 + (1.1 - h) * random.uniform() ;
+      x1 = x0 + w ; y1 = y0 + h ;
+    }
+    (*gt)[g] = x0 ; (*gt)[g + numGt] = y0 ;
+    (*gt)[g + 2 * numGt] = x1 ; (*gt)[g + 3 * numGt] = y1 ;
+  }
+}
+
+static void testModel(PriorSpec const &spec, int numImages, uint64_t seed)
+{
+  std::vector<float> priors ;
+  const int numPriors = makePriors(spec, &priors) ;
+  PriorGrid grid ;
+  grid.init(priors.data(), numPriors) ;
+  Random random(seed) ;
+
+  const double thresholds [] = { 0.5, 0.35 } ;
+  double referenceSeconds = 0, matcherSeconds = 0 ;
+  for (int i = 0 ; i < numImages ; ++i) {
+    const int numGt = (i == 0) ? 0 : 1 + random.index(12) ;
+    const bool ignoreBoundary = (i % 2 == 1) ;
+    const double threshold = thresholds[(i / 2) % 2] ;
+    std::vector<double> gt ;
+    makeGroundTruth(random, numGt, &gt) ;
+
+    std::vector<double> expectedOverlaps ;
+    std::vector<std::vector<int> > expected ;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now() ;
+    referenceMatch(priors, numPriors, gt, numGt, threshold, ignoreBoundary,
+                   &expectedOverlaps, &expected) ;
+    std::chrono::steady_clock::time_point mid = std::chrono::steady_clock::now() ;
+    std::vector<double> overlaps((size_t)numGt * numPriors, 0) ;
+    PriorMatches matches ;
+    matchPriors(grid, gt.data(), numGt, threshold, ignoreBoundary,
+                overlaps.data(), &matches) ;
+    std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now() ;
+    referenceSeconds += std::chrono::duration<double>(mid - start).count() ;
+    matcherSeconds += std::chrono::duration<double>(end - mid).count() ;
+
+    CHECK(matches.idx == expected, "%s image %d (%d boxes): different matches",
+          spec.name, i, numGt) ;
+    CHECK(overlaps == expectedOverlaps, "%s image %d (%d boxes): different "
+          "overlaps", spec.name, i, numGt) ;
+  }
+  printf("%s: %d images, reference %.3f ms, matcher %.3f ms per image\n",
+         spec.name, numImages, referenceSeconds * 1e3 / numImages,
+         matcherSeconds * 1e3 / numImages) ;
+}
+
+// The batch entry point gives the same result on any number of threads
+static void testBatch(uint64_t seed)
+{
+  std::vector<float> priors ;
+  const int numPriors = makePriors(*ssd300(), &priors) ;
+  PriorGrid grid ;
+  grid.init(priors.data(), numPriors) ;
+  Random random(seed) ;
+
+  const int batchSize = 16 ;
+  std::vector<std::vector<double> > gt(batchSize) ;
+  std::vector<double const*> gtBoxes(batchSize) ;
+  std::vector<int> numGtBoxes(batchSize) ;
+  for (int i = 0 ; i < batchSize ; ++i) {
+    numGtBoxes[i] = random.index(8) ;
+    makeGroundTruth(random, numGtBoxes[i], &gt[i]) ;
+    gtBoxes[i] = gt[i].data() ;
+  }
+  std::vector<PriorMatches> reference(batchSize) ;
+  matchPriorsBatch(grid, gtBoxes.data(), numGtBoxes.data(), batchSize, 0.5,
+                   false, (double * const *)NULL, 1, reference.data()) ;
+  const int numThreads [] = { 2, 4, 0 } ;
+  for (int t = 0 ; t < 3 ; ++t) {
+    std::vector<PriorMatches> matches(batchSize) ;
+    matchPriorsBatch(grid, gtBoxes.data(), numGtBoxes.data(), batchSize, 0.5,
+                     false, (double * const *)NULL, numThreads[t],
+                     matches.data()) ;
+    for (int i = 0 ; i < batchSize ; ++i) {
+      CHECK(matches[i].idx == reference[i].idx, "batch image %d: %d threads "
+            "change the matches", i, numThreads[t]) ;
+    }
+  }
+}
+
+int main(int argc, char **argv)
+{
+  testModel(*ssd300(), 200, 1) ;
+  testModel(*ssd512(), 60, 2) ;
+  testBatch(3) ;
+  return finishChecks() ;
+}
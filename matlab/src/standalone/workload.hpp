@@ -0,0 +1,232 @@
+// @file workload.hpp
+// @brief Synthetic SSD detector inputs for benchmarking and testing
+// @author Samuel Albanie
+// @author Andrea Vedaldi
+
+/*
+Copyright (C) 2017- Samuel Albanie and Andrea Vedaldi.
+All rights reserved.
+
+This file is part of the VLFeat library and is made available under
+the terms of the BSD license (see the COPYING file).
+*/
+
+#ifndef VL_STANDALONE_WORKLOAD_H
+#define VL_STANDALONE_WORKLOAD_H
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <vector>
+
+namespace vl { namespace standalone {
+
+  // Small, portable random number generator (splitmix64).  The standard
+  // library distributions are implementation defined, so they are not
+  // used: a given seed produces the same workload on every platform.
+  class Random
+  {
+  public:
+    explicit Random(uint64_t seed) : state(seed) { }
+
+    uint64_t next()
+    {
+      uint64_t z = (state += 0x9e3779b97f4a7c15ULL) ;
+      z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL ;
+      z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL ;
+      return z ^ (z >> 31) ;
+    }
+
+    // uniform in [0, 1)
+    float uniform() { return (next() >> 40) * (1.0f / 16777216.0f) ; }
+
+    // uniform in [0, n)
+    int index(int n) { return (int)(uniform() * n) % n ; }
+
+    // approximately standard normal (Irwin-Hall with four terms)
+    float normal()
+    {
+      float s = uniform() + uniform() + uniform() + uniform() ;
+      return (s - 2.0f) * 1.7320508f ;
+    }
+
+  private:
+    uint64_t state ;
+  } ;
+
+  // The prior tiling of the standard SSD models, as set up by
+  // core/ssd_init.m with `reproduceSSD` (see also vl_nnpriorbox.m)
+  struct PriorSpec
+  {
+    char const *name ;
+    int inputSize ;
+    int numSources ;
+    int featureSizes [7] ;
+    float pixelSteps [7] ;
+    float minSizes [7] ;
+    float maxSizes [7] ;
+    int numAspectRatios [7] ; // 1: {2}, 2: {2, 3}
+  } ;
+
+  inline PriorSpec const * ssd300()
+  {
+    static const PriorSpec spec = {
+      "ssd300", 300, 6,
+      { 38, 19, 10, 5, 3, 1 },
+      { 8, 16, 32, 64, 100, 300 },
+      { 30, 60, 111, 162, 213, 264 },
+      { 60, 111, 162, 213, 264, 315 },
+      { 1, 2, 2, 2, 1, 1 }
+    } ;
+    return &spec ;
+  }
+
+  inline PriorSpec const * ssd512()
+  {
+    static const PriorSpec spec = {
+      "ssd512", 512, 7,
+      { 64, 32, 16, 8, 4, 2, 1 },
+      { 8, 16, 32, 64, 128, 256, 512 },
+      { 35.84f, 76.8f, 153.6f, 230.4f, 307.2f, 384.0f, 460.8f },
+      { 76.8f, 153.6f, 230.4f, 307.2f, 384.0f, 460.8f, 537.6f },
+      { 1, 2, 2, 2, 2, 1, 1 }
+    } ;
+    return &spec ;
+  }
+
+  // Prior boxes in the layout expected by the detector: numPriors
+  // [xmin ymin xmax ymax] boxes followed by numPriors variances
+  inline int makePriors(PriorSpec const &spec, std::vector<float> *priors)
+  {
+    std::vector<float> boxes ;
+    const float ratios [] = { 2.0f, 3.0f } ;
+    const float imSize = (float)spec.inputSize ;
+    for (int s = 0 ; s < spec.numSources ; ++s) {
+      const int n = spec.featureSizes[s] ;
+      std::vector<float> widths, heights ;
+      float minSize = spec.minSizes[s] ;
+      float maxSize = spec.maxSizes[s] ;
+      widths.push_back(minSize) ; heights.push_back(minSize) ;
+      widths.push_back(sqrtf(minSize * maxSize)) ;
+      heights.push_back(sqrtf(minSize * maxSize)) ;
+      for (int flip = 0 ; flip < 2 ; ++flip) {
+        for (int a = 0 ; a < spec.numAspectRatios[s] ; ++a) {
+          float r = flip ? 1.0f / ratios[a] : ratios[a] ;
+          widths.push_back(minSize * sqrtf(r)) ;
+          heights.push_back(minSize / sqrtf(r)) ;
+        }
+      }
+      for (int i = 0 ; i < n ; ++i) {
+        for (int j = 0 ; j < n ; ++j) {
+          float cx = (j + 0.5f) * spec.pixelSteps[s] ;
+          float cy = (i + 0.5f) * spec.pixelSteps[s] ;
+          for (int b = 0 ; b < widths.size() ; ++b) {
+            boxes.push_back((cx - widths[b] / 2) / imSize) ;
+            boxes.push_back((cy - heights[b] / 2) / imSize) ;
+            boxes.push_back((cx + widths[b] / 2) / imSize) ;
+            boxes.push_back((cy + heights[b] / 2) / imSize) ;
+          }
+        }
+      }
+    }
+    const int numPriors = boxes.size() / 4 ;
+    const float variances [] = { 0.1f, 0.1f, 0.2f, 0.2f } ;
+    priors->assign(boxes.begin(), boxes.end()) ;
+    for (int p = 0 ; p < numPriors ; ++p) {
+      priors->insert(priors->end(), variances, variances + 4) ;
+    }
+    return numPriors ;
+  }
+
+  // The inputs of one call to the detector
+  struct Workload
+  {
+    int numPriors ;
+    int numClasses ;
+    int batchSize ;
+    std::vector<float> priors ;
+    std::vector<float> locPreds ;  // [k + 4 * p] for each image
+    std::vector<float> confPreds ; // [c + numClasses * p] for each image
+  } ;
+
+  inline float overlap(float const *a, float const *b)
+  {
+    float w = std::min(a[2], b[2]) - std::max(a[0], b[0]) ;
+    float h = std::min(a[3], b[3]) - std::max(a[1], b[1]) ;
+    if (w <= 0 || h <= 0) { return 0 ; }
+    float inter = w * h ;
+    return inter / ((a[2] - a[0]) * (a[3] - a[1]) +
+                    (b[2] - b[0]) * (b[3] - b[1]) - inter) ;
+  }
+
+  // Build a synthetic batch for the given prior tiling.  Each image holds
+  // a few objects: the priors that overlap an object are confident about
+  // its class (with a score that decays with the overlap), while all
+  // other priors are confident background with some noise, so that the
+  // number of candidates above the usual thresholds resembles that of a
+  // trained model.  The class scores are softmax probabilities, and the
+  // background is class 1 (MATLAB indexing).
+  inline void makeWorkload(PriorSpec const &spec,
+                           int numClasses,
+                           int batchSize,
+                           int objectsPerImage,
+                           uint64_t seed,
+                           Workload *workload)
+  {
+    Random random(seed) ;
+    workload->numClasses = numClasses ;
+    workload->batchSize = batchSize ;
+    workload->numPriors = makePriors(spec, &workload->priors) ;
+    const int numPriors = workload->numPriors ;
+    float const *boxes = workload->priors.data() ;
+
+    workload->locPreds.resize((size_t)batchSize * numPriors * 4) ;
+    workload->confPreds.resize((size_t)batchSize * numPriors * numClasses) ;
+    std::vector<float> logits(numClasses) ;
+    std::vector<float> objectness(numPriors) ;
+    std::vector<int> objectClass(numPriors) ;
+
+    for (int i = 0 ; i < batchSize ; ++i) {
+      std::fill(objectness.begin(), objectness.end(), 0.0f) ;
+      for (int o = 0 ; o < objectsPerImage ; ++o) {
+        float const *anchor = boxes + 4 * random.index(numPriors) ;
+        int label = 1 + random.index(numClasses - 1) ;
+        for (int p = 0 ; p < numPriors ; ++p) {
+          float iou = overlap(anchor, boxes + 4 * p) ;
+          if (iou > 0.3f && iou > objectness[p]) {
+            objectness[p] = iou ;
+            objectClass[p] = label ;
+          }
+        }
+      }
+
+      float *loc = workload->locPreds.data() + (size_t)numPriors * 4 * i ;
+      float *conf = workload->confPreds.data() + (size_t)numPriors * numClasses * i ;
+      for (int p = 0 ; p < numPriors ; ++p) {
+        for (int k = 0 ; k < 4 ; ++k) {
+          loc[4 * p + k] = 0.5f * random.normal() ;
+        }
+        for (int c = 0 ; c < numClasses ; ++c) {
+          logits[c] = random.normal() ;
+        }
+        logits[0] += 7.0f ;
+        if (objectness[p] > 0) {
+          logits[objectClass[p]] += 14.0f * objectness[p] ;
+        }
+        float maxLogit = *std::max_element(logits.begin(), logits.end()) ;
+        float sum = 0 ;
+        for (int c = 0 ; c < numClasses ; ++c) {
+          logits[c] = expf(logits[c] - maxLogit) ;
+          sum += logits[c] ;
+        }
+        for (int c = 0 ; c < numClasses ; ++c) {
+          conf[numClasses * p + c] = logits[c] / sum ;
+        }
+      }
+    }
+  }
+
+} }
+
+#endif /* defined(VL_STANDALONE_WORKLOAD_H) */
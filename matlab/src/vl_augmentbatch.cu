@@ -0,0 +1,436 @@
+// @file vl_augmentbatch.cu
+// @brief SSD training data augmentation MEX wrapper
+// @author Samuel Albanie
+// @author Andrea Vedaldi
+/*
+Copyright (C) 2017 Samuel Albanie and Andrea Vedaldi.
+All rights reserved.
+
+This file is part of the VLFeat library and is made available under
+the terms of the BSD license (see the COPYING file).
+*/
+
+#include <bits/mexutils.h>
+#include "bits/impl/augment.hpp"
+#include "bits/impl/parallel.hpp"
+
+#include <assert.h>
+#include <string.h>
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+/* option codes */
+enum {
+  opt_image_size = 0,
+  opt_average,
+  opt_resize_methods,
+  opt_brightness,
+  opt_contrast,
+  opt_saturation,
+  opt_hue,
+  opt_random_order,
+  opt_zoom,
+  opt_patch,
+  opt_clip_targets,
+  opt_flip,
+  opt_num_threads,
+  opt_key,
+  opt_prefetch,
+  opt_prefetch_depth,
+  opt_verbose,
+} ;
+
+/* options */
+VLMXOption  options [] = {
+  {"ImageSize",            1,   opt_image_size              },
+  {"Average",              1,   opt_average                 },
+  {"ResizeMethods",        1,   opt_resize_methods          },
+  {"Brightness",           1,   opt_brightness              },
+  {"Contrast",             1,   opt_contrast                },
+  {"Saturation",           1,   opt_saturation              },
+  {"Hue",                  1,   opt_hue                     },
+  {"RandomOrder",          1,   opt_random_order            },
+  {"Zoom",                 1,   opt_zoom                    },
+  {"Patch",                1,   opt_patch                   },
+  {"ClipTargets",          1,   opt_clip_targets            },
+  {"Flip",                 1,   opt_flip                    },
+  {"NumThreads",           1,   opt_num_threads             },
+  {"Key",                  1,   opt_key                     },
+  {"Prefetch",             0,   opt_prefetch                },
+  {"PrefetchDepth",        1,   opt_prefetch_depth          },
+  {"Verbose",              0,   opt_verbose                 },
+  {0,                      0,   0                           }
+} ;
+
+/* ---------------------------------------------------------------- */
+/*                                                          Context */
+/* ---------------------------------------------------------------- */
+
+// The prefetched batches are augmented by a pool of threads which
+// survives across calls (as does the pool of the augmentation kernel,
+// which is shut down after the queue)
+static std::unique_ptr<vl::impl::AugmentQueue> queue ;
+
+void atExit()
+{
+  queue.reset() ;
+  vl::impl::getThreadPool().shutdown() ;
+}
+
+/* ---------------------------------------------------------------- */
+/*                                                           Useful */
+/* ---------------------------------------------------------------- */
+
+// Read an option whose value is a real vector with n elements
+static void getVector(mxArray const *optarg, int n, char const *name,
+                      double *values)
+{
+  if (!vlmxIsPlainMatrix(optarg, -1, -1) || mxGetNumberOfElements(optarg) != n) {
+    vlmxError(VLMXE_IllegalArgument, "%s is not a vector with %d elements.",
+              name, n) ;
+  }
+  for (int k = 0 ; k < n ; ++k) { values[k] = mxGetPr(optarg)[k] ; }
+}
+
+static vl::impl::ResizeMethod getResizeMethod(mxArray const *array)
+{
+  if (!vlmxIsString(array, -1)) {
+    vlmxError(VLMXE_IllegalArgument, "RESIZEMETHODS is not a cell array of strings.") ;
+  }
+  if (vlmxCompareToStringI(array, "nearest") == 0) return vl::impl::RESIZE_NEAREST ;
+  if (vlmxCompareToStringI(array, "bilinear") == 0) return vl::impl::RESIZE_BILINEAR ;
+  if (vlmxCompareToStringI(array, "bicubic") == 0) return vl::impl::RESIZE_BICUBIC ;
+  if (vlmxCompareToStringI(array, "box") == 0) return vl::impl::RESIZE_BOX ;
+  if (vlmxCompareToStringI(array, "lanczos2") == 0) return vl::impl::RESIZE_LANCZOS2 ;
+  if (vlmxCompareToStringI(array, "lanczos3") == 0) return vl::impl::RESIZE_LANCZOS3 ;
+  char name [32] ;
+  mxGetString(array, name, sizeof(name)) ;
+  vlmxError(VLMXE_IllegalArgument, "Unknown resize method %s.", name) ;
+  return vl::impl::RESIZE_BILINEAR ;
+}
+
+// Copy a real numeric array to a vector of T
+template <typename T>
+static void copyArray(mxArray const *array, char const *name, int image,
+                      std::vector<T> *values)
+{
+  values->clear() ;
+  if (array == NULL || mxIsEmpty(array)) {
+    return ;
+  }
+  if (!(mxIsSingle(array) || mxIsDouble(array)) || mxIsComplex(array)) {
+    vlmxError(VLMXE_IllegalArgument, "%s{%d} is not a real single or double "
+              "array.", name, image + 1) ;
+  }
+  size_t n = mxGetNumberOfElements(array) ;
+  values->resize(n) ;
+  for (size_t k = 0 ; k < n ; ++k) {
+    (*values)[k] = mxIsSingle(array) ? (T)((float const*)mxGetData(array))[k]
+                                     : (T)((double const*)mxGetData(array))[k] ;
+  }
+}
+
+/* ---------------------------------------------------------------- */
+/*                                                       MEX driver */
+/* ---------------------------------------------------------------- */
+
+enum {
+  IN_IMAGES = 0, IN_BOXES, IN_LABELS, IN_SEEDS, IN_END
+} ;
+
+enum {
+  OUT_DATA = 0, OUT_BOXES, OUT_LABELS, OUT_END
+} ;
+
+void mexFunction(int nout, mxArray *out[],
+                 int nin, mxArray const *in[])
+{
+  vl::impl::AugmentOptions opts ;
+  std::vector<double> key ;
+  bool prefetch = false ;
+  int prefetchDepth = 2 ;
+  int numThreads = 1 ;
+  int verbosity = 0 ;
+  int opt ;
+  int next = IN_END ;
+  mxArray const *optarg ;
+  double values [5] ;
+
+  mexAtExit(atExit) ;
+
+  /* -------------------------------------------------------------- */
+  /*                                            Check the arguments */
+  /* -------------------------------------------------------------- */
+
+  if (nin < IN_END) {
+    mexErrMsgTxt("There are less than four arguments.") ;
+  }
+
+  while ((opt = vlmxNextOption (in, nin, options, &next, &optarg)) >= 0) {
+    switch (opt) {
+      case opt_verbose :
+        ++ verbosity ;
+        break ;
+
+      case opt_image_size :
+        getVector(optarg, 2, "IMAGESIZE", values) ;
+        if (values[0] < 1 || values[1] < 1) {
+          vlmxError(VLMXE_IllegalArgument, "IMAGESIZE is not positive.") ;
+        }
+        opts.height = (int)values[0] ;
+        opts.width = (int)values[1] ;
+        break ;
+
+      case opt_average :
+        getVector(optarg, 3, "AVERAGE", values) ;
+        for (int c = 0 ; c < 3 ; ++c) { opts.average[c] = (float)values[c] ; }
+        break ;
+
+      case opt_resize_methods :
+        if (!mxIsCell(optarg) || mxGetNumberOfElements(optarg) == 0) {
+          vlmxError(VLMXE_IllegalArgument, "RESIZEMETHODS is not a non-empty "
+                    "cell array.") ;
+        }
+        opts.resizeMethods.clear() ;
+        for (int k = 0 ; k < mxGetNumberOfElements(optarg) ; ++k) {
+          opts.resizeMethods.push_back(getResizeMethod(mxGetCell(optarg, k))) ;
+        }
+        break ;
+
+      case opt_brightness :
+        getVector(optarg, 2, "BRIGHTNESS", values) ;
+        opts.brightnessProb = values[0] ;
+        opts.brightnessDelta = values[1] ;
+        if (opts.brightnessDelta < 0) {
+          vlmxError(VLMXE_IllegalArgument, "The BRIGHTNESS delta is negative.") ;
+        }
+        break ;
+
+      case opt_contrast :
+        getVector(optarg, 3, "CONTRAST", values) ;
+        opts.contrastProb = values[0] ;
+        opts.contrastLower = values[1] ;
+        opts.contrastUpper = values[2] ;
+        if (opts.contrastLower < 0 || opts.contrastUpper < opts.contrastLower) {
+          vlmxError(VLMXE_IllegalArgument, "The CONTRAST range is invalid.") ;
+        }
+        break ;
+
+      case opt_saturation :
+        getVector(optarg, 3, "SATURATION", values) ;
+        opts.saturationProb = values[0] ;
+        opts.saturationLower = values[1] ;
+        opts.saturationUpper = values[2] ;
+        if (opts.saturationLower < 0 || opts.saturationUpper < opts.saturationLower) {
+          vlmxError(VLMXE_IllegalArgument, "The SATURATION range is invalid.") ;
+        }
+        break ;
+
+      case opt_hue :
+        getVector(optarg, 2, "HUE", values) ;
+        opts.hueProb = values[0] ;
+        opts.hueDelta = values[1] ;
+        if (opts.hueDelta < 0) {
+          vlmxError(VLMXE_IllegalArgument, "The HUE delta is negative.") ;
+        }
+        break ;
+
+      case opt_random_order :
+        getVector(optarg, 1, "RANDOMORDER", values) ;
+        opts.randomOrderProb = values[0] ;
+        break ;
+
+      case opt_zoom :
+        getVector(optarg, 3, "ZOOM", values) ;
+        opts.zoomProb = values[0] ;
+        opts.zoomMinScale = values[1] ;
+        opts.zoomMaxScale = values[2] ;
+        if (opts.zoomMinScale < 1 || opts.zoomMaxScale < opts.zoomMinScale) {
+          vlmxError(VLMXE_IllegalArgument, "The ZOOM scales are invalid.") ;
+        }
+        break ;
+
+      case opt_patch :
+        getVector(optarg, 5, "PATCH", values) ;
+        opts.patchNumTrials = (int)values[0] ;
+        opts.patchMinScale = values[1] ;
+        opts.patchMaxScale = values[2] ;
+        opts.patchMinAspect = values[3] ;
+        opts.patchMaxAspect = values[4] ;
+        if (opts.patchMinScale <= 0 || opts.patchMaxScale > 1 ||
+            opts.patchMaxScale < opts.patchMinScale ||
+            opts.patchMinAspect <= 0 || opts.patchMaxAspect < opts.patchMinAspect) {
+          vlmxError(VLMXE_IllegalArgument, "The PATCH parameters are invalid.") ;
+        }
+        break ;
+
+      case opt_clip_targets :
+        if (!vlmxIsScalar(optarg) &&
+            !(mxIsLogical(optarg) && mxGetNumberOfElements(optarg) == 1)) {
+          vlmxError(VLMXE_IllegalArgument, "CLIPTARGETS is not a logical scalar.") ;
+        }
+        opts.clipTargets = (bool)mxGetScalar(optarg) ;
+        break ;
+
+      case opt_flip :
+        getVector(optarg, 1, "FLIP", values) ;
+        opts.flipProb = values[0] ;
+        break ;
+
+      case opt_num_threads :
+        if (!vlmxIsScalar(optarg)) {
+          vlmxError(VLMXE_IllegalArgument, "NUMTHREADS is not a scalar.") ;
+        }
+        numThreads = (int)mxGetPr(optarg)[0] ;
+        break ;
+
+      case opt_key :
+        if (!vlmxIsPlainMatrix(optarg, -1, -1)) {
+          vlmxError(VLMXE_IllegalArgument, "KEY is not a plain matrix.") ;
+        }
+        key.assign(mxGetPr(optarg), mxGetPr(optarg) + mxGetNumberOfElements(optarg)) ;
+        break ;
+
+      case opt_prefetch :
+        prefetch = true ;
+        break ;
+
+      case opt_prefetch_depth :
+        if (!vlmxIsScalar(optarg) || mxGetScalar(optarg) < 1) {
+          vlmxError(VLMXE_IllegalArgument, "PREFETCHDEPTH is not a positive scalar.") ;
+        }
+        prefetchDepth = (int)mxGetScalar(optarg) ;
+        break ;
+
+      default:
+        break ;
+    }
+  }
+
+  if (!queue) {
+    queue.reset(new vl::impl::AugmentQueue()) ;
+  }
+  queue->setCapacity(prefetchDepth) ;
+
+  /* -------------------------------------------------------------- */
+  /*                                      Fetch a prefetched batch? */
+  /* -------------------------------------------------------------- */
+
+  mxArray const *ims = in[IN_IMAGES] ;
+  std::shared_ptr<vl::impl::AugmentBatch> batch ;
+  if (mxIsEmpty(ims)) {
+    if (prefetch) {
+      vlmxError(VLMXE_IllegalArgument, "There are no images to prefetch.") ;
+    }
+    batch = queue->take(key) ;
+    if (verbosity > 0) {
+      mexPrintf("vl_augmentbatch: prefetched batch %s\n", batch ? "found" : "not found") ;
+    }
+    if (!batch) {
+      for (int k = 0 ; k < std::max(nout, 1) ; ++k) {
+        out[k] = mxCreateDoubleMatrix(0, 0, mxREAL) ;
+      }
+      return ;
+    }
+  }
+
+  /* -------------------------------------------------------------- */
+  /*                                             Copy the arguments */
+  /* -------------------------------------------------------------- */
+
+  if (!batch) {
+    mxArray const *boxes = in[IN_BOXES] ;
+    mxArray const *labels = in[IN_LABELS] ;
+    mxArray const *seeds = in[IN_SEEDS] ;
+    if (!mxIsCell(ims)) {
+      vlmxError(VLMXE_IllegalArgument, "IMS is not a cell array.") ;
+    }
+    int batchSize = mxGetNumberOfElements(ims) ;
+    if (!mxIsCell(boxes) || mxGetNumberOfElements(boxes) != batchSize ||
+        !mxIsCell(labels) || mxGetNumberOfElements(labels) != batchSize) {
+      vlmxError(VLMXE_IllegalArgument, "BOXES and LABELS are not cell arrays "
+                "with an element for each image.") ;
+    }
+    if (!vlmxIsPlainMatrix(seeds, -1, -1) || mxGetNumberOfElements(seeds) != batchSize) {
+      vlmxError(VLMXE_IllegalArgument, "SEEDS is not a vector with an element "
+                "for each image.") ;
+    }
+
+    batch.reset(new vl::impl::AugmentBatch) ;
+    batch->init(opts, batchSize) ;
+    for (int i = 0 ; i < batchSize ; ++i) {
+      vl::impl::AugmentImage &image = batch->images[i] ;
+      mxArray const *im = mxGetCell(ims, i) ;
+      mwSize const *dims = (im != NULL) ? mxGetDimensions(im) : NULL ;
+      int numDims = (im != NULL) ? mxGetNumberOfDimensions(im) : 0 ;
+      if (im == NULL || !mxIsSingle(im) || mxIsComplex(im) || mxIsEmpty(im) ||
+          numDims > 3 || (numDims == 3 && dims[2] != 3)) {
+        vlmxError(VLMXE_IllegalArgument, "IMS{%d} is not a H x W x 3 or H x W "
+                  "single array.", i + 1) ;
+      }
+      image.height = dims[0] ;
+      image.width = dims[1] ;
+      image.depth = (numDims == 3) ? 3 : 1 ;
+      float const *pixels = (float const*)mxGetData(im) ;
+      image.pixels.assign(pixels, pixels + mxGetNumberOfElements(im)) ;
+
+      copyArray(mxGetCell(boxes, i), "BOXES", i, &image.boxes) ;
+      copyArray(mxGetCell(labels, i), "LABELS", i, &image.labels) ;
+      if (image.boxes.size() != 4 * image.labels.size()) {
+        vlmxError(VLMXE_IllegalArgument, "BOXES{%d} is not a N x 4 array with "
+                  "a row for each element of LABELS{%d}.", i + 1, i + 1) ;
+      }
+      image.seed = (uint64_t)mxGetPr(seeds)[i] ;
+    }
+
+    if (verbosity > 0) {
+      mexPrintf("vl_augmentbatch: %s %d images to %d x %d\n",
+                prefetch ? "prefetching" : "augmenting", batchSize,
+                opts.height, opts.width) ;
+      mexPrintf("vl_augmentbatch: numThreads: %d, prefetchDepth: %d\n",
+                numThreads, prefetchDepth) ;
+    }
+
+    /* ------------------------------------------------------------ */
+    /*                                                  Do the work */
+    /* ------------------------------------------------------------ */
+
+    if (prefetch) {
+      queue->setNumThreads(numThreads) ;
+      queue->submit(key, batch) ;
+      return ;
+    }
+    vl::impl::augmentBatch(batch.get(), numThreads) ;
+  }
+
+  /* -------------------------------------------------------------- */
+  /*                                                         Finish */
+  /* -------------------------------------------------------------- */
+
+  vl::impl::AugmentOptions const &bopts = batch->options ;
+  int batchSize = batch->images.size() ;
+  mwSize dims [4] = { (mwSize)bopts.height, (mwSize)bopts.width, 3, (mwSize)batchSize } ;
+  out[OUT_DATA] = mxCreateNumericArray(4, dims, mxSINGLE_CLASS, mxREAL) ;
+  memcpy(mxGetData(out[OUT_DATA]), batch->data.data(),
+         batch->data.size() * sizeof(float)) ;
+
+  if (nout > OUT_BOXES) {
+    out[OUT_BOXES] = mxCreateCellMatrix(1, batchSize) ;
+    for (int i = 0 ; i < batchSize ; ++i) {
+      vl::impl::AugmentAnnotations const &a = batch->annotations[i] ;
+      mxArray *boxes = mxCreateDoubleMatrix(a.labels.size(), 4, mxREAL) ;
+      std::copy(a.boxes.begin(), a.boxes.end(), mxGetPr(boxes)) ;
+      mxSetCell(out[OUT_BOXES], i, boxes) ;
+    }
+  }
+  if (nout > OUT_LABELS) {
+    out[OUT_LABELS] = mxCreateCellMatrix(1, batchSize) ;
+    for (int i = 0 ; i < batchSize ; ++i) {
+      vl::impl::AugmentAnnotations const &a = batch->annotations[i] ;
+      mxArray *labels = mxCreateNumericMatrix(a.labels.size(), 1, mxSINGLE_CLASS, mxREAL) ;
+      std::copy(a.labels.begin(), a.labels.end(), (float*)mxGetData(labels)) ;
+      mxSetCell(out[OUT_LABELS], i, labels) ;
+    }
+  }
+}
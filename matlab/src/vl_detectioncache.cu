@@ -0,0 +1,335 @@
+// @file vl_detectioncache.cu
+// @brief Binary detection cache MEX wrapper
+// @author Samuel Albanie
+// @author Andrea Vedaldi
+/*
+Copyright (C) 2017 Samuel Albanie and Andrea Vedaldi.
+All rights reserved.
+
+This file is part of the VLFeat library and is made available under
+the terms of the BSD license (see the COPYING file).
+*/
+
+#include <bits/mexutils.h>
+#include "bits/impl/detectioncache.hpp"
+
+#include <assert.h>
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+/* option codes */
+enum {
+  opt_num_classes = 0,
+  opt_height,
+  opt_verbose,
+} ;
+
+/* options */
+VLMXOption  options [] = {
+  {"NumClasses",           1,   opt_num_classes             },
+  {"Height",               1,   opt_height                  },
+  {"Verbose",              0,   opt_verbose                 },
+  {0,                      0,   0                           }
+} ;
+
+/* ---------------------------------------------------------------- */
+/*                                                          Context */
+/* ---------------------------------------------------------------- */
+
+// The caches being written, by path.  Clearing the MEX file abandons
+// them, so that they are left incomplete rather than truncated.
+static std::map<std::string, std::unique_ptr<vl::impl::DetectionCacheWriter> > writers ;
+
+void atExit()
+{
+  writers.clear() ;
+}
+
+/* ---------------------------------------------------------------- */
+/*                                                           Useful */
+/* ---------------------------------------------------------------- */
+
+static std::string getString(mxArray const *array, char const *name)
+{
+  if (!vlmxIsString(array, -1)) {
+    vlmxError(VLMXE_IllegalArgument, "%s is not a string.", name) ;
+  }
+  std::vector<char> buffer(mxGetNumberOfElements(array) + 1) ;
+  mxGetString(array, buffer.data(), buffer.size()) ;
+  return std::string(buffer.data()) ;
+}
+
+// Get a real numeric array as single precision, converting it if needed
+static float const *getSingle(mxArray const *array, char const *name,
+                              std::vector<float> *copy)
+{
+  if (!(mxIsSingle(array) || mxIsDouble(array)) || mxIsComplex(array)) {
+    vlmxError(VLMXE_IllegalArgument, "%s is not a real single or double "
+              "array.", name) ;
+  }
+  if (mxIsSingle(array)) {
+    return (float const*)mxGetData(array) ;
+  }
+  copy->assign(mxGetPr(array), mxGetPr(array) + mxGetNumberOfElements(array)) ;
+  return copy->data() ;
+}
+
+static void openCache(vl::impl::DetectionCache &cache, std::string const &path)
+{
+  if (!cache.open(path)) {
+    vlmxError(VLMXE_Execution, "%s", cache.getLastError().c_str()) ;
+  }
+}
+
+/* ---------------------------------------------------------------- */
+/*                                                       MEX driver */
+/* ---------------------------------------------------------------- */
+
+enum {
+  IN_MODE = 0, IN_PATH, IN_END
+} ;
+
+enum {
+  OUT_RESULT = 0, OUT_END
+} ;
+
+enum Mode {
+  MODE_OPEN = 0, MODE_APPEND, MODE_FINISH, MODE_INFO, MODE_READ, MODE_READCLASS
+} ;
+
+void mexFunction(int nout, mxArray *out[],
+                 int nin, mxArray const *in[])
+{
+  int numClasses = 21 ;
+  int height = -1 ;
+  int verbosity = 0 ;
+  int opt ;
+  int next ;
+  mxArray const *optarg ;
+
+  mexAtExit(atExit) ;
+
+  /* -------------------------------------------------------------- */
+  /*                                            Check the arguments */
+  /* -------------------------------------------------------------- */
+
+  if (nin < IN_END) {
+    mexErrMsgTxt("There are less than two arguments.") ;
+  }
+  if (!vlmxIsString(in[IN_MODE], -1)) {
+    vlmxError(VLMXE_IllegalArgument, "MODE is not a string.") ;
+  }
+  Mode mode ;
+  if (vlmxCompareToStringI(in[IN_MODE], "open") == 0) {
+    mode = MODE_OPEN ;
+  } else if (vlmxCompareToStringI(in[IN_MODE], "append") == 0) {
+    mode = MODE_APPEND ;
+  } else if (vlmxCompareToStringI(in[IN_MODE], "finish") == 0) {
+    mode = MODE_FINISH ;
+  } else if (vlmxCompareToStringI(in[IN_MODE], "info") == 0) {
+    mode = MODE_INFO ;
+  } else if (vlmxCompareToStringI(in[IN_MODE], "read") == 0) {
+    mode = MODE_READ ;
+  } else if (vlmxCompareToStringI(in[IN_MODE], "readclass") == 0) {
+    mode = MODE_READCLASS ;
+  } else {
+    vlmxError(VLMXE_IllegalArgument, "MODE is not 'open', 'append', 'finish', "
+              "'info', 'read' or 'readclass'.") ;
+    return ;
+  }
+  std::string path = getString(in[IN_PATH], "PATH") ;
+
+  // the numeric arguments of the mode precede the options
+  next = IN_END ;
+  while (next < nin && !vlmxIsString(in[next], -1)) { ++ next ; }
+  int numArgs = next - IN_END ;
+  mxArray const **args = in + IN_END ;
+
+  while ((opt = vlmxNextOption (in, nin, options, &next, &optarg)) >= 0) {
+    switch (opt) {
+      case opt_verbose :
+        ++ verbosity ;
+        break ;
+
+      case opt_num_classes :
+        if (!vlmxIsScalar(optarg) || mxGetScalar(optarg) < 1) {
+          vlmxError(VLMXE_IllegalArgument, "NUMCLASSES is not a positive scalar.") ;
+        }
+        numClasses = (int)mxGetScalar(optarg) ;
+        break ;
+
+      case opt_height :
+        if (!vlmxIsScalar(optarg) || mxGetScalar(optarg) < 0) {
+          vlmxError(VLMXE_IllegalArgument, "HEIGHT is not a non-negative scalar.") ;
+        }
+        height = (int)mxGetScalar(optarg) ;
+        break ;
+
+      default:
+        break ;
+    }
+  }
+
+  /* -------------------------------------------------------------- */
+  /*                                                        Writing */
+  /* -------------------------------------------------------------- */
+
+  if (mode == MODE_OPEN) {
+    std::unique_ptr<vl::impl::DetectionCacheWriter> &writer = writers[path] ;
+    writer.reset(new vl::impl::DetectionCacheWriter()) ;
+    if (!writer->open(path, numClasses)) {
+      std::string error = writer->getLastError() ;
+      writers.erase(path) ;
+      vlmxError(VLMXE_Execution, "%s", error.c_str()) ;
+    }
+    if (verbosity > 0) {
+      mexPrintf("vl_detectioncache: writing %s (%d classes)\n",
+                path.c_str(), numClasses) ;
+    }
+    return ;
+  }
+
+  if (mode == MODE_APPEND || mode == MODE_FINISH) {
+    std::map<std::string, std::unique_ptr<vl::impl::DetectionCacheWriter> >::iterator
+    writer = writers.find(path) ;
+    if (writer == writers.end()) {
+      vlmxError(VLMXE_IllegalArgument, "%s is not open for writing.", path.c_str()) ;
+    }
+    bool ok ;
+    if (mode == MODE_APPEND) {
+      std::vector<float> copy, countsCopy ;
+      if (numArgs == 1) {
+        // DETS in the fixed layout, K x 6 x 1 x N
+        mwSize const *dims = mxGetDimensions(args[0]) ;
+        int numDims = mxGetNumberOfDimensions(args[0]) ;
+        float const *dets = getSingle(args[0], "DETS", &copy) ;
+        if (numDims > 4 || (numDims > 1 && dims[1] != 6) ||
+            (numDims > 2 && dims[2] != 1)) {
+          vlmxError(VLMXE_IllegalArgument, "DETS is not a K x 6 x 1 x N array.") ;
+        }
+        size_t numImages = (numDims > 3) ? dims[3] : 1 ;
+        ok = writer->second->append(dets, dims[0], numImages) ;
+      } else if (numArgs == 2) {
+        // RECORDS and COUNTS in the compact layout, 6 x M and 1 x N
+        float const *records = getSingle(args[0], "RECORDS", &copy) ;
+        float const *counts = getSingle(args[1], "COUNTS", &countsCopy) ;
+        size_t numImages = mxGetNumberOfElements(args[1]) ;
+        double total = 0 ;
+        for (size_t i = 0 ; i < numImages ; ++i) { total += counts[i] ; }
+        if (mxGetM(args[0]) != 6 && !mxIsEmpty(args[0])) {
+          vlmxError(VLMXE_IllegalArgument, "RECORDS is not a 6 x M array.") ;
+        }
+        if (total > mxGetN(args[0])) {
+          vlmxError(VLMXE_IllegalArgument, "COUNTS add up to more than the "
+                    "number of RECORDS.") ;
+        }
+        ok = writer->second->appendCompact(records, counts, numImages) ;
+      } else {
+        vlmxError(VLMXE_IllegalArgument, "APPEND takes DETS or RECORDS and COUNTS.") ;
+        return ;
+      }
+    } else {
+      ok = writer->second->finish() ;
+      if (ok && verbosity > 0) {
+        mexPrintf("vl_detectioncache: finished %s (%d images)\n",
+                  path.c_str(), (int)writer->second->getNumImages()) ;
+      }
+    }
+    if (!ok || mode == MODE_FINISH) {
+      std::string error = writer->second->getLastError() ;
+      writers.erase(writer) ;
+      if (!ok) {
+        vlmxError(VLMXE_Execution, "%s", error.c_str()) ;
+      }
+    }
+    return ;
+  }
+
+  /* -------------------------------------------------------------- */
+  /*                                                        Reading */
+  /* -------------------------------------------------------------- */
+
+  vl::impl::DetectionCache cache ;
+
+  if (mode == MODE_INFO) {
+    openCache(cache, path) ;
+    char const *fields [] = {"version", "numClasses", "numImages",
+                             "numDetections"} ;
+    out[OUT_RESULT] = mxCreateStructMatrix(1, 1, 4, fields) ;
+    mxSetField(out[OUT_RESULT], 0, "version",
+               mxCreateDoubleScalar(vl::impl::DETECTION_CACHE_VERSION)) ;
+    mxSetField(out[OUT_RESULT], 0, "numClasses",
+               mxCreateDoubleScalar(cache.getNumClasses())) ;
+    mxSetField(out[OUT_RESULT], 0, "numImages",
+               mxCreateDoubleScalar((double)cache.getNumImages())) ;
+    mxSetField(out[OUT_RESULT], 0, "numDetections",
+               mxCreateDoubleScalar((double)cache.getNumDetections())) ;
+    return ;
+  }
+
+  if (mode == MODE_READ) {
+    openCache(cache, path) ;
+    std::vector<size_t> images ;
+    if (numArgs > 0) {
+      if (!vlmxIsPlainMatrix(args[0], -1, -1)) {
+        vlmxError(VLMXE_IllegalArgument, "IMAGES is not a vector of indices.") ;
+      }
+      size_t n = mxGetNumberOfElements(args[0]) ;
+      for (size_t k = 0 ; k < n ; ++k) {
+        double index = mxGetPr(args[0])[k] ;
+        if (!(index >= 1 && index <= cache.getNumImages()) ||
+            index != (double)(size_t)index) {
+          vlmxError(VLMXE_IllegalArgument, "IMAGES(%d) is not the index of an "
+                    "image in the cache.", (int)k + 1) ;
+        }
+        images.push_back((size_t)index - 1) ;
+      }
+    } else {
+      for (size_t i = 0 ; i < cache.getNumImages() ; ++i) {
+        images.push_back(i) ;
+      }
+    }
+
+    // by default, as tall as the image with the most detections
+    float const *dets ;
+    size_t maxCount = 0 ;
+    for (size_t k = 0 ; k < images.size() ; ++k) {
+      maxCount = std::max(maxCount, cache.getImageDetections(images[k], &dets)) ;
+    }
+    size_t outHeight = (height >= 0) ? (size_t)height : maxCount ;
+    mwSize dims [4] = {(mwSize)outHeight, 6, 1, (mwSize)images.size()} ;
+    out[OUT_RESULT] = mxCreateNumericArray(4, dims, mxSINGLE_CLASS, mxREAL) ;
+    float *output = (float*)mxGetData(out[OUT_RESULT]) ;
+    for (size_t k = 0 ; k < images.size() ; ++k) {
+      size_t n = cache.getImageDetections(images[k], &dets) ;
+      size_t m = std::min(n, outHeight) ;
+      float *slice = output + outHeight * 6 * k ;
+      for (size_t j = 0 ; j < 6 ; ++j) {
+        std::copy(dets + n * j, dets + n * j + m, slice + outHeight * j) ;
+      }
+    }
+    return ;
+  }
+
+  // readclass
+  {
+    openCache(cache, path) ;
+    if (numArgs < 1 || !vlmxIsScalar(args[0])) {
+      vlmxError(VLMXE_IllegalArgument, "LABEL is not a scalar.") ;
+    }
+    double value = mxGetScalar(args[0]) ;
+    if (!(value >= 1 && value <= cache.getNumClasses()) ||
+        value != (double)(int)value) {
+      vlmxError(VLMXE_IllegalArgument, "LABEL is not an integer between 1 "
+                "and %d.", cache.getNumClasses()) ;
+    }
+    int label = (int)value ;
+    float const *dets ;
+    size_t m = cache.getClassDetections(label, &dets) ;
+    out[OUT_RESULT] = mxCreateNumericMatrix(m, 6, mxSINGLE_CLASS, mxREAL) ;
+    std::copy(dets, dets + 6 * m, (float*)mxGetData(out[OUT_RESULT])) ;
+  }
+}
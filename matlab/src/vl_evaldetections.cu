@@ -0,0 +1,365 @@
+// @file vl_evaldetections.cu
+// @brief Detection evaluation MEX wrapper
+// @author Samuel Albanie
+// @author Andrea Vedaldi
+/*
+Copyright (C) 2017 Samuel Albanie and Andrea Vedaldi.
+All rights reserved.
+
+This file is part of the VLFeat library and is made available under
+the terms of the BSD license (see the COPYING file).
+*/
+
+#include <bits/mexutils.h>
+#include "bits/impl/detectioneval.hpp"
+#include "bits/impl/detectioncache.hpp"
+#include "bits/impl/parallel.hpp"
+
+#include <assert.h>
+#include <algorithm>
+#include <vector>
+
+/* option codes */
+enum {
+  opt_flags = 0,
+  opt_metric,
+  opt_iou,
+  opt_num_classes,
+  opt_background_label,
+  opt_max_detections,
+  opt_pixel_coordinates,
+  opt_clip_boxes,
+  opt_num_threads,
+  opt_verbose,
+} ;
+
+/* options */
+VLMXOption  options [] = {
+  {"Flags",                1,   opt_flags                   },
+  {"Metric",               1,   opt_metric                  },
+  {"IoU",                  1,   opt_iou                     },
+  {"NumClasses",           1,   opt_num_classes             },
+  {"BackgroundLabel",      1,   opt_background_label        },
+  {"MaxDetections",        1,   opt_max_detections          },
+  {"PixelCoordinates",     1,   opt_pixel_coordinates       },
+  {"ClipBoxes",            1,   opt_clip_boxes              },
+  {"NumThreads",           1,   opt_num_threads             },
+  {"Verbose",              0,   opt_verbose                 },
+  {0,                      0,   0                           }
+} ;
+
+/* ---------------------------------------------------------------- */
+/*                                                          Context */
+/* ---------------------------------------------------------------- */
+
+/*
+ The threads of the pool survive across calls, and are joined before
+ the MEX file is unloaded (e.g. on `clear mex`).
+ */
+void atExit()
+{
+  vl::impl::getThreadPool().shutdown() ;
+}
+
+/* ---------------------------------------------------------------- */
+/*                                                           Useful */
+/* ---------------------------------------------------------------- */
+
+// Copy a real numeric array to a vector of T
+template <typename T>
+static void copyArray(mxArray const *array, char const *name, int image,
+                      std::vector<T> *values)
+{
+  values->clear() ;
+  if (array == NULL || mxIsEmpty(array)) {
+    return ;
+  }
+  if (!(mxIsSingle(array) || mxIsDouble(array) || mxIsLogical(array)) ||
+      mxIsComplex(array)) {
+    vlmxError(VLMXE_IllegalArgument, "%s{%d} is not a real single, double or "
+              "logical array.", name, image + 1) ;
+  }
+  size_t n = mxGetNumberOfElements(array) ;
+  values->resize(n) ;
+  for (size_t k = 0 ; k < n ; ++k) {
+    if (mxIsLogical(array)) {
+      (*values)[k] = (T)((mxLogical const*)mxGetData(array))[k] ;
+    } else {
+      (*values)[k] = mxIsSingle(array) ? (T)((float const*)mxGetData(array))[k]
+                                       : (T)((double const*)mxGetData(array))[k] ;
+    }
+  }
+}
+
+/* ---------------------------------------------------------------- */
+/*                                                       MEX driver */
+/* ---------------------------------------------------------------- */
+
+enum {
+  IN_DETECTIONS = 0, IN_BOXES, IN_LABELS, IN_END
+} ;
+
+enum {
+  OUT_AP = 0, OUT_NUM_POSITIVES, OUT_END
+} ;
+
+void mexFunction(int nout, mxArray *out[],
+                 int nin, mxArray const *in[])
+{
+  vl::impl::DetectionEvalOptions opts ;
+  mxArray const *flags = NULL ;
+  bool iouSet = false ;
+  bool maxDetectionsSet = false ;
+  bool numClassesSet = false ;
+  int numClasses = 21 ;
+  int backgroundLabel = 1 ;
+  int verbosity = 0 ;
+  int opt ;
+  int next = IN_END ;
+  mxArray const *optarg ;
+
+  mexAtExit(atExit) ;
+
+  /* -------------------------------------------------------------- */
+  /*                                            Check the arguments */
+  /* -------------------------------------------------------------- */
+
+  if (nin < IN_END) {
+    mexErrMsgTxt("There are less than three arguments.") ;
+  }
+
+  while ((opt = vlmxNextOption (in, nin, options, &next, &optarg)) >= 0) {
+    switch (opt) {
+      case opt_verbose :
+        ++ verbosity ;
+        break ;
+
+      case opt_flags :
+        flags = optarg ;
+        break ;
+
+      case opt_metric :
+        if (!vlmxIsString(optarg, -1)) {
+          vlmxError(VLMXE_IllegalArgument, "METRIC is not a string.") ;
+        }
+        if (vlmxCompareToStringI(optarg, "voc07") == 0) {
+          opts.metric = vl::impl::AP_VOC07 ;
+        } else if (vlmxCompareToStringI(optarg, "voc12") == 0) {
+          opts.metric = vl::impl::AP_VOC12 ;
+        } else if (vlmxCompareToStringI(optarg, "coco") == 0) {
+          opts.metric = vl::impl::AP_COCO ;
+        } else {
+          vlmxError(VLMXE_IllegalArgument, "METRIC is not 'voc07', 'voc12' "
+                    "or 'coco'.") ;
+        }
+        break ;
+
+      case opt_iou :
+        if (!vlmxIsPlainMatrix(optarg, -1, -1) || mxIsEmpty(optarg)) {
+          vlmxError(VLMXE_IllegalArgument, "IOU is not a non-empty vector.") ;
+        }
+        opts.iouThresholds.assign(mxGetPr(optarg),
+                                  mxGetPr(optarg) + mxGetNumberOfElements(optarg)) ;
+        for (int t = 0 ; t < opts.iouThresholds.size() ; ++t) {
+          if (!(opts.iouThresholds[t] > 0 && opts.iouThresholds[t] <= 1)) {
+            vlmxError(VLMXE_IllegalArgument, "IOU thresholds must lie in (0, 1].") ;
+          }
+        }
+        iouSet = true ;
+        break ;
+
+      case opt_num_classes :
+        if (!vlmxIsScalar(optarg) || mxGetScalar(optarg) < 1) {
+          vlmxError(VLMXE_IllegalArgument, "NUMCLASSES is not a positive scalar.") ;
+        }
+        numClasses = (int)mxGetScalar(optarg) ;
+        numClassesSet = true ;
+        break ;
+
+      case opt_background_label :
+        if (!vlmxIsScalar(optarg)) {
+          vlmxError(VLMXE_IllegalArgument, "BACKGROUNDLABEL is not a scalar.") ;
+        }
+        backgroundLabel = (int)mxGetScalar(optarg) ;
+        break ;
+
+      case opt_max_detections :
+        if (!vlmxIsScalar(optarg)) {
+          vlmxError(VLMXE_IllegalArgument, "MAXDETECTIONS is not a scalar.") ;
+        }
+        opts.maxDetections = std::max((int)mxGetScalar(optarg), -1) ;
+        maxDetectionsSet = true ;
+        break ;
+
+      case opt_pixel_coordinates :
+        if (!vlmxIsScalar(optarg) &&
+            !(mxIsLogical(optarg) && mxGetNumberOfElements(optarg) == 1)) {
+          vlmxError(VLMXE_IllegalArgument, "PIXELCOORDINATES is not a logical scalar.") ;
+        }
+        opts.pixelCoordinates = (bool)mxGetScalar(optarg) ;
+        break ;
+
+      case opt_clip_boxes :
+        if (!vlmxIsScalar(optarg) &&
+            !(mxIsLogical(optarg) && mxGetNumberOfElements(optarg) == 1)) {
+          vlmxError(VLMXE_IllegalArgument, "CLIPBOXES is not a logical scalar.") ;
+        }
+        opts.clipBoxes = (bool)mxGetScalar(optarg) ;
+        break ;
+
+      case opt_num_threads :
+        if (!vlmxIsScalar(optarg)) {
+          vlmxError(VLMXE_IllegalArgument, "NUMTHREADS is not a scalar.") ;
+        }
+        opts.numThreads = (int)mxGetScalar(optarg) ;
+        break ;
+
+      default:
+        break ;
+    }
+  }
+
+  // COCO evaluates 100 detections per image at IoU 0.5:0.05:0.95 (as
+  // computed by numpy.linspace)
+  if (opts.metric == vl::impl::AP_COCO) {
+    if (!iouSet) {
+      opts.iouThresholds.resize(10) ;
+      for (int t = 0 ; t < 9 ; ++t) {
+        opts.iouThresholds[t] = t * ((0.95 - 0.5) / 9) + 0.5 ;
+      }
+      opts.iouThresholds[9] = 0.95 ;
+    }
+    if (!maxDetectionsSet) {
+      opts.maxDetections = 100 ;
+    }
+  }
+
+  /* -------------------------------------------------------------- */
+  /*                                             Copy the arguments */
+  /* -------------------------------------------------------------- */
+
+  mxArray const *dets = in[IN_DETECTIONS] ;
+  mxArray const *boxes = in[IN_BOXES] ;
+  mxArray const *labels = in[IN_LABELS] ;
+  int height = 0 ;
+  int numImages ;
+
+  // the detections of a cache file are evaluated in place, from a memory
+  // mapping, so that evaluation sweeps do not read them again
+  vl::impl::DetectionCache cache ;
+  if (vlmxIsString(dets, -1)) {
+    std::vector<char> path(mxGetNumberOfElements(dets) + 1) ;
+    mxGetString(dets, path.data(), path.size()) ;
+    if (!cache.open(path.data())) {
+      vlmxError(VLMXE_Execution, "%s", cache.getLastError().c_str()) ;
+    }
+    if (!numClassesSet) {
+      numClasses = cache.getNumClasses() ;
+    } else if (numClasses < cache.getNumClasses()) {
+      vlmxError(VLMXE_IllegalArgument, "NUMCLASSES is less than the %d "
+                "classes of the cache.", cache.getNumClasses()) ;
+    }
+    numImages = cache.getNumImages() ;
+  } else {
+    mwSize const *dims = mxGetDimensions(dets) ;
+    int numDims = mxGetNumberOfDimensions(dets) ;
+    if (!(mxIsSingle(dets) || mxIsDouble(dets)) || mxIsComplex(dets) ||
+        numDims > 4 || (numDims > 1 && dims[1] != 6) ||
+        (numDims > 2 && dims[2] != 1)) {
+      vlmxError(VLMXE_IllegalArgument, "DETS is not a real K x 6 x 1 x N array "
+                "or the path of a detection cache.") ;
+    }
+    height = dims[0] ;
+    numImages = (numDims > 3) ? dims[3] : 1 ;
+  }
+  if (!mxIsCell(boxes) || mxGetNumberOfElements(boxes) != numImages ||
+      !mxIsCell(labels) || mxGetNumberOfElements(labels) != numImages) {
+    vlmxError(VLMXE_IllegalArgument, "BOXES and LABELS are not cell arrays "
+              "with an element for each image.") ;
+  }
+  if (flags && (!mxIsCell(flags) || mxGetNumberOfElements(flags) != numImages)) {
+    vlmxError(VLMXE_IllegalArgument, "FLAGS is not a cell array with an "
+              "element for each image.") ;
+  }
+
+  std::vector<float> detData ;
+  float const *detections = (float const*)mxGetData(dets) ;
+  if (!cache.isOpen() && mxIsDouble(dets)) {
+    detData.assign(mxGetPr(dets), mxGetPr(dets) + mxGetNumberOfElements(dets)) ;
+    detections = detData.data() ;
+  }
+
+  std::vector<std::vector<float> > gtBoxes(numImages) ;
+  std::vector<std::vector<float> > gtLabels(numImages) ;
+  std::vector<std::vector<unsigned char> > gtFlags(numImages) ;
+  std::vector<vl::impl::DetectionEvalImage> images(numImages) ;
+  for (int i = 0 ; i < numImages ; ++i) {
+    copyArray(mxGetCell(boxes, i), "BOXES", i, &gtBoxes[i]) ;
+    copyArray(mxGetCell(labels, i), "LABELS", i, &gtLabels[i]) ;
+    if (gtBoxes[i].size() != 4 * gtLabels[i].size()) {
+      vlmxError(VLMXE_IllegalArgument, "BOXES{%d} is not a G x 4 array with "
+                "a row for each element of LABELS{%d}.", i + 1, i + 1) ;
+    }
+    if (flags) {
+      copyArray(mxGetCell(flags, i), "FLAGS", i, &gtFlags[i]) ;
+      if (gtFlags[i].size() != gtLabels[i].size()) {
+        vlmxError(VLMXE_IllegalArgument, "FLAGS{%d} does not have an element "
+                  "for each element of LABELS{%d}.", i + 1, i + 1) ;
+      }
+    }
+    vl::impl::DetectionEvalImage &image = images[i] ;
+    if (cache.isOpen()) {
+      image.numDetections = cache.getImageDetections(i, &image.detections) ;
+    } else {
+      image.detections = detections + (size_t)height * 6 * i ;
+      image.numDetections = height ;
+    }
+    image.boxes = gtBoxes[i].data() ;
+    image.labels = gtLabels[i].data() ;
+    image.flags = flags ? gtFlags[i].data() : NULL ;
+    image.numObjects = gtLabels[i].size() ;
+  }
+
+  if (verbosity > 0) {
+    mexPrintf("vl_evaldetections: %d images, %d classes, metric %s\n",
+              numImages, numClasses,
+              (opts.metric == vl::impl::AP_COCO) ? "coco" :
+              (opts.metric == vl::impl::AP_VOC12) ? "voc12" : "voc07") ;
+    mexPrintf("vl_evaldetections: %d IoU thresholds, maxDetections: %d\n",
+              (int)opts.iouThresholds.size(), opts.maxDetections) ;
+    mexPrintf("vl_evaldetections: numThreads: %d\n", opts.numThreads) ;
+  }
+
+  /* -------------------------------------------------------------- */
+  /*                                                    Do the work */
+  /* -------------------------------------------------------------- */
+
+  vl::impl::DetectionEvalResult result ;
+  vl::impl::evaluateDetections(images.data(), numImages, numClasses, opts,
+                               &result) ;
+
+  /* -------------------------------------------------------------- */
+  /*                                                         Finish */
+  /* -------------------------------------------------------------- */
+
+  // the rows of the background label are dropped
+  std::vector<int> keep ;
+  for (int c = 0 ; c < numClasses ; ++c) {
+    if (c + 1 != backgroundLabel) { keep.push_back(c) ; }
+  }
+  int numThresholds = opts.iouThresholds.size() ;
+  out[OUT_AP] = mxCreateDoubleMatrix(keep.size(), numThresholds, mxREAL) ;
+  double *ap = mxGetPr(out[OUT_AP]) ;
+  for (int t = 0 ; t < numThresholds ; ++t) {
+    for (int k = 0 ; k < keep.size() ; ++k) {
+      ap[keep.size() * t + k] = result.ap[(size_t)numClasses * t + keep[k]] ;
+    }
+  }
+  if (nout > OUT_NUM_POSITIVES) {
+    out[OUT_NUM_POSITIVES] = mxCreateDoubleMatrix(keep.size(), 1, mxREAL) ;
+    double *numPositives = mxGetPr(out[OUT_NUM_POSITIVES]) ;
+    for (int k = 0 ; k < keep.size() ; ++k) {
+      numPositives[k] = result.numPositives[keep[k]] ;
+    }
+  }
+}
@@ -0,0 +1,257 @@
+// @file vl_hardnegatives.cu
+// @brief Hard negative mining MEX wrapper
+// @author Samuel Albanie
+// @author Andrea Vedaldi
+/*
+Copyright (C) 2017 Samuel Albanie and Andrea Vedaldi.
+All rights reserved.
+
+This file is part of the VLFeat library and is made available under
+the terms of the BSD license (see the COPYING file).
+*/
+
+#include <bits/mexutils.h>
+#include <bits/datamex.hpp>
+#include "bits/impl/hardnegatives.hpp"
+#include "bits/impl/parallel.hpp"
+
+#include <assert.h>
+#include <vector>
+
+/* option codes */
+enum {
+  opt_num_classes = 0,
+  opt_neg_pos_ratio,
+  opt_background_label,
+  opt_ignore_x_boundary_boxes,
+  opt_num_threads,
+  opt_verbose,
+} ;
+
+/* options */
+VLMXOption  options [] = {
+  {"numClasses",           1,   opt_num_classes             },
+  {"negPosRatio",          1,   opt_neg_pos_ratio           },
+  {"backgroundLabel",      1,   opt_background_label        },
+  {"ignoreXBoundaryBoxes", 1,   opt_ignore_x_boundary_boxes },
+  {"numThreads",           1,   opt_num_threads             },
+  {"Verbose",              0,   opt_verbose                 },
+  {0,                      0,   0                           }
+} ;
+
+/* ---------------------------------------------------------------- */
+/*                                                          Context */
+/* ---------------------------------------------------------------- */
+
+vl::MexContext context ;
+
+void atExit()
+{
+  vl::impl::getThreadPool().shutdown() ;
+  context.clear() ;
+}
+
+/* ---------------------------------------------------------------- */
+/*                                                           Useful */
+/* ---------------------------------------------------------------- */
+
+// Append the (1-based) prior indices stored in a numeric array to a
+// list of 0-based indices
+static void appendIndices(mxArray const *array, int numPriors,
+                          char const *name, int image,
+                          std::vector<int> *indices)
+{
+  if (array == NULL || mxIsEmpty(array)) {
+    return ;
+  }
+  if (!(mxIsDouble(array) || mxIsSingle(array))) {
+    vlmxError(VLMXE_IllegalArgument, "M(%d).%s does not contain single or "
+              "double indices.", image + 1, name) ;
+  }
+  size_t n = mxGetNumberOfElements(array) ;
+  for (size_t k = 0 ; k < n ; ++k) {
+    double x = mxIsSingle(array) ? ((float const*)mxGetData(array))[k]
+                                 : ((double const*)mxGetData(array))[k] ;
+    if (!(x >= 1 && x <= numPriors)) {
+      vlmxError(VLMXE_IllegalArgument, "M(%d).%s contains an index which is "
+                "not a prior.", image + 1, name) ;
+    }
+    indices->push_back((int)x - 1) ;
+  }
+}
+
+/* ---------------------------------------------------------------- */
+/*                                                       MEX driver */
+/* ---------------------------------------------------------------- */
+
+enum {
+  IN_CONF_PREDS = 0, IN_MATCHES, IN_END
+} ;
+
+enum {
+  OUT_RESULT = 0, OUT_END
+} ;
+
+void mexFunction(int nout, mxArray *out[],
+                 int nin, mxArray const *in[])
+{
+  int numClasses = 21 ;
+  double negPosRatio = 3 ;
+  int backgroundLabel = 1 ;
+  bool ignoreBoundary = false ;
+  int numThreads = 1 ;
+  int verbosity = 0 ;
+  int opt ;
+  int next = IN_END ;
+  mxArray const *optarg ;
+
+  mexAtExit(atExit) ;
+
+  /* -------------------------------------------------------------- */
+  /*                                            Check the arguments */
+  /* -------------------------------------------------------------- */
+
+  if (nin < 2) {
+    mexErrMsgTxt("There are less than two arguments.") ;
+  }
+
+  while ((opt = vlmxNextOption (in, nin, options, &next, &optarg)) >= 0) {
+    switch (opt) {
+      case opt_verbose :
+        ++ verbosity ;
+        break ;
+
+      case opt_num_classes :
+        if (!vlmxIsScalar(optarg)) {
+          vlmxError(VLMXE_IllegalArgument, "NUMCLASSES is not a scalar.") ;
+        }
+        numClasses = (int)mxGetPr(optarg)[0] ;
+        break ;
+
+      case opt_neg_pos_ratio :
+        if (!vlmxIsScalar(optarg)) {
+          vlmxError(VLMXE_IllegalArgument, "NEGPOSRATIO is not a scalar.") ;
+        }
+        negPosRatio = mxGetPr(optarg)[0] ;
+        break ;
+
+      case opt_background_label :
+        if (!vlmxIsScalar(optarg)) {
+          vlmxError(VLMXE_IllegalArgument, "BACKGROUNDLABEL is not a scalar.") ;
+        }
+        backgroundLabel = (int)mxGetPr(optarg)[0] ;
+        break ;
+
+      case opt_ignore_x_boundary_boxes :
+        if (!vlmxIsScalar(optarg) &&
+            !(mxIsLogical(optarg) && mxGetNumberOfElements(optarg) == 1)) {
+          vlmxError(VLMXE_IllegalArgument, "IGNOREXBOUNDARYBOXES is not a logical scalar.") ;
+        }
+        ignoreBoundary = (bool)mxGetScalar(optarg) ;
+        break ;
+
+      case opt_num_threads :
+        if (!vlmxIsScalar(optarg)) {
+          vlmxError(VLMXE_IllegalArgument, "NUMTHREADS is not a scalar.") ;
+        }
+        numThreads = (int)mxGetPr(optarg)[0] ;
+        break ;
+
+      default:
+        break ;
+    }
+  }
+
+  vl::MexTensor confPreds(context) ;
+  confPreds.init(in[IN_CONF_PREDS]) ;
+
+  if (confPreds.getDeviceType() != vl::VLDT_CPU) {
+    vlmxError(VLMXE_IllegalArgument, "V must be a CPU array (use GATHER).") ;
+  }
+  if (numClasses < 1) {
+    vlmxError(VLMXE_IllegalArgument, "NUMCLASSES is not positive.") ;
+  }
+  if (backgroundLabel < 1 || backgroundLabel > numClasses) {
+    vlmxError(VLMXE_IllegalArgument, "BACKGROUNDLABEL is not a valid class.") ;
+  }
+
+  mxArray const *m = in[IN_MATCHES] ;
+  if (!mxIsStruct(m)) {
+    vlmxError(VLMXE_IllegalArgument, "M is not a struct array.") ;
+  }
+  int batchSize = mxGetNumberOfElements(m) ;
+  if (batchSize == 0 || confPreds.getNumElements() % ((size_t)batchSize * numClasses) != 0) {
+    vlmxError(VLMXE_IllegalArgument, "The number of elements of V is not a "
+              "multiple of NUMCLASSES * NUMEL(M).") ;
+  }
+  int numPriors = confPreds.getNumElements() / ((size_t)batchSize * numClasses) ;
+
+  // The positives of an image are the priors matched to any of its boxes
+  std::vector<std::vector<int> > positives(batchSize) ;
+  std::vector<std::vector<int> > ignored(batchSize) ;
+  std::vector<vl::impl::HardNegativeImage> images(batchSize) ;
+  for (int i = 0 ; i < batchSize ; ++i) {
+    mxArray const *idx = mxGetField(m, i, "idx") ;
+    if (idx == NULL || !mxIsCell(idx)) {
+      vlmxError(VLMXE_IllegalArgument, "M(%d).idx is not a cell array.", i + 1) ;
+    }
+    for (int g = 0 ; g < mxGetNumberOfElements(idx) ; ++g) {
+      appendIndices(mxGetCell(idx, g), numPriors, "idx", i, &positives[i]) ;
+    }
+    if (ignoreBoundary) {
+      appendIndices(mxGetField(m, i, "ignored"), numPriors, "ignored", i,
+                    &ignored[i]) ;
+    }
+    images[i].positives = positives[i].data() ;
+    images[i].numPositives = positives[i].size() ;
+    images[i].ignored = ignored[i].data() ;
+    images[i].numIgnored = ignored[i].size() ;
+  }
+
+  if (verbosity > 0) {
+    mexPrintf("vl_hardnegatives: numPriors: %d\n", numPriors) ;
+    mexPrintf("vl_hardnegatives: numClasses: %d\n", numClasses) ;
+    mexPrintf("vl_hardnegatives: batchSize: %d\n", batchSize) ;
+    mexPrintf("vl_hardnegatives: negPosRatio: %g\n", negPosRatio) ;
+    mexPrintf("vl_hardnegatives: backgroundLabel: %d\n", backgroundLabel) ;
+    mexPrintf("vl_hardnegatives: ignoreXBoundaryBoxes: %s\n",
+              ignoreBoundary ? "yes" : "no") ;
+    mexPrintf("vl_hardnegatives: numThreads: %d\n", numThreads) ;
+  }
+
+  /* -------------------------------------------------------------- */
+  /*                                                    Do the work */
+  /* -------------------------------------------------------------- */
+
+  std::vector<std::vector<int> > hardNegs(batchSize) ;
+  switch (confPreds.getDataType()) {
+    case vl::VLDT_Float :
+      vl::impl::mineHardNegativesBatch((float const*)confPreds.getMemory(),
+          numPriors, numClasses, backgroundLabel - 1, negPosRatio,
+          images.data(), batchSize, numThreads, hardNegs.data()) ;
+      break ;
+#ifdef ENABLE_DOUBLE
+    case vl::VLDT_Double :
+      vl::impl::mineHardNegativesBatch((double const*)confPreds.getMemory(),
+          numPriors, numClasses, backgroundLabel - 1, negPosRatio,
+          images.data(), batchSize, numThreads, hardNegs.data()) ;
+      break ;
+#endif
+    default:
+      vlmxError(VLMXE_IllegalArgument, "V has an unsupported data type.") ;
+  }
+
+  /* -------------------------------------------------------------- */
+  /*                                                         Finish */
+  /* -------------------------------------------------------------- */
+
+  mxArray *result = mxCreateCellMatrix(1, batchSize) ;
+  for (int i = 0 ; i < batchSize ; ++i) {
+    mxArray *imHardNegs = mxCreateDoubleMatrix(1, hardNegs[i].size(), mxREAL) ;
+    for (int k = 0 ; k < hardNegs[i].size() ; ++k) {
+      mxGetPr(imHardNegs)[k] = hardNegs[i][k] + 1 ; // MATLAB +1
+    }
+    mxSetCell(result, i, imHardNegs) ;
+  }
+  out[OUT_RESULT] = result ;
+}
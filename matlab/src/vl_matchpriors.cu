@@ -0,0 +1,252 @@
+// @file vl_matchpriors.cu
+// @brief Prior matching MEX wrapper
+// @author Samuel Albanie
+// @author Andrea Vedaldi
+/*
+Copyright (C) 2017 Samuel Albanie and Andrea Vedaldi.
+All rights reserved.
+
+This file is part of the VLFeat library and is made available under
+the terms of the BSD license (see the COPYING file).
+*/
+
+#include <bits/mexutils.h>
+#include <bits/datamex.hpp>
+#include "bits/impl/priormatcher.hpp"
+#include "bits/impl/parallel.hpp"
+
+#include <assert.h>
+#include <vector>
+
+/* option codes */
+enum {
+  opt_overlap_threshold = 0,
+  opt_ignore_x_boundary_boxes,
+  opt_num_threads,
+  opt_no_prior_cache,
+  opt_verbose,
+} ;
+
+/* options */
+VLMXOption  options [] = {
+  {"overlapThreshold",     1,   opt_overlap_threshold       },
+  {"ignoreXBoundaryBoxes", 1,   opt_ignore_x_boundary_boxes },
+  {"numThreads",           1,   opt_num_threads             },
+  {"NoPriorCache",         0,   opt_no_prior_cache          },
+  {"Verbose",              0,   opt_verbose                 },
+  {0,                      0,   0                           }
+} ;
+
+/* ---------------------------------------------------------------- */
+/*                                                          Context */
+/* ---------------------------------------------------------------- */
+
+vl::MexContext context ;
+
+/*
+ The grid over the priors is kept between calls, since the priors of a
+ model are the same for every batch. Entries are matched on the contents
+ of the priors, so a change of model simply causes a rebuild.
+ */
+vl::impl::PriorGridCache gridCache ;
+
+void atExit()
+{
+  gridCache.clear() ;
+  vl::impl::getThreadPool().shutdown() ;
+  context.clear() ;
+}
+
+/* ---------------------------------------------------------------- */
+/*                                                       MEX driver */
+/* ---------------------------------------------------------------- */
+
+enum {
+  IN_PRIORS = 0, IN_GT_BOXES, IN_END
+} ;
+
+enum {
+  OUT_RESULT = 0, OUT_END
+} ;
+
+void mexFunction(int nout, mxArray *out[],
+                 int nin, mxArray const *in[])
+{
+  double overlapThreshold = 0.5 ;
+  bool ignoreBoundary = false ;
+  int numThreads = 1 ;
+  bool usePriorCache = true ;
+  int verbosity = 0 ;
+  int opt ;
+  int next = IN_END ;
+  mxArray const *optarg ;
+
+  mexAtExit(atExit) ;
+
+  /* -------------------------------------------------------------- */
+  /*                                            Check the arguments */
+  /* -------------------------------------------------------------- */
+
+  if (nin < 2) {
+    mexErrMsgTxt("There are less than two arguments.") ;
+  }
+
+  while ((opt = vlmxNextOption (in, nin, options, &next, &optarg)) >= 0) {
+    switch (opt) {
+      case opt_verbose :
+        ++ verbosity ;
+        break ;
+
+      case opt_overlap_threshold :
+        if (!vlmxIsScalar(optarg)) {
+          vlmxError(VLMXE_IllegalArgument, "OVERLAPTHRESHOLD is not a scalar.") ;
+        }
+        overlapThreshold = mxGetPr(optarg)[0] ;
+        break ;
+
+      case opt_ignore_x_boundary_boxes :
+        if (!vlmxIsScalar(optarg) &&
+            !(mxIsLogical(optarg) && mxGetNumberOfElements(optarg) == 1)) {
+          vlmxError(VLMXE_IllegalArgument, "IGNOREXBOUNDARYBOXES is not a logical scalar.") ;
+        }
+        ignoreBoundary = (bool)mxGetScalar(optarg) ;
+        break ;
+
+      case opt_num_threads :
+        if (!vlmxIsScalar(optarg)) {
+          vlmxError(VLMXE_IllegalArgument, "NUMTHREADS is not a scalar.") ;
+        }
+        numThreads = (int)mxGetPr(optarg)[0] ;
+        break ;
+
+      case opt_no_prior_cache :
+        usePriorCache = false ;
+        break ;
+
+      default:
+        break ;
+    }
+  }
+
+  vl::MexTensor priors(context) ;
+  priors.init(in[IN_PRIORS]) ;
+  priors.reshape(4) ;
+
+  if (priors.getDeviceType() != vl::VLDT_CPU) {
+    vlmxError(VLMXE_IllegalArgument, "PRIORS must be a CPU array (use GATHER).") ;
+  }
+  if (priors.getDepth() < 2 || priors.getHeight() % 4 != 0) {
+    vlmxError(VLMXE_IllegalArgument, "PRIORS is not a 4*numPriors x 1 x 2 array of boxes and variances.") ;
+  }
+  int numPriors = priors.getHeight() / 4 ;
+
+  // Ground truth boxes may be single or double, and are copied (in double
+  // precision) as they are small
+  mxArray const *gt = in[IN_GT_BOXES] ;
+  if (!mxIsCell(gt)) {
+    vlmxError(VLMXE_IllegalArgument, "GT is not a cell array.") ;
+  }
+  int batchSize = mxGetNumberOfElements(gt) ;
+  std::vector<std::vector<double> > gtData(batchSize) ;
+  std::vector<double const*> gtBoxes(batchSize) ;
+  std::vector<int> numGtBoxes(batchSize) ;
+  for (int i = 0 ; i < batchSize ; ++i) {
+    mxArray const *boxes = mxGetCell(gt, i) ;
+    numGtBoxes[i] = 0 ;
+    if (boxes != NULL && !mxIsEmpty(boxes)) {
+      if (!(mxIsSingle(boxes) || mxIsDouble(boxes)) ||
+          mxGetNumberOfDimensions(boxes) != 2 || mxGetN(boxes) != 4) {
+        vlmxError(VLMXE_IllegalArgument, "GT{%d} is not a real N x 4 array.", i + 1) ;
+      }
+      numGtBoxes[i] = mxGetM(boxes) ;
+      gtData[i].resize(numGtBoxes[i] * 4) ;
+      for (int k = 0 ; k < numGtBoxes[i] * 4 ; ++k) {
+        gtData[i][k] = mxIsSingle(boxes) ? ((float const*)mxGetData(boxes))[k]
+                                         : ((double const*)mxGetData(boxes))[k] ;
+      }
+    }
+    gtBoxes[i] = gtData[i].data() ;
+  }
+
+  if (verbosity > 0) {
+    mexPrintf("vl_matchpriors: numPriors: %d\n", numPriors) ;
+    mexPrintf("vl_matchpriors: batchSize: %d\n", batchSize) ;
+    mexPrintf("vl_matchpriors: overlapThreshold: %g\n", overlapThreshold) ;
+    mexPrintf("vl_matchpriors: ignoreXBoundaryBoxes: %s\n",
+              ignoreBoundary ? "yes" : "no") ;
+    mexPrintf("vl_matchpriors: numThreads: %d\n", numThreads) ;
+    mexPrintf("vl_matchpriors: priorCache: %s\n",
+              usePriorCache ? "yes" : "no") ;
+  }
+
+  /* -------------------------------------------------------------- */
+  /*                                                    Do the work */
+  /* -------------------------------------------------------------- */
+
+  vl::impl::PriorGrid localGrid ;
+  vl::impl::PriorGrid const *grid = &localGrid ;
+  bool isFloat = (priors.getDataType() == vl::VLDT_Float) ;
+  if (usePriorCache) {
+    grid = isFloat ? &gridCache.get((float const*)priors.getMemory(), numPriors)
+                   : &gridCache.get((double const*)priors.getMemory(), numPriors) ;
+  } else if (isFloat) {
+    localGrid.init((float const*)priors.getMemory(), numPriors) ;
+  } else {
+    localGrid.init((double const*)priors.getMemory(), numPriors) ;
+  }
+
+  // the output arrays are created before the (multithreaded) matching,
+  // which writes the overlaps in place
+  char const *fields [] = { "idx", "ignored", "overlaps" } ;
+  mxArray *result = mxCreateStructArray(mxGetNumberOfDimensions(gt),
+                                        mxGetDimensions(gt), 3, fields) ;
+  std::vector<double*> overlaps(batchSize) ;
+  for (int i = 0 ; i < batchSize ; ++i) {
+    mxArray *imOverlaps = mxCreateDoubleMatrix(numGtBoxes[i], numPriors, mxREAL) ;
+    overlaps[i] = mxGetPr(imOverlaps) ;
+    mxSetField(result, i, "overlaps", imOverlaps) ;
+  }
+
+  std::vector<vl::impl::PriorMatches> matches(batchSize) ;
+  vl::impl::matchPriorsBatch(*grid, gtBoxes.data(), numGtBoxes.data(),
+                             batchSize, overlapThreshold, ignoreBoundary,
+                             overlaps.data(), numThreads, matches.data()) ;
+
+  /* -------------------------------------------------------------- */
+  /*                                                         Finish */
+  /* -------------------------------------------------------------- */
+
+  // As in matchPriors.m, `ignored` lists the boundary priors (1-based) if
+  // they are ignored and is a numPriors x 1 vector of zeros otherwise
+  mxArray *ignored ;
+  if (ignoreBoundary) {
+    std::vector<int> boundary ;
+    for (int p = 0 ; p < numPriors ; ++p) {
+      if (grid->isBoundary(p)) { boundary.push_back(p) ; }
+    }
+    ignored = mxCreateDoubleMatrix(boundary.size(), 1, mxREAL) ;
+    for (int k = 0 ; k < boundary.size() ; ++k) {
+      mxGetPr(ignored)[k] = boundary[k] + 1 ;
+    }
+  } else {
+    ignored = mxCreateDoubleMatrix(numPriors, 1, mxREAL) ;
+  }
+
+  for (int i = 0 ; i < batchSize ; ++i) {
+    mxArray *idx = mxCreateCellMatrix(1, numGtBoxes[i]) ;
+    for (int g = 0 ; g < numGtBoxes[i] ; ++g) {
+      std::vector<int> const &priorIdx = matches[i].idx[g] ;
+      mxArray *gtIdx = mxCreateDoubleMatrix(1, priorIdx.size(), mxREAL) ;
+      for (int k = 0 ; k < priorIdx.size() ; ++k) {
+        mxGetPr(gtIdx)[k] = priorIdx[k] + 1 ; // MATLAB +1
+      }
+      mxSetCell(idx, g, gtIdx) ;
+    }
+    mxSetField(result, i, "idx", idx) ;
+    mxSetField(result, i, "ignored", (i == 0) ? ignored : mxDuplicateArray(ignored)) ;
+  }
+  if (batchSize == 0) {
+    mxDestroyArray(ignored) ;
+  }
+  out[OUT_RESULT] = result ;
+}
@@ -0,0 +1,400 @@
+// @file vl_multiboxloss.cu
+// @brief Fused multibox loss MEX wrapper
+// @author Samuel Albanie
+// @author Andrea Vedaldi
+/*
+Copyright (C) 2017 Samuel Albanie and Andrea Vedaldi.
+All rights reserved.
+
+This file is part of the VLFeat library and is made available under
+the terms of the BSD license (see the COPYING file).
+*/
+
+#include <bits/mexutils.h>
+#include <bits/datamex.hpp>
+#include "bits/nnmultiboxloss.hpp"
+#include "bits/impl/multiboxloss.hpp"
+#include "bits/impl/priorcache.hpp"
+#include "bits/impl/parallel.hpp"
+
+#include <assert.h>
+#include <vector>
+
+/* option codes */
+enum {
+  opt_num_classes = 0,
+  opt_background_label,
+  opt_loc_weight,
+  opt_sigma,
+  opt_num_threads,
+  opt_no_prior_cache,
+  opt_verbose,
+} ;
+
+/* options */
+VLMXOption  options [] = {
+  {"numClasses",           1,   opt_num_classes             },
+  {"backgroundLabel",      1,   opt_background_label        },
+  {"locWeight",            1,   opt_loc_weight              },
+  {"sigma",                1,   opt_sigma                   },
+  {"numThreads",           1,   opt_num_threads             },
+  {"NoPriorCache",         0,   opt_no_prior_cache          },
+  {"Verbose",              0,   opt_verbose                 },
+  {0,                      0,   0                           }
+} ;
+
+/* ---------------------------------------------------------------- */
+/*                                                          Context */
+/* ---------------------------------------------------------------- */
+
+vl::MexContext context ;
+
+/*
+ As for vl_nnmultiboxdetector, the prior geometry is kept between calls.
+ */
+vl::impl::PriorCache priorCache ;
+
+void atExit()
+{
+  priorCache.clear() ;
+  vl::impl::getThreadPool().shutdown() ;
+  context.clear() ;
+}
+
+/* ---------------------------------------------------------------- */
+/*                                                           Useful */
+/* ---------------------------------------------------------------- */
+
+// Append the (1-based) indices stored in a numeric array to a list of
+// 0-based indices, checking that they lie in [1, maxIndex]
+static void appendIndices(mxArray const *array, int maxIndex,
+                          char const *name, int image,
+                          std::vector<int> *indices)
+{
+  if (array == NULL || mxIsEmpty(array)) {
+    return ;
+  }
+  if (!(mxIsDouble(array) || mxIsSingle(array))) {
+    vlmxError(VLMXE_IllegalArgument, "%s{%d} does not contain single or "
+              "double values.", name, image + 1) ;
+  }
+  size_t n = mxGetNumberOfElements(array) ;
+  for (size_t k = 0 ; k < n ; ++k) {
+    double x = mxIsSingle(array) ? ((float const*)mxGetData(array))[k]
+                                 : ((double const*)mxGetData(array))[k] ;
+    if (!(x >= 1 && x <= maxIndex)) {
+      vlmxError(VLMXE_IllegalArgument, "%s{%d} contains an out of range "
+                "value.", name, image + 1) ;
+    }
+    indices->push_back((int)x - 1) ;
+  }
+}
+
+// The loss is computed on the CPU: an input held on the GPU is copied to
+// the host, and the outputs are moved back to the GPU with toGpu()
+static mxArray const * gatherArray(mxArray const *array)
+{
+  if (!mxIsClass(array, "gpuArray")) {
+    return array ;
+  }
+  mxArray *input = const_cast<mxArray*>(array) ;
+  mxArray *gathered ;
+  mexCallMATLAB(1, &gathered, 1, &input, "gather") ;
+  return gathered ;
+}
+
+static mxArray * toGpu(mxArray *array)
+{
+  mxArray *moved ;
+  mexCallMATLAB(1, &moved, 1, &array, "gpuArray") ;
+  mxDestroyArray(array) ;
+  return moved ;
+}
+
+/* ---------------------------------------------------------------- */
+/*                                                       MEX driver */
+/* ---------------------------------------------------------------- */
+
+enum {
+  IN_LOC_PREDS = 0, IN_CONF_PREDS, IN_PRIORS, IN_GT_BOXES, IN_GT_LABELS,
+  IN_MATCHES, IN_HARD_NEGS, IN_DEROUTPUT, IN_END
+} ;
+
+enum {
+  OUT_RESULT = 0, OUT_DERLOCPREDS, OUT_DERCONFPREDS, OUT_END
+} ;
+
+void mexFunction(int nout, mxArray *out[],
+                 int nin, mxArray const *in[])
+{
+  int numClasses = 21 ;
+  int backgroundLabel = 1 ;
+  float locWeight = 1 ;
+  float sigma = 1 ;
+  int numThreads = 1 ;
+  bool usePriorCache = true ;
+  bool backMode = false ;
+  int verbosity = 0 ;
+  int opt ;
+  int next = IN_DEROUTPUT ;
+  mxArray const *optarg ;
+
+  mexAtExit(atExit) ;
+
+  /* -------------------------------------------------------------- */
+  /*                                            Check the arguments */
+  /* -------------------------------------------------------------- */
+
+  if (nin < IN_DEROUTPUT) {
+    mexErrMsgTxt("There are less than seven arguments.") ;
+  }
+  if (nin > IN_DEROUTPUT) {
+    backMode = !vlmxIsString(in[IN_DEROUTPUT], -1) ;
+  }
+  next = backMode ? IN_END : IN_DEROUTPUT ;
+
+  while ((opt = vlmxNextOption (in, nin, options, &next, &optarg)) >= 0) {
+    switch (opt) {
+      case opt_verbose :
+        ++ verbosity ;
+        break ;
+
+      case opt_num_classes :
+        if (!vlmxIsScalar(optarg)) {
+          vlmxError(VLMXE_IllegalArgument, "NUMCLASSES is not a scalar.") ;
+        }
+        numClasses = (int)mxGetPr(optarg)[0] ;
+        break ;
+
+      case opt_background_label :
+        if (!vlmxIsScalar(optarg)) {
+          vlmxError(VLMXE_IllegalArgument, "BACKGROUNDLABEL is not a scalar.") ;
+        }
+        backgroundLabel = (int)mxGetPr(optarg)[0] ;
+        break ;
+
+      case opt_loc_weight :
+        if (!vlmxIsScalar(optarg)) {
+          vlmxError(VLMXE_IllegalArgument, "LOCWEIGHT is not a scalar.") ;
+        }
+        locWeight = (float)mxGetPr(optarg)[0] ;
+        break ;
+
+      case opt_sigma :
+        if (!vlmxIsScalar(optarg) || mxGetPr(optarg)[0] <= 0) {
+          vlmxError(VLMXE_IllegalArgument, "SIGMA is not a positive scalar.") ;
+        }
+        sigma = (float)mxGetPr(optarg)[0] ;
+        break ;
+
+      case opt_num_threads :
+        if (!vlmxIsScalar(optarg)) {
+          vlmxError(VLMXE_IllegalArgument, "NUMTHREADS is not a scalar.") ;
+        }
+        numThreads = (int)mxGetPr(optarg)[0] ;
+        break ;
+
+      case opt_no_prior_cache :
+        usePriorCache = false ;
+        break ;
+
+      default:
+        break ;
+    }
+  }
+
+  vl::MexTensor locPreds(context) ;
+  vl::MexTensor confPreds(context) ;
+  vl::MexTensor priors(context) ;
+
+  bool onGpu = mxIsClass(in[IN_LOC_PREDS], "gpuArray") ;
+  locPreds.init(gatherArray(in[IN_LOC_PREDS])) ;
+  locPreds.reshape(4) ;
+  int batchSize = locPreds.getSize() ;
+
+  confPreds.init(gatherArray(in[IN_CONF_PREDS])) ;
+  confPreds.reshape(4) ;
+
+  priors.init(gatherArray(in[IN_PRIORS])) ;
+  priors.reshape(4) ;
+
+  /* check for GPU/data class consistency */
+  if (!vl::areCompatible(locPreds, confPreds)) {
+    vlmxError(VLMXE_IllegalArgument, "X and V do not have compatible formats.") ;
+  }
+  if (!vl::areCompatible(locPreds, priors)) {
+    vlmxError(VLMXE_IllegalArgument, "X and P do not have compatible formats.") ;
+  }
+  if (backgroundLabel < 1 || backgroundLabel > numClasses) {
+    vlmxError(VLMXE_IllegalArgument, "BACKGROUNDLABEL is not a valid class.") ;
+  }
+
+  /* check for appropriate number of prior predictions */
+  int numPriors = priors.getHeight() / 4 ;
+  if ((numPriors != (confPreds.getDepth() / numClasses)) | (numPriors != (locPreds.getDepth() / 4))) {
+    vlmxError(VLMXE_IllegalArgument, "X and V do not match the given set of priors.") ;
+  }
+  if (priors.getDepth() != 2) {
+    vlmxError(VLMXE_IllegalArgument, "P dim 3 should have a depth of 2 (containing variances)") ;
+  }
+
+  // The targets of each image: the matched priors (and the ground truth
+  // box each is matched to), the hard negatives and the ground truth
+  mxArray const *gt = in[IN_GT_BOXES] ;
+  mxArray const *labels = in[IN_GT_LABELS] ;
+  mxArray const *m = in[IN_MATCHES] ;
+  mxArray const *n = in[IN_HARD_NEGS] ;
+  if (!mxIsCell(gt) || mxGetNumberOfElements(gt) != batchSize ||
+      !mxIsCell(labels) || mxGetNumberOfElements(labels) != batchSize ||
+      !mxIsCell(n) || mxGetNumberOfElements(n) != batchSize) {
+    vlmxError(VLMXE_IllegalArgument, "GT, L and N are not cell arrays with "
+              "an element for each image.") ;
+  }
+  if (!mxIsStruct(m) || mxGetNumberOfElements(m) != batchSize) {
+    vlmxError(VLMXE_IllegalArgument, "M is not a struct array with an "
+              "element for each image.") ;
+  }
+
+  std::vector<std::vector<int> > positives(batchSize) ;
+  std::vector<std::vector<int> > assignments(batchSize) ;
+  std::vector<std::vector<int> > negatives(batchSize) ;
+  std::vector<std::vector<double> > gtBoxes(batchSize) ;
+  std::vector<std::vector<int> > gtLabels(batchSize) ;
+  std::vector<vl::impl::MultiboxLossImage> images(batchSize) ;
+  for (int i = 0 ; i < batchSize ; ++i) {
+    mxArray const *boxes = mxGetCell(gt, i) ;
+    int numGtBoxes = 0 ;
+    if (boxes != NULL && !mxIsEmpty(boxes)) {
+      if (!(mxIsSingle(boxes) || mxIsDouble(boxes)) ||
+          mxGetNumberOfDimensions(boxes) != 2 || mxGetN(boxes) != 4) {
+        vlmxError(VLMXE_IllegalArgument, "GT{%d} is not a real N x 4 array.", i + 1) ;
+      }
+      numGtBoxes = mxGetM(boxes) ;
+      gtBoxes[i].resize(numGtBoxes * 4) ;
+      for (int k = 0 ; k < numGtBoxes * 4 ; ++k) {
+        gtBoxes[i][k] = mxIsSingle(boxes) ? ((float const*)mxGetData(boxes))[k]
+                                          : ((double const*)mxGetData(boxes))[k] ;
+      }
+    }
+    appendIndices(mxGetCell(labels, i), numClasses, "L", i, &gtLabels[i]) ;
+    if (gtLabels[i].size() != numGtBoxes) {
+      vlmxError(VLMXE_IllegalArgument, "L{%d} does not have a label for each "
+                "box of GT{%d}.", i + 1, i + 1) ;
+    }
+
+    mxArray const *idx = mxGetField(m, i, "idx") ;
+    if (idx == NULL || !mxIsCell(idx) || mxGetNumberOfElements(idx) != numGtBoxes) {
+      vlmxError(VLMXE_IllegalArgument, "M(%d).idx is not a cell array with an "
+                "element for each box of GT{%d}.", i + 1, i + 1) ;
+    }
+    for (int g = 0 ; g < numGtBoxes ; ++g) {
+      appendIndices(mxGetCell(idx, g), numPriors, "M.idx", i, &positives[i]) ;
+      assignments[i].resize(positives[i].size(), g) ;
+    }
+    appendIndices(mxGetCell(n, i), numPriors, "N", i, &negatives[i]) ;
+
+    images[i].positives = positives[i].data() ;
+    images[i].assignments = assignments[i].data() ;
+    images[i].numPositives = positives[i].size() ;
+    images[i].negatives = negatives[i].data() ;
+    images[i].numNegatives = negatives[i].size() ;
+    images[i].gtBoxes = gtBoxes[i].data() ;
+    images[i].gtLabels = gtLabels[i].data() ;
+    images[i].numGtBoxes = numGtBoxes ;
+  }
+
+  /* Create output buffers */
+  vl::DataType dataType = locPreds.getDataType() ;
+  vl::MexTensor derLocPreds(context) ;
+  vl::MexTensor derConfPreds(context) ;
+  bool computeDerivatives = backMode || nout > OUT_DERLOCPREDS ;
+  if (computeDerivatives) {
+    derLocPreds.initWithZeros(vl::VLDT_CPU, dataType, locPreds) ;
+    derConfPreds.initWithZeros(vl::VLDT_CPU, dataType, confPreds) ;
+  }
+
+  if (verbosity > 0) {
+    mexPrintf("vl_multiboxloss: mode cpu; %s\n", backMode ? "backward" : "forward") ;
+    mexPrintf("vl_multiboxloss: numClasses: %d\n", numClasses) ;
+    mexPrintf("vl_multiboxloss: backgroundLabel: %d\n", backgroundLabel) ;
+    mexPrintf("vl_multiboxloss: locWeight: %g\n", locWeight) ;
+    mexPrintf("vl_multiboxloss: sigma: %g\n", sigma) ;
+    mexPrintf("vl_multiboxloss: numThreads: %d\n", numThreads) ;
+    mexPrintf("vl_multiboxloss: priorCache: %s\n", usePriorCache ? "yes" : "no") ;
+    vl::print("vl_multiboxloss: locPreds: ", locPreds) ;
+    vl::print("vl_multiboxloss: confPreds: ", confPreds) ;
+  }
+
+  /* -------------------------------------------------------------- */
+  /*                                                    Do the work */
+  /* -------------------------------------------------------------- */
+
+  vl::ErrorCode error ;
+  vl::impl::MultiboxLossValues values ;
+  if (backMode) {
+    mxArray const *derOutput = gatherArray(in[IN_DEROUTPUT]) ;
+    if (!vlmxIsScalar(derOutput)) {
+      vlmxError(VLMXE_IllegalArgument, "DZDY is not a scalar.") ;
+    }
+    error = vl::nnmultiboxloss_backward(context,
+                                        derLocPreds,
+                                        derConfPreds,
+                                        locPreds,
+                                        confPreds,
+                                        priors,
+                                        images.data(),
+                                        mxGetScalar(derOutput),
+                                        numClasses,
+                                        backgroundLabel - 1,
+                                        locWeight,
+                                        sigma,
+                                        numThreads,
+                                        usePriorCache ? &priorCache : NULL) ;
+  } else {
+    error = vl::nnmultiboxloss_forward(context,
+                                       &values,
+                                       derLocPreds,
+                                       derConfPreds,
+                                       locPreds,
+                                       confPreds,
+                                       priors,
+                                       images.data(),
+                                       numClasses,
+                                       backgroundLabel - 1,
+                                       locWeight,
+                                       sigma,
+                                       numThreads,
+                                       usePriorCache ? &priorCache : NULL) ;
+  }
+
+  /* -------------------------------------------------------------- */
+  /*                                                         Finish */
+  /* -------------------------------------------------------------- */
+
+  if (error != vl::VLE_Success) {
+    mexErrMsgTxt(context.getLastErrorMessage().c_str()) ;
+  }
+  if (backMode) {
+    out[OUT_RESULT] = derLocPreds.relinquish() ;
+    out[OUT_RESULT + 1] = derConfPreds.relinquish() ;
+  } else {
+    bool isFloat = (dataType == vl::VLDT_Float) ;
+    out[OUT_RESULT] = mxCreateNumericMatrix(1, 1, isFloat ? mxSINGLE_CLASS
+                                                          : mxDOUBLE_CLASS, mxREAL) ;
+    if (isFloat) {
+      ((float*)mxGetData(out[OUT_RESULT]))[0] = (float)values.total ;
+    } else {
+      ((double*)mxGetData(out[OUT_RESULT]))[0] = values.total ;
+    }
+    if (computeDerivatives) {
+      out[OUT_DERLOCPREDS] = derLocPreds.relinquish() ;
+      out[OUT_DERCONFPREDS] = derConfPreds.relinquish() ;
+    }
+  }
+  if (onGpu) {
+    int numOutputs = backMode ? 2 : (computeDerivatives ? OUT_END : 1) ;
+    for (int o = 0 ; o < numOutputs ; ++o) {
+      out[o] = toGpu(out[o]) ;
+    }
+  }
+}
@@ -13,12 +13,18 @@ the terms of the BSD license (see the COPYING file).
 #include <bits/mexutils.h>
 #include <bits/datamex.hpp>
 #include "bits/nnmultiboxdetector.hpp"
+#include "bits/impl/priorcache.hpp"
+#include "bits/impl/multiboxstats.hpp"
+#include "bits/impl/multiboxworkspace.hpp"
+#include "bits/impl/parallel.hpp"
 
 #if ENABLE_GPU
 #include <bits/datacu.hpp>
 #endif
 
 #include <assert.h>
+#include <algorithm>
+#include <vector>
 
 /* option codes */
 enum {
@@ -28,6 +34,17 @@ enum {
   opt_nms_thresh,
   opt_conf_thresh,
   opt_background_label,
+  opt_num_threads,
+  opt_lazy_decode,
+  opt_compact,
+  opt_batched_nms,
+  opt_class_agnostic,
+  opt_no_prior_cache,
+  opt_loc_scale,
+  opt_loc_zero_point,
+  opt_conf_scale,
+  opt_conf_zero_point,
+  opt_workspace_limit,
   opt_verbose,
 } ;
 
@@ -39,6 +56,17 @@ VLMXOption  options [] = {
   {"nmsThresh",       1,   opt_nms_thresh       },
   {"confThresh",      1,   opt_conf_thresh      },
   {"backgroundLabel", 1,   opt_background_label },
+  {"numThreads",      1,   opt_num_threads      },
+  {"lazyDecode",      1,   opt_lazy_decode      },
+  {"compact",         1,   opt_compact          },
+  {"batchedNMS",      1,   opt_batched_nms      },
+  {"classAgnostic",   1,   opt_class_agnostic   },
+  {"NoPriorCache",    0,   opt_no_prior_cache   },
+  {"locScale",        1,   opt_loc_scale        },
+  {"locZeroPoint",    1,   opt_loc_zero_point   },
+  {"confScale",       1,   opt_conf_scale       },
+  {"confZeroPoint",   1,   opt_conf_zero_point  },
+  {"WorkspaceLimit",  1,   opt_workspace_limit  },
   {"Verbose",         0,   opt_verbose          },
   {0,                 0,   0                    }
 } ;
@@ -49,12 +77,32 @@ VLMXOption  options [] = {
 
 vl::MexContext context ;
 
+/*
+ Prior tables are kept between calls, since the priors of a model are
+ the same on every forward pass. Entries are matched on the contents of
+ the priors, so a change of model simply causes a rebuild.
+ */
+vl::impl::PriorCache priorCache ;
+
+/*
+ The intermediate buffers of the detector (decoded boxes, permuted
+ scores, candidate lists, and the scratch of NMS and of the keepTopK
+ merge) and of the multiscale merge are kept between calls as well, so
+ that repeated calls of a similar size do not allocate.
+ */
+vl::impl::MultiboxWorkspace workspace ;
+
 /*
  Resetting the context here resolves a crash when MATLAB quits and
  the ~Context function is implicitly called on unloading the MEX file.
+ The prior cache and the workspace are released, and the threads of the
+ pool joined, at the same time (e.g. on `clear mex`).
  */
 void atExit()
 {
+  priorCache.clear() ;
+  workspace.release() ;
+  vl::impl::getThreadPool().shutdown() ;
   context.clear() ;
 }
 
@@ -67,33 +115,216 @@ enum {
 } ;
 
 enum {
-  OUT_RESULT = 0, OUT_END
+  OUT_RESULT = 0, OUT_COUNTS, OUT_STATS, OUT_END
 } ;
 
+/*
+ Convert the timings and counters of a forward pass to a structure with
+ a field `time` (the seconds spent in each stage, and in total) and a
+ numClasses x batchSize array for each counter.
+ */
+mxArray * statsToArray(vl::impl::MultiboxStats const &stats)
+{
+  char const *timeFields [vl::impl::vlMultiboxNumStages + 1] ;
+  for (int s = 0 ; s < vl::impl::vlMultiboxNumStages ; ++s) {
+    timeFields[s] = vl::impl::multiboxStageName(s) ;
+  }
+  timeFields[vl::impl::vlMultiboxNumStages] = "total" ;
+  mxArray *time = mxCreateStructMatrix(1, 1, vl::impl::vlMultiboxNumStages + 1,
+                                       timeFields) ;
+  for (int s = 0 ; s < vl::impl::vlMultiboxNumStages ; ++s) {
+    mxSetFieldByNumber(time, 0, s, mxCreateDoubleScalar(stats.seconds[s])) ;
+  }
+  mxSetFieldByNumber(time, 0, vl::impl::vlMultiboxNumStages,
+                     mxCreateDoubleScalar(stats.total())) ;
+
+  char const *fields [] = {"time", "numCandidates", "numRanked", "numKept",
+                           "numOutput", "numOverlaps"} ;
+  mxArray *array = mxCreateStructMatrix(1, 1, 6, fields) ;
+  mxSetFieldByNumber(array, 0, 0, time) ;
+  std::vector<int> const *counters [] = {&stats.numCandidates, 
+                                         &stats.numRanked, &stats.numKept, 
+                                         &stats.numOutput} ;
+  for (int f = 0 ; f < 5 ; ++f) {
+    mxArray *counter = mxCreateDoubleMatrix(stats.numClasses, stats.batchSize, 
+                                            mxREAL) ;
+    double *data = mxGetPr(counter) ;
+    for (size_t k = 0 ; k < (size_t)stats.numClasses * stats.batchSize ; ++k) {
+      data[k] = (f < 4) ? (*counters[f])[k] : (double)stats.numOverlaps[k] ;
+    }
+    mxSetFieldByNumber(array, 0, f + 1, counter) ;
+  }
+  return array ;
+}
+
+/*
+ Predictions in reduced precision are passed to the detector as they
+ are: uint16 arrays hold IEEE half floats (e.g. the bit patterns of
+ MATLAB `half` values) and uint8 arrays values quantized with a scale
+ and zero point.
+ */
+bool isReducedPrecision(mxArray const *array)
+{
+  return mxGetClassID(array) == mxUINT16_CLASS || 
+         mxGetClassID(array) == mxUINT8_CLASS ;
+}
+
+/*
+ Describe the predictions ARRAY (a 1 x 1 x DEPTH x N array of UINT16,
+ UINT8 or CPU SINGLE values) for the reduced precision detector.
+ */
+void initPreds(vl::MultiboxPreds *preds, size_t *depth, size_t *batchSize,
+               mxArray const *array, char const *name, 
+               float scale, float zeroPoint)
+{
+  switch (mxGetClassID(array)) {
+    case mxUINT16_CLASS : preds->type = vl::vlMultiboxPredHalf ; break ;
+    case mxUINT8_CLASS : preds->type = vl::vlMultiboxPredUInt8 ; break ;
+    case mxSINGLE_CLASS : preds->type = vl::vlMultiboxPredNative ; break ;
+    default:
+      vlmxError(VLMXE_IllegalArgument, 
+                "%s is not a UINT16, UINT8 or (CPU) SINGLE array.", name) ;
+  }
+  if (mxIsComplex(array)) {
+    vlmxError(VLMXE_IllegalArgument, "%s is complex.", name) ;
+  }
+  mwSize const *dimensions = mxGetDimensions(array) ;
+  *batchSize = (mxGetNumberOfDimensions(array) >= 4) ? dimensions[3] : 1 ;
+  *depth = (*batchSize > 0) ? mxGetNumberOfElements(array) / *batchSize : 0 ;
+  preds->data = mxGetData(array) ;
+  preds->scale = scale ;
+  preds->zeroPoint = zeroPoint ;
+}
+
+/*
+ Merge the fixed size detections of a batch computed at several scales
+ (the cell array PREDS) into keepTopK x 6 x 1 x batchSize detections. If
+ keepTopK is negative, the height of the first input is used.
+ */
+void mergeScales(int nout, mxArray *out[], mxArray const *preds,
+                 int keepTopK, float nmsThresh, int numThreads, 
+                 int verbosity)
+{
+  if (!mxIsCell(preds) || mxGetNumberOfElements(preds) == 0) {
+    vlmxError(VLMXE_IllegalArgument, "PREDS is not a non-empty cell array.") ;
+  }
+  int numInputs = (int)mxGetNumberOfElements(preds) ;
+  std::vector<vl::Tensor> inputs ;
+  for (int s = 0 ; s < numInputs ; ++s) {
+    mxArray const *array = mxGetCell(preds, s) ;
+    if (!array || (!mxIsSingle(array) && !mxIsDouble(array)) 
+        || mxIsComplex(array)) {
+      vlmxError(VLMXE_IllegalArgument, 
+                "PREDS{%d} is not a real SINGLE or DOUBLE array.", s + 1) ;
+    }
+    vl::MexTensor input(context) ;
+    input.init(array) ;
+    input.reshape(4) ;
+    if (input.getWidth() != 6 || input.getDepth() != 1) {
+      vlmxError(VLMXE_IllegalArgument, 
+                "PREDS{%d} is not a K x 6 x 1 x N array.", s + 1) ;
+    }
+    if (s > 0 && (input.getDataType() != inputs[0].getDataType() ||
+                  input.getSize() != inputs[0].getSize())) {
+      vlmxError(VLMXE_IllegalArgument, 
+                "PREDS{%d} does not match the class or batch size of PREDS{1}.", 
+                s + 1) ;
+    }
+    inputs.push_back(input) ;
+  }
+  if (keepTopK < 0) {
+    keepTopK = inputs[0].getHeight() ;
+  }
+  size_t batchSize = inputs[0].getSize() ;
+  vl::DataType dataType = inputs[0].getDataType() ;
+
+  vl::MexTensor output(context) ;
+  vl::MexTensor counts(context) ;
+  output.initWithZeros(vl::VLDT_CPU, dataType, 
+                       vl::TensorShape(keepTopK, 6, 1, batchSize)) ;
+  if (nout > OUT_COUNTS) {
+    counts.init(vl::VLDT_CPU, dataType, vl::TensorShape(1, batchSize, 1, 1)) ;
+  }
+
+  if (verbosity > 0) {
+    mexPrintf("vl_multiboxdetector: merge of %d scales\n", numInputs) ;
+    mexPrintf("vl_multiboxdetector: keepTopK: %d\n", keepTopK) ;
+    mexPrintf("vl_multiboxdetector: nmsThresh: %f\n", nmsThresh) ;
+    mexPrintf("vl_multiboxdetector: numThreads: %d\n", numThreads) ;
+    vl::print("vl_multiboxdetector: output: ", output) ;
+  }
+
+  vl::ErrorCode error ;
+  error = vl::nnmultiboxdetector_merge(context, output, counts, 
+                                       inputs.data(), numInputs, 
+                                       nmsThresh, numThreads, &workspace) ;
+  if (error != vl::VLE_Success) {
+    mexErrMsgTxt(context.getLastErrorMessage().c_str()) ;
+  }
+  out[OUT_RESULT] = output.relinquish() ;
+  if (nout > OUT_COUNTS) {
+    out[OUT_COUNTS] = counts.relinquish() ;
+  }
+}
+
 void mexFunction(int nout, mxArray *out[],
                  int nin, mxArray const *in[])
 {
   int nmsTopK = 400 ;
   int keepTopK = 200 ;
+  bool keepTopKSet = false ;
   int numClasses = 21 ;
   float nmsThresh = 0.45 ;
   float confThresh = 0.01 ;
   int backgroundLabel = 1 ;
+  int numThreads = 1 ;
+  bool lazyDecode = true ;
+  bool compact = false ;
+  bool batchedNMS = false ;
+  bool classAgnostic = false ;
+  bool usePriorCache = true ;
+  float locScale = 1 ;
+  float locZeroPoint = 0 ;
+  float confScale = 1 ;
+  float confZeroPoint = 0 ;
+  size_t workspaceLimit = (size_t)-1 ;
   int verbosity = 0 ;
   int opt ;
   int next = IN_END ;
   mxArray const *optarg ;
 
+  mexAtExit(atExit) ;
+
   /* -------------------------------------------------------------- */
   /*                                            Check the arguments */
   /* -------------------------------------------------------------- */
 
-  if (nin < 3) {
-    mexErrMsgTxt("There are less than three arguments.") ;
-  }
+  // vl_nnmultiboxdetector('merge', PREDS, ...) merges multiscale outputs
+  // and vl_nnmultiboxdetector('release') frees the workspace
+  bool mergeMode = (nin >= 1 && vlmxIsString(in[0], -1)) ;
+  if (mergeMode) {
+    if (vlmxCompareToStringI(in[0], "release") == 0) {
+      if (nin > 1 || nout > 0) {
+        vlmxError(VLMXE_IllegalArgument, "The release mode takes no other argument.") ;
+      }
+      workspace.release() ;
+      return ;
+    }
+    if (vlmxCompareToStringI(in[0], "merge") != 0) {
+      vlmxError(VLMXE_IllegalArgument, "Unknown mode (only 'merge' and 'release' are supported).") ;
+    }
+    if (nin < 2) {
+      mexErrMsgTxt("There are less than two arguments.") ;
+    }
+    next = 2 ;
+  } else {
+    if (nin < 3) {
+      mexErrMsgTxt("There are less than three arguments.") ;
+    }
 
-  // backwards mode is not supported
-  next = 3 ;
+    // backwards mode is not supported
+    next = 3 ;
+  }
 
   while ((opt = vlmxNextOption (in, nin, options, &next, &optarg)) >= 0) {
     switch (opt) {
@@ -113,6 +344,7 @@ void mexFunction(int nout, mxArray *out[],
           vlmxError(VLMXE_IllegalArgument, "KEEPTOPK is not a scalar.") ;
         }
         keepTopK = (int)mxGetPr(optarg)[0] ;
+        keepTopKSet = true ;
         break ;
 
       case opt_num_classes :
@@ -143,39 +375,171 @@ void mexFunction(int nout, mxArray *out[],
         backgroundLabel = (float)mxGetPr(optarg)[0] ;
         break ;
 
+      case opt_num_threads :
+        if (!vlmxIsScalar(optarg)) {
+          vlmxError(VLMXE_IllegalArgument, "NUMTHREADS is not a scalar.") ;
+        }
+        numThreads = (int)mxGetPr(optarg)[0] ;
+        break ;
+
+      case opt_lazy_decode :
+        if (!vlmxIsScalar(optarg) && 
+            !(mxIsLogical(optarg) && mxGetNumberOfElements(optarg) == 1)) {
+          vlmxError(VLMXE_IllegalArgument, "LAZYDECODE is not a logical scalar.") ;
+        }
+        lazyDecode = (bool)mxGetScalar(optarg) ;
+        break ;
+
+      case opt_compact :
+        if (!vlmxIsScalar(optarg) && 
+            !(mxIsLogical(optarg) && mxGetNumberOfElements(optarg) == 1)) {
+          vlmxError(VLMXE_IllegalArgument, "COMPACT is not a logical scalar.") ;
+        }
+        compact = (bool)mxGetScalar(optarg) ;
+        break ;
+
+      case opt_batched_nms :
+        if (!vlmxIsScalar(optarg) && 
+            !(mxIsLogical(optarg) && mxGetNumberOfElements(optarg) == 1)) {
+          vlmxError(VLMXE_IllegalArgument, "BATCHEDNMS is not a logical scalar.") ;
+        }
+        batchedNMS = (bool)mxGetScalar(optarg) ;
+        break ;
+
+      case opt_class_agnostic :
+        if (!vlmxIsScalar(optarg) && 
+            !(mxIsLogical(optarg) && mxGetNumberOfElements(optarg) == 1)) {
+          vlmxError(VLMXE_IllegalArgument, "CLASSAGNOSTIC is not a logical scalar.") ;
+        }
+        classAgnostic = (bool)mxGetScalar(optarg) ;
+        break ;
+
+      case opt_no_prior_cache :
+        usePriorCache = false ;
+        break ;
+
+      case opt_loc_scale :
+        if (!vlmxIsScalar(optarg) || !(mxGetScalar(optarg) > 0)) {
+          vlmxError(VLMXE_IllegalArgument, "LOCSCALE is not a positive scalar.") ;
+        }
+        locScale = (float)mxGetScalar(optarg) ;
+        break ;
+
+      case opt_loc_zero_point :
+        if (!vlmxIsScalar(optarg)) {
+          vlmxError(VLMXE_IllegalArgument, "LOCZEROPOINT is not a scalar.") ;
+        }
+        locZeroPoint = (float)mxGetScalar(optarg) ;
+        break ;
+
+      case opt_conf_scale :
+        if (!vlmxIsScalar(optarg) || !(mxGetScalar(optarg) > 0)) {
+          vlmxError(VLMXE_IllegalArgument, "CONFSCALE is not a positive scalar.") ;
+        }
+        confScale = (float)mxGetScalar(optarg) ;
+        break ;
+
+      case opt_conf_zero_point :
+        if (!vlmxIsScalar(optarg)) {
+          vlmxError(VLMXE_IllegalArgument, "CONFZEROPOINT is not a scalar.") ;
+        }
+        confZeroPoint = (float)mxGetScalar(optarg) ;
+        break ;
+
+      case opt_workspace_limit :
+        if (!vlmxIsScalar(optarg) || !(mxGetScalar(optarg) >= 0)) {
+          vlmxError(VLMXE_IllegalArgument, "WORKSPACELIMIT is not a non-negative scalar.") ;
+        }
+        // Inf (or any limit beyond the address space) leaves it unbounded
+        if (mxGetScalar(optarg) < (double)(size_t)-1) {
+          workspaceLimit = (size_t)mxGetScalar(optarg) ;
+        }
+        break ;
+
       default: 
         break ;
     }
   }
 
+  // the memory kept after the call is trimmed to the limit
+  workspace.setLimit(workspaceLimit) ;
+
+  if (mergeMode) {
+    if (nout > OUT_STATS) {
+      vlmxError(VLMXE_IllegalArgument, "STATS are not computed by the merge.") ;
+    }
+    mergeScales(nout, out, in[1], keepTopKSet ? keepTopK : -1, 
+                nmsThresh, numThreads, verbosity) ;
+    return ;
+  }
+
+  vl::MultiboxNMSMethod nmsMethod = vl::vlMultiboxNMSPerClass ;
+  if (classAgnostic) {
+    nmsMethod = vl::vlMultiboxNMSClassAgnostic ;
+  } else if (batchedNMS) {
+    nmsMethod = vl::vlMultiboxNMSBatched ;
+  }
 
   vl::MexTensor locPreds(context) ;
   vl::MexTensor confPreds(context) ;
   vl::MexTensor priors(context) ;
-
-  locPreds.init(in[IN_LOC_PREDS]) ;
-  locPreds.reshape(4) ;
-  int batchSize = locPreds.getSize() ;
-
-  confPreds.init(in[IN_CONF_PREDS]) ;
-  confPreds.reshape(4) ;
+  vl::MultiboxPreds locFormat ;
+  vl::MultiboxPreds confFormat ;
+  size_t locDepth, confDepth ;
+  int batchSize ;
 
   priors.init(in[IN_PRIORS]) ;
   priors.reshape(4) ;
 
-  /* check for GPU/data class consistency */
-  if (!vl::areCompatible(locPreds, confPreds)) {
-    vlmxError(VLMXE_IllegalArgument, "LOCPREDS and CONFPREDS do not have compatible formats.") ;
+  /* predictions in reduced precision are only read by the CPU detector */
+  bool reduced = isReducedPrecision(in[IN_LOC_PREDS]) || 
+                 isReducedPrecision(in[IN_CONF_PREDS]) ;
+  if (reduced) {
+    size_t locBatchSize, confBatchSize ;
+    initPreds(&locFormat, &locDepth, &locBatchSize, in[IN_LOC_PREDS], 
+              "LOCPREDS", locScale, locZeroPoint) ;
+    initPreds(&confFormat, &confDepth, &confBatchSize, in[IN_CONF_PREDS], 
+              "CONFPREDS", confScale, confZeroPoint) ;
+    if (locBatchSize != confBatchSize) {
+      vlmxError(VLMXE_IllegalArgument, "LOCPREDS and CONFPREDS do not have the same batch size.") ;
+    }
+    if (priors.getDeviceType() != vl::VLDT_CPU || 
+        priors.getDataType() != vl::VLDT_Float) {
+      vlmxError(VLMXE_IllegalArgument, "PRIORS is not a CPU SINGLE array (as required by UINT16 or UINT8 predictions).") ;
+    }
+    batchSize = locBatchSize ;
+  } else {
+    locPreds.init(in[IN_LOC_PREDS]) ;
+    locPreds.reshape(4) ;
+    batchSize = locPreds.getSize() ;
+
+    confPreds.init(in[IN_CONF_PREDS]) ;
+    confPreds.reshape(4) ;
+    locDepth = locPreds.getDepth() ;
+    confDepth = confPreds.getDepth() ;
+
+    /* check for GPU/data class consistency */
+    if (!vl::areCompatible(locPreds, confPreds)) {
+      vlmxError(VLMXE_IllegalArgument, "LOCPREDS and CONFPREDS do not have compatible formats.") ;
+    }
+
+    /* check for GPU/data prior consistency */
+    if (!vl::areCompatible(locPreds, priors)) {
+      vlmxError(VLMXE_IllegalArgument, "LOCPREDS and PRIORS do not have compatible formats.") ;
+    }
   }
+  vl::DeviceType deviceType = reduced ? vl::VLDT_CPU : locPreds.getDeviceType() ;
 
-  /* check for GPU/data prior consistency */
-  if (!vl::areCompatible(locPreds, priors)) {
-    vlmxError(VLMXE_IllegalArgument, "LOCPREDS and PRIORS do not have compatible formats.") ;
+  /* the timings and counters are only gathered if they are returned */
+  if (nout > OUT_STATS && deviceType != vl::VLDT_CPU) {
+    vlmxError(VLMXE_IllegalArgument, "STATS are only computed by the CPU detector.") ;
   }
+  vl::impl::MultiboxStats stats ;
+  stats.counting = true ;
 
   /* check for appropriate number of prior predictions */
   int numPriors = priors.getHeight() / 4 ;
-  if ((numPriors != (confPreds.getDepth() / numClasses)) | (numPriors != (locPreds.getDepth() / 4))) {
+  if ((numPriors != (confDepth / numClasses)) | (numPriors != (locDepth / 4))) {
     vlmxError(VLMXE_IllegalArgument, "LOCPREDS and CONFPREDS do not match the given set of priors.") ;
   }
 
@@ -189,21 +553,62 @@ void mexFunction(int nout, mxArray *out[],
   // of the input data
   //vl::DeviceType deviceType = locPreds.getDeviceType() ;
   vl::MexTensor output(context) ;
-  vl::DataType dataType = locPreds.getDataType() ;
-  vl::TensorShape outputShape = vl::TensorShape(keepTopK, 6, 1, batchSize) ;
-  output.initWithZeros(vl::VLDT_CPU, dataType, outputShape) ;
+  vl::MexTensor counts(context) ;
+  vl::DataType dataType = reduced ? vl::VLDT_Float : locPreds.getDataType() ;
+  if (compact) {
+    // Room for the largest possible number of detections per image. The
+    // records are packed by the detector, so no zero padding is needed 
+    // and the unused tail is released once the counts are known.
+    int maxPerImage = keepTopK ;
+    if (keepTopK < 0) {
+      maxPerImage = numClasses * ((nmsTopK > -1) ? 
+                                  std::min(nmsTopK, numPriors) : numPriors) ;
+    }
+    vl::TensorShape outputShape = vl::TensorShape(6, maxPerImage, 1, batchSize) ;
+    output.init(vl::VLDT_CPU, dataType, outputShape) ;
+  } else {
+    vl::TensorShape outputShape = vl::TensorShape(keepTopK, 6, 1, batchSize) ;
+    output.initWithZeros(vl::VLDT_CPU, dataType, outputShape) ;
+  }
+  if (compact || nout > OUT_COUNTS) {
+    counts.init(vl::VLDT_CPU, dataType, vl::TensorShape(1, batchSize, 1, 1)) ;
+  }
 
 
   if (verbosity > 0) {
     mexPrintf("vl_multiboxdetector: mode %s; %s\n",  
-            (locPreds.getDeviceType()==vl::VLDT_GPU)?"gpu":"cpu", "forward") ;
+            (deviceType==vl::VLDT_GPU)?"gpu":"cpu", "forward") ;
         mexPrintf("vl_multiboxdetector: nmsTopK: %d\n", nmsTopK) ;
         mexPrintf("vl_multiboxdetector: keepTopK: %d\n", keepTopK) ;
         mexPrintf("vl_multiboxdetector: numClasses: %d\n", numClasses) ;
         mexPrintf("vl_multiboxdetector: nmsThresh: %d\n", nmsThresh) ;
         mexPrintf("vl_multiboxdetector: confThresh: %d\n", confThresh) ;
         mexPrintf("vl_multiboxdetector: backgroundLabel: %d\n", backgroundLabel) ;
-        vl::print("vl_multiboxdetector: locPreds: ", locPreds) ;
+        mexPrintf("vl_multiboxdetector: numThreads: %d\n", numThreads) ;
+        mexPrintf("vl_multiboxdetector: nmsMethod: %s\n", 
+                  (nmsMethod == vl::vlMultiboxNMSClassAgnostic) ? "class agnostic" :
+                  (nmsMethod == vl::vlMultiboxNMSBatched) ? "batched" : "per class") ;
+        mexPrintf("vl_multiboxdetector: compact: %s\n", 
+                  compact ? "yes" : "no") ;
+        mexPrintf("vl_multiboxdetector: lazyDecode: %s\n", 
+                  lazyDecode ? "yes" : "no") ;
+        mexPrintf("vl_multiboxdetector: priorCache: %s\n", 
+                  usePriorCache ? "yes" : "no") ;
+        if (workspaceLimit == (size_t)-1) {
+          mexPrintf("vl_multiboxdetector: workspaceLimit: none\n") ;
+        } else {
+          mexPrintf("vl_multiboxdetector: workspaceLimit: %.0f bytes\n", 
+                    (double)workspaceLimit) ;
+        }
+        if (reduced) {
+          char const *formats [] = {"single", "half", "uint8"} ;
+          mexPrintf("vl_multiboxdetector: locPreds: %s (scale %g, zero point %g)\n", 
+                    formats[locFormat.type], locScale, locZeroPoint) ;
+          mexPrintf("vl_multiboxdetector: confPreds: %s (scale %g, zero point %g)\n", 
+                    formats[confFormat.type], confScale, confZeroPoint) ;
+        } else {
+          vl::print("vl_multiboxdetector: locPreds: ", locPreds) ;
+        }
         vl::print("vl_multiboxdetector: output: ", output) ;
       }
       /* -------------------------------------------------------------- */
@@ -211,24 +616,84 @@ void mexFunction(int nout, mxArray *out[],
       /* -------------------------------------------------------------- */
 
       vl::ErrorCode error ;
-      error = vl::nnmultiboxdetector_forward(context,
-                                             output, 
-                                             locPreds,
-                                             confPreds,
-                                             priors, 
-                                             nmsTopK,
-                                             keepTopK,
-                                             numClasses,
-                                             nmsThresh,
-                                             confThresh,
-                                             backgroundLabel) ;
+      if (reduced) {
+        error = vl::nnmultiboxdetector_forward(context,
+                                               output, 
+                                               counts,
+                                               locFormat,
+                                               confFormat,
+                                               priors, 
+                                               nmsTopK,
+                                               keepTopK,
+                                               numClasses,
+                                               nmsThresh,
+                                               confThresh,
+                                               backgroundLabel,
+                                               nmsMethod,
+                                               compact,
+                                               numThreads,
+                                               lazyDecode,
+                                               usePriorCache ? &priorCache : NULL,
+                                               &workspace,
+                                               (nout > OUT_STATS) ? &stats : NULL) ;
+      } else {
+        error = vl::nnmultiboxdetector_forward(context,
+                                               output, 
+                                               counts,
+                                               locPreds,
+                                               confPreds,
+                                               priors, 
+                                               nmsTopK,
+                                               keepTopK,
+                                               numClasses,
+                                               nmsThresh,
+                                               confThresh,
+                                               backgroundLabel,
+                                               nmsMethod,
+                                               compact,
+                                               numThreads,
+                                               lazyDecode,
+                                               usePriorCache ? &priorCache : NULL,
+                                               &workspace,
+                                               (nout > OUT_STATS) ? &stats : NULL) ;
+      }
 
   /* -------------------------------------------------------------- */
   /*                                                         Finish */
   /* -------------------------------------------------------------- */
 
+  if (verbosity > 0) {
+    mexPrintf("vl_multiboxdetector: workspace: %.0f host bytes\n", 
+              (double)workspace.getHostBytes()) ;
+#if ENABLE_GPU
+    mexPrintf("vl_multiboxdetector: workspace: %.0f device bytes\n", 
+              (double)workspace.getDeviceBytes()) ;
+#endif
+  }
   if (error != vl::VLE_Success) {
     mexErrMsgTxt(context.getLastErrorMessage().c_str()) ;
   }
   out[OUT_RESULT] = output.relinquish() ;
+  if (compact) {
+    // trim the packed detections to 6 x (total number of detections)
+    bool isFloat = (dataType == vl::VLDT_Float) ;
+    size_t elementSize = isFloat ? sizeof(float) : sizeof(double) ;
+    void const *countData = counts.getMemory() ;
+    mwSize numDetections = 0 ;
+    for (int i = 0 ; i < batchSize ; ++i) {
+      numDetections += (mwSize)(isFloat ? ((float const*)countData)[i] 
+                                        : ((double const*)countData)[i]) ;
+    }
+    size_t numBytes = std::max(numDetections, (mwSize)1) * 6 * elementSize ;
+    mwSize dimensions [2] = {6, numDetections} ;
+    mxSetData(out[OUT_RESULT], 
+              mxRealloc(mxGetData(out[OUT_RESULT]), numBytes)) ;
+    mxSetDimensions(out[OUT_RESULT], dimensions, 2) ;
+  }
+  if (nout > OUT_COUNTS) {
+    out[OUT_COUNTS] = counts.relinquish() ;
+  }
+  if (nout > OUT_STATS) {
+    out[OUT_STATS] = statsToArray(stats) ;
+  }
 }
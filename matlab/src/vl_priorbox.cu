@@ -0,0 +1,300 @@
+// @file vl_priorbox.cu
+// @brief Prior box generation MEX wrapper
+// @author Samuel Albanie
+// @author Andrea Vedaldi
+/*
+Copyright (C) 2017 Samuel Albanie and Andrea Vedaldi.
+All rights reserved.
+
+This file is part of the VLFeat library and is made available under
+the terms of the BSD license (see the COPYING file).
+*/
+
+#include <bits/mexutils.h>
+#include "bits/impl/priorbox.hpp"
+
+#include <assert.h>
+#include <string.h>
+#include <vector>
+
+/* option codes */
+enum {
+  opt_min_size = 0,
+  opt_max_size,
+  opt_aspect_ratios,
+  opt_flip,
+  opt_clip,
+  opt_offset,
+  opt_pixel_step,
+  opt_variance,
+  opt_double,
+  opt_no_cache,
+  opt_verbose,
+} ;
+
+/* options */
+VLMXOption  options [] = {
+  {"minSize",              1,   opt_min_size                },
+  {"maxSize",              1,   opt_max_size                },
+  {"aspectRatios",         1,   opt_aspect_ratios           },
+  {"flip",                 1,   opt_flip                    },
+  {"clip",                 1,   opt_clip                    },
+  {"offset",               1,   opt_offset                  },
+  {"pixelStep",            1,   opt_pixel_step              },
+  {"variance",             1,   opt_variance                },
+  {"Double",               0,   opt_double                  },
+  {"NoCache",              0,   opt_no_cache                },
+  {"Verbose",              0,   opt_verbose                 },
+  {0,                      0,   0                           }
+} ;
+
+/* ---------------------------------------------------------------- */
+/*                                                          Context */
+/* ---------------------------------------------------------------- */
+
+/*
+ The priors of the last few input resolutions are kept between calls, as
+ they only depend on the sizes of the feature maps and of the image, so
+ that the forward pass of a deployed model does not rebuild them.
+ */
+vl::impl::PriorBoxCache priorBoxCache ;
+
+void atExit()
+{
+  priorBoxCache.clear() ;
+}
+
+/* ---------------------------------------------------------------- */
+/*                                                           Useful */
+/* ---------------------------------------------------------------- */
+
+// Read the elements of a real double, single or logical array
+static bool getValues(mxArray const *array, std::vector<double> *values)
+{
+  size_t n = mxGetNumberOfElements(array) ;
+  values->resize(n) ;
+  if (mxIsDouble(array) && !mxIsComplex(array)) {
+    double const *data = (double const*)mxGetData(array) ;
+    values->assign(data, data + n) ;
+  } else if (mxIsSingle(array) && !mxIsComplex(array)) {
+    float const *data = (float const*)mxGetData(array) ;
+    values->assign(data, data + n) ;
+  } else if (mxIsLogical(array)) {
+    mxLogical const *data = (mxLogical const*)mxGetData(array) ;
+    for (size_t k = 0 ; k < n ; ++k) { (*values)[k] = data[k] ; }
+  } else {
+    return false ;
+  }
+  return true ;
+}
+
+// Read an option with either one value for all the layers or one value
+// per layer
+static void getLayerValues(mxArray const *optarg, char const *name,
+                           int numLayers, std::vector<double> *values)
+{
+  if (!getValues(optarg, values) ||
+      (values->size() != 1 && values->size() != numLayers)) {
+    vlmxError(VLMXE_IllegalArgument,
+              "%s is not a scalar or a vector with one element per layer.", name) ;
+  }
+  if (values->size() == 1) {
+    values->assign(numLayers, (*values)[0]) ;
+  }
+}
+
+/* ---------------------------------------------------------------- */
+/*                                                       MEX driver */
+/* ---------------------------------------------------------------- */
+
+enum {
+  IN_FEATURE_SIZES = 0, IN_IMAGE_SIZE, IN_END
+} ;
+
+enum {
+  OUT_RESULT = 0, OUT_END
+} ;
+
+void mexFunction(int nout, mxArray *out[],
+                 int nin, mxArray const *in[])
+{
+  bool useDouble = false ;
+  bool useCache = true ;
+  int verbosity = 0 ;
+  int opt ;
+  int next = IN_END ;
+  mxArray const *optarg ;
+
+  mxArray const *minSizeArg = NULL ;
+  mxArray const *maxSizeArg = NULL ;
+  mxArray const *aspectRatiosArg = NULL ;
+  mxArray const *flipArg = NULL ;
+  mxArray const *clipArg = NULL ;
+  mxArray const *offsetArg = NULL ;
+  mxArray const *pixelStepArg = NULL ;
+  mxArray const *varianceArg = NULL ;
+
+  mexAtExit(atExit) ;
+
+  /* -------------------------------------------------------------- */
+  /*                                            Check the arguments */
+  /* -------------------------------------------------------------- */
+
+  if (nin < 2) {
+    mexErrMsgTxt("There are less than two arguments.") ;
+  }
+
+  while ((opt = vlmxNextOption (in, nin, options, &next, &optarg)) >= 0) {
+    switch (opt) {
+      case opt_verbose :
+        ++ verbosity ;
+        break ;
+
+      case opt_min_size : minSizeArg = optarg ; break ;
+      case opt_max_size : maxSizeArg = optarg ; break ;
+      case opt_aspect_ratios : aspectRatiosArg = optarg ; break ;
+      case opt_flip : flipArg = optarg ; break ;
+      case opt_clip : clipArg = optarg ; break ;
+      case opt_offset : offsetArg = optarg ; break ;
+      case opt_pixel_step : pixelStepArg = optarg ; break ;
+      case opt_variance : varianceArg = optarg ; break ;
+
+      case opt_double :
+        useDouble = true ;
+        break ;
+
+      case opt_no_cache :
+        useCache = false ;
+        break ;
+
+      default:
+        break ;
+    }
+  }
+
+  // One row [height width ...] per layer (e.g. the SIZE of each feature
+  // map), and the [height width ...] of the image
+  std::vector<double> featureSizes ;
+  mxArray const *featureSizesArg = in[IN_FEATURE_SIZES] ;
+  if (!getValues(featureSizesArg, &featureSizes) ||
+      mxGetNumberOfDimensions(featureSizesArg) != 2 ||
+      (mxGetM(featureSizesArg) > 0 && mxGetN(featureSizesArg) < 2)) {
+    vlmxError(VLMXE_IllegalArgument, "FEATSIZES is not a numLayers x 2 array.") ;
+  }
+  const int numLayers = (int)mxGetM(featureSizesArg) ;
+
+  std::vector<double> imageSize ;
+  if (!getValues(in[IN_IMAGE_SIZE], &imageSize) || imageSize.size() < 2) {
+    vlmxError(VLMXE_IllegalArgument, "IMSIZE is not a vector [height width ...].") ;
+  }
+  const int imageHeight = (int)imageSize[0] ;
+  const int imageWidth = (int)imageSize[1] ;
+
+  std::vector<vl::impl::PriorBoxLayer> layers(numLayers) ;
+  for (int l = 0 ; l < numLayers ; ++l) {
+    layers[l].featureHeight = (int)featureSizes[l] ;
+    layers[l].featureWidth = (int)featureSizes[l + numLayers] ;
+  }
+
+  std::vector<double> values ;
+#define LAYER_OPTION(arg, name, field, type) \
+  if (arg) { \
+    getLayerValues(arg, name, numLayers, &values) ; \
+    for (int l = 0 ; l < numLayers ; ++l) { layers[l].field = (type)values[l] ; } \
+  }
+  LAYER_OPTION(minSizeArg, "MINSIZE", minSize, double)
+  LAYER_OPTION(maxSizeArg, "MAXSIZE", maxSize, double)
+  LAYER_OPTION(flipArg, "FLIP", flip, bool)
+  LAYER_OPTION(clipArg, "CLIP", clip, bool)
+  LAYER_OPTION(offsetArg, "OFFSET", offset, double)
+  LAYER_OPTION(pixelStepArg, "PIXELSTEP", pixelStep, double)
+#undef LAYER_OPTION
+
+  // The same aspect ratios for all layers, or a cell array with the
+  // ratios of each layer.  The shape of the ratios matters with `flip`,
+  // which appends the reciprocals of each column.
+  if (aspectRatiosArg) {
+    bool isCell = mxIsCell(aspectRatiosArg) ;
+    if (isCell && mxGetNumberOfElements(aspectRatiosArg) != numLayers) {
+      vlmxError(VLMXE_IllegalArgument, "ASPECTRATIOS is a cell array without one element per layer.") ;
+    }
+    for (int l = 0 ; l < numLayers ; ++l) {
+      mxArray const *ratios = isCell ? mxGetCell(aspectRatiosArg, l) : aspectRatiosArg ;
+      if (ratios == NULL || mxIsEmpty(ratios)) {
+        layers[l].aspectRatios.clear() ;
+        continue ;
+      }
+      if (!getValues(ratios, &layers[l].aspectRatios) ||
+          mxGetNumberOfDimensions(ratios) != 2) {
+        vlmxError(VLMXE_IllegalArgument, "ASPECTRATIOS is not a matrix or a cell array of matrices.") ;
+      }
+      layers[l].aspectRatioRows = (int)mxGetM(ratios) ;
+    }
+  }
+
+  // [v1 v2 v3 v4] for all layers, or a 4 x numLayers array
+  if (varianceArg) {
+    if (!getValues(varianceArg, &values) ||
+        (values.size() != 4 && values.size() != 4 * (size_t)numLayers)) {
+      vlmxError(VLMXE_IllegalArgument, "VARIANCE does not have four elements (per layer).") ;
+    }
+    for (int l = 0 ; l < numLayers ; ++l) {
+      double const *variance = values.data() + ((values.size() == 4) ? 0 : 4 * l) ;
+      memcpy(layers[l].variance, variance, sizeof(layers[l].variance)) ;
+    }
+  }
+
+  for (int l = 0 ; l < numLayers ; ++l) {
+    char const *error = vl::impl::checkPriorBoxLayer(layers[l], imageHeight, imageWidth) ;
+    if (error) {
+      vlmxError(VLMXE_IllegalArgument, "Layer %d: %s.", l + 1, error) ;
+    }
+  }
+
+  if (verbosity > 0) {
+    mexPrintf("vl_priorbox: numLayers: %d\n", numLayers) ;
+    mexPrintf("vl_priorbox: image size: %d x %d\n", imageHeight, imageWidth) ;
+    mexPrintf("vl_priorbox: numPriors: %d\n",
+              vl::impl::countPriorBoxes(layers.data(), numLayers)) ;
+    mexPrintf("vl_priorbox: precision: %s\n", useDouble ? "double" : "single") ;
+    mexPrintf("vl_priorbox: cache: %s\n", useCache ? "yes" : "no") ;
+  }
+
+  /* -------------------------------------------------------------- */
+  /*                                                    Do the work */
+  /* -------------------------------------------------------------- */
+
+  int numPriors = vl::impl::countPriorBoxes(layers.data(), numLayers) ;
+  size_t elementSize = useDouble ? sizeof(double) : sizeof(float) ;
+  mwSize dims [] = { (mwSize)(4 * (size_t)numPriors), 1, 2 } ;
+  mxArray *result = mxCreateNumericArray(3, dims,
+                                         useDouble ? mxDOUBLE_CLASS : mxSINGLE_CLASS,
+                                         mxREAL) ;
+  void *priors = mxGetData(result) ;
+
+  if (useCache) {
+    void const *cached ;
+    int numCached ;
+    if (useDouble) {
+      cached = priorBoxCache.get<double>(layers.data(), numLayers,
+                                         imageHeight, imageWidth, &numCached) ;
+    } else {
+      cached = priorBoxCache.get<float>(layers.data(), numLayers,
+                                        imageHeight, imageWidth, &numCached) ;
+    }
+    assert(numCached == numPriors) ;
+    memcpy(priors, cached, 8 * (size_t)numPriors * elementSize) ;
+  } else if (useDouble) {
+    vl::impl::makePriorBoxes((double*)priors, layers.data(), numLayers,
+                             imageHeight, imageWidth) ;
+  } else {
+    vl::impl::makePriorBoxes((float*)priors, layers.data(), numLayers,
+                             imageHeight, imageWidth) ;
+  }
+
+  /* -------------------------------------------------------------- */
+  /*                                                         Finish */
+  /* -------------------------------------------------------------- */
+
+  out[OUT_RESULT] = result ;
+}
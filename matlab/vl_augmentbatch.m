@@ -0,0 +1,90 @@
+%VL_AUGMENTBATCH augments a batch of SSD training images
+%   [DATA, BOXES, LABELS] = VL_AUGMENTBATCH(IMS, BOXES, LABELS, SEEDS)
+%   applies the data augmentation of SSD_TRAIN_GET_BATCH (photometric
+%   distortion, zoom out, patch sampling, resizing and flipping) to a batch
+%   of images, processing the images in parallel.  The zoomed out canvas is
+%   never formed: only the sampled patch is extracted from it.  In the
+%   following, `N` denotes the batch size:
+%
+%     IMS is a 1 x N cell array of H x W x 3 (or H x W) SINGLE images with
+%         values in [0, 255], e.g. as returned by VL_IMREADJPEG.
+%
+%     BOXES is a 1 x N cell array, whose i-th element is a G x 4 array of
+%         [xmin ymin xmax ymax] ground truth boxes of the i-th image, in
+%         normalised coordinates.
+%
+%     LABELS is a 1 x N cell array with the labels of the boxes.
+%
+%     SEEDS is a vector with the seed of the random number generator used
+%         to augment each image.  The result only depends on the images and
+%         their seeds (and not on the number of threads).
+%
+%     DATA is a H' x W' x 3 x N SINGLE array with the augmented images,
+%         minus the average colour, where [H' W'] is the `ImageSize`.
+%
+%     BOXES and LABELS are the annotations of the augmented images: the
+%         boxes whose centre lies in the sampled patch, expressed relative
+%         to it.
+%
+%   VL_AUGMENTBATCH(IMS, BOXES, LABELS, SEEDS, ..., 'Key', K, 'Prefetch')
+%   copies the batch and starts augmenting it on a pool of threads in the
+%   background, returning immediately.  [DATA, BOXES, LABELS] =
+%   VL_AUGMENTBATCH({}, {}, {}, [], 'Key', K) then waits for the batch with
+%   key K and returns it (or empty arrays if there is no such batch).
+%
+%   VL_AUGMENTBATCH(...,'OPT',VALUE,...) takes the following options (the
+%   augmentations are disabled by default):
+%
+%   `ImageSize`:: [300 300]
+%    The size of the augmented images.
+%
+%   `Average`:: [123 117 104]
+%    The average colour, used to fill the zoomed out canvas and subtracted
+%    from the augmented images.
+%
+%   `ResizeMethods`:: {'bilinear'}
+%    The IMRESIZE methods among which the method used for each image is
+%    chosen uniformly at random ('nearest', 'bilinear', 'bicubic', 'box',
+%    'lanczos2' or 'lanczos3').
+%
+%   `Brightness`:: [0 0]
+%    [PROB DELTA]: with probability PROB, add a value drawn uniformly from
+%    [-DELTA, DELTA] to the image.
+%
+%   `Contrast`:: [0 1 1]
+%    [PROB LOWER UPPER]: with probability PROB, multiply the image by a
+%    value drawn uniformly from [LOWER, UPPER].
+%
+%   `Saturation`:: [0 1 1]
+%    [PROB LOWER UPPER]: with probability PROB, multiply the saturation of
+%    the image by a value drawn uniformly from [LOWER, UPPER].
+%
+%   `Hue`:: [0 0]
+%    [PROB DELTA]: with probability PROB, add a value drawn uniformly from
+%    [-DELTA, DELTA] to the hue of the image.
+%
+%   `RandomOrder`:: 0
+%    The probability of randomly permuting the colour channels.
+%
+%   `Zoom`:: [0 1 1]
+%    [PROB MINSCALE MAXSCALE]: with probability PROB, place the image at a
+%    random location of a canvas larger by a factor drawn uniformly from
+%    [MINSCALE, MAXSCALE].
+%
+%   `Patch`:: []
+%    [NUMTRIALS MINSCALE MAXSCALE MINASPECT MAXASPECT]: sample a patch of
+%    the image as PATCHSAMPLER does.
+%
+%   `ClipTargets`:: false
+%    Clip the boxes to the sampled patch.
+%
+%   `Flip`:: 0
+%    The probability of flipping the image horizontally.
+%
+%   `NumThreads`:: 1
+%    The number of CPU threads. A value of zero (or less) uses all available
+%    hardware threads.
+%
+%   `PrefetchDepth`:: 2
+%    The maximum number of prefetched batches kept. When a new batch would
+%    exceed it, the oldest one is dropped.
@@ -0,0 +1,51 @@
+%VL_DETECTIONCACHE reads and writes binary detection caches
+%   VL_DETECTIONCACHE('open', PATH, 'NumClasses', C) starts writing the
+%   detection cache PATH, for detections with (background inclusive)
+%   labels 1, ..., C (21 by default).
+%
+%   VL_DETECTIONCACHE('append', PATH, DETS) appends the detections of a
+%   batch of images, where DETS is a K x 6 x 1 x N SINGLE or DOUBLE array of
+%   [label score xmin ymin xmax ymax] detections, such as the (default
+%   layout) output of VL_NNMULTIBOXDETECTOR.  Rows with a label below one
+%   are padding, and are not stored.
+%
+%   VL_DETECTIONCACHE('append', PATH, RECORDS, COUNTS) appends the
+%   detections of a batch in the compact layout of VL_NNMULTIBOXDETECTOR,
+%   where RECORDS is 6 x M and COUNTS has the number of records of each
+%   image.
+%
+%   VL_DETECTIONCACHE('finish', PATH) writes the indices of the cache and
+%   marks it complete.  A cache which is not finished (e.g. because the
+%   MEX file is cleared first) is rejected by the other modes.
+%
+%   INFO = VL_DETECTIONCACHE('info', PATH) returns a structure with the
+%   version, numClasses, numImages and numDetections of a complete cache.
+%
+%   DETS = VL_DETECTIONCACHE('read', PATH) returns the detections of all
+%   the images as a K x 6 x 1 x N SINGLE array, padded with zeros, where K
+%   is the largest number of detections of an image.
+%   VL_DETECTIONCACHE('read', PATH, IMAGES) returns those of the images
+%   with the given (1-based) indices only.
+%
+%   DETS = VL_DETECTIONCACHE('readclass', PATH, LABEL) returns the
+%   detections with the given label as an M x 6 SINGLE array of [image
+%   score xmin ymin xmax ymax] rows, where image is the (1-based) index of
+%   the image, by descending score (with ties in image and row order).
+%
+%   The cache is a flat, versioned file, with the detections of each image
+%   (in the order they were appended), an index of the images and the
+%   detections of each label.  It is memory mapped when it is read, so
+%   only the pages which are used are read from disk, and VL_EVALDETECTIONS
+%   evaluates a cache in place if it is given its PATH instead of DETS.
+%
+%   VL_DETECTIONCACHE(...,'OPT',VALUE,...) takes the following options:
+%
+%   `NumClasses`:: 21
+%    The number of classes, including the background ('open').
+%
+%   `Height`:: not set
+%    The number of rows of each image ('read'); images with more
+%    detections are truncated.
+%
+%   `Verbose`:: not set
+%    If set, print information about the cache.
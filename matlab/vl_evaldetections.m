@@ -0,0 +1,80 @@
+%VL_EVALDETECTIONS evaluates detections with VOC or COCO average precision
+%   AP = VL_EVALDETECTIONS(DETS, BOXES, LABELS) computes the average
+%   precision of each class from the detections of a set of images, as the
+%   VOC devkit (VOCevaldet) or the COCO API (evaluateImg and accumulate,
+%   for the 'all' area range) do.  The detections of each image are
+%   matched to its ground truth in parallel, and the precision recall
+%   curves of the classes are then computed in parallel.  In the
+%   following, `N` denotes the number of images:
+%
+%     DETS is a K x 6 x 1 x N SINGLE or DOUBLE array of [label score xmin
+%         ymin xmax ymax] detections, such as the (default layout) output
+%         of VL_NNMULTIBOXDETECTOR.  Rows with a label below one are
+%         padding.  DETS can also be the path of a detection cache (see
+%         VL_DETECTIONCACHE), whose detections are evaluated in place from
+%         a memory mapping.
+%
+%     BOXES is a 1 x N cell array, whose i-th element is a G x 4 array of
+%         [xmin ymin xmax ymax] ground truth boxes of the i-th image, in
+%         the coordinates of DETS.
+%
+%     LABELS is a 1 x N cell array with the labels of the boxes, which
+%         use the same (background inclusive) labels as DETS.
+%
+%     AP is a (C - 1) x T array with the average precision of every
+%         class except the background at each of the T IoU thresholds
+%         (C is the number of classes, including the background).  The AP
+%         of a class without ground truth boxes is NaN.
+%
+%   [AP, NPOS] = VL_EVALDETECTIONS(...) also returns the number of (non
+%   difficult, non crowd) ground truth boxes of each class.
+%
+%   The detections of a class are ranked by descending score, with ties
+%   broken by image and then row order, as the stable sorts of the VOC and
+%   COCO code do, so the result does not depend on the number of threads.
+%
+%   VL_EVALDETECTIONS(...,'OPT',VALUE,...) takes the following options:
+%
+%   `Metric`:: 'voc07'
+%    'voc07' averages the interpolated precision at the 11 recall levels
+%    0:0.1:1 and 'voc12' integrates it over all recall levels; in both
+%    cases a detection is matched to the box it overlaps most and is
+%    ignored if that box is difficult.  'coco' averages the interpolated
+%    precision at the 101 recall levels 0:0.01:1: a detection is matched
+%    to the best overlapping box that is not yet matched, preferring boxes
+%    that are not crowds, and its overlap with a crowd is measured
+%    relative to its own area.
+%
+%   `IoU`:: 0.5 (0.5:0.05:0.95 for 'coco')
+%    The overlap thresholds at which a detection is a true positive.
+%
+%   `Flags`:: {}
+%    A 1 x N cell array with the difficult (VOC) or crowd (COCO) flag of
+%    each ground truth box.
+%
+%   `NumClasses`:: 21
+%    The number of classes, including the background (by default, that of
+%    the cache if DETS is a path).
+%
+%   `BackgroundLabel`:: 1
+%    The label of the background class, whose row is dropped from AP.
+%
+%   `MaxDetections`:: -1 (100 for 'coco')
+%    The maximum number of detections of each class kept for each image
+%    (the highest scoring ones), or -1 for no limit.
+%
+%   `PixelCoordinates`:: false
+%    If true, boxes are in inclusive pixel coordinates, so that widths and
+%    heights are xmax - xmin + 1 (as in the VOC devkit).
+%
+%   `ClipBoxes`:: false
+%    If true, the detected boxes are clipped to [0, 1] (the extent of the
+%    image in normalised coordinates) before they are matched, which
+%    saves a clipped copy of DETS (and also applies to a cache).
+%
+%   `NumThreads`:: 1
+%    The number of CPU threads. A value of zero (or less) uses all
+%    available hardware threads.
+%
+%   `Verbose`:: not set
+%    If set, print information about the evaluation.
@@ -0,0 +1,47 @@
+%VL_HARDNEGATIVES selects hard negatives for the multibox loss
+%   HARDNEGS = VL_HARDNEGATIVES(V, M) selects the hard negatives of every
+%   image in a batch in a single call, producing the same result as
+%   calling COMPUTE_HARD_NEGS on each image.  The background loss of each
+%   prior is its softmax cross-entropy against the background class; the
+%   priors matched to a ground truth box (and, optionally, those crossing
+%   the image boundary) are excluded, and the unmatched priors with the
+%   largest losses are kept.  The kept priors are found by partial
+%   selection, and the loss of priors which cannot be kept is not
+%   evaluated, so the cost of the ranking depends on the number of
+%   negatives that are kept rather than on a full sort of the priors.
+%   In the following, `N` denotes the batch size:
+%
+%     V is a 1 x 1 x C2 x N CPU array containing the per-class confidence
+%         predictions of the network, where C2 = numClasses * numPriors.
+%
+%     M is a struct array of N elements, as produced by VL_NNMATCHPRIORS
+%         (or VL_MATCHPRIORS), whose `idx` field lists the priors matched
+%         to each ground truth box and whose `ignored` field lists the
+%         priors crossing the image boundary.
+%
+%     HARDNEGS is a 1 x N cell array, whose i-th element is a row vector
+%         with the hard negatives of the i-th image, in order of decreasing
+%         loss.  The number of hard negatives is
+%         MIN(ROUND(negPosRatio * numPos), numPriors - numPos), where numPos
+%         is the number of matched priors.
+%
+%   VL_HARDNEGATIVES(...,'OPT',VALUE,...) takes the following options:
+%
+%   `numClasses`:: 21
+%    The number of classes predicted by the network (including the
+%    background).
+%
+%   `negPosRatio`:: 3
+%    The number of hard negatives to keep per matched prior.
+%
+%   `backgroundLabel`:: 1
+%    The label of the background class.
+%
+%   `ignoreXBoundaryBoxes`:: false
+%    If true, the priors listed in the `ignored` field of M are not
+%    selected as hard negatives.
+%
+%   `numThreads`:: 1
+%    The number of CPU threads used to process the images of the batch. A
+%    value of zero (or less) uses all available hardware threads. The
+%    output does not depend on this setting.
@@ -0,0 +1,45 @@
+%VL_MATCHPRIORS matches prior boxes against ground truth boxes
+%   MATCHES = VL_MATCHPRIORS(P, GT) matches the prior boxes P against the
+%   ground truth boxes of every image in a batch, producing the same
+%   result as calling MATCHPRIORS on each image (with the 'overlap' match
+%   ranker).  Rather than computing the overlap of every box with every
+%   prior, the priors are indexed by a grid, so that each box is only
+%   compared with the priors that lie near it.  In the following, `N`
+%   denotes the batch size:
+%
+%     P is a C3 x 1 x 2 (x N) CPU array containing the prior boxes,
+%         encoded as in VL_NNMULTIBOXDETECTOR, where C3 = 4 * numPriors.
+%         Only the boxes of the first image are used.
+%
+%     GT is a cell array of N elements, where GT{i} is a G x 4 array of
+%         [xmin ymin xmax ymax] ground truth boxes (single or double).
+%
+%     MATCHES is a struct array with the same size as GT, with fields:
+%         `idx`: a 1 x G cell array, whose g-th element lists the priors
+%           (in ascending order) matched to the g-th box
+%         `ignored`: the indices of the priors crossing the image
+%           boundary if `ignoreXBoundaryBoxes` is set, and a numPriors
+%           x 1 vector of zeros otherwise
+%         `overlaps`: the G x numPriors matrix of overlaps (intersection
+%           over union) between the boxes and the priors
+%
+%   VL_MATCHPRIORS(...,'OPT',VALUE,...) takes the following options:
+%
+%   `overlapThreshold`:: 0.5
+%    Every box is matched to the prior with which it has the greatest
+%    overlap, and to all priors whose overlap with it exceeds this
+%    threshold.
+%
+%   `ignoreXBoundaryBoxes`:: false
+%    If true, prior boxes which cross the image boundary are not matched.
+%
+%   `numThreads`:: 1
+%    The number of CPU threads used to match the images of the batch. A
+%    value of zero (or less) uses all available hardware threads. The
+%    output does not depend on this setting.
+%
+%   `NoPriorCache`:: not set
+%    By default, the grid built over the priors is cached between calls,
+%    keyed by the number of priors and a hash of their contents, and is
+%    released by `clear mex`. This flag disables the cache so that the
+%    grid is built on every call.
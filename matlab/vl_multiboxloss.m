@@ -0,0 +1,70 @@
+%VL_MULTIBOXLOSS computes the multibox loss in a single native pass
+%   Y = VL_MULTIBOXLOSS(X, V, P, GT, L, M, N) computes the SSD training
+%   loss of a batch directly from the predictions of the network,
+%   producing the same value as the chain of VL_NNMULTIBOXCODER,
+%   VL_NNLOSS ('softmaxlog'), VL_NNHUBERLOSS and VL_NNMULTIBOXLOSS
+%   layers, without building the intermediate arrays of targets, gathered
+%   predictions and instance weights.  In the following, `N` denotes the
+%   batch size:
+%
+%     X is a 1 x 1 x 4P x N array containing the location predictions
+%         of the network, where P is the number of priors.
+%
+%     V is a 1 x 1 x C2 x N array containing the per-class confidence
+%         predictions (scores) of the network, where C2 = numClasses * P.
+%
+%     P is a 4P x 1 x 2 array containing the priors, together with their
+%         variances, as produced by VL_NNPRIORBOX.
+%
+%     GT is a 1 x N cell array, whose i-th element is a G x 4 array of
+%         [xmin ymin xmax ymax] ground truth boxes of the i-th image.
+%
+%     L is a 1 x N cell array, whose i-th element contains the (1-based)
+%         labels of the ground truth boxes of the i-th image.
+%
+%     M is a struct array of N elements, as produced by VL_NNMATCHPRIORS
+%         (or VL_MATCHPRIORS), whose `idx` field lists the priors matched
+%         to each ground truth box.
+%
+%     N is a 1 x N cell array with the hard negatives of each image, as
+%         produced by VL_NNHARDNEGATIVES (or VL_HARDNEGATIVES).
+%
+%     Y is the loss, the sum of the softmax log-loss of the matched and
+%         hard negative priors and of locWeight times the smooth L1 loss
+%         of the encoded boxes of the matched priors, both divided by the
+%         number of matched priors in the batch.
+%
+%   The loss is computed on the CPU. If X is a gpuArray, the inputs are
+%   gathered and the outputs are returned as gpuArrays, so that the
+%   function can be used as a layer of a network trained on the GPU.
+%
+%   [Y, DX, DV] = VL_MULTIBOXLOSS(X, V, P, GT, L, M, N) also computes the
+%   derivatives of the loss with respect to X and V in the same pass.
+%
+%   [DX, DV] = VL_MULTIBOXLOSS(X, V, P, GT, L, M, N, DZDY) computes the
+%   derivatives of the loss projected onto the scalar DZDY.
+%
+%   VL_MULTIBOXLOSS(...,'OPT',VALUE,...) takes the following options:
+%
+%   `numClasses`:: 21
+%    The number of classes predicted by the network (including the
+%    background).
+%
+%   `backgroundLabel`:: 1
+%    The label of the background class, used as the target of the hard
+%    negatives.
+%
+%   `locWeight`:: 1
+%    The weight of the localisation term of the loss.
+%
+%   `sigma`:: 1
+%    The sigma parameter of the smooth L1 loss (as in VL_NNHUBERLOSS).
+%
+%   `numThreads`:: 1
+%    The number of CPU threads used to process the images of the batch. A
+%    value of zero (or less) uses all available hardware threads. The
+%    output does not depend on this setting.
+%
+%   `NoPriorCache`:: false
+%    By default, the decoded priors are cached across calls. Setting this
+%    flag recomputes them on every call.
@@ -1,5 +1,14 @@
 function [hardNegs, extendedLabels, cWeights] = ...
                            vl_nnhardnegatives(v, l, m, varargin) 
+%VL_NNHARDNEGATIVES selects the hard negatives of a batch
+%   HARDNEGS = VL_NNHARDNEGATIVES(V, L, M) selects, for every image, the
+%   unmatched priors whose confidence predictions V give the largest 
+%   background loss (see COMPUTE_HARD_NEGS), given the ground truth labels
+%   L and the matches M produced by VL_NNMATCHPRIORS.
+%
+%   VL_NNHARDNEGATIVES(..., 'native', true) (the default) mines the whole
+%   batch with the VL_HARDNEGATIVES MEX file when it has been compiled,
+%   with the same result. It uses `numThreads` (default 1) CPU threads.
 
   opts.numClasses = 21 ; 
   opts.negPosRatio = 3 ;
@@ -9,15 +18,32 @@ function [hardNegs, extendedLabels, cWeights] = ...
   opts.normAG = false ;
   opts.normAGpop = false ;
   opts.normAGpopComb = false ;
+  opts.native = true ;
+  opts.numThreads = 1 ;
   [opts, ~] = vl_argparsepos(opts, varargin, 'nonrecursive') ;
 
   batchSize = size(v, 4) ; 
   numGtBoxes = cellfun(@numel, l) ;
-  confPreds = permute(reshape(v, opts.numClasses, [], 1, batchSize), ...
-                                                          [2 1 3 4]) ;
+
+  % mine the whole batch at once if possible
+  useNative = opts.native && exist('vl_hardnegatives', 'file') == 3 ;
+  if useNative
+    hardNegs = vl_hardnegatives(gather(v), m, ...
+                       'numClasses', opts.numClasses, ...
+                       'backgroundLabel', opts.backgroundLabel, ...
+                       'negPosRatio', opts.negPosRatio, ...
+                       'ignoreXBoundaryBoxes', opts.ignoreXBoundaryBoxes, ...
+                       'numThreads', opts.numThreads) ;
+    if isa(v, 'gpuArray')
+      hardNegs = cellfun(@gpuArray, hardNegs, 'Uni', false) ;
+    end
+  else
+    confPreds = permute(reshape(v, opts.numClasses, [], 1, batchSize), ...
+                                                            [2 1 3 4]) ;
+    hardNegs = cell(1, batchSize) ;
+  end
 
   % loop over batch
-  hardNegs = cell(1, batchSize) ;
   extendedLabels = cell(1, batchSize) ;
   for i = 1:batchSize
 
@@ -25,10 +51,12 @@ function [hardNegs, extendedLabels, cWeights] = ...
     matches = m(i) ;
 
     % Add hard negatives
-    hardNegs{i} = compute_hard_negs(confPreds(:,:,:,i), matches, ...
+    if ~useNative
+      hardNegs{i} = compute_hard_negs(confPreds(:,:,:,i), matches, ...
                        'backgroundLabel', opts.backgroundLabel, ...
                        'negPosRatio', opts.negPosRatio, ...
                        'ignoreXBoundaryBoxes', opts.ignoreXBoundaryBoxes)' ;
+    end
 
     % repeat labels for each ground truth match 
     extendedLabels_ = arrayfun(@(x) repmat(l_(x), ...
@@ -24,12 +24,25 @@ function [matches, targets, tWeights, boxes] = vl_nnmatchpriors(p, gt, varargin)
 %    to be matched to a given prior box. The prior box then becomes a 
 %    positive example during training.
 %
+%   `ignoreXBoundaryBoxes`:: false
+%    If true, prior boxes which cross the image boundary are not matched.
+%
+%   `native`:: true
+%    If true (and the `vl_matchpriors` MEX file has been compiled), the 
+%    matching is done by VL_MATCHPRIORS rather than by MATCHPRIORS, with
+%    the same results.
+%
+%   `numThreads`:: 1
+%    The number of CPU threads used by the native matcher.
+%
 % Copyright (C) 2017 Samuel Albanie 
 % Licensed under The MIT License [see LICENSE.md for details]
 
   opts.matchRanker = 'overlap' ;
   opts.overlapThreshold = 0.5 ;
   opts.ignoreXBoundaryBoxes = false ;
+  opts.native = true ;
+  opts.numThreads = 1 ;
   [opts, dzdy] = vl_argparsepos(opts, varargin, 'nonrecursive') ;
 
   assert(isempty(dzdy), 'prior matching is not performed on the back pass') ;
@@ -50,10 +63,19 @@ function [matches, targets, tWeights, boxes] = vl_nnmatchpriors(p, gt, varargin)
   pBoxes = gather(pBoxes) ;
   pCenWH = bboxCoder(pBoxes, 'MinMax', 'CenWH') ;
 
-  matches = cellfun(@(x) matchPriors(x, pBoxes, ...
+  useNative = opts.native && strcmp(opts.matchRanker, 'overlap') ...
+              && exist('vl_matchpriors', 'file') == 3 ;
+  if useNative
+    matches = vl_matchpriors(gather(p), gt, ...
                'overlapThreshold', opts.overlapThreshold, ...
-               'matchRanker', opts.matchRanker, ...
-               'ignoreXBoundaryBoxes', opts.ignoreXBoundaryBoxes), gt) ;
+               'ignoreXBoundaryBoxes', opts.ignoreXBoundaryBoxes, ...
+               'numThreads', opts.numThreads) ;
+  else
+    matches = cellfun(@(x) matchPriors(x, pBoxes, ...
+                 'overlapThreshold', opts.overlapThreshold, ...
+                 'matchRanker', opts.matchRanker, ...
+                 'ignoreXBoundaryBoxes', opts.ignoreXBoundaryBoxes), gt) ;
+  end
 
   % Repeat each gt bounding box for every prior it has been matched against
   % (enables vectorization of the bbox target computation)
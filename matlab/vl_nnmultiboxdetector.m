@@ -31,6 +31,54 @@
 %         [xmin, ymin, xmax, ymax] and the remaining columns are
 %         the scores across each of the 21 classes
 %
+%   [Y, N] = VL_NNMULTIBOXDETECTOR(L, C, P) also returns a 1 x N array
+%   containing the number of detections produced for each image.
+%
+%   [Y, N, STATS] = VL_NNMULTIBOXDETECTOR(L, C, P) also returns the
+%   timings and counters of the call (for CPU inputs only; they are not
+%   gathered unless STATS is requested).  STATS.time has the seconds spent
+%   in each stage (setup, candidates, ranking, decode, nms, merge, output)
+%   and in total.  The other fields are numClasses x N arrays with, for
+%   each class and image:
+%
+%     numCandidates  the number of scores above `confidenceThreshold`
+%     numRanked      the number of candidates passed into NMS (at most
+%                    `nmsTopK`)
+%     numKept        the number of boxes kept by NMS (with `batchedNMS`,
+%                    which selects the `keepTopK` detections itself, at
+%                    most `keepTopK` in total)
+%     numOutput      the number of detections in Y (after `keepTopK`)
+%     numOverlaps    the number of overlaps (IoUs) computed by NMS, in
+%                    whole tiles of 64, charged to the suppressing box
+%
+%   L and C may also be given in reduced precision (on the CPU), as
+%   UINT16 arrays holding IEEE half floats (e.g. the bit patterns of HALF
+%   values, as returned by STOREDINTEGER) or as UINT8 arrays of values
+%   Q that stand for SCALE * (Q - ZEROPOINT) (see the `locScale` and
+%   `confScale` options).  The scores are thresholded and ranked in
+%   their own precision, and only the surviving candidates (and the
+%   location offsets of the boxes that are decoded) are converted to
+%   single precision.  P must then be a SINGLE array, and so is Y.  The
+%   detections are those of the same call on the SINGLE values which
+%   the inputs stand for.
+%
+%   Y = VL_NNMULTIBOXDETECTOR('merge', PREDS) merges the detections of
+%   the same batch computed at several scales, where PREDS is a cell 
+%   array of (default layout) K x 6 x 1 x N outputs.  The detections of
+%   each label are pooled across the scales and passed through NMS (with
+%   threshold `nmsThresh`), and the `keepTopK` (by default K) highest
+%   scoring ones are returned in descending score order, zero-padded,
+%   as the multiscale evaluation in core/ssd_evaluation.m does.  The
+%   `nmsThresh`, `keepTopK` and `numThreads` options apply; PREDS must
+%   be on the CPU.
+%
+%   VL_NNMULTIBOXDETECTOR('release') frees the workspace in which the
+%   intermediate buffers of the detector (decoded boxes, permuted scores,
+%   candidate lists and the scratch of NMS and of the `keepTopK` merge)
+%   and of the multiscale merge are kept between calls, so that repeated
+%   calls of a similar size do not allocate any memory.  The workspace is also released by `clear
+%   mex`, and its size can be bounded with `WorkspaceLimit`.
+%
 %   VL_NNMULTIBOXDETECTOR(...,'OPT',VALUE,...) takes the following options:
 %
 %   `numClasses`:: 21
@@ -50,3 +98,59 @@
 %
 %   `keepTopK`:: 200
 %    Maximum number of predictions to be kept per image after NMS
+%
+%   `numThreads`:: 1
+%    The number of CPU threads used to decode the boxes and run the 
+%    per-class NMS (work is split over images and classes). A value of 
+%    zero (or less) uses all available hardware threads. The output does
+%    not depend on this setting.
+%
+%   `batchedNMS`:: false
+%    If true, the candidates of all classes of an image are ranked with a
+%    single sort and passed through a single NMS pass, in which boxes only 
+%    suppress boxes of the same class and which stops once `keepTopK` 
+%    detections have been kept. The detections are the same as those of
+%    the (default) per-class NMS.
+%
+%   `classAgnostic`:: false
+%    If true, a single batched NMS pass is run in which boxes suppress
+%    overlapping boxes of any class (this implies `batchedNMS`).
+%
+%   `compact`:: false
+%    If true, Y is instead a 6 x M array packing the M detections of the
+%    whole batch without any padding: each column holds the [label score 
+%    xmin ymin xmax ymax] of one detection, and the detections of image i
+%    are the N(i) columns following those of images 1 to i-1 (i.e. 
+%    offsets are given by CUMSUM(N)). In this mode the output is not 
+%    zero-filled, and Y' matches the (unpadded) rows of the default 
+%    layout.
+%
+%   `lazyDecode`:: true
+%    If true, only the boxes of the priors which are ranked (i.e. pass
+%    `confidenceThreshold` and the per-class `nmsTopK` cut) for some class
+%    are decoded, rather than the boxes of every prior.  The output does
+%    not depend on this setting. It is only used for CPU inputs.
+%
+%   `NoPriorCache`:: not set
+%    By default, the geometry derived from the priors (centres, sizes and 
+%    variances) is cached between calls, keyed by the number of priors 
+%    and a hash of their contents, and is released by `clear mex`. This 
+%    flag disables the cache so that the priors are processed on every 
+%    call. The cache is only used for CPU inputs.
+%
+%   `locScale`, `locZeroPoint`:: 1, 0
+%    The scale and zero point of UINT8 location predictions L, whose
+%    values are locScale * (L - locZeroPoint).  The scale must be
+%    positive.
+%
+%   `confScale`, `confZeroPoint`:: 1, 0
+%    The scale and zero point of UINT8 confidence predictions C, whose
+%    values are confScale * (C - confZeroPoint).  The scale must be
+%    positive.
+%
+%   `WorkspaceLimit`:: Inf
+%    The number of bytes of host memory (and, separately, of GPU memory)
+%    the workspace may keep after the call.  The workspace is trimmed to
+%    this size at the end of the call, so that a limit of zero frees all
+%    the buffers after each call.  The output does not depend on this
+%    setting.
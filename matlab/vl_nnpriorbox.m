@@ -23,6 +23,13 @@ function y = vl_nnpriorbox(x, im, varargin)
 %    xmin = xmin + xmin * xmin_variance
 %    ...
 %
+%   Y = VL_NNPRIORBOX({X1, ..., XL}, IM) produces the prior boxes of
+%   several feature maps in one call, concatenated along the first
+%   dimension (as the networks do before the detector and the loss).  The
+%   options below may then also be given per feature map, as a vector of
+%   L values, a cell array of L aspect ratio arrays or a 4 x L array of
+%   variances.
+%
 %   VL_NNPRIORBOX does not support a backward pass.
 %
 %   VL_NNPRIORBOX(...,'OPT',VALUE,...) takes the following options:
@@ -58,6 +65,15 @@ function y = vl_nnpriorbox(x, im, varargin)
 %   `pixelStep`:: 1
 %    Dictates how many pixels in the input image, IM correspond 
 %    to a single pixel in the feature layer X
+%
+%   `native`:: true
+%    If true (and the `vl_priorbox` MEX file has been compiled), the 
+%    priors are generated by VL_PRIORBOX, with the same results.  It
+%    keeps the priors of the last few feature map and image sizes, so
+%    that repeated calls at a fixed input resolution do not rebuild them.
+%    Aspect ratios of one are skipped, leaving zero boxes at the end of
+%    the output; as VL_PRIORBOX rejects them, such priors are always
+%    generated in MATLAB.
 
   opts.aspectRatios = 2 ;
   opts.flip = true ;
@@ -67,9 +83,27 @@ function y = vl_nnpriorbox(x, im, varargin)
   opts.maxSize = 0.2 ;
   opts.pixelStep = 1 ;
   opts.variance = [0.1 0.1 0.2 0.2] ;
+  opts.native = true ;
 
   opts = vl_argparse(opts, varargin, 'nonrecursive') ;
 
+  if opts.native && exist('vl_priorbox', 'file') == 3 && ...
+      ~hasUnitAspectRatio(opts.aspectRatios)
+    y = nativePriorBoxes(x, im, opts) ;
+    return ;
+  end
+
+  % The priors of several feature maps are generated one map at a time
+  if iscell(x)
+    y = cell(numel(x), 1) ;
+    for l = 1:numel(x)
+      layerOpts = selectLayer(opts, l) ;
+      y{l} = vl_nnpriorbox(x{l}, im, layerOpts{:}, 'native', false) ;
+    end
+    y = cat(1, y{:}) ;
+    return ;
+  end
+
   % Each spatial element of the input layer `im` produces a corresponding
   % prior box in the input image. We assume that every image in the
   % batch is the same size so that the prior boxes can be duplicated
@@ -160,3 +194,48 @@ function y = vl_nnpriorbox(x, im, varargin)
 
   variances = repmat(opts.variance, [numBoxes 1]) ;
   y = cast(cat(3, boxes, variances), 'like', x) ;
+
+% ------------------------------------------------------------------
+function y = nativePriorBoxes(x, im, opts)
+% ------------------------------------------------------------------
+  if ~iscell(x), x = {x} ; end
+  featSizes = zeros(numel(x), 2) ;
+  for l = 1:numel(x)
+    featSizes(l,:) = [size(x{l}, 1) size(x{l}, 2)] ;
+  end
+  args = {'minSize', opts.minSize, 'maxSize', opts.maxSize, ...
+          'aspectRatios', opts.aspectRatios, 'flip', opts.flip, ...
+          'clip', opts.clip, 'offset', opts.offset, ...
+          'pixelStep', opts.pixelStep, 'variance', opts.variance} ;
+  if isa(x{1}, 'gpuArray')
+    precision = classUnderlying(x{1}) ;
+  else
+    precision = class(x{1}) ;
+  end
+  if strcmp(precision, 'double'), args{end+1} = 'Double' ; end
+  y = cast(vl_priorbox(featSizes, size(im), args{:}), 'like', x{1}) ;
+
+% ------------------------------------------------------------------
+function tf = hasUnitAspectRatio(aspectRatios)
+% ------------------------------------------------------------------
+% True if an aspect ratio (or its flip) is one, as skipped above
+  if ~iscell(aspectRatios), aspectRatios = {aspectRatios} ; end
+  ratios = cellfun(@(r) r(:), aspectRatios, 'UniformOutput', false) ;
+  ratios = cat(1, ratios{:}) ;
+  tf = any(abs(ratios - 1) < 1e-6 | abs(1 ./ ratios - 1) < 1e-6) ;
+
+% ------------------------------------------------------------------
+function args = selectLayer(opts, l)
+% ------------------------------------------------------------------
+  args = {} ;
+  names = {'minSize', 'maxSize', 'flip', 'clip', 'offset', 'pixelStep'} ;
+  for i = 1:numel(names)
+    value = opts.(names{i}) ;
+    if numel(value) > 1, value = value(l) ; end
+    args(end+1:end+2) = {names{i}, value} ;
+  end
+  ratios = opts.aspectRatios ;
+  if iscell(ratios), ratios = ratios{l} ; end
+  variance = opts.variance ;
+  if numel(variance) > 4, variance = variance(:,l) ; end
+  args(end+1:end+4) = {'aspectRatios', ratios, 'variance', variance} ;
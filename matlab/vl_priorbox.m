@@ -0,0 +1,40 @@
+%VL_PRIORBOX generates the prior boxes of several feature maps
+%   Y = VL_PRIORBOX(FEATSIZES, IMSIZE, 'OPT', VALUE, ...) generates the
+%   prior boxes of L source feature maps in a single call, producing the
+%   same result as calling VL_NNPRIORBOX on each feature map (with the
+%   same options) and concatenating the outputs along the first
+%   dimension, as the SSD networks do before the detector and the loss:
+%
+%     FEATSIZES is an L x 2 (or larger) array, whose l-th row holds the
+%         [height width] of the l-th feature map (e.g. its SIZE).
+%
+%     IMSIZE is the [height width ...] of the input image.
+%
+%     Y is a C3 x 1 x 2 SINGLE array with the boxes and variances of the
+%         priors, encoded as in VL_NNMULTIBOXDETECTOR, where C3 = 4 *
+%         numPriors.
+%
+%   The boxes are computed in double precision, as by VL_NNPRIORBOX.  As
+%   they only depend on the sizes of the feature maps and of the image,
+%   the priors of the last few sizes (and options) are kept between
+%   calls, so that at a fixed input resolution Y is built once and later
+%   calls only copy it.  The cache is released by `clear mex`.
+%
+%   VL_PRIORBOX(...,'OPT',VALUE,...) takes the options of VL_NNPRIORBOX
+%   (`minSize`, `maxSize`, `aspectRatios`, `flip`, `clip`, `offset`,
+%   `pixelStep` and `variance`, with the same defaults).  Each of them is
+%   either given for all the feature maps or per feature map, as a
+%   vector of L values, a cell array of L aspect ratio arrays, or a
+%   4 x L array of variances.  As in VL_NNPRIORBOX, flipping appends the
+%   reciprocals of each column of the aspect ratios, so that a row [2 3]
+%   gives the ratios 2, 1/2, 3, 1/3.  Aspect ratios of one are rejected,
+%   since that box is always generated.  In addition:
+%
+%   `Double`:: not set
+%    If set, Y is a DOUBLE array.
+%
+%   `NoCache`:: not set
+%    If set, the priors are generated on every call.
+%
+%   `Verbose`:: not set
+%    If set, print information about the call.
@@ -0,0 +1,26 @@
+classdef uthardnegatives < matlab.unittest.TestCase
+  methods (Test)
+
+    function checkNative(test)
+      if exist('vl_hardnegatives', 'file') ~= 3
+        return ; % MEX file not compiled
+      end
+      numClasses = 5 ; numPriors = 40 ; batchSize = 3 ;
+      v = randn(1, 1, numClasses * numPriors, batchSize, 'single') ;
+      m = struct('idx', {{[3 7], 12}, {}, {1:9}}, ...
+                 'ignored', {(20:25)', (1:4)', zeros(0, 1)}) ;
+
+      for ignore = [false true]
+        hardNegs = vl_hardnegatives(v, m, 'numClasses', numClasses, ...
+                                    'ignoreXBoundaryBoxes', ignore) ;
+        for i = 1:batchSize
+          preds = reshape(v(:,:,:,i), numClasses, [])' ;
+          expected = compute_hard_negs(preds, m(i), ...
+                                       'ignoreXBoundaryBoxes', ignore)' ;
+          test.verifyEqual(hardNegs{i}, expected) ;
+        end
+      end
+    end
+
+  end
+end
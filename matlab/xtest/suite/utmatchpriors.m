@@ -0,0 +1,33 @@
+classdef utmatchpriors < matlab.unittest.TestCase
+  methods (Test)
+
+    function checkNative(test)
+      if exist('vl_matchpriors', 'file') ~= 3
+        return ; % MEX file not compiled
+      end
+      pBoxes = single([ 0.1 0.1 0.4 0.4 ;
+                        0.2 0.2 0.6 0.6 ;
+                        0.5 0.5 0.9 0.9 ;
+                       -0.1 0.3 0.3 0.7 ;
+                        0.3 0.3 1.2 1.0 ]) ;
+      pVars = repmat(single([0.1 0.1 0.2 0.2]), [size(pBoxes, 1) 1]) ;
+      p = cat(3, reshape(pBoxes', [], 1), reshape(pVars', [], 1)) ;
+      gt = {[0.15 0.15 0.45 0.45 ; 0.5 0.45 0.95 0.9], ...
+            [0 0.3 0.3 0.75], zeros(0, 4)} ;
+
+      for ignore = [false true]
+        matches = vl_matchpriors(p, gt, 'ignoreXBoundaryBoxes', ignore) ;
+        for i = 1:numel(gt)
+          if isempty(gt{i}), continue ; end
+          expected = matchPriors(gt{i}, double(pBoxes), ...
+                                 'ignoreXBoundaryBoxes', ignore) ;
+          test.verifyEqual(matches(i).idx, expected.idx) ;
+          test.verifyEqual(matches(i).ignored, expected.ignored) ;
+          test.verifyEqual(matches(i).overlaps, expected.overlaps, ...
+                           'AbsTol', 1e-6) ;
+        end
+      end
+    end
+
+  end
+end
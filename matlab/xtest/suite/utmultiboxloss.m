@@ -0,0 +1,52 @@
+classdef utmultiboxloss < matlab.unittest.TestCase
+  methods (Test)
+
+    function checkNative(test)
+      if exist('vl_multiboxloss', 'file') ~= 3
+        return ; % MEX file not compiled
+      end
+      numClasses = 5 ; numPriors = 40 ; batchSize = 2 ;
+      x = randn(1, 1, 4 * numPriors, batchSize, 'single') ;
+      v = randn(1, 1, numClasses * numPriors, batchSize, 'single') ;
+      corners = rand(numPriors, 2) * 0.5 ;
+      p = cat(3, reshape([corners corners + 0.3]', [], 1), ...
+              repmat([0.1 0.1 0.2 0.2]', numPriors, 1)) ;
+      gt = {[0.1 0.1 0.5 0.6 ; 0.3 0.2 0.7 0.9], [0.2 0.3 0.4 0.5]} ;
+      l = {[2 4], 3} ;
+      m = struct('idx', {{[3 7], 12}, {1:9}}) ;
+      n = {[1 2 20], [30 31]} ;
+
+      [y, dx, dv] = vl_multiboxloss(x, v, p, gt, l, m, n, ...
+                                    'numClasses', numClasses) ;
+      [dx_, dv_] = vl_multiboxloss(x, v, p, gt, l, m, n, single(1), ...
+                                   'numClasses', numClasses) ;
+      test.verifyEqual(dx, dx_) ;
+      test.verifyEqual(dv, dv_) ;
+
+      % only the matched and hard negative priors contribute
+      v_ = v ; v_(:,:,numClasses*9+1:numClasses*10,1) = 0 ;
+      test.verifyEqual(vl_multiboxloss(x, v_, p, gt, l, m, n, ...
+                                       'numClasses', numClasses), y) ;
+
+      % numerical derivatives
+      h = 1e-2 ;
+      for k = [9 12*4 27]
+        e = zeros(size(x), 'single') ; e(k) = h ;
+        f = @(x) vl_multiboxloss(x, v, p, gt, l, m, n, 'numClasses', numClasses) ;
+        test.verifyEqual(double(dx(k)), double(f(x + e) - f(x - e)) / (2*h), ...
+                         'AbsTol', 1e-2) ;
+      end
+
+      % gpu inputs are gathered and the outputs moved back to the gpu
+      if gpuDeviceCount > 0
+        [yg, dxg, dvg] = vl_multiboxloss(gpuArray(x), gpuArray(v), p, gt, ...
+                                         l, m, n, 'numClasses', numClasses) ;
+        test.verifyClass(dxg, 'gpuArray') ;
+        test.verifyEqual(gather(yg), y) ;
+        test.verifyEqual(gather(dxg), dx) ;
+        test.verifyEqual(gather(dvg), dv) ;
+      end
+    end
+
+  end
+end
@@ -0,0 +1,47 @@
+classdef utpriorbox < matlab.unittest.TestCase
+  methods (Test)
+
+    function checkNative(test)
+      if exist('vl_priorbox', 'file') ~= 3
+        return ; % MEX file not compiled
+      end
+      im = zeros(300, 500, 3, 'single') ;
+      x = {zeros(10, 17, 8, 'single'), zeros(5, 9, 8, 'single'), ...
+           zeros(1, 1, 8, 'single')} ;
+      args = {'aspectRatios', [2 3], 'pixelStep', 30, 'minSize', 45, ...
+              'maxSize', 99, 'variance', [0.1 0.1 0.2 0.2]', 'offset', 0.5} ;
+      for clip = [false true]
+        expected = cell(numel(x), 1) ;
+        for l = 1:numel(x)
+          y = vl_nnpriorbox(x{l}, im, args{:}, 'clip', clip) ;
+          expected{l} = vl_nnpriorbox(x{l}, im, args{:}, 'clip', clip, ...
+                                      'native', false) ;
+          test.verifyEqual(y, expected{l}) ;
+        end
+        y = vl_nnpriorbox(x, im, args{:}, 'clip', clip) ;
+        test.verifyEqual(y, cat(1, expected{:})) ;
+        y = vl_nnpriorbox(x, im, args{:}, 'clip', clip, 'native', false) ;
+        test.verifyEqual(y, cat(1, expected{:})) ;
+      end
+
+      % per-layer options and double precision
+      x = cellfun(@double, x, 'UniformOutput', false) ;
+      args = {'aspectRatios', {2, [2 3], [2; 3]}, 'pixelStep', [30 60 0], ...
+              'minSize', [45 90 150], 'maxSize', [90 150 0], ...
+              'variance', [0.1 0.1 0.2 0.2]'} ;
+      y = vl_nnpriorbox(x, im(1:300,1:300,:), args{:}) ;
+      expected = vl_nnpriorbox(x, im(1:300,1:300,:), args{:}, 'native', false) ;
+      test.verifyClass(y, 'double') ;
+      test.verifyEqual(y, expected) ;
+
+      % aspect ratios of one are rejected by VL_PRIORBOX, so the native
+      % path must fall back to MATLAB, which zero-fills their slots
+      args = {'aspectRatios', [1 2], 'pixelStep', 30, 'minSize', 45, ...
+              'maxSize', 99} ;
+      y = vl_nnpriorbox(x{1}, im, args{:}) ;
+      expected = vl_nnpriorbox(x{1}, im, args{:}, 'native', false) ;
+      test.verifyEqual(y, expected) ;
+    end
+
+  end
+end
@@ -19,8 +19,14 @@ function ssd_pascal_evaluation(varargin)
 %
 %   `evalVersion` :: 'fast'
 %    The type of VOC evaluation code to be run.  The options are 'official', 
-%    which runs the original (slow) pascal evaluation code, or 'fast', which
-%    runs an optimised version which is useful during development.
+%    which runs the original (slow) pascal evaluation code, 'fast', which
+%    runs an optimised version which is useful during development, or
+%    'native', which evaluates the detector outputs against the (normalised)
+%    imdb annotations with vl_evaldetections (11-point AP for 2007, area
+%    under the curve otherwise).  Since the imdb annotations may differ from
+%    the devkit ones (e.g. if difficult objects were excluded) and the boxes
+%    are not in pixels, 'native' scores can differ slightly from the
+%    official ones.
 %
 %   `nms` :: 'cpu'
 %    NMS can be run on either the gpu if the dependency has been installed
@@ -34,6 +40,14 @@ function ssd_pascal_evaluation(varargin)
 %    If true, overwrite previous predictions by any detector sharing the 
 %    same model name, otherwise, load results directly from cache.
 %
+%   `reuseDetections` :: false
+%    If true, the detections of a previous run of the detector are read
+%    from its binary detection cache (see vl_detectioncache), if it is
+%    complete and was computed for the same test images, rather than
+%    computed again (e.g. to evaluate them with other settings).  The
+%    cache is written whenever the detector is run, if vl_detectioncache
+%    is compiled.
+%
 %   `net` :: []
 %    A cell array containing the `autonn` network object to be evaluated.  
 %    If not supplied, a network will be loaded instead by name from the 
@@ -69,6 +83,10 @@ function ssd_pascal_evaluation(varargin)
 %      `nmsThresh` :: 0.45 
 %       The NMS threshold used to select predictions on a single image.
 %
+%      `numThreads` :: 1 
+%       The number of CPU threads used by the detector to decode boxes and
+%       run NMS (zero selects all available hardware threads).
+%
 %      `outCols` :: 6
 %       The number of columns forming the structured output of the detector.
 %       By default this is 6 (where each row consists of a class label, a 
@@ -103,6 +121,7 @@ function ssd_pascal_evaluation(varargin)
   opts.testset = 'test' ; 
   opts.evalVersion = 'fast' ;
   opts.refreshCache = true ;
+  opts.reuseDetections = false ;
   opts.modelName = 'ssd-pascal-vggvd-300' ;
 
   % configure batch opts
@@ -117,6 +136,7 @@ function ssd_pascal_evaluation(varargin)
   opts.dataOpts.getImdb = @getCombinedPascalImdb ;
   opts.dataOpts.resultsFormat = 'minMax' ; 
   opts.dataOpts.eval_func = @pascal_eval_func ;
+  opts.dataOpts.native_eval_func = [] ;
   opts.dataOpts.evalVersion = opts.evalVersion ;
   opts.dataOpts.displayResults = @displayPascalResults ;
   opts.dataOpts.configureImdbOpts = @configureImdbOpts ;
@@ -128,6 +148,7 @@ function ssd_pascal_evaluation(varargin)
   opts.modelOpts.keepTopK = 200 ;
   opts.modelOpts.nmsThresh = 0.45 ;
   opts.modelOpts.confThresh = 0.01 ;
+  opts.modelOpts.numThreads = 1 ;
   opts.modelOpts.outCols = 6 ;
   opts.modelOpts.predVar = 'detection_out' ;
   opts.modelOpts.get_eval_batch = @ssd_eval_get_batch ;
@@ -139,6 +160,9 @@ function ssd_pascal_evaluation(varargin)
   opts = vl_argparse(opts, varargin) ;
 
   [net, opts] = configureNets(opts) ; % configure network(s) for evaluation
+  if strcmp(opts.evalVersion, 'native')
+    opts.dataOpts.native_eval_func = @pascal_native_eval_func ;
+  end
 
   % configure paths
   tail = fullfile('evaluations', opts.dataOpts.name, opts.modelName) ;
@@ -146,6 +170,7 @@ function ssd_pascal_evaluation(varargin)
   resultsFile = sprintf('%s-%s-results.mat', opts.modelName, opts.testset) ;
   rawPredsFile = sprintf('%s-%s-raw-preds.mat', opts.modelName, opts.testset) ;
   decodedPredsFile = sprintf('%s-%s-decoded.mat', opts.modelName, opts.testset) ;
+  detsFile = sprintf('%s-%s-dets', opts.modelName, opts.testset) ;
   evalCacheDir = fullfile(expDir, sprintf('eval_cache-%d', opts.year)) ;
   if ~exist(evalCacheDir, 'dir') 
     mkdir(evalCacheDir) ; mkdir(fullfile(evalCacheDir, 'cache')) ;
@@ -153,9 +178,11 @@ function ssd_pascal_evaluation(varargin)
 
   % cache configuration 
   cacheOpts.rawPredsCache = fullfile(evalCacheDir, rawPredsFile) ;
+  cacheOpts.detectionCache = fullfile(evalCacheDir, detsFile) ;
   cacheOpts.decodedPredsCache = fullfile(evalCacheDir, decodedPredsFile) ;
   cacheOpts.resultsCache = fullfile(evalCacheDir, resultsFile) ;
   cacheOpts.evalCacheDir = evalCacheDir ;
+  cacheOpts.reuseDetections = opts.reuseDetections ;
   cacheOpts.refreshCache = opts.refreshCache ;
   opts.cacheOpts = cacheOpts ;
   ssd_evaluation(expDir, net, opts) ;
@@ -185,6 +212,38 @@ function aps = pascal_eval_func(modelName, decodedPreds, imdb, opts)
     save(opts.cacheOpts.resultsCache, 'aps') ;
   end
 
+% ----------------------------------------------------------------------------
+function aps = pascal_native_eval_func(modelName, preds, imdb, testIdx, opts)
+% ----------------------------------------------------------------------------
+  fprintf('evaluating predictions for %s\n', modelName) ;
+  if (opts.year == 2012) && strcmp(opts.testset, 'test')
+    error('preds on 2012 test set must be submitted to the eval server') ;
+  end
+  annotations = imdb.annotations(testIdx) ;
+  boxes = cellfun(@(x) x.boxes, annotations, 'Uni', 0) ;
+  labels = cellfun(@(x) x.classes, annotations, 'Uni', 0) ;
+  flags = cellfun(@getDifficult, annotations, 'Uni', 0) ;
+  if opts.year == 2007, metric = 'voc07' ; else, metric = 'voc12' ; end
+  % preds is either an array or the path of a detection cache, which is
+  % evaluated in place (the boxes are clipped to the image while matching)
+  aps = vl_evaldetections(preds, boxes, labels, 'Flags', flags, ...
+                          'Metric', metric, 'ClipBoxes', true, ...
+                          'NumClasses', numel(imdb.meta.classes), ...
+                          'NumThreads', 0) ;
+  for c = 1:numel(aps)
+    fprintf('%s %.1f\n', imdb.meta.classes{c + 1}, 100 * aps(c)) ;
+  end
+  save(opts.cacheOpts.resultsCache, 'aps') ;
+
+% ------------------------------------
+function flags = getDifficult(gt)
+% ------------------------------------
+  if isfield(gt, 'difficult')
+    flags = logical(gt.difficult) ;
+  else
+    flags = false(numel(gt.classes), 1) ;
+  end
+
 % -----------------------------------------------------------
 function [opts, imdb] = configureImdbOpts(expDir, opts, imdb)
 % -----------------------------------------------------------
@@ -120,6 +120,7 @@ function ssd_pascal_train(varargin)
   opts.modelOpts.batchRenormalization = false ;
   opts.modelOpts.CudnnWorkspaceLimit = 1024*1024*1204 ; % 1GB
   opts.modelOpts.sourceModel = 'vgg-vd-16-reduced' ;
+  opts.modelOpts.nativeLoss = true ;
 
   % configure dataset options
   opts.dataOpts.name = 'pascal' ;
@@ -136,6 +137,12 @@ function ssd_pascal_train(varargin)
   opts.dataOpts.dataRoot = fullfile(vl_rootnn, 'data', 'datasets') ;
   opts = vl_argparse(opts, varargin) ;
 
+  % The fused native loss (used if compiled) does not report its two terms
+  if opts.modelOpts.nativeLoss && exist('vl_multiboxloss', 'file') == 3
+    opts.train.stats = setdiff(opts.train.stats, {'conf_loss', 'loc_loss'}, ...
+                               'stable') ;
+  end
+
   % Since losses in each batch are computed as a function of ground truth
   % matches rather than batch size, we scale up the final derivative to "undo"
   % derivative normalisation
@@ -194,6 +201,8 @@ function ssd_pascal_train(varargin)
   batchOpts.distortOpts.randomOrderProb = 0 ;
   batchOpts.useGpu = numel(opts.train.gpus) >  0 ;
   batchOpts.resizeMethods = {'bilinear', 'box', 'nearest', 'bicubic', 'lanczos2'} ;
+  batchOpts.nativeAugmentation = exist('vl_augmentbatch', 'file') == 3 ;
+  batchOpts.prefetchDepth = 2 ;
 
   % determine experiment name
   expName = getExpName(opts.modelOpts, opts.dataOpts) ;